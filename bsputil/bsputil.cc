@@ -592,13 +592,22 @@ static void CheckBSPFile(const mbsp_t *bsp)
 
 static void FindFaces(const mbsp_t *bsp, const qvec3d &pos, const qvec3d &normal)
 {
+    const face_leafs_t face_leafs = BSP_BuildFaceLeafs(bsp);
+
     for (int i = 0; i < bsp->dmodels.size(); ++i) {
         const dmodelh2_t *model = &bsp->dmodels[i];
         const mface_t *face = BSP_FindFaceAtPoint(bsp, model, pos, normal);
 
         if (face != nullptr) {
-            logging::print("model {} face {}: texture '{}' texinfo {}\n", i, Face_GetNum(bsp, face),
-                Face_TextureName(bsp, face), face->texinfo);
+            const int facenum = Face_GetNum(bsp, face);
+            std::string leafs;
+
+            for (const uint32_t leafnum : face_leafs.leafs(facenum)) {
+                leafs += fmt::format("{}{}", leafs.empty() ? "" : " ", leafnum);
+            }
+
+            logging::print("model {} face {}: texture '{}' texinfo {} leafs [{}]\n", i, facenum,
+                Face_TextureName(bsp, face), face->texinfo, leafs);
         }
     }
 }
@@ -31,8 +31,15 @@
 
 #include <fmt/core.h>
 
+#include <array>
 #include <atomic>
+#include <cstring>
 #include <mutex>
+#include <functional>
+#include <numeric>
+#include <type_traits>
+
+#include <tbb/parallel_for.h>
 
 static std::vector<qvec3b> make_palette(std::initializer_list<uint8_t> bytes)
 {
@@ -2114,11 +2121,58 @@ static bool isHexen2(const dheader_t *header, const bspversion_t *bspversion)
     return true;
 }
 
+// returns true if raw little-endian file data for T can be
+// copied straight into (and out of) memory, rather than going
+// through the stream operators one field at a time. this is
+// checked by streaming a record made of distinct bytes in both
+// directions and comparing it to a plain copy of the same bytes,
+// so any type with padding, reordered/converted fields or a
+// big-endian host will fail it.
+template<typename T>
+static bool lump_is_bulk_copyable()
+{
+    if constexpr (!std::is_trivially_copyable_v<T> || !std::is_default_constructible_v<T>) {
+        return false;
+    } else {
+        static const bool copyable = []() {
+            std::array<uint8_t, sizeof(T)> pattern;
+            std::iota(pattern.begin(), pattern.end(), uint8_t(1));
+
+            imemstream stream(pattern.data(), pattern.size());
+            stream >> endianness<std::endian::little>;
+
+            T streamed{};
+            stream >= streamed;
+
+            T copied;
+            memcpy(&copied, pattern.data(), sizeof(T));
+
+            std::array<uint8_t, sizeof(T)> written{};
+            omemstream out_stream(written.data(), written.size());
+            out_stream << endianness<std::endian::little>;
+            out_stream <= copied;
+
+            return stream && out_stream && !memcmp(&streamed, &copied, sizeof(T)) && written == pattern;
+        }();
+
+        return copyable;
+    }
+}
+
 struct lump_reader
 {
     std::istream &s;
     const bspversion_t *version;
     const std::vector<lump_t> &lumps;
+    // the raw file data the stream is reading from
+    const uint8_t *file_data;
+    size_t file_size;
+
+    inline bool lump_in_bounds(const lump_t &lump) const
+    {
+        return lump.fileofs >= 0 && lump.filelen >= 0 &&
+               static_cast<size_t>(lump.fileofs) + static_cast<size_t>(lump.filelen) <= file_size;
+    }
 
     // read structured lump data from stream into vector
     template<typename T>
@@ -2145,6 +2199,17 @@ struct lump_reader
         if (!lump.filelen)
             return;
 
+        if (lump_in_bounds(lump)) {
+            if (lumpspec.size == 1) {
+                memcpy(buffer.data(), file_data + lump.fileofs, length);
+                return;
+            } else if (lump_is_bulk_copyable<T>()) {
+                buffer.resize(length);
+                memcpy(buffer.data(), file_data + lump.fileofs, length * sizeof(T));
+                return;
+            }
+        }
+
         s.seekg(lump.fileofs);
 
         if (lumpspec.size > 1) {
@@ -2280,8 +2345,8 @@ void LoadBSPFile(fs::path &filename, bspdata_t *bspdata)
 
     bspdata->file = filename;
 
-    /* load the file header */
-    fs::data file_data = fs::load(filename);
+    /* map the file; loose files are read straight from the mapping */
+    std::unique_ptr<fs::mapped_data> file_data = fs::load_view(filename);
 
     if (!file_data) {
         FError("Unable to load \"{}\"\n", filename);
@@ -2334,7 +2399,7 @@ void LoadBSPFile(fs::path &filename, bspdata_t *bspdata)
         logging::print("BSP is version {}\n", *bspdata->version);
     }
 
-    lump_reader reader{stream, bspdata->version, lumps};
+    lump_reader reader{stream, bspdata->version, lumps, file_data->data(), file_data->size()};
 
     /* copy the data */
     if (bspdata->version == &bspver_q2) {
@@ -2395,6 +2460,24 @@ void LoadBSPFile(fs::path &filename, bspdata_t *bspdata)
 /* ========================================================================= */
 #include <fstream>
 
+// serialize the data written by `write` into a contiguous buffer
+template<typename F>
+static std::vector<uint8_t> serialize_lump(F &&write)
+{
+    omemsizestream size_stream;
+    size_stream << endianness<std::endian::little>;
+    write(size_stream);
+
+    std::vector<uint8_t> buffer(static_cast<size_t>(size_stream.tellp()));
+    omemstream stream(buffer.data(), buffer.size());
+    stream << endianness<std::endian::little>;
+    write(stream);
+
+    Q_assert((bool)stream);
+
+    return buffer;
+}
+
 struct bspfile_t
 {
     const bspversion_t *version;
@@ -2406,39 +2489,58 @@ struct bspfile_t
         q2_dheader_t q2header;
     };
 
-    std::ofstream stream;
+    // a lump to be written, in file order. `serialize` fills in
+    // `data`; the lumps are serialized in parallel, then laid out.
+    struct pending_lump_t
+    {
+        size_t lump_num;
+        std::function<std::vector<uint8_t>()> serialize;
+        std::vector<uint8_t> data;
+    };
+
+    std::vector<pending_lump_t> pending;
+
+    // BSPX header, lump headers and lump data, serialized
+    // after the offsets of the regular lumps are known
+    std::vector<uint8_t> bspx;
 
 private:
-    // write structured lump data from vector
-    template<typename T>
-    inline void write_lump(size_t lump_num, const std::vector<T> &data)
+    inline lump_t &header_lump(size_t lump_num)
     {
         Q_assert(version->lumps.size() > lump_num);
-        const lumpspec_t &lumpspec = version->lumps.begin()[lump_num];
-        lump_t *lumps;
 
         if (version->version.has_value()) {
-            lumps = q2header.lumps.data();
+            return q2header.lumps[lump_num];
         } else {
-            lumps = q1header.lumps.data();
+            return q1header.lumps[lump_num];
         }
+    }
 
-        lump_t &lump = lumps[lump_num];
-
-        lump.fileofs = stream.tellp();
-
-        for (auto &v : data)
-            stream <= v;
+    // write structured lump data from vector
+    template<typename T>
+    inline void write_lump(size_t lump_num, const std::vector<T> &data)
+    {
+        Q_assert(version->lumps.size() > lump_num);
+        const lumpspec_t &lumpspec = version->lumps.begin()[lump_num];
 
-        auto written = static_cast<int32_t>(stream.tellp()) - lump.fileofs;
+        pending.push_back({lump_num, [&data, &lumpspec]() {
+                               std::vector<uint8_t> buffer;
 
-        if (sizeof(T) == 1 || lumpspec.size > 1)
-            Q_assert(written == (lumpspec.size * data.size()));
+                               if (sizeof(T) == 1 || (lumpspec.size == sizeof(T) && lump_is_bulk_copyable<T>())) {
+                                   buffer.resize(data.size() * sizeof(T));
+                                   memcpy(buffer.data(), data.data(), buffer.size());
+                               } else {
+                                   buffer = serialize_lump([&data](std::ostream &s) {
+                                       for (auto &v : data)
+                                           s <= v;
+                                   });
+                               }
 
-        lump.filelen = written;
+                               if (sizeof(T) == 1 || lumpspec.size > 1)
+                                   Q_assert(buffer.size() == (lumpspec.size * data.size()));
 
-        if (written % 4)
-            stream <= padding_n(4 - (written % 4));
+                               return buffer;
+                           }});
     }
 
     // this is only here to satisfy std::visit
@@ -2448,62 +2550,28 @@ private:
     inline void write_lump(size_t lump_num, const std::string &data)
     {
         Q_assert(version->lumps.size() > lump_num);
-        const lumpspec_t &lumpspec = version->lumps.begin()[lump_num];
-        lump_t *lumps;
-
-        Q_assert(lumpspec.size == 1);
-
-        if (version->version.has_value()) {
-            lumps = q2header.lumps.data();
-        } else {
-            lumps = q1header.lumps.data();
-        }
-
-        lump_t &lump = lumps[lump_num];
+        Q_assert(version->lumps.begin()[lump_num].size == 1);
 
-        lump.fileofs = stream.tellp();
-
-        stream.write(data.c_str(), data.size() + 1); // null terminator
-
-        auto written = static_cast<int32_t>(stream.tellp()) - lump.fileofs;
-
-        Q_assert(written == data.size() + 1);
-
-        lump.filelen = written;
-
-        if (written % 4)
-            stream <= padding_n(4 - (written % 4));
+        pending.push_back({lump_num, [&data]() {
+                               // null terminator
+                               return std::vector<uint8_t>(
+                                   reinterpret_cast<const uint8_t *>(data.c_str()),
+                                   reinterpret_cast<const uint8_t *>(data.c_str()) + data.size() + 1);
+                           }});
     }
 
     // write structured lump data
     template<typename T, typename = std::enable_if_t<std::is_member_function_pointer_v<decltype(&T::stream_write)>>>
     inline void write_lump(size_t lump_num, const T &data)
     {
-        const lumpspec_t &lumpspec = version->lumps.begin()[lump_num];
-        lump_t *lumps;
-
-        Q_assert(lumpspec.size == 1);
-
-        if (version->version.has_value()) {
-            lumps = q2header.lumps.data();
-        } else {
-            lumps = q1header.lumps.data();
-        }
-
-        lump_t &lump = lumps[lump_num];
-
-        lump.fileofs = stream.tellp();
+        Q_assert(version->lumps.begin()[lump_num].size == 1);
 
-        data.stream_write(stream);
-
-        auto written = static_cast<int32_t>(stream.tellp()) - lump.fileofs;
-
-        lump.filelen = written;
-
-        if (written % 4)
-            stream <= padding_n(4 - (written % 4));
+        pending.push_back(
+            {lump_num, [&data]() { return serialize_lump([&data](std::ostream &s) { data.stream_write(s); }); }});
     }
 
+    static constexpr size_t align4(size_t size) { return (size + 3) & ~3; }
+
 public:
     inline void write_bsp(const mbsp_t &) { FError("Can't write generic BSP"); }
     inline void write_bsp(const std::monostate &) { FError("No BSP to write"); }
@@ -2553,42 +2621,83 @@ public:
         write_lump(Q2_LUMP_ENTITIES, bsp.dentdata);
     }
 
-    inline void write_bspx(const bspdata_t &bspdata)
+    // serialize all of the pending lumps in parallel, then compute
+    // the file offsets of each of them and fill in the header.
+    // returns the total size of the file.
+    inline size_t layout(const bspdata_t &bspdata)
     {
-        if (!bspdata.bspx.entries.size())
-            return;
+        tbb::parallel_for(static_cast<size_t>(0), pending.size(),
+            [this](size_t i) { pending[i].data = pending[i].serialize(); });
 
-        if (stream.tellp() & 3)
-            FError("BSPX header is misaligned");
+        size_t offset = version->version.has_value() ? sizeof(q2_dheader_t) : sizeof(dheader_t);
 
-        stream <= bspx_header_t(bspdata.bspx.entries.size());
+        for (auto &lump : pending) {
+            lump_t &header = header_lump(lump.lump_num);
+            header.fileofs = numeric_cast<int32_t>(offset);
+            header.filelen = numeric_cast<int32_t>(lump.data.size());
+            offset += align4(lump.data.size());
+        }
 
-        auto bspxheader = stream.tellp();
+        /*BSPX lumps are at a 4-byte alignment after the last of any official lump*/
+        if (bspdata.bspx.entries.size()) {
+            size_t bspx_size = sizeof(bspx_header_t) + (sizeof(bspx_lump_t) * bspdata.bspx.entries.size());
+            size_t data_offset = offset + bspx_size;
 
-        // write dummy lump headers
-        for ([[maybe_unused]] auto &_ : bspdata.bspx.entries) {
-            stream <= bspx_lump_t{};
-        }
+            for (auto &x : bspdata.bspx.entries) {
+                bspx_size += align4(x.second.size());
+            }
+
+            bspx.resize(bspx_size);
+
+            omemstream stream(bspx.data(), bspx.size());
+            stream << endianness<std::endian::little>;
 
-        std::vector<bspx_lump_t> xlumps;
-        xlumps.reserve(bspdata.bspx.entries.size());
+            stream <= bspx_header_t(bspdata.bspx.entries.size());
 
-        for (auto &x : bspdata.bspx.entries) {
-            bspx_lump_t &lump = xlumps.emplace_back();
-            lump.filelen = x.second.size();
-            lump.fileofs = stream.tellp();
-            memcpy(lump.lumpname.data(), x.first.c_str(), std::min(x.first.size(), lump.lumpname.size() - 1));
+            for (auto &x : bspdata.bspx.entries) {
+                bspx_lump_t lump{};
+                lump.filelen = x.second.size();
+                lump.fileofs = data_offset;
+                memcpy(lump.lumpname.data(), x.first.c_str(), std::min(x.first.size(), lump.lumpname.size() - 1));
+                stream <= lump;
 
-            stream.write(reinterpret_cast<const char *>(x.second.data()), x.second.size());
+                data_offset += align4(x.second.size());
+            }
+
+            for (auto &x : bspdata.bspx.entries) {
+                stream.write(reinterpret_cast<const char *>(x.second.data()), x.second.size());
 
-            if (x.second.size() % 4)
-                stream <= padding_n(4 - (x.second.size() % 4));
+                if (x.second.size() % 4)
+                    stream <= padding_n(4 - (x.second.size() % 4));
+            }
+
+            Q_assert((bool)stream);
+
+            offset += bspx.size();
         }
 
-        stream.seekp(bspxheader);
+        return offset;
+    }
 
-        for (auto &lump : xlumps)
-            stream <= lump;
+    // write the laid out file to the given stream
+    inline void write(std::ostream &stream)
+    {
+        stream << endianness<std::endian::little>;
+
+        if (version->version.has_value()) {
+            stream <= q2header;
+        } else {
+            stream <= q1header;
+        }
+
+        for (auto &lump : pending) {
+            stream.write(reinterpret_cast<const char *>(lump.data.data()), lump.data.size());
+
+            if (lump.data.size() % 4)
+                stream <= padding_n(4 - (lump.data.size() % 4));
+        }
+
+        stream.write(reinterpret_cast<const char *>(bspx.data()), bspx.size());
     }
 };
 
@@ -2596,6 +2705,10 @@ public:
  * =============
  * WriteBSPFile
  * Swaps the bsp file in place, so it should not be referenced again
+ *
+ * Lumps are serialized in memory first, then written to a temporary
+ * file which replaces `filename` once it is complete, so an
+ * interrupted write never leaves a truncated .bsp behind.
  * =============
  */
 void WriteBSPFile(const fs::path &filename, bspdata_t *bspdata)
@@ -2612,32 +2725,39 @@ void WriteBSPFile(const fs::path &filename, bspdata_t *bspdata)
     }
 
     logging::print("Writing {} as {}\n", filename, *bspdata->version);
-    bspfile.stream.open(filename, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
 
-    if (!bspfile.stream)
-        FError("unable to open {} for writing", filename);
+    std::visit([&bspfile](auto &&arg) { bspfile.write_bsp(arg); }, bspdata->bsp);
+
+    size_t file_size = bspfile.layout(*bspdata);
 
-    bspfile.stream << endianness<std::endian::little>;
+    fs::path temp_filename = filename;
+    temp_filename += ".tmp";
 
-    /* Save header space, updated after adding the lumps */
-    if (bspfile.version->version.has_value()) {
-        bspfile.stream <= bspfile.q2header;
-    } else {
-        bspfile.stream <= bspfile.q1header;
-    }
+    {
+        std::ofstream stream(temp_filename, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
 
-    std::visit([&bspfile](auto &&arg) { bspfile.write_bsp(arg); }, bspdata->bsp);
+        if (!stream)
+            FError("unable to open {} for writing", temp_filename);
 
-    /*BSPX lumps are at a 4-byte alignment after the last of any official lump*/
-    bspfile.write_bspx(*bspdata);
+        bspfile.write(stream);
 
-    bspfile.stream.seekp(0);
+        Q_assert(!stream || static_cast<size_t>(stream.tellp()) == file_size);
 
-    // write the real header
-    if (bspfile.version->version.has_value()) {
-        bspfile.stream <= bspfile.q2header;
-    } else {
-        bspfile.stream <= bspfile.q1header;
+        stream.close();
+
+        if (!stream) {
+            std::error_code ec;
+            fs::remove(temp_filename, ec);
+            FError("unable to write {}", temp_filename);
+        }
+    }
+
+    std::error_code ec;
+    fs::rename(temp_filename, filename, ec);
+
+    if (ec) {
+        fs::remove(temp_filename, ec);
+        FError("unable to replace {}: {}", filename, ec.message());
     }
 }
 
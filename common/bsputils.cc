@@ -505,6 +505,56 @@ std::vector<const mface_t *> Leaf_Markfaces(const mbsp_t *bsp, const mleaf_t *le
     return result;
 }
 
+std::span<const uint32_t> face_leafs_t::leafs(size_t facenum) const
+{
+    if (facenum + 1 >= offsets.size()) {
+        return {};
+    }
+
+    return {leafnums.data() + offsets[facenum], leafnums.data() + offsets[facenum + 1]};
+}
+
+face_leafs_t BSP_BuildFaceLeafs(const mbsp_t *bsp)
+{
+    face_leafs_t result;
+    result.offsets.assign(bsp->dfaces.size() + 1, 0);
+
+    // count the leafs of each face, shifted by one so that the prefix sum
+    // below turns them into start offsets
+    for (auto &leaf : bsp->dleafs) {
+        for (uint32_t i = 0; i < leaf.nummarksurfaces; ++i) {
+            const uint32_t face_index = bsp->dleaffaces.at(leaf.firstmarksurface + i);
+
+            if (face_index < bsp->dfaces.size()) {
+                result.offsets[face_index + 1]++;
+            }
+        }
+    }
+
+    for (size_t i = 1; i < result.offsets.size(); ++i) {
+        result.offsets[i] += result.offsets[i - 1];
+    }
+
+    result.leafnums.resize(result.offsets.back());
+
+    // visiting the leafs in order keeps each face's leafs sorted
+    std::vector<uint32_t> next(result.offsets.begin(), result.offsets.end() - 1);
+
+    for (size_t leafnum = 0; leafnum < bsp->dleafs.size(); ++leafnum) {
+        const mleaf_t &leaf = bsp->dleafs[leafnum];
+
+        for (uint32_t i = 0; i < leaf.nummarksurfaces; ++i) {
+            const uint32_t face_index = bsp->dleaffaces[leaf.firstmarksurface + i];
+
+            if (face_index < bsp->dfaces.size()) {
+                result.leafnums[next[face_index]++] = static_cast<uint32_t>(leafnum);
+            }
+        }
+    }
+
+    return result;
+}
+
 std::vector<const dbrush_t *> Leaf_Brushes(const mbsp_t *bsp, const mleaf_t *leaf)
 {
     std::vector<const dbrush_t *> result;
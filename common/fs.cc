@@ -26,11 +26,171 @@
 #include <memory>
 #include <array>
 #include <list>
+#include <mutex>
+#include <shared_mutex>
 #include <stdexcept>
 #include <unordered_map>
 
+#ifdef _WIN32
+#include <windows.h>
+
+// don't break std::min
+#ifdef min
+#undef min
+#endif
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace fs
 {
+mapped_data::mapped_data(std::vector<uint8_t> &&buffer)
+    : owned(std::move(buffer))
+{
+    ptr = owned.data();
+    len = owned.size();
+}
+
+mapped_data::mapped_data(std::shared_ptr<const mapped_data> parent_in, size_t offset, size_t length)
+    : parent(std::move(parent_in))
+{
+    if (offset > parent->size() || length > parent->size() - offset) {
+        throw std::out_of_range("mapped_data view");
+    }
+
+    ptr = parent->data() + offset;
+    len = length;
+}
+
+mapped_data::~mapped_data()
+{
+    if (!mapping) {
+        return;
+    }
+
+#ifdef _WIN32
+    UnmapViewOfFile(mapping);
+    CloseHandle(mapping_handle);
+    CloseHandle(file_handle);
+#else
+    munmap(mapping, len);
+#endif
+}
+
+std::unique_ptr<mapped_data> mapped_data::map_file(const path &p, bool sequential)
+{
+    auto result = std::make_unique<mapped_data>();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileW(p.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | (sequential ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS), nullptr);
+
+    if (file == INVALID_HANDLE_VALUE) {
+        return nullptr;
+    }
+
+    LARGE_INTEGER size;
+
+    if (!GetFileSizeEx(file, &size) || !size.QuadPart) {
+        CloseHandle(file);
+        return nullptr;
+    }
+
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+    if (!mapping) {
+        CloseHandle(file);
+        return nullptr;
+    }
+
+    void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+    if (!view) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return nullptr;
+    }
+
+    result->file_handle = file;
+    result->mapping_handle = mapping;
+    result->mapping = view;
+    result->len = static_cast<size_t>(size.QuadPart);
+#else
+    int fd = open(p.c_str(), O_RDONLY);
+
+    if (fd == -1) {
+        return nullptr;
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || !st.st_size) {
+        close(fd);
+        return nullptr;
+    }
+
+    void *view = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    // the mapping keeps its own reference to the file
+    close(fd);
+
+    if (view == MAP_FAILED) {
+        return nullptr;
+    }
+
+    // we're going to read the whole thing front to back
+    if (sequential) {
+        madvise(view, st.st_size, MADV_WILLNEED);
+    }
+
+    result->mapping = view;
+    result->len = static_cast<size_t>(st.st_size);
+#endif
+
+    result->ptr = reinterpret_cast<const uint8_t *>(result->mapping);
+    return result;
+}
+
+std::unique_ptr<mapped_data> mapped_data::open_file(const path &p, bool sequential)
+{
+    if (auto mapped = map_file(p, sequential)) {
+        return mapped;
+    }
+
+    // empty files, special files, etc
+    try {
+        if (!exists(p)) {
+            return nullptr;
+        }
+
+        uintmax_t size = file_size(p);
+        std::ifstream stream(p, std::ios_base::in | std::ios_base::binary);
+        std::vector<uint8_t> data(size);
+        stream.read(reinterpret_cast<char *>(data.data()), size);
+
+        if (!stream) {
+            return nullptr;
+        }
+
+        return std::make_unique<mapped_data>(std::move(data));
+    } catch (const filesystem_error &e) {
+        logging::funcprint("WARNING: {}\n", e.what());
+        return nullptr;
+    }
+}
+
+std::unique_ptr<mapped_data> archive_like::load_view(const path &filename)
+{
+    if (auto buffer = load(filename)) {
+        return std::make_unique<mapped_data>(std::move(*buffer));
+    }
+
+    return nullptr;
+}
+
 struct directory_archive : archive_like
 {
     using archive_like::archive_like;
@@ -59,12 +219,64 @@ struct directory_archive : archive_like
             return std::nullopt;
         }
     }
+
+    std::unique_ptr<mapped_data> load_view(const path &filename) override
+    {
+        return mapped_data::open_file(!pathname.empty() ? (pathname / filename) : filename);
+    }
 };
 
-struct pak_archive : archive_like
+// an archive that is a single file on disk with a directory of
+// entries in it. the archive is mapped once, and files in it are
+// views into that mapping, so loads don't need any locking.
+struct mapped_archive : archive_like
 {
-    std::ifstream pakstream;
+    std::shared_ptr<const mapped_data> file;
+
+    std::unordered_map<std::string, std::tuple<uint32_t, uint32_t>, case_insensitive_hash, case_insensitive_equal>
+        files;
+
+    inline mapped_archive(const path &pathname, bool external)
+        : archive_like(pathname, external),
+          file(mapped_data::open_file(pathname, false))
+    {
+        if (!file) {
+            throw std::runtime_error("Unable to read");
+        }
+    }
 
+    bool contains(const path &filename) override { return files.find(filename.generic_string()) != files.end(); }
+
+    data load(const path &filename) override
+    {
+        if (auto view = load_view(filename)) {
+            return view->to_vector();
+        }
+
+        return std::nullopt;
+    }
+
+    std::unique_ptr<mapped_data> load_view(const path &filename) override
+    {
+        auto it = files.find(filename.generic_string());
+
+        if (it == files.end()) {
+            return nullptr;
+        }
+
+        auto [offset, size] = it->second;
+
+        if (offset > file->size() || size > file->size() - offset) {
+            logging::funcprint("WARNING: '{}' in '{}' is out of bounds\n", filename, pathname);
+            return nullptr;
+        }
+
+        return std::make_unique<mapped_data>(file, offset, size);
+    }
+};
+
+struct pak_archive : mapped_archive
+{
     struct pak_header
     {
         std::array<char, 4> magic;
@@ -83,20 +295,17 @@ struct pak_archive : archive_like
         auto stream_data() { return std::tie(name, offset, size); }
     };
 
-    std::unordered_map<std::string, std::tuple<uint32_t, uint32_t>, case_insensitive_hash, case_insensitive_equal>
-        files;
-
     inline pak_archive(const path &pathname, bool external)
-        : archive_like(pathname, external),
-          pakstream(pathname, std::ios_base::in | std::ios_base::binary)
+        : mapped_archive(pathname, external)
     {
+        imemstream pakstream(file->data(), file->size());
         pakstream >> endianness<std::endian::little>;
 
         pak_header header;
 
         pakstream >= header;
 
-        if (header.magic != std::array<char, 4>{'P', 'A', 'C', 'K'}) {
+        if (!pakstream || header.magic != std::array<char, 4>{'P', 'A', 'C', 'K'}) {
             throw std::runtime_error("Bad magic");
         }
 
@@ -107,36 +316,19 @@ struct pak_archive : archive_like
         pakstream.seekg(header.offset);
 
         for (size_t i = 0; i < totalFiles; i++) {
-            pak_file file;
+            pak_file entry;
 
-            pakstream >= file;
-
-            files[file.name.data()] = std::make_tuple(file.offset, file.size);
-        }
-    }
-
-    bool contains(const path &filename) override { return files.find(filename.generic_string()) != files.end(); }
-
-    data load(const path &filename) override
-    {
-        auto it = files.find(filename.generic_string());
+            if (!(pakstream >= entry)) {
+                throw std::runtime_error("Truncated directory");
+            }
 
-        if (it == files.end()) {
-            return std::nullopt;
+            files[entry.name.data()] = std::make_tuple(entry.offset, entry.size);
         }
-
-        pakstream.seekg(std::get<0>(it->second));
-        uintmax_t size = std::get<1>(it->second);
-        std::vector<uint8_t> data(size);
-        pakstream.read(reinterpret_cast<char *>(data.data()), size);
-        return data;
     }
 };
 
-struct wad_archive : archive_like
+struct wad_archive : mapped_archive
 {
-    std::ifstream wadstream;
-
     // WAD Format
     struct wad_header
     {
@@ -180,20 +372,17 @@ struct wad_archive : archive_like
         }
     };
 
-    std::unordered_map<std::string, std::tuple<uint32_t, uint32_t>, case_insensitive_hash, case_insensitive_equal>
-        files;
-
     inline wad_archive(const path &pathname, bool external)
-        : archive_like(pathname, external),
-          wadstream(pathname, std::ios_base::in | std::ios_base::binary)
+        : mapped_archive(pathname, external)
     {
+        imemstream wadstream(file->data(), file->size());
         wadstream >> endianness<std::endian::little>;
 
         wad_header header;
 
         wadstream >= header;
 
-        if (header.identification != wad2_ident && header.identification != wad3_ident) {
+        if (!wadstream || (header.identification != wad2_ident && header.identification != wad3_ident)) {
             throw std::runtime_error("Bad magic");
         }
 
@@ -202,48 +391,63 @@ struct wad_archive : archive_like
         wadstream.seekg(header.infotableofs);
 
         for (size_t i = 0; i < header.numlumps; i++) {
-            wad_lump_header file;
+            wad_lump_header entry;
 
-            wadstream >= file;
+            if (!(wadstream >= entry)) {
+                throw std::runtime_error("Truncated directory");
+            }
 
-            std::string tex_name = file.name_as_string();
+            std::string tex_name = entry.name_as_string();
             if (tex_name.size() == 16) {
                 logging::print("WARNING: texture name {} ({}) is not null-terminated\n", tex_name, pathname);
             }
-            files[tex_name] = std::make_tuple(file.filepos, file.disksize);
+            files[tex_name] = std::make_tuple(entry.filepos, entry.disksize);
         }
     }
-
-    bool contains(const path &filename) override { return files.find(filename.generic_string()) != files.end(); }
-
-    data load(const path &filename) override
-    {
-        auto it = files.find(filename.generic_string());
-
-        if (it == files.end()) {
-            return std::nullopt;
-        }
-
-        wadstream.seekg(std::get<0>(it->second));
-        uintmax_t size = std::get<1>(it->second);
-        std::vector<uint8_t> data(size);
-        wadstream.read(reinterpret_cast<char *>(data.data()), size);
-        return data;
-    }
 };
 
 static std::shared_ptr<directory_archive> absrel_dir = std::make_shared<directory_archive>("", false);
 std::list<std::shared_ptr<archive_like>> archives, directories;
 
+// path -> archive that contains it, for every file in every registered
+// archive. newer archives take priority, same as the search order of
+// `archives`, so the entry for a path is always the one `where` wants.
+static std::unordered_map<std::string, std::shared_ptr<mapped_archive>, case_insensitive_hash,
+    case_insensitive_equal>
+    archive_index;
+
+// guards archives, directories & archive_index; registration takes
+// it exclusively, lookups share it.
+static std::shared_mutex archives_lock;
+
 /** It's possible to compile quake 1/hexen 2 maps without a qdir */
 void clear()
 {
+    std::unique_lock lock(archives_lock);
+
     archives.clear();
     directories.clear();
+    archive_index.clear();
+}
+
+template<typename T>
+inline std::shared_ptr<archive_like> addMappedArchive(const path &p, bool external, const char *kind)
+{
+    auto arch = std::make_shared<T>(p, external);
+    archives.emplace_front(arch);
+
+    for (auto &file : arch->files) {
+        archive_index.insert_or_assign(file.first, arch);
+    }
+
+    logging::print(logging::flag::VERBOSE, "Added {} '{}' with {} files\n", kind, p, arch->files.size());
+    return arch;
 }
 
 inline std::shared_ptr<archive_like> addArchiveInternal(const path &p, bool external)
 {
+    std::unique_lock lock(archives_lock);
+
     if (is_directory(p)) {
         for (auto &dir : directories) {
             if (equivalent(dir->pathname, p)) {
@@ -265,15 +469,9 @@ inline std::shared_ptr<archive_like> addArchiveInternal(const path &p, bool exte
 
         try {
             if (string_iequals(ext.generic_string(), ".pak")) {
-                auto &arch = archives.emplace_front(std::make_shared<pak_archive>(p, external));
-                auto &pak = reinterpret_cast<std::shared_ptr<pak_archive> &>(arch);
-                logging::print(logging::flag::VERBOSE, "Added pak '{}' with {} files\n", p, pak->files.size());
-                return arch;
+                return addMappedArchive<pak_archive>(p, external, "pak");
             } else if (string_iequals(ext.generic_string(), ".wad")) {
-                auto &arch = archives.emplace_front(std::make_shared<wad_archive>(p, external));
-                auto &wad = reinterpret_cast<std::shared_ptr<wad_archive> &>(arch);
-                logging::print(logging::flag::VERBOSE, "Added wad '{}' with {} lumps\n", p, wad->files.size());
-                return arch;
+                return addMappedArchive<wad_archive>(p, external, "wad");
             } else {
                 logging::funcprint("WARNING: no idea what to do with archive '{}'\n", p);
             }
@@ -318,6 +516,8 @@ resolve_result where(const path &p, bool prefer_loose)
         }
     }
 
+    std::shared_lock lock(archives_lock);
+
     for (int32_t pass = 0; pass < 2; pass++) {
         if (prefer_loose != !!pass) {
             // check absolute + relative
@@ -331,10 +531,14 @@ resolve_result where(const path &p, bool prefer_loose)
             for (int32_t archive_pass = 0; archive_pass < 2; archive_pass++) {
                 // check directories & archives, depending on whether
                 // we want loose first or not
-                for (auto &dir : (prefer_loose != !!archive_pass) ? directories : archives) {
-                    if (dir->contains(p)) {
-                        return {dir, p};
+                if (prefer_loose != !!archive_pass) {
+                    for (auto &dir : directories) {
+                        if (dir->contains(p)) {
+                            return {dir, p};
+                        }
                     }
+                } else if (auto it = archive_index.find(p.generic_string()); it != archive_index.end()) {
+                    return {it->second, p};
                 }
             }
         }
@@ -359,6 +563,22 @@ data load(const path &p, bool prefer_loose)
     return load(where(p, prefer_loose));
 }
 
+std::unique_ptr<mapped_data> load_view(const resolve_result &pos)
+{
+    if (!pos) {
+        return nullptr;
+    }
+
+    logging::print(logging::flag::VERBOSE, "Mapped '{}' from archive '{}'\n", pos.filename, pos.archive->pathname);
+
+    return pos.archive->load_view(pos.filename);
+}
+
+std::unique_ptr<mapped_data> load_view(const path &p, bool prefer_loose)
+{
+    return load_view(where(p, prefer_loose));
+}
+
 archive_components splitArchivePath(const path &source)
 {
     // check direct archive loading
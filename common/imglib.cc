@@ -4,8 +4,14 @@
 #include <common/entdata.h>
 #include <common/json.hh>
 #include <common/log.hh>
+#include <common/parallel.hh>
 #include <common/settings.hh>
 
+#include <atomic>
+#include <fstream>
+#include <random>
+#include <unordered_set>
+
 #define STB_IMAGE_IMPLEMENTATION
 #include "../3rdparty/stb_image.h"
 
@@ -323,6 +329,282 @@ qvec3b calculate_average(const std::vector<qvec4b> &pixels)
     return avg /= n;
 }
 
+/*
+============================================================================
+DECODED TEXTURE CACHE
+Decoded textures and metadata are stored in -texturecache, keyed on the
+file(s) they were decoded from, so that later runs of any of the tools
+against the same textures can skip decoding them.
+============================================================================
+*/
+
+namespace cache
+{
+constexpr std::array<char, 4> ident = {'E', 'W', 'T', 'C'};
+constexpr uint32_t version = 1;
+
+static uint64_t fnv1a(const void *data, size_t size, uint64_t hash = 0xcbf29ce484222325ull)
+{
+    for (size_t i = 0; i < size; i++) {
+        hash ^= reinterpret_cast<const uint8_t *>(data)[i];
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+// identifies the on-disk file backing a resolved file; loose files
+// are their own stamp, files in archives use the archive's.
+static bool append_stamp(std::string &key, const fs::resolve_result &pos)
+{
+    std::error_code ec;
+    fs::path disk = pos.archive->pathname;
+
+    if (!fs::is_regular_file(disk, ec)) {
+        disk = disk.empty() ? pos.filename : (disk / pos.filename);
+    }
+
+    auto size = fs::file_size(disk, ec);
+
+    if (ec) {
+        return false;
+    }
+
+    auto mtime = fs::last_write_time(disk, ec);
+
+    if (ec) {
+        return false;
+    }
+
+    key += fmt::format("|{}|{}|{}|{}", fs::absolute(disk, ec).generic_string(), pos.filename.generic_string(), size,
+        mtime.time_since_epoch().count());
+    return true;
+}
+
+// the key for the given decode of the given files; empty if
+// the cache is disabled or the files can't be identified
+static std::string make_key(const settings::common_settings &options, std::string_view kind, std::string_view name,
+    bool meta_only, const gamedef_t *game, std::initializer_list<const fs::resolve_result *> sources)
+{
+    if (options.texturecache.value().empty()) {
+        return {};
+    }
+
+    // paletted formats depend on the palette as well
+    std::string key = fmt::format("{}|{}|{}|{}|{:016x}", kind, name, meta_only, static_cast<int32_t>(game->id),
+        fnv1a(palette.data(), palette.size() * sizeof(qvec3b)));
+
+    // a source that doesn't exist (yet) is part of the key too, so
+    // that the entry goes stale once it shows up
+    for (auto *source : sources) {
+        if (!*source) {
+            key += "|missing";
+        } else if (!append_stamp(key, *source)) {
+            return {};
+        }
+    }
+
+    return key;
+}
+
+static fs::path entry_path(const settings::common_settings &options, const std::string &key)
+{
+    return options.texturecache.value() / fmt::format("{:016x}.ewtc", fnv1a(key.data(), key.size()));
+}
+
+static void write_string(std::ostream &s, const std::string &str)
+{
+    s <= static_cast<uint32_t>(str.size());
+    s.write(str.data(), str.size());
+}
+
+static void read_string(std::istream &s, std::string &str)
+{
+    uint32_t size = 0;
+    s >= size;
+
+    if (!s || size > (1u << 24)) {
+        s.setstate(std::ios_base::failbit);
+        return;
+    }
+
+    str.resize(size);
+
+    // read() fails at the end of the stream, even for zero bytes
+    if (size) {
+        s.read(str.data(), size);
+    }
+}
+
+// only the parts of the meta that the loaders fill in are stored
+static void write_meta(std::ostream &s, const texture_meta &meta)
+{
+    write_string(s, meta.name);
+    s <= meta.width <= meta.height;
+    s <= static_cast<uint8_t>(meta.extension.has_value()) <= meta.extension.value_or(ext::TGA);
+    qvec3b color_override = meta.color_override.value_or(qvec3b{});
+    s <= static_cast<uint8_t>(meta.color_override.has_value()) <= color_override;
+    s <= meta.flags.native <= meta.contents_native <= meta.value;
+    write_string(s, meta.animation);
+}
+
+static void read_meta(std::istream &s, texture_meta &meta)
+{
+    uint8_t has_extension, has_color_override;
+    ext extension;
+    qvec3b color_override;
+
+    read_string(s, meta.name);
+    s >= meta.width >= meta.height;
+    s >= has_extension >= extension;
+    s >= has_color_override >= color_override;
+    s >= meta.flags.native >= meta.contents_native >= meta.value;
+    read_string(s, meta.animation);
+
+    if (has_extension) {
+        meta.extension = extension;
+    }
+
+    if (has_color_override) {
+        meta.color_override = color_override;
+    }
+}
+
+static void write_value(std::ostream &s, const texture &tex)
+{
+    write_meta(s, tex.meta);
+    s <= tex.width <= tex.height <= tex.width_scale <= tex.height_scale;
+    s <= static_cast<uint32_t>(tex.pixels.size());
+    s.write(reinterpret_cast<const char *>(tex.pixels.data()), tex.pixels.size() * sizeof(qvec4b));
+}
+
+static void read_value(std::istream &s, texture &tex)
+{
+    uint32_t num_pixels = 0;
+
+    read_meta(s, tex.meta);
+    s >= tex.width >= tex.height >= tex.width_scale >= tex.height_scale;
+    s >= num_pixels;
+
+    // meta-only textures have no pixels
+    if (!s || (num_pixels && num_pixels != static_cast<uint64_t>(tex.width) * tex.height)) {
+        s.setstate(std::ios_base::failbit);
+        return;
+    }
+
+    tex.pixels.resize(num_pixels);
+    s.read(reinterpret_cast<char *>(tex.pixels.data()), num_pixels * sizeof(qvec4b));
+}
+
+static void write_value(std::ostream &s, const texture_meta &meta)
+{
+    write_meta(s, meta);
+}
+
+static void read_value(std::istream &s, texture_meta &meta)
+{
+    read_meta(s, meta);
+}
+
+// fetch the cached result for `key`; the outer optional is empty on
+// a cache miss (or if the cache is disabled), the inner one if the file
+// failed to decode.
+template<typename T>
+static std::optional<std::optional<T>> find(const settings::common_settings &options, const std::string &key)
+{
+    if (key.empty()) {
+        return std::nullopt;
+    }
+
+    auto file = fs::mapped_data::open_file(entry_path(options, key));
+
+    if (!file) {
+        return std::nullopt;
+    }
+
+    imemstream stream(file->data(), file->size());
+    stream >> endianness<std::endian::little>;
+
+    std::array<char, 4> file_ident;
+    uint32_t file_version;
+    std::string file_key;
+    uint8_t has_value;
+
+    stream >= file_ident >= file_version;
+    read_string(stream, file_key);
+    stream >= has_value;
+
+    // a different version or a hash collision
+    if (!stream || file_ident != ident || file_version != version || file_key != key) {
+        return std::nullopt;
+    }
+
+    if (!has_value) {
+        return std::optional<T>{};
+    }
+
+    T value{};
+    read_value(stream, value);
+
+    if (!stream) {
+        return std::nullopt;
+    }
+
+    return std::optional<T>{std::move(value)};
+}
+
+// store the result for `key`. written to a uniquely named file and
+// renamed into place, so concurrent processes never see a partial entry.
+template<typename T>
+static void store(const settings::common_settings &options, const std::string &key, const std::optional<T> &value)
+{
+    if (key.empty()) {
+        return;
+    }
+
+    static const uint64_t process_id = std::random_device{}();
+    static std::atomic<uint64_t> temp_counter = 0;
+
+    std::error_code ec;
+    fs::create_directories(options.texturecache.value(), ec);
+
+    const fs::path path = entry_path(options, key);
+    const fs::path temp_path = fs::path(path).concat(fmt::format(".{:x}.{}.tmp", process_id, temp_counter++));
+
+    {
+        std::ofstream stream(temp_path, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+
+        if (!stream) {
+            return;
+        }
+
+        stream << endianness<std::endian::little>;
+        stream <= ident <= version;
+        write_string(stream, key);
+        stream <= static_cast<uint8_t>(value.has_value());
+
+        if (value) {
+            write_value(stream, *value);
+        }
+
+        stream.close();
+
+        if (!stream) {
+            fs::remove(temp_path, ec);
+            return;
+        }
+    }
+
+    fs::rename(temp_path, path, ec);
+
+    if (ec) {
+        // another process probably has it open; they'll have the same data
+        fs::remove(temp_path, ec);
+    }
+}
+
+} // namespace cache
+
 std::tuple<std::optional<img::texture>, fs::resolve_result, fs::data> load_texture(std::string_view name,
     bool meta_only, const gamedef_t *game, const settings::common_settings &options, bool no_prefix, bool mip_only)
 {
@@ -346,8 +628,19 @@ std::tuple<std::optional<img::texture>, fs::resolve_result, fs::data> load_textu
         p += ext.suffix;
 
         if (auto pos = fs::where(p, options.filepriority.value() == settings::search_priority_t::LOOSE)) {
-            if (auto data = fs::load(pos)) {
-                if (auto texture = ext.loader(name.data(), data, meta_only, game)) {
+            auto key = cache::make_key(options, ext.suffix, name, meta_only, game, {&pos});
+
+            // on a cache hit the file is only read if it's a mip, as those
+            // are the only ones callers embed
+            if (auto cached = cache::find<texture>(options, key)) {
+                if (*cached) {
+                    return {std::move(*cached), pos, ext.id == ext::MIP ? fs::load(pos) : fs::data{}};
+                }
+            } else if (auto data = fs::load(pos)) {
+                auto texture = ext.loader(name.data(), data, meta_only, game);
+                cache::store(options, key, texture);
+
+                if (texture) {
                     return {texture, pos, data};
                 }
             }
@@ -466,8 +759,26 @@ std::tuple<std::optional<img::texture_meta>, fs::resolve_result, fs::data> load_
         fs::path p = (prefix / name) += ext.suffix;
 
         if (auto pos = fs::where(p, options.filepriority.value() == settings::search_priority_t::LOOSE)) {
-            if (auto data = fs::load(pos)) {
-                if (auto texture = ext.loader(name.data(), data, game)) {
+            std::string key;
+
+            // .wal_json pulls in the .wal's meta too, if there is one, so it's part of the key
+            if (ext.id == meta_ext::WAL_JSON) {
+                fs::resolve_result wal = fs::where(fs::path(name).replace_extension(".wal"));
+                key = cache::make_key(options, ext.suffix, name, true, game, {&pos, &wal});
+            } else {
+                key = cache::make_key(options, ext.suffix, name, true, game, {&pos});
+            }
+
+            // the file isn't read at all on a cache hit
+            if (auto cached = cache::find<texture_meta>(options, key)) {
+                if (*cached) {
+                    return {std::move(*cached), pos, {}};
+                }
+            } else if (auto data = fs::load(pos)) {
+                auto texture = ext.loader(name.data(), data, game);
+                cache::store(options, key, texture);
+
+                if (texture) {
                     return {texture, pos, data};
                 }
             }
@@ -528,21 +839,47 @@ static qvec3b increase_saturation(const qvec3b &color)
     return color_int;
 }
 
-// Load the specified texture from the BSP
-static void AddTextureName(std::string_view textureName, const mbsp_t *bsp, const settings::common_settings &options)
+// a texture decoded on a worker thread, along with any warnings
+// to print once all of the textures are done, so that output
+// stays in a stable order
+struct decoded_texture_t
 {
-    if (img::find(textureName)) {
-        return;
+    texture tex;
+    std::vector<std::string> warnings;
+};
+
+// fill in the data derived from the pixels & meta of a texture
+static void FinishTexture(texture &tex, const settings::common_settings &options)
+{
+    if (tex.meta.color_override) {
+        tex.averageColor = *tex.meta.color_override;
+    } else {
+        tex.averageColor = img::calculate_average(tex.pixels);
+
+        if (options.tex_saturation_boost.value() > 0.0f) {
+            tex.averageColor =
+                mix(tex.averageColor, increase_saturation(tex.averageColor), options.tex_saturation_boost.value());
+        }
     }
 
-    // always add entry
-    auto &tex = img::textures.emplace(textureName, img::texture{}).first->second;
+    if (tex.meta.width && tex.meta.height) {
+        tex.width_scale = (float)tex.width / (float)tex.meta.width;
+        tex.height_scale = (float)tex.height / (float)tex.meta.height;
+    }
+}
+
+// Load the specified texture & its meta; safe to call in parallel
+static decoded_texture_t DecodeTextureName(
+    std::string_view textureName, const mbsp_t *bsp, const settings::common_settings &options)
+{
+    decoded_texture_t result;
+    auto &tex = result.tex;
 
     // find texture & meta
     auto [texture, _0, _1] = img::load_texture(textureName, false, bsp->loadversion->game, options);
 
     if (!texture) {
-        logging::funcprint("WARNING: can't find pixel data for {}\n", textureName);
+        result.warnings.push_back(fmt::format("can't find pixel data for {}", textureName));
     } else {
         tex = std::move(texture.value());
     }
@@ -550,35 +887,35 @@ static void AddTextureName(std::string_view textureName, const mbsp_t *bsp, cons
     auto [texture_meta, __0, __1] = img::load_texture_meta(textureName, bsp->loadversion->game, options);
 
     if (!texture_meta) {
-        logging::funcprint("WARNING: can't find meta data for {}\n", textureName);
+        result.warnings.push_back(fmt::format("can't find meta data for {}", textureName));
     } else {
         tex.meta = std::move(texture_meta.value());
     }
 
-    if (tex.meta.color_override) {
-        tex.averageColor = *tex.meta.color_override;
-    } else {
-        tex.averageColor = img::calculate_average(tex.pixels);
+    FinishTexture(tex, options);
 
-        if (options.tex_saturation_boost.value() > 0.0f) {
-            tex.averageColor =
-                mix(tex.averageColor, increase_saturation(tex.averageColor), options.tex_saturation_boost.value());
-        }
-    }
-
-    if (tex.meta.width && tex.meta.height) {
-        tex.width_scale = (float)tex.width / (float)tex.meta.width;
-        tex.height_scale = (float)tex.height / (float)tex.meta.height;
-    }
+    return result;
 }
 
 // Load all of the referenced textures from the BSP texinfos into
 // the texture cache.
 static void LoadTextures(const mbsp_t *bsp, const settings::common_settings &options)
 {
+    // gather the unique names first, in the order they're referenced
+    std::vector<std::string> names;
+    std::unordered_set<std::string, case_insensitive_hash, case_insensitive_equal> seen;
+
+    auto add_name = [&](std::string_view name) {
+        if (img::find(name) || !seen.emplace(name).second) {
+            return;
+        }
+
+        names.emplace_back(name);
+    };
+
     // gather all loadable textures...
     for (auto &texinfo : bsp->texinfo) {
-        AddTextureName(texinfo.texture.data(), bsp, options);
+        add_name(texinfo.texture.data());
     }
 
     // gather textures used by _project_texture.
@@ -588,10 +925,57 @@ static void LoadTextures(const mbsp_t *bsp, const settings::common_settings &opt
         if (entdict.get("classname").find("light") == 0) {
             const auto &tex = entdict.get("_project_texture");
             if (!tex.empty()) {
-                AddTextureName(tex.c_str(), bsp, options);
+                add_name(tex);
             }
         }
     }
+
+    // resolve & decode them in parallel
+    std::vector<decoded_texture_t> decoded(names.size());
+
+    logging::parallel_for(static_cast<size_t>(0), names.size(),
+        [&](size_t i) { decoded[i] = DecodeTextureName(names[i], bsp, options); });
+
+    // always add an entry, even if the texture couldn't be loaded
+    for (size_t i = 0; i < names.size(); i++) {
+        for (auto &warning : decoded[i].warnings) {
+            logging::funcprint("WARNING: {}\n", warning);
+        }
+
+        img::textures.emplace(names[i], std::move(decoded[i].tex));
+    }
+}
+
+// Load the specified paletted texture from the BSP, replacing
+// its pixels if a replacement texture exists; safe to call in parallel
+static decoded_texture_t DecodeMiptex(
+    const miptex_t &miptex, const mbsp_t *bsp, const settings::common_settings &options)
+{
+    decoded_texture_t result;
+    auto &tex = result.tex;
+
+    // if the miptex entry isn't a dummy, use it as our base
+    if (miptex.data.size() >= sizeof(dmiptex_t)) {
+        if (auto loaded_tex = img::load_mip(miptex.name, miptex.data, false, bsp->loadversion->game)) {
+            tex = std::move(loaded_tex.value());
+        }
+    }
+
+    // find replacement texture
+    if (auto [texture, _0, _1] = img::load_texture(miptex.name, false, bsp->loadversion->game, options); texture) {
+        tex.width = texture->width;
+        tex.height = texture->height;
+        tex.pixels = std::move(texture->pixels);
+    }
+
+    if (!tex.pixels.size() || !tex.width || !tex.meta.width) {
+        result.warnings.push_back(fmt::format("invalid size data for {}", miptex.name));
+        return result;
+    }
+
+    FinishTexture(tex, options);
+
+    return result;
 }
 
 // Load all of the paletted textures from the BSP into
@@ -602,49 +986,32 @@ static void ConvertTextures(const mbsp_t *bsp, const settings::common_settings &
         return;
     }
 
+    // pick out the unique textures first, in order
+    std::vector<const miptex_t *> miptexes;
+    std::unordered_set<std::string, case_insensitive_hash, case_insensitive_equal> seen;
+
     for (auto &miptex : bsp->dtex.textures) {
-        if (img::find(miptex.name)) {
+        if (img::find(miptex.name) || !seen.emplace(miptex.name).second) {
             logging::funcprint("WARNING: Texture {} duplicated\n", miptex.name);
             continue;
         }
 
-        // always add entry
-        auto &tex = img::textures.emplace(miptex.name, img::texture{}).first->second;
-
-        // if the miptex entry isn't a dummy, use it as our base
-        if (miptex.data.size() >= sizeof(dmiptex_t)) {
-            if (auto loaded_tex = img::load_mip(miptex.name, miptex.data, false, bsp->loadversion->game)) {
-                tex = std::move(loaded_tex.value());
-            }
-        }
-
-        // find replacement texture
-        if (auto [texture, _0, _1] = img::load_texture(miptex.name, false, bsp->loadversion->game, options); texture) {
-            tex.width = texture->width;
-            tex.height = texture->height;
-            tex.pixels = std::move(texture->pixels);
-        }
+        miptexes.push_back(&miptex);
+    }
 
-        if (!tex.pixels.size() || !tex.width || !tex.meta.width) {
-            logging::funcprint("WARNING: invalid size data for {}\n", miptex.name);
-            continue;
-        }
+    // decode them in parallel
+    std::vector<decoded_texture_t> decoded(miptexes.size());
 
-        if (tex.meta.color_override) {
-            tex.averageColor = *tex.meta.color_override;
-        } else {
-            tex.averageColor = img::calculate_average(tex.pixels);
+    logging::parallel_for(static_cast<size_t>(0), miptexes.size(),
+        [&](size_t i) { decoded[i] = DecodeMiptex(*miptexes[i], bsp, options); });
 
-            if (options.tex_saturation_boost.value() > 0.0f) {
-                tex.averageColor =
-                    mix(tex.averageColor, increase_saturation(tex.averageColor), options.tex_saturation_boost.value());
-            }
+    // always add an entry, even if the texture was invalid
+    for (size_t i = 0; i < miptexes.size(); i++) {
+        for (auto &warning : decoded[i].warnings) {
+            logging::funcprint("WARNING: {}\n", warning);
         }
 
-        if (tex.meta.width && tex.meta.height) {
-            tex.width_scale = (float)tex.width / (float)tex.meta.width;
-            tex.height_scale = (float)tex.height / (float)tex.meta.height;
-        }
+        img::textures.emplace(miptexes[i]->name, std::move(decoded[i].tex));
     }
 }
 
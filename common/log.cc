@@ -26,6 +26,9 @@
 #include <fstream>
 #include <iostream>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <algorithm>
 #include <fmt/ostream.h>
 #include <fmt/chrono.h>
 #include <fmt/color.h>
@@ -34,6 +37,9 @@
 #include <common/log.hh>
 #include <common/settings.hh>
 #include <common/cmdlib.hh>
+#include <common/profiler.hh>
+
+#include <tbb/task_arena.h>
 
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
@@ -95,6 +101,8 @@ void init(std::optional<fs::path> filename, const settings::common_settings &set
 
 void close()
 {
+    profiler::write();
+
     if (logfile) {
         fmt::print(logfile, "\n\n");
         logfile.close();
@@ -183,7 +191,7 @@ static time_point start_time;
 static bool is_timing = false;
 static uint64_t last_count = -1;
 static time_point last_indeterminate_time;
-static std::atomic_bool locked = false;
+static std::mutex percent_lock;
 static std::array<duration, 10> one_percent_times;
 static size_t num_percent_times, percent_time_index;
 static time_point last_percent_time;
@@ -237,17 +245,16 @@ void set_percent_callback(percent_callback_t cb)
 
 void percent(uint64_t count, uint64_t max, bool displayElapsed)
 {
-    bool expected = false;
-
     if (!(logging::mask & flag::CLOCK_ELAPSED)) {
         displayElapsed = false;
     }
 
+    std::unique_lock lock(percent_lock, std::defer_lock);
+
     if (count == max) {
-        while (!locked.compare_exchange_weak(expected, true))
-            ; // wait until everybody else is done
+        lock.lock(); // wait until everybody else is done
     } else {
-        if (!locked.compare_exchange_weak(expected, true)) {
+        if (!lock.try_lock()) {
             return; // somebody else is doing this already
         }
     }
@@ -322,30 +329,122 @@ void percent(uint64_t count, uint64_t max, bool displayElapsed)
             }
         }
     }
-
-    // unlock for next call
-    locked = false;
 }
 
 // percent_clock
 
+// one per thread, on its own cache line so the workers don't contend
+struct alignas(64) percent_clock::slot_t
+{
+    std::atomic<uint64_t> value = 0;
+};
+
+/*
+ * Samples the running clock every 100ms and displays its progress, so that
+ * the threads doing the work never call percent() themselves. Only one clock
+ * is registered at a time: clocks started while another is running (e.g. by a
+ * parallel_for nested in another one) are counted but not displayed, so the
+ * outer pass's progress stays on screen.
+ */
+class percent_reporter
+{
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    const percent_clock *clock = nullptr;
+    bool stop = false;
+    std::thread thread;
+
+    void run()
+    {
+        std::unique_lock lock(mutex);
+
+        while (!stop) {
+            wakeup.wait_for(lock, std::chrono::milliseconds(100));
+
+            if (stop || !clock) {
+                continue;
+            }
+
+            const uint64_t max = clock->max;
+            const uint64_t count = clock->count();
+
+            // the 100% tick is left to percent_clock::print
+            if (count < max) {
+                percent(count, max, clock->displayElapsed);
+            }
+        }
+    }
+
+public:
+    percent_reporter()
+        : thread(&percent_reporter::run, this)
+    {
+    }
+
+    ~percent_reporter()
+    {
+        {
+            std::unique_lock lock(mutex);
+            stop = true;
+        }
+        wakeup.notify_all();
+        thread.join();
+    }
+
+    // returns false, and doesn't register the clock, if another one is
+    // already running
+    bool add(const percent_clock *new_clock)
+    {
+        std::unique_lock lock(mutex);
+
+        if (clock) {
+            return false;
+        }
+
+        clock = new_clock;
+        return true;
+    }
+
+    // once this returns, the reporter no longer touches the clock
+    void remove(const percent_clock *old_clock)
+    {
+        std::unique_lock lock(mutex);
+
+        if (clock == old_clock) {
+            clock = nullptr;
+        }
+    }
+};
+
+static percent_reporter &reporter()
+{
+    static percent_reporter instance;
+    return instance;
+}
+
 percent_clock::percent_clock(uint64_t i_max)
-    : max(i_max)
+    : max(i_max),
+      // one slot per thread of the task arena, plus a shared one for anyone else
+      slots(std::make_unique<slot_t[]>(tbb::this_task_arena::max_concurrency() + 1)),
+      num_slots(tbb::this_task_arena::max_concurrency() + 1),
+      nested(!reporter().add(this))
 {
-    if (max != 0) {
+    if (max != 0 && !nested) {
         percent(0, max, displayElapsed);
     }
 }
 
-void percent_clock::increase()
+void percent_clock::increase(uint64_t n)
 {
-#ifdef _DEBUG
-    if (count == max) {
-        logging::print("ERROR TO FIX LATER: clock counter increased to end, but not finished yet\n");
-    }
-#endif
+    const int index = tbb::this_task_arena::current_thread_index();
 
-    percent(count++, max, displayElapsed);
+    if (index >= 0 && static_cast<size_t>(index) < num_slots - 1) {
+        // the index is only unique within one arena, so threads of nested or separate arenas
+        // can share a slot; the add must still be atomic, but is uncontended in the usual case
+        slots[index].value.fetch_add(n, std::memory_order_relaxed);
+    } else {
+        slots[num_slots - 1].value.fetch_add(n, std::memory_order_relaxed);
+    }
 }
 
 void percent_clock::operator()()
@@ -358,6 +457,17 @@ void percent_clock::operator++(int)
     increase();
 }
 
+uint64_t percent_clock::count() const
+{
+    uint64_t total = 0;
+
+    for (size_t i = 0; i < num_slots; i++) {
+        total += slots[i].value.load(std::memory_order_relaxed);
+    }
+
+    return total;
+}
+
 void percent_clock::print()
 {
     if (!ready) {
@@ -366,15 +476,21 @@ void percent_clock::print()
 
     ready = false;
 
+    if (!nested) {
+        reporter().remove(this);
+    }
+
 #ifdef _DEBUG
     if (max != indeterminate) {
-        if (count != max) {
+        if (count() != max) {
             logging::print("ERROR TO FIX LATER: clock counter ended too early\n");
         }
     }
 #endif
 
-    percent(max, max, displayElapsed);
+    if (!nested) {
+        percent(max, max, displayElapsed);
+    }
 }
 
 percent_clock::~percent_clock()
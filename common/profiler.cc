@@ -0,0 +1,259 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#include <common/profiler.hh>
+#include <common/log.hh>
+#include <common/json.hh>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <fmt/ostream.h>
+
+namespace profiler
+{
+struct event_t
+{
+    const char *name;
+    uint64_t start, end; // nanoseconds since epoch
+    bool per_item; // ended inside a parallel_region
+};
+
+// events recorded by one thread; only that thread appends to it,
+// the lock is only contended while writing the trace out
+struct thread_events_t
+{
+    uint32_t tid;
+    bool is_main;
+    std::mutex lock;
+    std::vector<event_t> events;
+};
+
+// guards everything below
+static std::mutex registry_lock;
+// one per thread that has ever recorded anything; never shrinks, as threads
+// keep a pointer to theirs
+static std::vector<std::unique_ptr<thread_events_t>> registry;
+static std::unordered_set<std::string> interned_names;
+static fs::path output_path;
+static std::thread::id main_thread;
+
+static thread_local thread_events_t *local_events = nullptr;
+
+static const auto epoch = std::chrono::steady_clock::now();
+
+namespace detail
+{
+std::atomic<bool> enabled = false;
+thread_local int parallel_depth = 0;
+
+uint64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void record(const char *name, uint64_t start, uint64_t end)
+{
+    if (!local_events) {
+        std::unique_lock lock(registry_lock);
+        auto &events = registry.emplace_back(std::make_unique<thread_events_t>());
+        events->tid = static_cast<uint32_t>(registry.size());
+        events->is_main = std::this_thread::get_id() == main_thread;
+        local_events = events.get();
+    }
+
+    std::unique_lock lock(local_events->lock);
+    local_events->events.push_back({name, start, end, parallel_depth > 0});
+}
+
+const char *intern(const std::string &name)
+{
+    std::unique_lock lock(registry_lock);
+    return interned_names.insert(name).first->c_str();
+}
+} // namespace detail
+
+static void clear_events()
+{
+    for (auto &thread : registry) {
+        std::unique_lock lock(thread->lock);
+        thread->events.clear();
+    }
+}
+
+void start(const fs::path &path)
+{
+    std::unique_lock lock(registry_lock);
+
+    if (detail::enabled && path == output_path) {
+        return;
+    }
+
+    clear_events();
+    output_path = path;
+    main_thread = std::this_thread::get_id();
+
+    // a thread that recorded before keeps its registry entry, so the calling
+    // thread may already have one
+    for (auto &thread : registry) {
+        thread->is_main = thread.get() == local_events;
+    }
+
+    detail::enabled = true;
+}
+
+void stop()
+{
+    std::unique_lock lock(registry_lock);
+
+    detail::enabled = false;
+    clear_events();
+    output_path.clear();
+}
+
+std::vector<std::pair<std::string, double>> phase_times()
+{
+    std::unique_lock lock(registry_lock);
+
+    std::unordered_set<std::string> worker_names;
+    std::vector<event_t> main_events;
+
+    for (auto &thread : registry) {
+        std::unique_lock thread_lock(thread->lock);
+
+        if (thread->is_main) {
+            std::copy_if(thread->events.begin(), thread->events.end(), std::back_inserter(main_events),
+                [](const event_t &event) { return !event.per_item; });
+        } else {
+            for (auto &event : thread->events) {
+                worker_names.insert(event.name);
+            }
+        }
+    }
+
+    // events are recorded when their scope ends, so sort by start time to
+    // get them in the order they began, with outer scopes before inner ones
+    std::stable_sort(main_events.begin(), main_events.end(), [](const event_t &a, const event_t &b) {
+        return a.start < b.start;
+    });
+
+    struct phase_t
+    {
+        uint64_t total = 0;
+        uint64_t covered_until = 0; // end of the last counted event, to skip nested ones
+    };
+
+    std::unordered_map<std::string, phase_t> phases;
+    std::vector<std::pair<std::string, double>> result;
+
+    for (auto &event : main_events) {
+        if (worker_names.count(event.name)) {
+            continue;
+        }
+
+        auto [it, inserted] = phases.try_emplace(event.name);
+
+        if (inserted) {
+            result.emplace_back(event.name, 0.0);
+        }
+
+        if (event.start < it->second.covered_until) {
+            continue;
+        }
+
+        it->second.total += event.end - event.start;
+        it->second.covered_until = event.end;
+    }
+
+    for (auto &[name, seconds] : result) {
+        seconds = phases[name].total / 1e9;
+    }
+
+    return result;
+}
+
+void write()
+{
+    std::unique_lock lock(registry_lock);
+
+    if (!detail::enabled) {
+        return;
+    }
+
+    std::ofstream f(output_path, std::ios_base::out | std::ios_base::trunc);
+
+    if (!f) {
+        logging::print("WARNING: can't write profile to {}\n", output_path);
+        return;
+    }
+
+    // names are mostly the same handful of string literals, so only escape each once
+    std::unordered_map<const char *, std::string> escaped_names;
+    size_t num_events = 0;
+    bool first = true;
+
+    auto separator = [&]() -> const char * {
+        if (first) {
+            first = false;
+            return "\n";
+        }
+        return ",\n";
+    };
+
+    fmt::print(f, "{{\"displayTimeUnit\":\"ms\",\"otherData\":{{\"version\":{}}},\"traceEvents\":[",
+        json(ERICWTOOLS_VERSION).dump());
+
+    for (auto &thread : registry) {
+        std::unique_lock thread_lock(thread->lock);
+
+        if (thread->events.empty()) {
+            continue;
+        }
+
+        fmt::print(f, "{}{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},\"args\":{{\"name\":\"{}\"}}}}",
+            separator(), thread->tid, thread->is_main ? "main" : fmt::format("worker {}", thread->tid));
+
+        for (auto &event : thread->events) {
+            auto it = escaped_names.find(event.name);
+
+            if (it == escaped_names.end()) {
+                it = escaped_names.emplace(event.name, json(event.name).dump()).first;
+            }
+
+            // timestamps are in microseconds
+            fmt::print(f, "{}{{\"name\":{},\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}}}",
+                separator(), it->second, thread->tid, event.start / 1000.0, (event.end - event.start) / 1000.0);
+        }
+
+        num_events += thread->events.size();
+    }
+
+    fmt::print(f, "\n]}}\n");
+
+    logging::print(logging::flag::PROGRESS, "wrote {} profile events to {}\n", num_events, output_path);
+}
+} // namespace profiler
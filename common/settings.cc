@@ -21,6 +21,7 @@
 #include "common/threads.hh"
 #include "common/fs.hh"
 #include <common/log.hh>
+#include <common/profiler.hh>
 
 namespace settings
 {
@@ -653,54 +654,60 @@ void setting_container::print_rst_documentation()
     throw quit_after_help_exception();
 }
 
-std::vector<std::string> setting_container::parse(parser_base_t &parser)
+setting_base *setting_container::parse_setting(parser_base_t &parser)
 {
-    // the settings parser loop will continuously eat tokens as long as
-    // it begins with a -; once we have no more settings to consume, we
-    // break out of this loop and return the remainder.
-    while (true) {
-        // end of cmd line
-        if (!parser.parse_token(PARSE_PEEK)) {
-            break;
-        }
+    // end of cmd line
+    if (!parser.parse_token(PARSE_PEEK)) {
+        return nullptr;
+    }
 
-        // end of options
-        if (parser.token[0] != '-') {
-            break;
-        }
+    // end of options
+    if (parser.token[0] != '-') {
+        return nullptr;
+    }
 
-        // actually eat the token since we peeked above
-        parser.parse_token();
+    // actually eat the token since we peeked above
+    parser.parse_token();
 
-        // remove leading hyphens. we support any number of them.
-        while (parser.token.front() == '-') {
-            parser.token.erase(parser.token.begin());
-        }
+    // remove leading hyphens. we support any number of them.
+    while (parser.token.front() == '-') {
+        parser.token.erase(parser.token.begin());
+    }
 
-        if (parser.token.empty()) {
-            throw parse_exception("stray \"-\" in command line; please check your parameters");
-        }
+    if (parser.token.empty()) {
+        throw parse_exception("stray \"-\" in command line; please check your parameters");
+    }
 
-        if (parser.token == "help" || parser.token == "h" || parser.token == "?") {
-            print_help(true);
-        } else if (parser.token == "rst") {
-            print_rst_documentation();
-        }
+    if (parser.token == "help" || parser.token == "h" || parser.token == "?") {
+        print_help(true);
+    } else if (parser.token == "rst") {
+        print_rst_documentation();
+    }
 
-        auto setting = find_setting(parser.token);
+    auto setting = find_setting(parser.token);
 
-        if (!setting) {
-            throw parse_exception(fmt::format("unknown option \"{}\"", parser.token));
-        }
+    if (!setting) {
+        throw parse_exception(fmt::format("unknown option \"{}\"", parser.token));
+    }
 
-        // pass off to setting to parse; store
-        // name for error message below
-        std::string token = std::move(parser.token);
+    // pass off to setting to parse; store
+    // name for error message below
+    std::string token = std::move(parser.token);
 
-        if (!setting->parse(token, parser, source::COMMANDLINE)) {
-            throw parse_exception(
-                fmt::format("invalid value for option \"{}\"; should be in format {}", token, setting->format()));
-        }
+    if (!setting->parse(token, parser, source::COMMANDLINE)) {
+        throw parse_exception(
+            fmt::format("invalid value for option \"{}\"; should be in format {}", token, setting->format()));
+    }
+
+    return setting;
+}
+
+std::vector<std::string> setting_container::parse(parser_base_t &parser)
+{
+    // the settings parser loop will continuously eat tokens as long as
+    // it begins with a -; once we have no more settings to consume, we
+    // break out of this loop and return the remainder.
+    while (parse_setting(parser)) {
     }
 
     // return remainder
@@ -744,9 +751,13 @@ common_settings::common_settings()
           "whether the compiler should attempt to automatically derive game/base paths for games that support it"},
       tex_saturation_boost{this, "tex_saturation_boost", 0.0f, 0.0f, 1.0f, &game_group,
           "increase texture saturation to match original Q2 tools"},
+      texturecache{this, "texturecache", "", &game_group,
+          "directory to store decoded textures and texture metadata in, so they can be reused by later runs of any tool; disabled if empty"},
       logfile{this, "logfile", "auto", "\"path\"", &logging_group,
           "File to output logging data to. If unchanged, it is set by the tool."},
-      logappend{this, "logappend", false, &logging_group, "Whether to append to log file or replace"}
+      logappend{this, "logappend", false, &logging_group, "Whether to append to log file or replace"},
+      profile{this, "profile", "", &performance_group,
+          "write the time spent in each phase, per thread, to this path as a Chrome trace-event JSON file"}
 {
 }
 
@@ -790,5 +801,11 @@ void common_settings::postinitialize(int argc, const char **argv)
     if (nocolor.value()) {
         logging::enable_color_codes = false;
     }
+
+    if (!profile.value().empty()) {
+        profiler::start(profile.value());
+    } else {
+        profiler::stop();
+    }
 }
 } // namespace settings
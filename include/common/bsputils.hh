@@ -31,6 +31,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <span>
 #include <unordered_map>
 #include <string_view>
 
@@ -104,6 +105,22 @@ clipnode_info_t BSP_FindClipnodeAtPoint(
 int BSP_FindContentsAtPoint(const mbsp_t *bsp, hull_index_t hullnum, const dmodelh2_t *model, const qvec3d &point);
 
 std::vector<const mface_t *> Leaf_Markfaces(const mbsp_t *bsp, const mleaf_t *leaf);
+
+/**
+ * The reverse of the leafs' marksurfaces: which leafs each face is marked in,
+ * stored compressed (CSR) so finding them doesn't need a scan of every leaf.
+ */
+struct face_leafs_t
+{
+    // the leafs of face i are leafnums[offsets[i]] up to leafnums[offsets[i + 1]]
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> leafnums;
+
+    // indices into bsp->dleafs, in increasing order; empty for faces no leaf marks
+    std::span<const uint32_t> leafs(size_t facenum) const;
+};
+face_leafs_t BSP_BuildFaceLeafs(const mbsp_t *bsp);
+
 std::vector<const dbrush_t *> Leaf_Brushes(const mbsp_t *bsp, const mleaf_t *leaf);
 const qvec3f &Vertex_GetPos(const mbsp_t *bsp, int num);
 qvec3d Face_Normal(const mbsp_t *bsp, const mface_t *f);
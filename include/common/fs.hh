@@ -21,7 +21,9 @@
 
 #pragma once
 
+#include <cstdint>
 #include <filesystem>
+#include <memory>
 #include <optional>
 #include <vector>
 
@@ -31,6 +33,52 @@ using namespace std::filesystem;
 
 using data = std::optional<std::vector<uint8_t>>;
 
+// read-only view of a file's contents. loose files and archives are
+// memory-mapped so that large files (ie, BSPs) don't need to be copied
+// into memory before being parsed; files inside of an archive are views
+// into the archive's mapping, which they keep alive. anything else is
+// backed by a loaded buffer. views are safe to read from any thread.
+class mapped_data
+{
+    const uint8_t *ptr = nullptr;
+    size_t len = 0;
+    std::vector<uint8_t> owned;
+    std::shared_ptr<const mapped_data> parent;
+    void *mapping = nullptr;
+#ifdef _WIN32
+    void *file_handle = nullptr, *mapping_handle = nullptr;
+#endif
+
+public:
+    mapped_data() = default;
+    explicit mapped_data(std::vector<uint8_t> &&buffer);
+    // view of [offset, offset + length) of `parent`; must be in bounds
+    mapped_data(std::shared_ptr<const mapped_data> parent, size_t offset, size_t length);
+    ~mapped_data();
+
+    mapped_data(const mapped_data &) = delete;
+    mapped_data &operator=(const mapped_data &) = delete;
+
+    // map the given file on disk; returns nullptr if the
+    // file can't be mapped (missing, empty, etc).
+    // `sequential` hints that the whole file will be read
+    // front to back, so it can be read ahead.
+    static std::unique_ptr<mapped_data> map_file(const path &p, bool sequential = true);
+
+    // map the given file on disk, or read it into memory if it
+    // can't be mapped; returns nullptr if it can't be read at all
+    static std::unique_ptr<mapped_data> open_file(const path &p, bool sequential = true);
+
+    inline const uint8_t *data() const { return ptr; }
+    inline size_t size() const { return len; }
+    inline const uint8_t *begin() const { return ptr; }
+    inline const uint8_t *end() const { return ptr + len; }
+    inline bool is_mapped() const { return mapping != nullptr || (parent && parent->is_mapped()); }
+
+    // copy the contents into a buffer
+    inline std::vector<uint8_t> to_vector() const { return std::vector<uint8_t>(begin(), end()); }
+};
+
 struct archive_like
 {
     path pathname;
@@ -47,6 +95,10 @@ struct archive_like
     virtual bool contains(const path &filename) = 0;
 
     virtual data load(const path &filename) = 0;
+
+    // get a read-only view of the specified file; by default,
+    // this just wraps the result of load().
+    virtual std::unique_ptr<mapped_data> load_view(const path &filename);
 };
 
 // clear all initialized/loaded data from fs
@@ -78,6 +130,9 @@ struct resolve_result
 // - registered archives in reverse order (ie, "c:/quake/pak1/maps/start.map", "c:/quake/pak0/maps/start.map")
 // returns the archive that it is contained in, and the filename.
 // the filename is only different from p if p is an archive path.
+// archive contents are looked up in an index built by addArchive, so
+// the number of registered archives doesn't affect lookup time.
+// where/load/load_view are safe to call from multiple threads.
 resolve_result where(const path &p, bool prefer_loose = false);
 
 // attempt to load the specified resolve result.
@@ -87,6 +142,14 @@ data load(const resolve_result &pos);
 // shortcut to load(where(p))
 data load(const path &p, bool prefer_loose = false);
 
+// attempt to get a read-only view of the specified file;
+// loose files are memory-mapped and files in archives point
+// directly into the archive's mapping rather than being copied.
+std::unique_ptr<mapped_data> load_view(const resolve_result &pos);
+
+// shortcut to load_view(where(p))
+std::unique_ptr<mapped_data> load_view(const path &p, bool prefer_loose = false);
+
 struct archive_components
 {
     path archive, filename;
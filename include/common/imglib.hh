@@ -112,6 +112,8 @@ constexpr extension_info_t extension_list[] = {{".png", ext::STB, load_stb}, {".
     {".tga", ext::TGA, load_stb}, {".wal", ext::WAL, load_wal}, {".mip", ext::MIP, load_mip}, {"", ext::MIP, load_mip}};
 
 // Attempt to load a texture from the specified name.
+// When it comes from -texturecache, the returned file data is only
+// filled in for .mip textures.
 std::tuple<std::optional<texture>, fs::resolve_result, fs::data> load_texture(std::string_view name, bool meta_only,
     const gamedef_t *game, const settings::common_settings &options, bool no_prefix = false, bool mip_only = false);
 
@@ -136,6 +138,7 @@ constexpr struct
     {".wal_json", meta_ext::WAL_JSON, load_wal_json_meta}, {".wal", meta_ext::WAL, load_wal_meta}};
 
 // Attempt to load a texture meta from the specified name.
+// When it comes from -texturecache, no file data is returned.
 std::tuple<std::optional<texture_meta>, fs::resolve_result, fs::data> load_texture_meta(
     std::string_view name, const gamedef_t *game, const settings::common_settings &options);
 
@@ -32,6 +32,7 @@
 #include <cmath> // for log10
 #include <stdexcept> // for std::runtime_error
 #include <functional> // for std::function
+#include <memory> // for std::unique_ptr
 #include <optional> // for std::optional
 #include <fmt/core.h>
 #include <common/bitflags.hh>
@@ -136,19 +137,23 @@ constexpr uint64_t indeterminate = std::numeric_limits<uint64_t>::max();
 
 // simple wrapper to percent() to use it in an object-oriented manner. you can
 // call print() to explicitly end the clock, or allow it to run out of scope.
+// increasing the count is a relaxed atomic add on a per-thread slot, which is
+// uncontended unless threads of different task arenas share a slot index;
+// a background reporter thread sums them up every 100ms and calls percent(),
+// so it's cheap enough to tick on every iteration of a fine-grained loop.
 struct percent_clock
 {
     std::atomic<uint64_t> max;
     bool displayElapsed = true;
-    std::atomic<uint64_t> count = 0;
     bool ready = true;
 
     // runs a tick immediately to show up on stdout
-    // unless max is zero
+    // unless max is zero. while another clock is running, this one only
+    // counts and never prints (see percent_reporter in log.cc)
     percent_clock(uint64_t i_max = indeterminate);
 
-    // increase count by 1
-    void increase();
+    // increase count by n
+    void increase(uint64_t n = 1);
 
     // increase count by 1
     void operator()();
@@ -156,11 +161,20 @@ struct percent_clock
     // increase count by 1
     void operator++(int);
 
+    // the current count, summed over all threads
+    uint64_t count() const;
+
     // prints & ends the clock; class is invalid after this call.
     void print();
 
     // implicitly calls print()
     ~percent_clock();
+
+private:
+    struct slot_t;
+    std::unique_ptr<slot_t[]> slots;
+    size_t num_slots;
+    bool nested;
 };
 
 // base class intended to be inherited for stat trackers;
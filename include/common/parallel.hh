@@ -21,53 +21,50 @@
 #pragma once
 
 #include "common/log.hh"
+#include "common/profiler.hh"
+#include <tbb/blocked_range.h>
 #include <tbb/parallel_for.h>
 #include <tbb/parallel_for_each.h>
 
-#include <atomic>
-
 // parallel extensions to logging
 namespace logging
 {
 template<typename TS, typename TE, typename Body>
 void parallel_for(const TS &start, const TE &end, const Body &func)
 {
-    auto length = end - start;
-    std::atomic<uint64_t> progress = 0;
-
-    tbb::parallel_for(start, end, [&](const auto &it) {
-        percent(progress++, length);
-        func(it);
+    percent_clock clock(end - start);
+    profiler::parallel_region region;
+
+    // count progress once per chunk rather than once per iteration
+    tbb::parallel_for(tbb::blocked_range<TE>(start, end), [&](const tbb::blocked_range<TE> &range) {
+        for (TE it = range.begin(); it != range.end(); ++it) {
+            func(it);
+        }
+        clock.increase(range.size());
     });
-
-    percent(progress, length);
 }
 
 template<typename Container, typename Body>
 void parallel_for_each(Container &container, const Body &func)
 {
-    auto length = std::size(container);
-    std::atomic<uint64_t> progress = 0;
+    percent_clock clock(std::size(container));
+    profiler::parallel_region region;
 
     tbb::parallel_for_each(container, [&](auto &f) {
-        percent(progress++, length);
         func(f);
+        clock.increase();
     });
-
-    percent(progress, length);
 }
 
 template<typename Container, typename Body>
 void parallel_for_each(const Container &container, const Body &func)
 {
-    auto length = std::size(container);
-    std::atomic<uint64_t> progress = 0;
+    percent_clock clock(std::size(container));
+    profiler::parallel_region region;
 
     tbb::parallel_for_each(container, [&](const auto &f) {
-        percent(progress++, length);
         func(f);
+        clock.increase();
     });
-
-    percent(progress, length);
 }
-} // namespace logging
\ No newline at end of file
+} // namespace logging
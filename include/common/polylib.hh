@@ -189,7 +189,7 @@ public:
 };
 
 // Heap storage; uses a vector.
-template<class T>
+template<class T, class Alloc = tbb::scalable_allocator<qvec<T, 3>>>
 struct winding_storage_heap_t
 {
 public:
@@ -197,7 +197,7 @@ public:
     using vec3_type = qvec<T, 3>;
 
 protected:
-    std::vector<vec3_type, tbb::scalable_allocator<vec3_type>> values{};
+    std::vector<vec3_type, Alloc> values{};
 
 public:
     // default constructor does nothing
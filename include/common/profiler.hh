@@ -0,0 +1,130 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+/*
+ * common/profiler.hh
+ *
+ * Records how long each compile phase took on each thread, and writes
+ * the result as a Chrome trace-event JSON file (chrome://tracing, Perfetto).
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include <common/fs.hh>
+
+namespace profiler
+{
+namespace detail
+{
+extern std::atomic<bool> enabled;
+
+uint64_t now();
+void record(const char *name, uint64_t start, uint64_t end);
+const char *intern(const std::string &name);
+extern thread_local int parallel_depth;
+} // namespace detail
+
+// start recording, to be written to `path`. if we're already recording
+// to the same path (e.g. the next tool in an in-process pipeline), the
+// existing events are kept and the new ones are added to them.
+void start(const fs::path &path);
+
+// stop recording and throw away everything recorded so far
+void stop();
+
+// write everything recorded so far to the path given to start();
+// recording continues. no-op if not recording.
+// must not be called while other threads are inside a scope.
+void write();
+
+// total time in seconds spent in each scope name that was only ever recorded
+// on the thread that called start(), outside of a parallel_region, i.e. the
+// compile phases rather than per-item work inside parallel loops; nested
+// scopes of the same name are only counted once. in order of first appearance.
+// must not be called while other threads are inside a scope.
+std::vector<std::pair<std::string, double>> phase_times();
+
+inline bool enabled()
+{
+    return detail::enabled.load(std::memory_order_relaxed);
+}
+
+// times the enclosing block; nested scopes on the same thread show up nested
+// in the trace. when not recording this costs a single relaxed load, so
+// it's fine to use in per-face/per-portal code.
+class scope
+{
+    const char *name = nullptr;
+    uint64_t start_time = 0;
+
+public:
+    // `name` must outlive the recording, e.g. a string literal or __func__
+    inline explicit scope(const char *name)
+    {
+        if (enabled()) {
+            this->name = name;
+            start_time = detail::now();
+        }
+    }
+
+    // for names built at runtime; the string is copied
+    inline explicit scope(const std::string &name)
+    {
+        if (enabled()) {
+            this->name = detail::intern(name);
+            start_time = detail::now();
+        }
+    }
+
+    inline ~scope()
+    {
+        if (name) {
+            detail::record(name, start_time, detail::now());
+        }
+    }
+
+    scope(const scope &) = delete;
+    scope &operator=(const scope &) = delete;
+};
+
+// marks the enclosing block as running a parallel loop; scopes that end on
+// this thread inside it are per-item work, even when no other thread took part
+// (e.g. -threads 1), so phase_times() doesn't count them as phases
+class parallel_region
+{
+public:
+    inline parallel_region() { detail::parallel_depth++; }
+    inline ~parallel_region() { detail::parallel_depth--; }
+
+    parallel_region(const parallel_region &) = delete;
+    parallel_region &operator=(const parallel_region &) = delete;
+};
+} // namespace profiler
+
+// times the rest of the enclosing function, named after the function
+#ifdef _MSC_VER
+#define profilefunc() profiler::scope profile_scope_(__FUNCTION__)
+#else
+#define profilefunc() profiler::scope profile_scope_(__func__)
+#endif
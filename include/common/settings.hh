@@ -592,6 +592,13 @@ public:
      * eaten by the options).
      */
     std::vector<std::string> parse(parser_base_t &parser);
+
+    /**
+     * Parse a single option (and its value, if any) from the input
+     * parser. Returns the setting that was set, or nullptr if the next
+     * token isn't an option.
+     */
+    setting_base *parse_setting(parser_base_t &parser);
 };
 
 // global groups
@@ -624,8 +631,10 @@ public:
     setting_bool q2rtx;
     setting_invertible_bool defaultpaths;
     setting_scalar tex_saturation_boost;
+    setting_path texturecache;
     setting_string logfile;
     setting_bool logappend;
+    setting_path profile;
 
     common_settings();
 
@@ -25,6 +25,7 @@
 #include <common/bsputils.hh> // for faceextents_t
 
 #include <common/qvec.hh>
+#include <light/pvs.hh>
 
 namespace img
 {
@@ -132,9 +133,9 @@ struct lightsurf_t
 
     /*
      pvs for the entire light surface. generated by ORing together
-     the pvs at each of the sample points
+     the pvs of the leafs the surface is in
      */
-    std::vector<uint8_t> pvs;
+    pvs_row_t pvs;
     std::vector<const mleaf_t *> leaves;
 
     // output width * extra
@@ -296,6 +297,7 @@ public:
     setting_scalar dirtscale;
     setting_scalar dirtgain;
     setting_scalar dirtangle;
+    setting_scalar dirtadaptive;
     setting_bool minlight_dirt;
 
     /* phong */
@@ -379,6 +381,7 @@ public:
     setting_bool novanilla;
     setting_scalar gate;
     setting_int32 sunsamples;
+    setting_int32 sunsamples_subset;
     setting_bool arghradcompat;
     setting_bool nolighting;
     setting_vec3 debugface;
@@ -401,13 +404,18 @@ public:
     setting_func bspxhdr;
     setting_scalar world_units_per_luxel;
     setting_bool litonly;
+    setting_bool nolightmapdedup;
+    setting_int32 maxlightdata;
     setting_bool nolights;
     setting_int32 facestyles;
     setting_bool exportobj;
+    setting_path raystats;
     setting_int32 lmshift;
     setting_bool lightgrid;
     setting_vec3 lightgrid_dist;
     setting_enum<lightgrid_format_t> lightgrid_format;
+    setting_scalar lightgrid_adaptive;
+    setting_bool lightgrid_nobatch;
 
     setting_func dirtdebug;
     setting_func bouncedebug;
@@ -439,7 +447,10 @@ public:
 
 extern settings::light_settings light_options;
 
-const std::unordered_map<int, std::vector<uint8_t>> &UncompressedVis();
+// the uncompressed PVS of every leaf
+const pvs_table_t &PvsTable();
+// the leafs each face is in, built once after loading the bsp
+const face_leafs_t &FaceLeafs();
 
 bool IsOutputtingSupplementaryData();
 
@@ -464,3 +475,9 @@ const qvec3f &Face_LookupTextureBounceColor(const mbsp_t *bsp, const mface_t *fa
 void light_reset();
 int light_main(int argc, const char **argv);
 int light_main(const std::vector<std::string> &args);
+// in-process variants: light bspdata instead of loading the .bsp, optionally reusing
+// the PVS rows vis already has uncompressed (see ExportUncompressedVis)
+int light_main(int argc, const char **argv, bspdata_t &bspdata,
+    std::unordered_map<int, std::vector<uint8_t>> *uncompressed_vis = nullptr);
+int light_main(const std::vector<std::string> &args, bspdata_t &bspdata,
+    std::unordered_map<int, std::vector<uint8_t>> *uncompressed_vis = nullptr);
@@ -23,6 +23,7 @@
 
 #include <atomic>
 #include <memory>
+#include <span>
 
 struct mface_t;
 struct mbsp_t;
@@ -37,11 +38,6 @@ class faceextents_t;
 class light_t;
 struct facesup_t;
 
-#if 0
-extern std::atomic<uint32_t> total_light_rays, total_light_ray_hits, total_samplepoints;
-extern std::atomic<uint32_t> total_bounce_rays, total_bounce_ray_hits;
-extern std::atomic<uint32_t> total_surflight_rays, total_surflight_ray_hits; // mxd
-#endif
 extern std::atomic<uint32_t> fully_transparent_lightmaps; // write.cc
 
 void PrintFaceInfo(const mface_t *face, const mbsp_t *bsp);
@@ -86,4 +82,8 @@ struct lightgrid_samples_t
 };
 
 lightgrid_samples_t CalcLightgridAtPoint(const mbsp_t *bsp, const qvec3f &world_point);
+// same as CalcLightgridAtPoint for each point, but with the rays for all of the
+// points traced together, one stream per light; results must be the same size
+void CalcLightgridAtPoints(
+    const mbsp_t *bsp, std::span<const qvec3f> world_points, std::span<lightgrid_samples_t> results);
 void ResetLtFace();
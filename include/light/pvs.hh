@@ -0,0 +1,112 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+/*
+ * light/pvs.hh
+ *
+ * Uncompressed PVS rows for light, stored once per distinct row in one flat
+ * array of 64-bit words, and looked up by leaf number rather than by hashing
+ * the visofs/cluster.
+ */
+
+#pragma once
+
+#include <common/bspfile.hh>
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+class pvs_table_t
+{
+    size_t words_per_row = 0;
+    // all the rows, back to back; row 0 sees nothing, row 1 sees everything
+    std::vector<uint64_t> rows;
+    // per leaf: index of its row, or -1 if it has none
+    std::vector<int32_t> leaf_rows;
+    // per leaf: its bit in a row (cluster for Q2, visleaf otherwise), or -1 if
+    // it can't be seen from anywhere
+    std::vector<int32_t> leaf_bits;
+    const mleaf_t *first_leaf = nullptr;
+
+    int32_t add_row(const uint8_t *bytes, size_t numbytes,
+        std::unordered_map<uint64_t, std::vector<int32_t>> &rows_by_hash);
+
+public:
+    // decompress the visdata of bsp. if uncompressed_vis is set, its rows are used
+    // instead (keyed like DecompressAllVis). keeps a pointer to bsp's leafs.
+    void build(const mbsp_t *bsp, const std::unordered_map<int, std::vector<uint8_t>> *uncompressed_vis = nullptr);
+    void clear();
+
+    size_t row_words() const { return words_per_row; }
+    size_t num_rows() const { return words_per_row ? rows.size() / words_per_row : 0; }
+    size_t memory_bytes() const;
+
+    const uint64_t *none_visible() const;
+    const uint64_t *all_visible() const;
+
+    // the row of leaf, or nullptr if the bsp has no visdata for it
+    inline const uint64_t *leaf_row(const mleaf_t *leaf) const
+    {
+        // unsigned, so a leaf before first_leaf is out of range too
+        const size_t leafnum = static_cast<size_t>(leaf - first_leaf);
+
+        if (!first_leaf || leafnum >= leaf_rows.size()) {
+            return nullptr;
+        }
+
+        const int32_t row = leaf_rows[leafnum];
+
+        return row < 0 ? nullptr : rows.data() + row * words_per_row;
+    }
+
+    // returns true if row can see leaf; called for every light and surface
+    // light a face is tested against, so it's kept inline
+    inline bool leaf_visible(const uint64_t *row, const mleaf_t *leaf) const
+    {
+        const size_t leafnum = static_cast<size_t>(leaf - first_leaf);
+
+        if (!first_leaf || leafnum >= leaf_bits.size()) {
+            return false;
+        }
+
+        const int32_t bit = leaf_bits[leafnum];
+
+        return bit >= 0 && ((row[bit >> 6] >> (bit & 63)) & 1);
+    }
+};
+
+/**
+ * The PVS of a light surface: one of the table's rows when all of the
+ * surface's leafs share it, or a merged copy owned by the surface otherwise.
+ * Empty (data() == nullptr) if there's no vis.
+ */
+class pvs_row_t
+{
+    const uint64_t *shared = nullptr;
+    std::vector<uint64_t> merged;
+
+public:
+    const uint64_t *data() const { return merged.empty() ? shared : merged.data(); }
+
+    void set(const uint64_t *row);
+    // OR row into this one; the first row is only referenced, not copied
+    void merge(const uint64_t *row, size_t words);
+};
@@ -0,0 +1,83 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+/*
+ * light/raystats.hh
+ *
+ * Counts the rays light traces, per light category and per lighting pass
+ * (direct, each bounce, lightgrid). Every thread counts into its own
+ * counters, which are only summed up when the stats are printed.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include <common/fs.hh>
+
+namespace raystats
+{
+enum class category_t : uint8_t
+{
+    light, // point/spot light entities
+    sun, // suns and sky domes
+    surflight, // emissive surfaces
+    bounce, // bounce lights (VPLs)
+    minlight, // _minlight on light entities (LF_LOCALMIN)
+    dirt, // ambient occlusion
+    count
+};
+
+struct counters_t
+{
+    uint64_t traces = 0; // ray streams traced
+    uint64_t rays = 0; // rays traced
+    uint64_t occluded = 0; // rays that didn't reach the light
+    uint64_t filtered = 0; // glass/fence texture tests run by the ray filter
+    uint64_t vpls = 0; // surface light / bounce light points tested
+
+    counters_t &operator+=(const counters_t &other);
+};
+
+// start a new pass named `name`; everything counted from now on belongs to it.
+// ends the previous pass, if any. call between parallel loops, not during them.
+void begin_pass(const std::string &name);
+
+// end the current pass, so that its time is accurate
+void end_pass();
+
+// the calling thread's counters for `category` in the current pass.
+// glass/fence tests from count_filtered() on this thread are added to these
+// until the next call, or until the pass ends or reset() is called. if no
+// pass is running, the counts are discarded.
+counters_t &local(category_t category);
+
+// called from the ray filter for every glass/fence texture test
+void count_filtered();
+
+// print a table of the counts per pass and category
+void print();
+
+// write the same as print(), as JSON
+void write_json(const fs::path &path);
+
+// throw away all passes and counts
+void reset();
+} // namespace raystats
@@ -23,6 +23,8 @@
 #include <common/qvec.hh>
 #include <common/log.hh> // for FError
 
+#include <algorithm>
+#include <span>
 #include <vector>
 #include <set>
 
@@ -76,21 +78,31 @@ struct alignas(16) aligned_vec3
 class raystream_embree_common_t
 {
 protected:
+    // every element is constructed, with the fields that are the same for every ray already set;
+    // only the first _count are pushed rays
     aligned_vector<ray_io> _rays;
+    size_t _count = 0;
 
 public:
     inline raystream_embree_common_t() = default;
-    inline raystream_embree_common_t(size_t capacity) { _rays.reserve(capacity); }
+    inline raystream_embree_common_t(size_t capacity) { reserve(capacity); }
     virtual ~raystream_embree_common_t() = default;
 
-    void resize(size_t size) { _rays.resize(size); }
+    // make room for `capacity` rays without growing
+    void reserve(size_t capacity)
+    {
+        if (capacity > _rays.size()) {
+            _rays.resize(capacity, BlankRay());
+        }
+    }
+    size_t capacity() const { return _rays.size(); }
 
     ray_io &getRay(size_t index) { return _rays[index]; }
     const ray_io &getRay(size_t index) const { return _rays[index]; };
 
-    const size_t numPushedRays() const { return _rays.size(); }
+    const size_t numPushedRays() const { return _count; }
 
-    void clearPushedRays() { _rays.clear(); }
+    void clearPushedRays() { _count = 0; }
 
     inline qvec3f getPushedRayColor(size_t j) const
     {
@@ -112,31 +124,72 @@ public:
         return result;
     }
 
+    inline void pushRay(int i, const qvec3f &origin, const qvec3f &dir, float dist, const qvec3f *color = nullptr,
+        const qvec3f *normalcontrib = nullptr)
+    {
+        grow(1);
+
+        SetupRay(_rays[_count], _count, i, origin, dir, dist, color, normalcontrib);
+        _count++;
+    }
+
+    // pushes one ray per origin, all along `dir` and with the same color; ray k gets index k
+    inline void pushRays(std::span<const qvec3f> origins, const qvec3f &dir, float dist,
+        const qvec3f *color = nullptr, const qvec3f *normalcontrib = nullptr)
+    {
+        grow(origins.size());
+
+        for (size_t k = 0; k < origins.size(); k++) {
+            SetupRay(_rays[_count], _count, k, origins[k], dir, dist, color, normalcontrib);
+            _count++;
+        }
+    }
+
 protected:
-    static inline RTCRayHit SetupRay(
-        unsigned int rayindex, const aligned_vec3 &start, const aligned_vec3 &dir, float dist)
+    // makes room for pushing `n` more rays, at least doubling the capacity when it runs out
+    inline void grow(size_t n)
     {
-        RTCRayHit ray;
-        ray.ray.org_x = start.x;
-        ray.ray.org_y = start.y;
-        ray.ray.org_z = start.z;
-        ray.ray.tnear = start.w;
-
-        ray.ray.dir_x = dir.x; // can be un-normalized
-        ray.ray.dir_y = dir.y;
-        ray.ray.dir_z = dir.z;
-        ray.ray.time = dir.w; // not using
-
-        ray.ray.tfar = dist;
-        ray.ray.mask = 1; // we're not using, but needs to be set if embree is compiled with masks
-        ray.ray.id = rayindex;
-        ray.ray.flags = 0; // reserved
-
-        ray.hit.geomID = RTC_INVALID_GEOMETRY_ID;
-        ray.hit.primID = RTC_INVALID_GEOMETRY_ID;
-        ray.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+        if (_count + n > _rays.size()) {
+            reserve(std::max({_count + n, _rays.size() * 2, size_t(64)}));
+        }
+    }
+
+    static inline ray_io BlankRay()
+    {
+        ray_io ray{};
+        ray.ray.ray.tnear = 0.f;
+        ray.ray.ray.time = 0.f; // not using
+        ray.ray.ray.mask = 1; // we're not using, but needs to be set if embree is compiled with masks
+        ray.ray.ray.flags = 0; // reserved
         return ray;
     }
+
+    // fills in the fields of a blank ray that vary between rays, or are written by tracing
+    static inline void SetupRay(ray_io &ray, size_t rayindex, int index, const qvec3f &start, const qvec3f &dir,
+        float dist, const qvec3f *color, const qvec3f *normalcontrib)
+    {
+        ray.ray.ray.org_x = start[0];
+        ray.ray.ray.org_y = start[1];
+        ray.ray.ray.org_z = start[2];
+
+        ray.ray.ray.dir_x = dir[0]; // can be un-normalized
+        ray.ray.ray.dir_y = dir[1];
+        ray.ray.ray.dir_z = dir[2];
+
+        ray.ray.ray.tfar = dist;
+        ray.ray.ray.id = rayindex;
+
+        ray.ray.hit.geomID = RTC_INVALID_GEOMETRY_ID;
+        ray.ray.hit.primID = RTC_INVALID_GEOMETRY_ID;
+        ray.ray.hit.instID[0] = RTC_INVALID_GEOMETRY_ID;
+
+        ray.maxdist = dist;
+        ray.index = index;
+        ray.color = color ? *color : qvec3f{};
+        ray.normalcontrib = normalcontrib ? *normalcontrib : qvec3f{};
+        ray.hit_glass = false;
+        ray.dynamic_style = 0;
+    }
 };
 
 extern RTCScene scene;
@@ -214,31 +267,19 @@ class raystream_intersection_t : public raystream_embree_common_t
 public:
     using raystream_embree_common_t::raystream_embree_common_t;
 
-    inline void pushRay(int i, const qvec3f &origin, const qvec3f &dir, float dist, const qvec3f *color = nullptr,
-        const qvec3f *normalcontrib = nullptr)
-    {
-        const RTCRayHit rayHit =
-            SetupRay(_rays.size(), {origin[0], origin[1], origin[2], 0.f}, {dir[0], dir[1], dir[2], 0.f}, dist);
-        _rays.push_back(ray_io{.ray = rayHit,
-            .maxdist = dist,
-            .index = i,
-            .color = color ? *color : qvec3f{},
-            .normalcontrib = normalcontrib ? *normalcontrib : qvec3f{}});
-    }
-
     inline void tracePushedRaysIntersection(const modelinfo_t *self, int shadowmask)
     {
-        if (!_rays.size())
+        if (!_count)
             return;
 
         ray_source_info ctx2(this, self, shadowmask);
 
 #ifdef HAVE_EMBREE4
         RTCIntersectArguments embree4_args = ctx2.setup_intersection_arguments();
-        for (auto &ray : _rays)
-            rtcIntersect1(scene, &ray.ray, &embree4_args);
+        for (size_t j = 0; j < _count; j++)
+            rtcIntersect1(scene, &_rays[j].ray, &embree4_args);
 #else
-        rtcIntersect1M(scene, &ctx2, &_rays.data()->ray, _rays.size(), sizeof(_rays[0]));
+        rtcIntersect1M(scene, &ctx2, &_rays.data()->ray, _count, sizeof(_rays[0]));
 #endif
     }
 
@@ -279,34 +320,36 @@ class raystream_occlusion_t : public raystream_embree_common_t
 public:
     using raystream_embree_common_t::raystream_embree_common_t;
 
-    inline void pushRay(int i, const qvec3f &origin, const qvec3f &dir, float dist, const qvec3f *color = nullptr,
-        const qvec3f *normalcontrib = nullptr)
-    {
-        const RTCRay ray =
-            SetupRay(_rays.size(), {origin[0], origin[1], origin[2], 0.f}, {dir[0], dir[1], dir[2], 0.f}, dist).ray;
-        _rays.push_back(ray_io{.ray = {ray},
-            .maxdist = dist,
-            .index = i,
-            .color = color ? *color : qvec3f{},
-            .normalcontrib = normalcontrib ? *normalcontrib : qvec3f{}});
-    }
-
     inline void tracePushedRaysOcclusion(const modelinfo_t *self, int shadowmask)
     {
-        if (!_rays.size())
+        if (!_count)
             return;
 
         ray_source_info ctx2(this, self, shadowmask);
 #ifdef HAVE_EMBREE4
         RTCOccludedArguments embree4_args = ctx2.setup_occluded_arguments();
-        for (auto &ray : _rays)
-            rtcOccluded1(scene, &ray.ray.ray, &embree4_args);
+        for (size_t j = 0; j < _count; j++)
+            rtcOccluded1(scene, &_rays[j].ray.ray, &embree4_args);
 #else
-        rtcOccluded1M(scene, &ctx2, &_rays.data()->ray.ray, _rays.size(), sizeof(_rays[0]));
+        rtcOccluded1M(scene, &ctx2, &_rays.data()->ray.ray, _count, sizeof(_rays[0]));
 #endif
     }
 
     inline bool getPushedRayOccluded(size_t j) const { return (_rays[j].ray.ray.tfar < 0.0f); }
 
     inline const qvec3f &getPushedRayDir(size_t j) const { return *((qvec3f *)&_rays[j].ray.ray.dir_x); }
-};
\ No newline at end of file
+};
+
+/**
+ * The ray streams of one worker thread, reused for every face it lights.
+ */
+struct raystream_pool_t
+{
+    raystream_occlusion_t occlusion;
+    raystream_intersection_t intersection;
+};
+
+// sets how many rays every worker's streams are reserved for, e.g. the most samples on any face
+void Embree_ReserveRayStreams(size_t rays);
+// the calling thread's streams, reserved for at least the size given to Embree_ReserveRayStreams
+raystream_pool_t &Embree_LocalRayStreams();
@@ -46,3 +46,14 @@ void WriteLitFile(const mbsp_t *bsp, const std::vector<facesup_t> &facesup, cons
 void WriteLuxFile(const mbsp_t *bsp, const fs::path &filename, int version, const std::vector<uint8_t> &lux_filebase);
 
 void SaveLightmapSurfaces(bspdata_t *bspdata, const fs::path &source);
+
+/**
+ * Filters one style of a face's lightmap before it is quantized: optionally
+ * highlights seams, flood fills occluded samples, box blurs by `soft` and
+ * downsamples by `extra`.
+ *
+ * `image` is width * height samples with alpha 0 where occluded, 1 otherwise,
+ * and is replaced by the filtered image. The lightmap writer runs the same
+ * filters row by row as it quantizes; this gives the whole image at once.
+ */
+void PostProcessLightmap(std::vector<qvec4f> &image, int width, int height, int extra, int soft, bool highlightseams);
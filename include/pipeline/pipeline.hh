@@ -0,0 +1,83 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#pragma once
+
+#include <common/settings.hh>
+#include <common/fs.hh>
+
+#include <string>
+#include <vector>
+
+// options for one in-process qbsp -> vis -> light run
+struct pipeline_args_t
+{
+    fs::path map_path;
+    // defaults to map_path with a .bsp extension
+    fs::path bsp_path;
+
+    // passed to every stage, before the stage's own options
+    std::vector<std::string> common_args;
+    std::vector<std::string> qbsp_args;
+    std::vector<std::string> vis_args;
+    std::vector<std::string> light_args;
+
+    bool run_vis = true;
+    bool run_light = true;
+};
+
+/**
+ * Compiles map_path with qbsp, vis and light in this process. The BSP and portal
+ * data are handed from stage to stage in memory, as is the PVS vis already has
+ * uncompressed, so only the final .bsp is written (plus the usual .prt, .lit, logs etc).
+ */
+void RunPipeline(const pipeline_args_t &args);
+
+// splits the value of e.g. -qbsp "-q2bsp -wrbrushes" into separate arguments; double quotes group words
+std::vector<std::string> SplitPipelineArgs(const std::string &str);
+
+namespace settings
+{
+extern setting_group pipeline_group;
+
+class pipeline_settings : public common_settings
+{
+public:
+    setting_string qbsp{this, "qbsp", "", "\"options\"", &pipeline_group, "extra options for the qbsp stage"};
+    setting_string vis{this, "vis", "", "\"options\"", &pipeline_group, "extra options for the vis stage"};
+    setting_string light{this, "light", "", "\"options\"", &pipeline_group, "extra options for the light stage"};
+    setting_bool novis{this, "novis", false, &pipeline_group, "don't run vis"};
+    setting_bool nolight{this, "nolight", false, &pipeline_group, "don't run light"};
+
+    // the options on the command line that aren't the pipeline's own, as given;
+    // every stage gets these
+    std::vector<std::string> common_args;
+
+    void set_parameters(int argc, const char **argv) override
+    {
+        common_settings::set_parameters(argc, argv);
+        program_description = "pipeline compiles a .MAP file with qbsp, vis and light in one process,\n"
+                              "handing the BSP between them in memory.\n\n";
+        remainder_name = "mapname.map [output.bsp]";
+    }
+    void initialize(int argc, const char **argv) override;
+};
+} // namespace settings
+
+int pipeline_main(int argc, const char **argv);
@@ -21,6 +21,7 @@
 
 #pragma once
 
+#include <qbsp/pool.hh>
 #include <qbsp/winding.hh>
 #include <common/aabb.hh>
 #include <optional>
@@ -61,11 +62,14 @@ struct bspbrush_t
     using ptr = std::shared_ptr<bspbrush_t>;
     using container = std::vector<ptr>;
     using list = std::list<ptr>;
+    using side_container = std::vector<side_t, pool::allocator_t<side_t>>;
 
+    // the brush and its shared_ptr control block are allocated
+    // together, in one block from the calling thread's pool
     template<typename... Args>
     static inline ptr make_ptr(Args &&...args)
     {
-        return std::make_shared<bspbrush_t>(std::forward<Args>(args)...);
+        return std::allocate_shared<bspbrush_t>(pool::allocator_t<bspbrush_t>(), std::forward<Args>(args)...);
     }
 
     /**
@@ -80,7 +84,7 @@ struct bspbrush_t
 
     aabb3d bounds;
     int side, testside; // side of node during construction
-    std::vector<side_t> sides;
+    side_container sides;
     contentflags_t contents; /* BSP contents */
 
     qvec3d sphere_origin;
@@ -94,7 +94,10 @@ enum tree_split_t
     // to make a good BSP tree
     PRECISE,
     // always use faster methods to create the tree
-    FAST
+    FAST,
+    // always use the binned surface area heuristic; faster than
+    // PRECISE, but makes better trees than FAST
+    SAH
 };
 
 double BrushVolume(const bspbrush_t &brush);
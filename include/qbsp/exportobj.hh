@@ -26,9 +26,9 @@
 #include <qbsp/brush.hh>
 
 struct face_t;
-struct node_t;
+struct tree_t;
 
 void ExportObj_Faces(const std::string &filesuffix, const std::vector<const face_t *> &faces);
 void ExportObj_Brushes(const std::string &filesuffix, const bspbrush_t::container &brushes);
-void ExportObj_Nodes(const std::string &filesuffix, const node_t *nodes);
-void ExportObj_Marksurfaces(const std::string &filesuffix, const node_t *nodes);
+void ExportObj_Nodes(const std::string &filesuffix, const tree_t &tree);
+void ExportObj_Marksurfaces(const std::string &filesuffix, const tree_t &tree);
@@ -23,7 +23,7 @@
 
 #include <list>
 
-struct node_t;
+struct tree_t;
 
-void MakeMarkFaces(node_t *headnode);
-void MakeFaces(node_t *node);
+void MakeMarkFaces(tree_t &tree);
+void MakeFaces(tree_t &tree);
@@ -258,6 +258,9 @@ struct mapdata_t
     // whether we had attempted loading texture stuff
     bool textures_loaded = false;
 
+    // set by ProcessFile when the BSP is handed over in memory rather than written
+    qbsp_output_t *output = nullptr;
+
     // map compile region
     std::optional<mapbrush_t> region = std::nullopt;
     std::vector<mapbrush_t> antiregions;
@@ -335,10 +338,10 @@ qvec3d FixRotateOrigin(mapentity_t &entity);
 /* Create BSP brushes from map brushes */
 void Brush_LoadEntity(mapentity_t &entity, hull_index_t hullnum, bspbrush_t::container &brushes, size_t &num_clipped);
 
-size_t EmitFaces(node_t *headnode);
-void EmitVertices(node_t *headnode);
-void ExportClipNodes(mapentity_t &entity, node_t *headnode, hull_index_t::value_type hullnum);
-void ExportDrawNodes(mapentity_t &entity, node_t *headnode, int firstface);
+size_t EmitFaces(tree_t &tree);
+void EmitVertices(tree_t &tree);
+void ExportClipNodes(mapentity_t &entity, tree_t &tree, hull_index_t::value_type hullnum);
+void ExportDrawNodes(mapentity_t &entity, tree_t &tree, int firstface);
 void WriteBspBrushMap(std::string_view filename_suffix, const bspbrush_t::container &list);
 
 bool IsValidTextureProjection(const qvec3f &faceNormal, const qvec3f &s_vec, const qvec3f &t_vec);
@@ -0,0 +1,96 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+/*
+ * qbsp/pool.hh
+ *
+ * Per-thread slab pools for qbsp's short-lived geometry: bspbrush_t (together
+ * with its shared_ptr control block), side arrays and winding points.
+ *
+ * Blocks are rounded up to a size class and handed out from the calling
+ * thread's free list for that class, or carved out of the thread's current
+ * 64 KiB slab; neither needs a lock or an atomic. A block freed on another
+ * thread goes onto that thread's free list. Slabs are kept for the life of
+ * the process and reused by later passes; blocks too large for any class
+ * come from tbb::scalable_allocator.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace pool
+{
+void *allocate(size_t bytes);
+void deallocate(void *p) noexcept;
+
+template<typename T>
+struct allocator_t
+{
+    using value_type = T;
+
+    allocator_t() noexcept = default;
+
+    template<typename U>
+    allocator_t(const allocator_t<U> &) noexcept
+    {
+    }
+
+    inline T *allocate(size_t n)
+    {
+        static_assert(alignof(T) <= 16, "pool blocks are only 16-byte aligned");
+        return static_cast<T *>(pool::allocate(n * sizeof(T)));
+    }
+
+    inline void deallocate(T *p, size_t) noexcept { pool::deallocate(p); }
+
+    template<typename U>
+    constexpr bool operator==(const allocator_t<U> &) const noexcept
+    {
+        return true;
+    }
+};
+
+struct counts_t
+{
+    size_t allocations = 0;
+    size_t frees = 0;
+    size_t bytes = 0; // requested, not including size class rounding
+};
+
+// counts the allocations made on any thread while it's alive, and the frees
+// of those same blocks; blocks allocated before it don't count when they're
+// freed. if scopes are nested, only the innermost one counts.
+class scope_t
+{
+    uint32_t epoch;
+    uint32_t previous;
+
+public:
+    scope_t();
+    ~scope_t();
+
+    // call once the scope's parallel work is done
+    counts_t counts() const;
+};
+
+// total size of the slabs reserved so far, on all threads
+size_t slab_bytes();
+} // namespace pool
@@ -66,9 +66,9 @@ struct portalstats_t : logging::stat_tracker_t
     stat &c_tinyportals = register_stat("tiny portals");
 };
 
-contentflags_t ClusterContents(const node_t *node);
-bool Portal_VisFlood(const portal_t *p);
-bool Portal_EntityFlood(const portal_t *p, int32_t s);
+contentflags_t ClusterContents(const tree_t &tree, const node_t *node);
+bool Portal_VisFlood(const tree_t &tree, const portal_t *p);
+bool Portal_EntityFlood(const tree_t &tree, const portal_t *p, int32_t s);
 enum class portaltype_t
 {
     NONE,
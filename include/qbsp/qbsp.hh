@@ -28,6 +28,7 @@
 #include <unordered_map>
 #include <array>
 #include <optional>
+#include <limits>
 #include <string>
 #include <variant>
 
@@ -45,6 +46,7 @@
 #include <qbsp/winding.hh>
 
 #include <common/bspfile.hh>
+#include <common/prtfile.hh>
 #include <common/aabb.hh>
 #include <common/settings.hh>
 #include <common/fs.hh>
@@ -118,6 +120,12 @@ enum class filltype_t
     INSIDE
 };
 
+enum class midsplitmethod_t
+{
+    VOLUME, // pick the plane that divides the node volume most evenly
+    SAH // binned surface area heuristic over the brush bounds
+};
+
 enum class tjunclevel_t
 {
     NONE, // don't attempt to adjust faces at all - pass them through unchanged
@@ -193,6 +201,7 @@ public:
     setting_bool forcegoodtree;
     setting_scalar midsplitsurffraction;
     setting_int32 maxnodesize;
+    setting_enum<midsplitmethod_t> midsplitmethod;
     setting_bool oldrottex;
     setting_scalar epsilon;
     setting_scalar microvolume;
@@ -291,6 +300,7 @@ struct portal_t;
 struct qbsp_plane_t;
 struct mapface_t;
 struct node_t;
+struct tree_t;
 
 struct face_t
 {
@@ -392,26 +402,18 @@ struct bspbrush_t;
 struct side_t;
 class mapbrush_t;
 
+// cold data for decision nodes, stored in tree_t::nodedata
 struct nodedata_t
 {
-    // information for decision nodes
-    size_t planenum; // decision node only
-
-    const qbsp_plane_t &get_plane() const;
-
-    int firstface; // decision node only
-    int numfaces; // decision node only
-    twosided<node_t *>
-        children; // children[0] = front side, children[1] = back side of plane. only valid for decision nodes
-    std::list<std::unique_ptr<face_t>> facelist; // decision nodes only, list for both sides
-    bool detail_separator; // for vis portal generation. true if ALL faces on node, and on all descendant nodes/leafs,
-                           // are detail.
+    int firstface;
+    int numfaces;
+    std::list<std::unique_ptr<face_t>> facelist; // list for both sides
 };
 
+// cold data for leafs, stored in tree_t::leafdata
 struct leafdata_t
 {
-    // information for leafs
-    std::vector<face_t *> markfaces; // leaf nodes only, point to node faces
+    contentflags_t contents;
     int outside_distance; // -1 = can't reach outside, 0 = first void node, >0 = distance from void, in number of
                           // portals used to write leak lines that take the shortest path to the void
     int occupied; // 0=can't reach entity, 1 = has entity, >1 = distance from leaf with entity
@@ -419,44 +421,58 @@ struct leafdata_t
     uint32_t firstleafbrush; // Q2
     uint32_t numleafbrushes;
     int32_t area;
-    contentflags_t contents; // leaf nodes (0 for decision nodes)
+    std::vector<face_t *> markfaces; // point to node faces
     std::vector<bspbrush_t *> original_brushes;
-    bspbrush_t::container bsp_brushes;
+    // the brush fragments that ended up in this leaf; only kept
+    // for -debugleak/-debugbspbrushes
+    std::unique_ptr<bspbrush_t::container> bsp_brushes;
 };
 
+// only the fields used to walk the tree are kept here; the rest are in
+// the owning tree_t's nodedata/leafdata tables, at `dataindex`
 struct node_t
 {
+    static constexpr uint32_t NO_DATA = std::numeric_limits<uint32_t>::max();
+
     // both leafs and nodes
     aabb3d bounds; // bounding volume, not just points inside
     node_t *parent;
     // this is also a bounding volume like `bounds`
     bspbrush_t::ptr volume; // one for each leaf/node
-    std::variant<nodedata_t, leafdata_t> data;
+
+    // information for decision nodes
+    size_t planenum;
+    twosided<node_t *> children; // children[0] = front side, children[1] = back side of plane
+
+    const qbsp_plane_t &get_plane() const;
 
     // data for portals and detail separator nodes
     portal_t *portals;
     int visleafnum; // -1 = solid
     int viscluster; // detail cluster for faster vis
 
-    bool is_leaf() const { return data.index() == 1; }
-
-    nodedata_t *get_nodedata() { return std::get_if<0>(&data); }
-    const nodedata_t *get_nodedata() const { return std::get_if<0>(&data); }
+    // index into tree_t::leafdata for leafs, tree_t::nodedata for decision nodes;
+    // NO_DATA until tree_t::make_node/make_leaf is called
+    uint32_t dataindex = NO_DATA;
+    bool leaf;
+    bool detail_separator; // for vis portal generation. true if ALL faces on node, and on all descendant nodes/leafs,
+                           // are detail.
 
-    leafdata_t *get_leafdata() { return std::get_if<1>(&data); }
-    const leafdata_t *get_leafdata() const { return std::get_if<1>(&data); }
+    bool is_leaf() const { return leaf; }
+};
 
-    // defaults to node
-    leafdata_t *make_leaf()
-    {
-        data = leafdata_t{};
-        return get_leafdata();
-    }
+// what ProcessFile hands over to the next stage when qbsp is run in-process
+struct qbsp_output_t
+{
+    // the BSP, already converted to the output format; not written to disk
+    bspdata_t bspdata{};
+    // the portals for vis, if the map didn't leak (the .prt file is still written for map editors)
+    std::optional<prtfile_t> prtfile;
 };
 
 void InitQBSP(int argc, const char **argv);
 void InitQBSP(const std::vector<std::string> &args);
-void CountLeafs(node_t *headnode);
-void ProcessFile();
+void CountLeafs(const tree_t &tree);
+void ProcessFile(qbsp_output_t *output = nullptr);
 
 int qbsp_main(int argc, const char **argv);
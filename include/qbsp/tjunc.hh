@@ -21,6 +21,6 @@
 
 #pragma once
 
-struct node_t;
+struct tree_t;
 
-void TJunc(node_t *headnode);
+void TJunc(tree_t &tree);
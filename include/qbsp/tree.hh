@@ -29,6 +29,7 @@
 #include <memory>
 #include <vector>
 
+#include <tbb/concurrent_queue.h>
 #include <tbb/concurrent_vector.h>
 
 struct portal_t;
@@ -54,16 +55,56 @@ struct tree_t
     // promises not to move elements so we can omit the std::unique_ptr wrapper.
     tbb::concurrent_vector<node_t> nodes;
 
+    // data that isn't needed to walk the tree, indexed by node_t::dataindex.
+    // kept out of node_t so decision nodes don't carry leaf data around, and
+    // vice versa.
+    tbb::concurrent_vector<nodedata_t> nodedata;
+    tbb::concurrent_vector<leafdata_t> leafdata;
+
+    // slots of the above that were released and can be handed out again
+    tbb::concurrent_queue<uint32_t> free_nodedata;
+    tbb::concurrent_queue<uint32_t> free_leafdata;
+
     // creates a new portal owned by `this` (stored in the `portals` vector) and
     // returns a raw pointer to it
     portal_t *create_portal();
 
     // creates a new node owned by `this` (stored in the `nodes` vector) and
-    // returns a raw pointer to it
+    // returns a raw pointer to it. it has no node/leaf data until
+    // make_node() or make_leaf() is called on it.
     node_t *create_node();
 
+    // turn `node` into a decision node or leaf with fresh data, and return
+    // the data. a node that already is of that kind keeps its slot, which is
+    // reset; otherwise its old data (e.g. the faces of a pruned decision
+    // node) is released, and a released slot is reused if there is one.
+    nodedata_t *make_node(node_t *node);
+    leafdata_t *make_leaf(node_t *node);
+
+    // reset `node`'s data and hand its slot back for reuse; `node` has
+    // no data afterwards. used for the children of a pruned node.
+    void release_data(node_t *node);
+
+    // nullptr if `node` is a leaf / decision node respectively
+    inline nodedata_t *get_nodedata(const node_t *node)
+    {
+        return node->is_leaf() ? nullptr : &nodedata[node->dataindex];
+    }
+    inline const nodedata_t *get_nodedata(const node_t *node) const
+    {
+        return node->is_leaf() ? nullptr : &nodedata[node->dataindex];
+    }
+    inline leafdata_t *get_leafdata(const node_t *node)
+    {
+        return node->is_leaf() ? &leafdata[node->dataindex] : nullptr;
+    }
+    inline const leafdata_t *get_leafdata(const node_t *node) const
+    {
+        return node->is_leaf() ? &leafdata[node->dataindex] : nullptr;
+    }
+
     // reset the tree without clearing allocated vector space
     void clear();
 };
 
-void PruneNodes(node_t *node);
+void PruneNodes(tree_t &tree);
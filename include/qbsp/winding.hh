@@ -22,5 +22,7 @@
 #pragma once
 
 #include "common/polylib.hh"
+#include <qbsp/pool.hh>
 
-using winding_t = polylib::winding_t;
+// qbsp's windings take their points from the per-thread pools
+using winding_t = polylib::winding_base_t<polylib::winding_storage_heap_t<double, pool::allocator_t<qvec3d>>>;
@@ -26,6 +26,8 @@
 #include <common/prtfile.hh>
 #include <vis/leafbits.hh>
 
+#include <unordered_map>
+
 constexpr double VIS_ON_EPSILON = 0.1;
 constexpr double VIS_EQUAL_EPSILON = 0.001;
 
@@ -296,3 +298,8 @@ extern settings::vis_settings vis_options;
 void vis_reset();
 int vis_main(int argc, const char **argv);
 int vis_main(const std::vector<std::string> &args);
+// in-process variants: vis bspdata (left in bspver_generic) using prtfile, without
+// reading or writing the .bsp/.prt
+int vis_main(int argc, const char **argv, bspdata_t &bspdata, const prtfile_t &prtfile);
+int vis_main(const std::vector<std::string> &args, bspdata_t &bspdata, const prtfile_t &prtfile);
+std::unordered_map<int, std::vector<uint8_t>> ExportUncompressedVis(const mbsp_t *bsp);
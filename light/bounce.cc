@@ -32,6 +32,7 @@
 
 #include <common/polylib.hh>
 #include <common/bsputils.hh>
+#include <common/profiler.hh>
 
 #include <vector>
 #include <unordered_map>
@@ -225,6 +226,7 @@ static bool MakeBounceLightsThread(
 bool MakeBounceLights(const settings::worldspawn_keys &cfg, const mbsp_t *bsp, size_t depth)
 {
     logging::funcheader();
+    profilefunc();
 
     std::atomic_bool any_to_bounce = false;
 
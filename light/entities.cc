@@ -447,7 +447,6 @@ static void SetupSun(const settings::worldspawn_keys &cfg, float light, const qv
     int i;
     int sun_num_samples = (sun_deviance == 0 ? 1 : light_options.sunsamples.value()); // mxd
     float sun_deviance_rad = DEG2RAD(sun_deviance); // mxd
-    float sun_deviance_sq = sun_deviance * sun_deviance; // mxd
 
     qvec3f sunvec = qv::normalize(sunvec_in);
 
@@ -464,18 +463,16 @@ static void SetupSun(const settings::worldspawn_keys &cfg, float light, const qv
         if (i == 0) {
             direction = sunvec;
         } else {
-            float da, de;
             float d = sqrt(sunvec[0] * sunvec[0] + sunvec[1] * sunvec[1]);
             float angle = atan2(sunvec[1], sunvec[0]);
             float elevation = atan2(sunvec[2], d);
 
-            /* jitter the angles (loop to keep random sample within sun->deviance steridians) */
-            do {
-                da = (Random() * 2.0f - 1.0f) * sun_deviance_rad;
-                de = (Random() * 2.0f - 1.0f) * sun_deviance_rad;
-            } while ((da * da + de * de) > sun_deviance_sq);
-            angle += da;
-            elevation += de;
+            /* offset the angles, spreading the samples evenly over a disc of sun->deviance radians
+               (golden angle spiral) rather than picking them at random */
+            const float r = sun_deviance_rad * sqrt((i - 0.5f) / (sun_num_samples - 1));
+            const float theta = i * 2.39996323f;
+            angle += r * cos(theta);
+            elevation += r * sin(theta);
 
             /* create new vector */
             direction[0] = cos(angle) * cos(elevation);
@@ -1164,7 +1161,8 @@ aabb3f EstimateVisibleBoundsAtPoint(const qvec3f &point)
     constexpr size_t N = 32;
     constexpr size_t N2 = N * N;
 
-    raystream_intersection_t rs{N2};
+    raystream_intersection_t &rs = Embree_LocalRayStreams().intersection;
+    rs.clearPushedRays();
 
     aabb3f bounds = point;
 
@@ -30,9 +30,11 @@
 #include <light/entities.hh>
 #include <light/ltface.hh>
 #include <light/write.hh> // for facesup_t
+#include <light/raystats.hh>
 #include <light/trace_embree.hh>
 
 #include <common/log.hh>
+#include <common/profiler.hh>
 #include <common/bsputils.hh>
 #include <common/numeric_cast.hh>
 #include <common/fs.hh>
@@ -94,11 +96,18 @@ bool IsOutputtingSupplementaryData()
     return !faces_sup.empty();
 }
 
-static std::unordered_map<int, std::vector<uint8_t>> all_uncompressed_vis;
+static pvs_table_t pvs_table;
 
-const std::unordered_map<int, std::vector<uint8_t>> &UncompressedVis()
+const pvs_table_t &PvsTable()
 {
-    return all_uncompressed_vis;
+    return pvs_table;
+}
+
+static face_leafs_t face_leafs;
+
+const face_leafs_t &FaceLeafs()
+{
+    return face_leafs;
 }
 
 std::vector<modelinfo_t *> modelinfo;
@@ -183,6 +192,7 @@ worldspawn_keys::worldspawn_keys()
       dirtscale{this, "dirtscale", 1.0, 0.0, 100.0, &worldspawn_group},
       dirtgain{this, "dirtgain", 1.0, 0.0, 100.0, &worldspawn_group},
       dirtangle{this, "dirtangle", 88.0, 1.0, 90.0, &worldspawn_group},
+      dirtadaptive{this, "dirtadaptive", 0.0, 0.0, 1.0, &worldspawn_group},
       minlight_dirt{this, "minlight_dirt", false, &worldspawn_group},
       phongallowed{this, "phong", true, &worldspawn_group},
       phongangle{this, "phong_angle", 0, &worldspawn_group},
@@ -291,6 +301,8 @@ light_settings::light_settings()
       novanilla{this, "novanilla", false, &experimental_group, "implies -bspxlit; don't write vanilla lighting"},
       gate{this, "gate", LIGHT_EQUAL_EPSILON, &performance_group, "cutoff lights at this brightness level"},
       sunsamples{this, "sunsamples", 64, 8, 2048, &performance_group, "set samples for _sunlight2, default 64"},
+      sunsamples_subset{this, "sunsamples_subset", 0, 0, 2048, &performance_group,
+          "trace only this many suns per sample, picked by how much light they'd cast; 0 traces all of them"},
       arghradcompat{this, "arghradcompat", false, &output_group, "enable compatibility for Arghrad-specific keys"},
       nolighting{this, "nolighting", false, &output_group, "don't output main world lighting (Q2RTX)"},
       debugface{this, "debugface", std::numeric_limits<float>::quiet_NaN(), std::numeric_limits<float>::quiet_NaN(),
@@ -377,9 +389,16 @@ light_settings::light_settings()
       world_units_per_luxel{
           this, "world_units_per_luxel", 0, 0, 1024, &output_group, "enables output of DECOUPLED_LM BSPX lump"},
       litonly{this, "litonly", false, &output_group, "only write .lit file, don't modify BSP"},
+      nolightmapdedup{this, "nolightmapdedup", false, &output_group,
+          "give every face its own lightmap data, even if it's identical to another face's"},
+      maxlightdata{this, "maxlightdata", std::numeric_limits<int32_t>::max(), 1,
+          std::numeric_limits<int32_t>::max(), &output_group,
+          "error out if the lightmap data, in bytes of the greyscale lightmap, would exceed this"},
       nolights{this, "nolights", false, &output_group, "ignore light entities (only sunlight/minlight)"},
       facestyles{this, "facestyles", 4, &output_group, "max amount of styles per face; requires BSPX lump if > 4"},
       exportobj{this, "exportobj", false, &output_group, "export an .OBJ for inspection"},
+      raystats{this, "raystats", "", &output_group,
+          "write the number of rays traced per light category and lighting pass to this path as JSON"},
       lmshift{this, "lmshift", 4, &output_group,
           "force a specified lmshift to be applied to the entire map; this is useful if you want to re-light a map with higher quality BSPX lighting without the sources. Will add the LMSHIFT lump to the BSP."},
       lightgrid{this, "lightgrid", false, &experimental_group,
@@ -388,6 +407,10 @@ light_settings::light_settings()
           "distance between lightgrid sample points, in world units. controls lightgrid size."},
       lightgrid_format{this, "lightgrid_format", lightgrid_format_t::OCTREE, {{"octree", lightgrid_format_t::OCTREE}},
           &experimental_group, "lightgrid BSPX lump to use"},
+      lightgrid_adaptive{this, "lightgrid_adaptive", 0.0, 0.0, 255.0, &experimental_group,
+          "if nonzero, only trace the lightgrid where it changes by more than this much (0..255 per color channel), and interpolate elsewhere"},
+      lightgrid_nobatch{this, "lightgrid_nobatch", false, &experimental_group,
+          "trace each lightgrid point on its own instead of in batches; slower, for checking the batched path"},
 
       dirtdebug{this, {"dirtdebug", "debugdirt"},
           [&](const std::string &, parser_base_t &, source) {
@@ -687,6 +710,14 @@ static void CreateLightmapSurfaces(mbsp_t *bsp)
 
         light_surfaces[i] = CreateLightmapSurface(bsp, face, facesup, facesup_decoupled, light_options);
     });
+
+    // most passes push at most one ray per sample at a time, so size every worker's ray streams for the
+    // biggest face up front
+    size_t max_samples = 0;
+    for (const lightsurf_t &surf : light_surfaces_span) {
+        max_samples = std::max(max_samples, surf.samples.size());
+    }
+    Embree_ReserveRayStreams(max_samples);
 }
 
 static void ClearLightmapSurfaces()
@@ -786,6 +817,7 @@ static void FindModelInfo(const mbsp_t *bsp)
 static void LightWorld(bspdata_t *bspdata, const fs::path &source, bool forcedscale)
 {
     logging::funcheader();
+    profilefunc();
 
     mbsp_t &bsp = std::get<mbsp_t>(bspdata->bsp);
 
@@ -844,19 +876,24 @@ static void LightWorld(bspdata_t *bspdata, const fs::path &source, bool forcedsc
     MakeRadiositySurfaceLights(light_options, &bsp);
     UpdateEmissiveLightSurfacesList();
 
-    logging::header("Direct Lighting"); // mxd
-    logging::parallel_for(static_cast<size_t>(0), bsp.dfaces.size(), [&bsp](size_t i) {
-        if (Face_IsLightmapped(&bsp, &bsp.dfaces[i])) {
+    {
+        logging::header("Direct Lighting"); // mxd
+        profiler::scope profile("Direct Lighting");
+        raystats::begin_pass("direct");
+        logging::parallel_for(static_cast<size_t>(0), bsp.dfaces.size(), [&bsp](size_t i) {
+            if (Face_IsLightmapped(&bsp, &bsp.dfaces[i])) {
 #if defined(HAVE_EMBREE) && defined(__SSE2__)
-            _MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
+                _MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
 #endif
-            DirectLightFace(&bsp, light_surfaces[i], light_options);
-        }
-    });
+                DirectLightFace(&bsp, light_surfaces[i], light_options);
+            }
+        });
+    }
 
     if (bouncerequired && !light_options.nolighting.value()) {
 
         for (size_t i = 0; i < light_options.bounce.value(); i++) {
+            profiler::scope profile(fmt::format("Bounce (pass {})", i));
 
             if (!MakeBounceLights(light_options, &bsp, i)) {
                 logging::header("No bounces; indirect lighting halted");
@@ -865,6 +902,8 @@ static void LightWorld(bspdata_t *bspdata, const fs::path &source, bool forcedsc
             UpdateEmissiveLightSurfacesList();
 
             logging::header(fmt::format("Indirect Lighting (pass {0})", i).c_str()); // mxd
+            profiler::scope indirect_profile("Indirect Lighting");
+            raystats::begin_pass(fmt::format("bounce {}", i));
 
             logging::parallel_for(static_cast<size_t>(0), bsp.dfaces.size(), [i, &bsp](size_t f) {
                 if (Face_IsLightmapped(&bsp, &bsp.dfaces[f])) {
@@ -878,8 +917,11 @@ static void LightWorld(bspdata_t *bspdata, const fs::path &source, bool forcedsc
         }
     }
 
+    raystats::end_pass();
+
     if (!light_options.nolighting.value()) {
         logging::header("Post-Processing"); // mxd
+        profiler::scope profile("Post-Processing");
         logging::parallel_for(static_cast<size_t>(0), bsp.dfaces.size(), [&bsp](size_t i) {
             if (Face_IsLightmapped(&bsp, &bsp.dfaces[i])) {
 #if defined(HAVE_EMBREE) && defined(__SSE2__)
@@ -1355,7 +1397,8 @@ static void ResetLight()
     faces_sup.clear();
     facesup_decoupled_global.clear();
 
-    all_uncompressed_vis.clear();
+    pvs_table.clear();
+    face_leafs = {};
     modelinfo.clear();
     tracelist.clear();
     selfshadowlist.clear();
@@ -1384,13 +1427,19 @@ void light_reset()
  * ==================
  * main
  * light modelfile
+ *
+ * in_bspdata: if set, the BSP handed over by the previous stage of the in-process
+ * pipeline, lit instead of loading the .bsp from disk.
+ * uncompressed_vis: if set, used instead of decompressing the visdata again.
  * ==================
  */
-int light_main(int argc, const char **argv)
+static int LightMain(int argc, const char **argv, bspdata_t *in_bspdata,
+    std::unordered_map<int, std::vector<uint8_t>> *uncompressed_vis)
 {
     light_reset();
 
-    bspdata_t bspdata;
+    bspdata_t loaded_bspdata;
+    bspdata_t &bspdata = in_bspdata ? *in_bspdata : loaded_bspdata;
 
     light_options.preinitialize(argc, argv);
     light_options.initialize(argc, argv);
@@ -1414,12 +1463,20 @@ int light_main(int argc, const char **argv)
     ParseLightsFile(source); // map-specific file name
 
     source.replace_extension("bsp");
-    LoadBSPFile(source, &bspdata);
-
-    bspdata.version->game->init_filesystem(source, light_options);
+    if (!in_bspdata) {
+        LoadBSPFile(source, &bspdata);
+    } else if (light_options.litonly.value() || light_options.write_litfile == lightfile::lit2) {
+        // these leave the .bsp alone, so it has to be on disk as the previous stage would have left it
+        if (bspdata.version == &bspver_generic) {
+            ConvertBSPFormat(&bspdata, bspdata.loadversion);
+        }
+        WriteBSPFile(source, &bspdata);
+    }
 
     ConvertBSPFormat(&bspdata, &bspver_generic);
 
+    bspdata.loadversion->game->init_filesystem(source, light_options);
+
     mbsp_t &bsp = std::get<mbsp_t>(bspdata.bsp);
 
     // mxd. Use 1.0 rangescale as a default to better match with qrad3/arghrad
@@ -1470,7 +1527,8 @@ int light_main(int argc, const char **argv)
     light_options.light_postinitialize(argc, argv);
     light_options.print_summary();
 
-    all_uncompressed_vis = DecompressAllVis(&bsp, true);
+    pvs_table.build(&bsp, uncompressed_vis);
+    face_leafs = BSP_BuildFaceLeafs(&bsp);
     FindModelInfo(&bsp);
 
     FindDebugFace(&bsp);
@@ -1535,25 +1593,30 @@ int light_main(int argc, const char **argv)
 
     auto end = I_FloatTime();
     logging::print("{:.3} seconds elapsed\n", (end - start));
-#if 0
-    logging::print("\n");
-    logging::print("stats:\n");
-    logging::print("{} lights tested, {} hits per sample point\n",
-        static_cast<float>(total_light_rays) / static_cast<float>(total_samplepoints),
-        static_cast<float>(total_light_ray_hits) / static_cast<float>(total_samplepoints));
-    logging::print("{} surface lights tested, {} hits per sample point\n",
-        static_cast<float>(total_surflight_rays) / static_cast<float>(total_samplepoints),
-        static_cast<float>(total_surflight_ray_hits) / static_cast<float>(total_samplepoints)); // mxd
-    logging::print("{} bounce lights tested, {} hits per sample point\n",
-        static_cast<float>(total_bounce_rays) / static_cast<float>(total_samplepoints),
-        static_cast<float>(total_bounce_ray_hits) / static_cast<float>(total_samplepoints));
-#endif
+
+    raystats::print();
+
+    if (!light_options.raystats.value().empty()) {
+        raystats::write_json(light_options.raystats.value());
+    }
+
     logging::print("{} empty lightmaps\n", static_cast<int>(fully_transparent_lightmaps));
     logging::close();
 
     return 0;
 }
 
+int light_main(int argc, const char **argv)
+{
+    return LightMain(argc, argv, nullptr, nullptr);
+}
+
+int light_main(
+    int argc, const char **argv, bspdata_t &bspdata, std::unordered_map<int, std::vector<uint8_t>> *uncompressed_vis)
+{
+    return LightMain(argc, argv, &bspdata, uncompressed_vis);
+}
+
 int light_main(const std::vector<std::string> &args)
 {
     std::vector<const char *> argPtrs;
@@ -1563,3 +1626,14 @@ int light_main(const std::vector<std::string> &args)
 
     return light_main(argPtrs.size(), argPtrs.data());
 }
+
+int light_main(const std::vector<std::string> &args, bspdata_t &bspdata,
+    std::unordered_map<int, std::vector<uint8_t>> *uncompressed_vis)
+{
+    std::vector<const char *> argPtrs;
+    for (const std::string &arg : args) {
+        argPtrs.push_back(arg.data());
+    }
+
+    return light_main(argPtrs.size(), argPtrs.data(), bspdata, uncompressed_vis);
+}
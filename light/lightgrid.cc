@@ -24,17 +24,24 @@
 #include <fstream>
 #include <vector>
 #include <algorithm>
+#include <array>
 #include <string>
+#include <span>
 #include <utility>
 
 #include <light/light.hh>
 #include <light/entities.hh>
 #include <light/ltface.hh>
+#include <light/raystats.hh>
 
 #include <common/prtfile.hh>
 #include <common/parallel.hh>
+#include <common/profiler.hh>
 #include <common/qvec.hh>
 #include <common/cmdlib.hh>
+#include <common/bsputils.hh>
+
+#include <tbb/parallel_for.h>
 
 static aabb3f LightGridBounds(const mbsp_t &bsp)
 {
@@ -72,6 +79,12 @@ struct lightgrid_raw_data
     int get_grid_index(int x, int y, int z) const { return (grid_size[0] * grid_size[1] * z) + (grid_size[0] * y) + x; }
 
     qvec3f grid_index_to_world(const qvec3i &index) const { return grid_mins + (index * grid_dist); }
+
+    qvec3i get_grid_coord(int sample_index) const
+    {
+        return {sample_index % grid_size[0], (sample_index / grid_size[0]) % grid_size[1],
+            sample_index / (grid_size[0] * grid_size[1])};
+    }
 };
 
 static std::vector<uint8_t> MakeOctreeLump(const mbsp_t &bsp, const lightgrid_raw_data &data)
@@ -364,7 +377,11 @@ static std::vector<uint8_t> MakeOctreeLump(const mbsp_t &bsp, const lightgrid_ra
     return vec;
 }
 
-std::tuple<lightgrid_samples_t, bool> FixPointAndCalcLightgrid(const mbsp_t *bsp, qvec3f world_point)
+/**
+ * If world_point is in solid, moves it to a nearby spot that isn't, if there is
+ * one. Returns the point and whether it's still occluded.
+ */
+static std::tuple<qvec3f, bool> FixLightgridPoint(const mbsp_t *bsp, qvec3f world_point)
 {
     bool occluded = Light_PointInWorld(bsp, world_point);
     if (occluded) {
@@ -376,20 +393,384 @@ std::tuple<lightgrid_samples_t, bool> FixPointAndCalcLightgrid(const mbsp_t *bsp
         }
     }
 
+    return {world_point, occluded};
+}
+
+std::tuple<lightgrid_samples_t, bool> FixPointAndCalcLightgrid(const mbsp_t *bsp, qvec3f world_point)
+{
+    auto [fixed_point, occluded] = FixLightgridPoint(bsp, world_point);
+
     lightgrid_samples_t samples;
 
     if (!occluded)
-        samples = CalcLightgridAtPoint(bsp, world_point);
+        samples = CalcLightgridAtPoint(bsp, fixed_point);
 
     return {samples, occluded};
 }
 
+// dense sampling is done in bricks of this many grid points on each axis
+constexpr int LIGHTGRID_BRICK_SIZE = 4;
+// adaptive sampling traces the points it needs in batches of this many
+constexpr size_t LIGHTGRID_BATCH_SIZE = LIGHTGRID_BRICK_SIZE * LIGHTGRID_BRICK_SIZE * LIGHTGRID_BRICK_SIZE;
+
+/**
+ * Traces the given grid points (indices into data.grid_result) together, and
+ * stores their samples and occlusion.
+ */
+static void SampleLightGridPoints(const mbsp_t &bsp, lightgrid_raw_data &data, std::span<const int> sample_indices)
+{
+    std::vector<qvec3f> points;
+    std::vector<int> point_indices;
+    points.reserve(sample_indices.size());
+    point_indices.reserve(sample_indices.size());
+
+    for (const int sample_index : sample_indices) {
+        auto [world_point, occluded] =
+            FixLightgridPoint(&bsp, data.grid_index_to_world(data.get_grid_coord(sample_index)));
+
+        data.occlusion[sample_index] = occluded;
+        data.grid_result[sample_index] = {};
+
+        if (!occluded) {
+            points.push_back(world_point);
+            point_indices.push_back(sample_index);
+        }
+    }
+
+    std::vector<lightgrid_samples_t> results(points.size());
+
+    if (light_options.lightgrid_nobatch.value()) {
+        for (size_t i = 0; i < points.size(); i++) {
+            results[i] = CalcLightgridAtPoint(&bsp, points[i]);
+        }
+    } else {
+        CalcLightgridAtPoints(&bsp, points, results);
+    }
+
+    for (size_t i = 0; i < results.size(); i++) {
+        data.grid_result[point_indices[i]] = results[i];
+    }
+}
+
+/**
+ * Traces every grid point, a brick of LIGHTGRID_BRICK_SIZE^3 points at a time.
+ */
+static void SampleLightGridDense(const mbsp_t &bsp, lightgrid_raw_data &data)
+{
+    const qvec3i bricks = (data.grid_size + qvec3i(LIGHTGRID_BRICK_SIZE - 1)) / LIGHTGRID_BRICK_SIZE;
+
+    logging::parallel_for(0, bricks[0] * bricks[1] * bricks[2], [&](int brick) {
+        const qvec3i mins = qvec3i{brick % bricks[0], (brick / bricks[0]) % bricks[1], brick / (bricks[0] * bricks[1])} *
+                            LIGHTGRID_BRICK_SIZE;
+        const qvec3i maxs = qv::min(mins + qvec3i(LIGHTGRID_BRICK_SIZE), data.grid_size);
+
+        std::array<int, LIGHTGRID_BATCH_SIZE> sample_indices;
+        size_t count = 0;
+
+        for (int z = mins[2]; z < maxs[2]; z++) {
+            for (int y = mins[1]; y < maxs[1]; y++) {
+                for (int x = mins[0]; x < maxs[0]; x++) {
+                    sample_indices[count++] = data.get_grid_index(x, y, z);
+                }
+            }
+        }
+
+        SampleLightGridPoints(bsp, data, {sample_indices.data(), count});
+    });
+}
+
+// adaptive cells start out at most this many grid steps across, so a light
+// can't hide between the samples of a huge cell
+constexpr int ADAPTIVE_MAX_CELL = 8;
+
+/**
+ * A box of grid points, corners inclusive.
+ */
+struct adaptive_cell_t
+{
+    qvec3i lo, hi;
+
+    qvec3i mid() const { return (lo + hi) / 2; }
+    bool can_split() const { return hi[0] - lo[0] > 1 || hi[1] - lo[1] > 1 || hi[2] - lo[2] > 1; }
+
+    // the corners (duplicates included when the cell is flat on an axis), then the center
+    std::array<qvec3i, 9> points() const
+    {
+        std::array<qvec3i, 9> result;
+        for (int i = 0; i < 8; i++) {
+            result[i] = {(i & 4) ? hi[0] : lo[0], (i & 2) ? hi[1] : lo[1], (i & 1) ? hi[2] : lo[2]};
+        }
+        result[8] = mid();
+        return result;
+    }
+};
+
+/**
+ * Counts grid points in solid over any box in O(1), from a summed volume table.
+ */
+class solid_counts_t
+{
+    qvec3i size;
+    std::vector<uint32_t> sums;
+
+    uint32_t at(int x, int y, int z) const { return sums[((z * (size[1] + 1)) + y) * (size[0] + 1) + x]; }
+
+public:
+    solid_counts_t(const mbsp_t &bsp, const lightgrid_raw_data &data) : size(data.grid_size)
+    {
+        const size_t count = static_cast<size_t>(size[0]) * size[1] * size[2];
+        std::vector<uint8_t> solid(count);
+
+        tbb::parallel_for(static_cast<size_t>(0), count, [&](size_t i) {
+            const int z = static_cast<int>(i / (size[0] * size[1]));
+            const int y = static_cast<int>(i / size[0]) % size[1];
+            const int x = static_cast<int>(i % size[0]);
+            solid[i] = Light_PointInWorld(&bsp, data.grid_index_to_world({x, y, z}));
+        });
+
+        sums.assign(static_cast<size_t>(size[0] + 1) * (size[1] + 1) * (size[2] + 1), 0);
+
+        auto ref = [&](int x, int y, int z) -> uint32_t & {
+            return sums[((z * (size[1] + 1)) + y) * (size[0] + 1) + x];
+        };
+
+        for (int z = 1; z <= size[2]; z++) {
+            for (int y = 1; y <= size[1]; y++) {
+                for (int x = 1; x <= size[0]; x++) {
+                    ref(x, y, z) = solid[data.get_grid_index(x - 1, y - 1, z - 1)] + at(x - 1, y, z) + at(x, y - 1, z) +
+                                   at(x, y, z - 1) - at(x - 1, y - 1, z) - at(x - 1, y, z - 1) - at(x, y - 1, z - 1) +
+                                   at(x - 1, y - 1, z - 1);
+                }
+            }
+        }
+    }
+
+    // number of points in solid in [lo, hi], inclusive
+    uint32_t count(const qvec3i &lo, const qvec3i &hi) const
+    {
+        const qvec3i a = lo, b = hi + qvec3i(1, 1, 1);
+        return at(b[0], b[1], b[2]) - at(a[0], b[1], b[2]) - at(b[0], a[1], b[2]) - at(b[0], b[1], a[2]) +
+               at(a[0], a[1], b[2]) + at(a[0], b[1], a[2]) + at(b[0], a[1], a[2]) - at(a[0], a[1], a[2]);
+    }
+};
+
+/**
+ * Returns true if the cell's samples are close enough together that its other
+ * points can be interpolated from the corners: nothing in it is in solid, the
+ * corners and center all have the same styles, and no color channel of any
+ * style varies by more than `tolerance`.
+ */
+static bool AdaptiveCellIsFlat(
+    const lightgrid_raw_data &data, const solid_counts_t &solid, const adaptive_cell_t &cell, float tolerance)
+{
+    if (solid.count(cell.lo, cell.hi)) {
+        return false;
+    }
+
+    const auto points = cell.points();
+    const int first_index = data.get_grid_index(points[0][0], points[0][1], points[0][2]);
+    const lightgrid_samples_t &first = data.grid_result[first_index];
+
+    for (auto &point : points) {
+        const int index = data.get_grid_index(point[0], point[1], point[2]);
+        const lightgrid_samples_t &samples = data.grid_result[index];
+
+        if (data.occlusion[index]) {
+            return false;
+        }
+
+        for (size_t i = 0; i < samples.samples_by_style.size(); i++) {
+            const lightgrid_sample_t &a = first.samples_by_style[i];
+            const lightgrid_sample_t &b = samples.samples_by_style[i];
+
+            if (a.used != b.used || (a.used && a.style != b.style)) {
+                return false;
+            }
+            if (!a.used) {
+                break;
+            }
+            for (int c = 0; c < 3; c++) {
+                if (!(fabs(a.color[c] - b.color[c]) <= tolerance)) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Fills in the points owned by a flat cell that weren't traced, by trilinear
+ * interpolation of its corners. A cell owns its points up to but excluding its
+ * max corner on each axis (unless that's the edge of the grid), so neighbouring
+ * cells never write the same point.
+ */
+static void AdaptiveFillCell(lightgrid_raw_data &data, const std::vector<uint8_t> &traced, const adaptive_cell_t &cell)
+{
+    const auto corners = cell.points();
+    std::array<const lightgrid_samples_t *, 8> corner_samples;
+    for (int i = 0; i < 8; i++) {
+        corner_samples[i] = &data.grid_result[data.get_grid_index(corners[i][0], corners[i][1], corners[i][2])];
+    }
+
+    qvec3i end;
+    for (int axis = 0; axis < 3; axis++) {
+        end[axis] = (cell.hi[axis] == data.grid_size[axis] - 1) ? cell.hi[axis] + 1 : cell.hi[axis];
+        end[axis] = std::max(end[axis], cell.lo[axis] + 1);
+    }
+
+    for (int z = cell.lo[2]; z < end[2]; z++) {
+        for (int y = cell.lo[1]; y < end[1]; y++) {
+            for (int x = cell.lo[0]; x < end[0]; x++) {
+                const int index = data.get_grid_index(x, y, z);
+
+                if (traced[index]) {
+                    continue;
+                }
+
+                const qvec3i p{x, y, z};
+                qvec3f t;
+                for (int axis = 0; axis < 3; axis++) {
+                    const int span = cell.hi[axis] - cell.lo[axis];
+                    t[axis] = span ? static_cast<float>(p[axis] - cell.lo[axis]) / span : 0.0f;
+                }
+
+                lightgrid_samples_t result = *corner_samples[0];
+                for (size_t s = 0; s < result.samples_by_style.size() && result.samples_by_style[s].used; s++) {
+                    qvec3f color{};
+                    for (int i = 0; i < 8; i++) {
+                        const float weight = ((i & 4) ? t[0] : 1.0f - t[0]) * ((i & 2) ? t[1] : 1.0f - t[1]) *
+                                             ((i & 1) ? t[2] : 1.0f - t[2]);
+                        color += corner_samples[i]->samples_by_style[s].color * weight;
+                    }
+                    result.samples_by_style[s].color = color;
+                }
+
+                data.grid_result[index] = result;
+                data.occlusion[index] = false;
+            }
+        }
+    }
+}
+
+/**
+ * Samples the lightgrid top-down: the grid is cut into cells of at most
+ * ADAPTIVE_MAX_CELL steps, each cell's corners and center are traced, and cells
+ * are split in 8 until their samples agree within `tolerance` (see
+ * AdaptiveCellIsFlat). The rest of the grid is interpolated, so the octree lump
+ * is built from a full grid as usual.
+ *
+ * Each level is traced and tested as a batch, so which points get traced
+ * doesn't depend on thread timing.
+ */
+static void SampleLightGridAdaptive(const mbsp_t &bsp, lightgrid_raw_data &data, float tolerance)
+{
+    const solid_counts_t solid(bsp, data);
+
+    std::vector<adaptive_cell_t> cells;
+    for (int z = 0; z == 0 || z < data.grid_size[2] - 1; z += ADAPTIVE_MAX_CELL) {
+        for (int y = 0; y == 0 || y < data.grid_size[1] - 1; y += ADAPTIVE_MAX_CELL) {
+            for (int x = 0; x == 0 || x < data.grid_size[0] - 1; x += ADAPTIVE_MAX_CELL) {
+                const qvec3i lo{x, y, z};
+                const qvec3i hi{std::min(x + ADAPTIVE_MAX_CELL, data.grid_size[0] - 1),
+                    std::min(y + ADAPTIVE_MAX_CELL, data.grid_size[1] - 1),
+                    std::min(z + ADAPTIVE_MAX_CELL, data.grid_size[2] - 1)};
+                cells.push_back({lo, hi});
+            }
+        }
+    }
+
+    std::vector<uint8_t> traced(data.occlusion.size(), 0);
+    std::vector<adaptive_cell_t> flat_cells;
+    std::vector<int> to_trace;
+    size_t num_traced = 0;
+
+    while (!cells.empty()) {
+        // trace the corners and centers of this level's cells that haven't been traced yet
+        to_trace.clear();
+        for (auto &cell : cells) {
+            for (auto &point : cell.points()) {
+                const int index = data.get_grid_index(point[0], point[1], point[2]);
+                if (!traced[index]) {
+                    traced[index] = 1;
+                    to_trace.push_back(index);
+                }
+            }
+        }
+
+        // to_trace is in cell order, so batches are mostly of nearby points
+        const size_t num_batches = (to_trace.size() + LIGHTGRID_BATCH_SIZE - 1) / LIGHTGRID_BATCH_SIZE;
+        tbb::parallel_for(static_cast<size_t>(0), num_batches, [&](size_t batch) {
+            const size_t first = batch * LIGHTGRID_BATCH_SIZE;
+            SampleLightGridPoints(bsp, data,
+                std::span<const int>(to_trace).subspan(first, std::min(LIGHTGRID_BATCH_SIZE, to_trace.size() - first)));
+        });
+        num_traced += to_trace.size();
+
+        std::vector<uint8_t> flat(cells.size());
+        tbb::parallel_for(static_cast<size_t>(0), cells.size(),
+            [&](size_t i) { flat[i] = AdaptiveCellIsFlat(data, solid, cells[i], tolerance); });
+
+        // split the rest in 8 (fewer if they are thin on an axis); cells that can't
+        // be split have had all their points traced
+        std::vector<adaptive_cell_t> next;
+        for (size_t i = 0; i < cells.size(); i++) {
+            const adaptive_cell_t &cell = cells[i];
+
+            if (flat[i]) {
+                flat_cells.push_back(cell);
+                continue;
+            }
+            if (!cell.can_split()) {
+                continue;
+            }
+
+            const qvec3i mid = cell.mid();
+            for (int octant = 0; octant < 8; octant++) {
+                adaptive_cell_t child;
+                bool valid = true;
+
+                for (int axis = 0; axis < 3; axis++) {
+                    const int bit = 4 >> axis;
+                    const bool upper = (octant & bit) != 0;
+
+                    if (cell.hi[axis] - cell.lo[axis] < 2) {
+                        // don't split this axis
+                        if (upper) {
+                            valid = false;
+                        }
+                        child.lo[axis] = cell.lo[axis];
+                        child.hi[axis] = cell.hi[axis];
+                    } else {
+                        child.lo[axis] = upper ? mid[axis] : cell.lo[axis];
+                        child.hi[axis] = upper ? cell.hi[axis] : mid[axis];
+                    }
+                }
+
+                if (valid) {
+                    next.push_back(child);
+                }
+            }
+        }
+
+        cells = std::move(next);
+    }
+
+    tbb::parallel_for(static_cast<size_t>(0), flat_cells.size(),
+        [&](size_t i) { AdaptiveFillCell(data, traced, flat_cells[i]); });
+
+    logging::print(logging::flag::STAT, "     {} of {} grid points traced ({:.1f} percent), {} cells interpolated\n",
+        num_traced, data.occlusion.size(), 100.0 * num_traced / data.occlusion.size(), flat_cells.size());
+}
+
 void LightGrid(bspdata_t *bspdata)
 {
     if (!light_options.lightgrid.value())
         return;
 
     logging::funcheader();
+    profilefunc();
 
     auto &bsp = std::get<mbsp_t>(bspdata->bsp);
 
@@ -410,21 +791,13 @@ void LightGrid(bspdata_t *bspdata)
 
     data.occlusion.resize(data.grid_size[0] * data.grid_size[1] * data.grid_size[2]);
 
-    logging::parallel_for(0, data.grid_size[0] * data.grid_size[1] * data.grid_size[2], [&](int sample_index) {
-        const int z = (sample_index / (data.grid_size[0] * data.grid_size[1]));
-        const int y = (sample_index / data.grid_size[0]) % data.grid_size[1];
-        const int x = sample_index % data.grid_size[0];
-
-        qvec3f world_point = data.grid_mins + (qvec3f{x, y, z} * data.grid_dist);
-
-        bool occluded;
-        lightgrid_samples_t samples;
-
-        std::tie(samples, occluded) = FixPointAndCalcLightgrid(&bsp, world_point);
-
-        data.grid_result[sample_index] = samples;
-        data.occlusion[sample_index] = occluded;
-    });
+    raystats::begin_pass("lightgrid");
+    if (light_options.lightgrid_adaptive.value() > 0) {
+        SampleLightGridAdaptive(bsp, data, light_options.lightgrid_adaptive.value());
+    } else {
+        SampleLightGridDense(bsp, data);
+    }
+    raystats::end_pass();
 
     // the maximum used styles across the map.
     data.num_styles = [&]() {
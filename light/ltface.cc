@@ -25,11 +25,13 @@
 #include <light/surflight.hh> //mxd
 #include <light/entities.hh>
 #include <light/lightgrid.hh>
+#include <light/raystats.hh>
 #include <light/trace.hh>
 #include <light/write.hh> // for facesup_t
 
 #include <common/imglib.hh>
 #include <common/log.hh>
+#include <common/profiler.hh>
 #include <common/bsputils.hh>
 #include <common/qvec.hh>
 #include <common/ostream.hh>
@@ -39,15 +41,16 @@
 #include <cmath>
 #include <algorithm>
 #include <fstream>
+#include <span>
 
-#if 0
-std::atomic<uint32_t> total_light_rays, total_light_ray_hits, total_samplepoints;
-std::atomic<uint32_t> total_bounce_rays, total_bounce_ray_hits;
-std::atomic<uint32_t> total_surflight_rays, total_surflight_ray_hits; // mxd
-#endif
-
-thread_local static raystream_occlusion_t occlusion_stream;
-thread_local static raystream_intersection_t intersection_stream;
+// counts the rays just traced by `rs` towards `stats`
+static inline void CountTrace(raystats::counters_t &stats, const raystream_embree_common_t &rs)
+{
+    if (rs.numPushedRays()) {
+        stats.traces++;
+        stats.rays += rs.numPushedRays();
+    }
+}
 
 /* Debug helper - move elsewhere? */
 void PrintFaceInfo(const mface_t *face, const mbsp_t *bsp)
@@ -460,33 +463,7 @@ static void CalcPoints(
     }
 }
 
-static bool Mod_LeafPvs(const mbsp_t *bsp, const mleaf_t *leaf, uint8_t *out)
-{
-    const size_t num_pvsclusterbytes = DecompressedVisSize(bsp);
-
-    // init to all visible
-    memset(out, 0xFF, num_pvsclusterbytes);
-
-    if (bsp->loadversion->game->id == GAME_QUAKE_II) {
-        auto it = UncompressedVis().find(leaf->cluster);
-        if (it == UncompressedVis().end()) {
-            return false;
-        }
-
-        memcpy(out, it->second.data(), num_pvsclusterbytes);
-    } else {
-        auto it = UncompressedVis().find(leaf->visofs);
-        if (it == UncompressedVis().end()) {
-            return false;
-        }
-
-        memcpy(out, it->second.data(), num_pvsclusterbytes);
-    }
-
-    return true;
-}
-
-static const std::vector<uint8_t> *Mod_LeafPvs(const mbsp_t *bsp, const mleaf_t *leaf)
+static const uint64_t *Mod_LeafPvs(const mbsp_t *bsp, const mleaf_t *leaf)
 {
     if (bsp->loadversion->game->contents_are_liquid(
             bsp->loadversion->game->create_contents_from_native(leaf->contents))) {
@@ -496,11 +473,7 @@ static const std::vector<uint8_t> *Mod_LeafPvs(const mbsp_t *bsp, const mleaf_t
         return nullptr;
     }
 
-    const int key = (bsp->loadversion->game->id == GAME_QUAKE_II) ? leaf->cluster : leaf->visofs;
-    if (auto it = UncompressedVis().find(key); it != UncompressedVis().end()) {
-        return &it->second;
-    }
-    return nullptr;
+    return PvsTable().leaf_row(leaf);
 }
 
 static void CalcPvs(const mbsp_t *bsp, lightsurf_t *lightsurf)
@@ -509,21 +482,14 @@ static void CalcPvs(const mbsp_t *bsp, lightsurf_t *lightsurf)
         return;
     }
 
-    const int pvssize = DecompressedVisSize(bsp);
-
-    // set lightsurf->pvs
-    uint8_t *pointpvs = (uint8_t *)alloca(pvssize);
-    lightsurf->pvs.resize(pvssize);
-
     if (lightsurf->modelinfo->isWorld()) {
-        size_t face_index = lightsurf->face - bsp->dfaces.data();
+        const size_t face_index = lightsurf->face - bsp->dfaces.data();
+        const auto leafnums = FaceLeafs().leafs(face_index);
 
-        for (auto &leaf : bsp->dleafs) {
-            for (size_t surf = 0; surf < leaf.nummarksurfaces; surf++) {
-                if (bsp->dleaffaces[leaf.firstmarksurface + surf] == face_index) {
-                    lightsurf->leaves.push_back(&leaf);
-                }
-            }
+        lightsurf->leaves.reserve(leafnums.size());
+
+        for (const uint32_t leafnum : leafnums) {
+            lightsurf->leaves.push_back(&bsp->dleafs[leafnum]);
         }
     } else {
         for (auto &sample : lightsurf->samples) {
@@ -535,25 +501,25 @@ static void CalcPvs(const mbsp_t *bsp, lightsurf_t *lightsurf)
         }
     }
 
-    for (auto &leaf : lightsurf->leaves) {
-        /* copy the pvs for this leaf into pointpvs */
-        Mod_LeafPvs(bsp, leaf, pointpvs);
+    const pvs_table_t &table = PvsTable();
 
+    for (auto &leaf : lightsurf->leaves) {
         if (bsp->loadversion->game->contents_are_liquid(
                 bsp->loadversion->game->create_contents_from_native(leaf->contents))) {
             // hack for when the sample point might be in an opaque liquid, blocking vis,
             // but we typically want light to pass through these.
             // see also VisCullEntity() which handles the case when the light emitter is in liquid.
-            for (int j = 0; j < pvssize; j++) {
-                lightsurf->pvs[j] |= 0xff;
-            }
+            lightsurf->pvs.set(table.all_visible());
             break;
         }
 
-        /* merge the pvs for this sample point into lightsurf->pvs */
-        for (int j = 0; j < pvssize; j++) {
-            lightsurf->pvs[j] |= pointpvs[j];
-        }
+        /* merge the pvs for this leaf into lightsurf->pvs; leafs without visdata see everything */
+        const uint64_t *leafpvs = table.leaf_row(leaf);
+        lightsurf->pvs.merge(leafpvs ? leafpvs : table.all_visible(), table.row_words());
+    }
+
+    if (!lightsurf->pvs.data()) {
+        lightsurf->pvs.set(table.none_visible());
     }
 
     lightsurf->leaves.shrink_to_fit();
@@ -718,9 +684,6 @@ static lightsurf_t Lightsurf_Init(const modelinfo_t *modelinfo, const settings::
         lightsurf.extents.origin += modelinfo->offset;
         lightsurf.extents.bounds = lightsurf.extents.bounds.translate(modelinfo->offset);
 
-        intersection_stream.resize(lightsurf.samples.size());
-        occlusion_stream.resize(lightsurf.samples.size());
-
         /* Setup vis data */
         CalcPvs(bsp, &lightsurf);
     }
@@ -1173,9 +1136,9 @@ inline bool CullLight(const light_t *entity, const lightsurf_t *lightsurf)
     return fabs(GetLightValue(cfg, entity, dist)) <= light_options.gate.value();
 }
 
-static bool VisCullEntity(const mbsp_t *bsp, const std::vector<uint8_t> &pvs, const mleaf_t *entleaf)
+static bool VisCullEntity(const mbsp_t *bsp, const uint64_t *pvs, const mleaf_t *entleaf)
 {
-    if (pvs.empty()) {
+    if (!pvs) {
         return false;
     }
     if (entleaf == nullptr) {
@@ -1192,7 +1155,7 @@ static bool VisCullEntity(const mbsp_t *bsp, const std::vector<uint8_t> &pvs, co
         return false;
     }
 
-    return !Pvs_LeafVisible(bsp, pvs, entleaf);
+    return !PvsTable().leaf_visible(pvs, entleaf);
 }
 
 /*
@@ -1211,7 +1174,7 @@ static void LightFace_Entity(
     if (light_options.visapprox.value() == visapprox_t::VIS &&
         entity->light_channel_mask.value() == CHANNEL_MASK_DEFAULT &&
         entity->shadow_channel_mask.value() == CHANNEL_MASK_DEFAULT &&
-        VisCullEntity(bsp, lightsurf->pvs, entity->leaf)) {
+        VisCullEntity(bsp, lightsurf->pvs.data(), entity->leaf)) {
         return;
     }
 
@@ -1241,7 +1204,7 @@ static void LightFace_Entity(
     /*
      * Check it for real
      */
-    raystream_occlusion_t &rs = occlusion_stream;
+    raystream_occlusion_t &rs = Embree_LocalRayStreams().occlusion;
     rs.clearPushedRays();
 
     for (int i = 0; i < lightsurf->samples.size(); i++) {
@@ -1273,10 +1236,9 @@ static void LightFace_Entity(
     }
 
     // don't need closest hit, just checking for occlusion between light and surface point
+    raystats::counters_t &stats = raystats::local(raystats::category_t::light);
     rs.tracePushedRaysOcclusion(modelinfo, entity->shadow_channel_mask.value());
-#if 0
-    total_light_rays += rs.numPushedRays();
-#endif
+    CountTrace(stats, rs);
 
     int cached_style = entity->style.value();
     lightmap_t *cached_lightmap = Lightmap_ForStyle(lightmaps, cached_style, lightsurf);
@@ -1284,13 +1246,10 @@ static void LightFace_Entity(
     const int N = rs.numPushedRays();
     for (int j = 0; j < N; j++) {
         if (rs.getPushedRayOccluded(j)) {
+            stats.occluded++;
             continue;
         }
 
-#if 0
-        total_light_ray_hits++;
-#endif
-
         const ray_io &ray = rs.getRay(j);
 
         int i = ray.index;
@@ -1330,143 +1289,143 @@ static void LightFace_Entity(
 #define LIGHTPOINT_TAKE_MAX
 
 /**
- * Calculates light at a given point from an entity
+ * Calculates light at the given points from an entity, with one ray per point
+ * traced as a single stream
  */
 static void LightPoint_Entity(const mbsp_t *bsp, raystream_occlusion_t &rs, const light_t *entity,
-    const qvec3f &surfpoint, lightgrid_samples_t &result)
+    std::span<const qvec3f> surfpoints, std::span<lightgrid_samples_t> results)
 {
     rs.clearPushedRays();
 
-    qvec3f surfpointToLightDir;
-    float surfpointToLightDist;
-    qvec3f color{};
+    for (size_t i = 0; i < surfpoints.size(); i++) {
+        const qvec3f &surfpoint = surfpoints[i];
 
-    for (int axis = 0; axis < 3; ++axis) {
-        for (int sign = -1; sign <= +1; sign += 2) {
+        qvec3f surfpointToLightDir;
+        float surfpointToLightDist;
+        qvec3f color{};
 
-            qvec3f cube_color;
+        for (int axis = 0; axis < 3; ++axis) {
+            for (int sign = -1; sign <= +1; sign += 2) {
 
-            qvec3f cube_normal{};
-            cube_normal[axis] = sign;
+                qvec3f cube_color;
+
+                qvec3f cube_normal{};
+                cube_normal[axis] = sign;
 
-            qvec3f normalcontrib_unused;
+                qvec3f normalcontrib_unused;
 
-            GetLightContrib(light_options, entity, cube_normal, true, surfpoint, false, cube_color, surfpointToLightDir,
-                normalcontrib_unused, &surfpointToLightDist);
+                GetLightContrib(light_options, entity, cube_normal, true, surfpoint, false, cube_color,
+                    surfpointToLightDir, normalcontrib_unused, &surfpointToLightDist);
 
 #ifdef LIGHTPOINT_TAKE_MAX
-            if (qv::length2(cube_color) > qv::length2(color)) {
-                color = cube_color;
-            }
+                if (qv::length2(cube_color) > qv::length2(color)) {
+                    color = cube_color;
+                }
 #else
-            color += cube_color / 6.0;
+                color += cube_color / 6.0;
 #endif
+            }
+        }
+
+        /* Quick distance check first */
+        if (fabs(LightSample_Brightness(color)) <= light_options.gate.value()) {
+            continue;
         }
+
+        rs.pushRay(i, surfpoint, surfpointToLightDir, surfpointToLightDist, &color);
     }
 
-    /* Quick distance check first */
-    if (fabs(LightSample_Brightness(color)) <= light_options.gate.value()) {
+    if (!rs.numPushedRays()) {
         return;
     }
 
-    rs.pushRay(0, surfpoint, surfpointToLightDir, surfpointToLightDist, &color);
-
+    raystats::counters_t &stats = raystats::local(raystats::category_t::light);
     rs.tracePushedRaysOcclusion(nullptr, CHANNEL_MASK_DEFAULT);
+    CountTrace(stats, rs);
 
     // add result
     const int N = rs.numPushedRays();
     for (int j = 0; j < N; j++) {
         if (rs.getPushedRayOccluded(j)) {
+            stats.occluded++;
             continue;
         }
 
-        result.add(rs.getPushedRayColor(j), entity->style.value());
+        results[rs.getRay(j).index].add(rs.getPushedRayColor(j), entity->style.value());
     }
 }
 
-/*
- * =============
- * LightFace_Sky
- * =============
- */
-static void LightFace_Sky(const mbsp_t *bsp, const sun_t *sun, lightsurf_t *lightsurf, lightmapdict_t *lightmaps)
-{
-    const settings::worldspawn_keys &cfg = *lightsurf->cfg;
-    const modelinfo_t *modelinfo = lightsurf->modelinfo;
-    const qplane3f &plane = lightsurf->plane;
-
-    // FIXME: Normalized sun vector should be stored in the sun_t. Also clarify which way the vector points (towards or
-    // away..)
-    // FIXME: Much of this is copied/pasted from LightFace_Entity, should probably be merged
-    qvec3f incoming = qv::normalize(sun->sunvec);
-
-    /* Don't bother if surface facing away from sun */
-    const float dp = qv::dot(incoming, plane.normal);
-    if (dp < -LIGHT_ANGLE_EPSILON && !lightsurf->curved && !lightsurf->twosided) {
-        return;
-    }
+// upper bound on the sun rays pushed to the stream before tracing them
+constexpr size_t SUN_BATCH_RAYS = 8192;
 
-    // check lighting channels (currently sunlight is always on CHANNEL_MASK_DEFAULT)
-    if (!(lightsurf->object_channel_mask & CHANNEL_MASK_DEFAULT)) {
-        return;
-    }
-
-    /* Check each point... */
-    raystream_intersection_t &rs = intersection_stream;
-    rs.clearPushedRays();
-
-    for (int i = 0; i < lightsurf->samples.size(); i++) {
-        const auto &sample = lightsurf->samples[i];
+struct sun_candidate_t
+{
+    const sun_t *sun;
+    // normalized, pointing towards the sun
+    qvec3f incoming;
+};
 
-        if (sample.occluded)
-            continue;
+thread_local static std::vector<sun_candidate_t> sun_candidates;
+// for each sun ray pushed to the intersection stream, the index of its sun in sun_candidates
+thread_local static std::vector<int> sun_ray_candidate;
+thread_local static std::vector<float> sun_weights;
 
-        const qvec3f &surfpoint = sample.point;
-        const qvec3f &surfnorm = sample.normal;
+// the light a sun casts on a sample if it isn't occluded; returns false if it's below the gate
+static bool SunSampleLight(const settings::worldspawn_keys &cfg, const lightsurf_t *lightsurf,
+    const sun_candidate_t &candidate, const lightsurf_t::sample_data_t &sample, qvec3f &color, qvec3f &normalcontrib)
+{
+    const sun_t *sun = candidate.sun;
 
-        float angle = qv::dot(incoming, surfnorm);
-        if (lightsurf->twosided) {
-            if (angle < 0) {
-                angle = -angle;
-            }
+    float angle = qv::dot(candidate.incoming, sample.normal);
+    if (lightsurf->twosided) {
+        if (angle < 0) {
+            angle = -angle;
         }
+    }
 
-        angle = std::max(0.0f, angle);
+    angle = std::max(0.0f, angle);
 
-        angle = (1.0f - sun->anglescale) + sun->anglescale * angle;
-        float value = angle * sun->sunlight;
+    angle = (1.0f - sun->anglescale) + sun->anglescale * angle;
+    float value = angle * sun->sunlight;
 
-        if (sun->dirt) {
-            value *= Dirt_GetScaleFactor(cfg, sample.occlusion, NULL, 0.0f, lightsurf);
-        }
+    if (sun->dirt) {
+        value *= Dirt_GetScaleFactor(cfg, sample.occlusion, NULL, 0.0f, lightsurf);
+    }
 
-        qvec3f color = sun->sunlight_color * (value / 255.0f);
+    color = sun->sunlight_color * (value / 255.0f);
 
-        /* Quick distance check first */
-        if (fabs(LightSample_Brightness(color)) <= light_options.gate.value()) {
-            continue;
-        }
+    /* Quick distance check first */
+    if (fabs(LightSample_Brightness(color)) <= light_options.gate.value()) {
+        return false;
+    }
 
-        qvec3f normalcontrib = incoming * value;
+    normalcontrib = candidate.incoming * value;
+    return true;
+}
 
-        rs.pushRay(i, surfpoint, incoming, MAX_SKY_DIST, &color, &normalcontrib);
+// traces the pushed sun rays and adds the ones that reach the sky to the lightmaps
+static void LightFace_TraceSunRays(const mbsp_t *bsp, lightsurf_t *lightsurf, lightmapdict_t *lightmaps,
+    raystream_intersection_t &rs, raystats::counters_t &stats)
+{
+    const int N = rs.numPushedRays();
+    if (!N) {
+        return;
     }
 
     // We need to check if the first hit face is a sky face, so we need
     // to test intersection (not occlusion)
-    rs.tracePushedRaysIntersection(modelinfo, CHANNEL_MASK_DEFAULT);
+    rs.tracePushedRaysIntersection(lightsurf->modelinfo, CHANNEL_MASK_DEFAULT);
+    CountTrace(stats, rs);
 
-    /* if sunlight is set, use a style 0 light map */
-    int cached_style = sun->style;
-    lightmap_t *cached_lightmap = Lightmap_ForStyle(lightmaps, cached_style, lightsurf);
-
-    const int N = rs.numPushedRays();
-#if 0
-    total_light_rays += N;
-#endif
+    // the rays are mostly grouped by sun, so the style rarely changes between them
+    int cached_style = -1;
+    lightmap_t *cached_lightmap = nullptr;
 
     for (int j = 0; j < N; j++) {
+        const sun_t *sun = sun_candidates[sun_ray_candidate[j]].sun;
+
         if (rs.getPushedRayHitType(j) != hittype_t::SKY) {
+            stats.occluded++;
             continue;
         }
 
@@ -1474,6 +1433,7 @@ static void LightFace_Sky(const mbsp_t *bsp, const sun_t *sun, lightsurf_t *ligh
         if (sun->suntexture_value) {
             const triinfo *face = rs.getPushedRayHitFaceInfo(j);
             if (sun->suntexture_value != face->texture) {
+                stats.occluded++;
                 continue;
             }
         }
@@ -1498,16 +1458,161 @@ static void LightFace_Sky(const mbsp_t *bsp, const sun_t *sun, lightsurf_t *ligh
         sample.color += rs.getPushedRayColor(j);
         cached_lightmap->bounce_color += rs.getPushedRayColor(j);
         sample.direction += ray.normalcontrib;
-#if 0
-        total_light_ray_hits++;
-#endif
 
         Lightmap_Save(bsp, lightmaps, lightsurf, cached_lightmap, cached_style);
     }
+
+    rs.clearPushedRays();
+    sun_ray_candidate.clear();
 }
 
-static void LightPoint_Sky(const mbsp_t *bsp, raystream_intersection_t &rs, const sun_t *sun, const qvec3f &surfpoint,
-    lightgrid_samples_t &result)
+/*
+ * =============
+ * LightFace_Sky
+ *
+ * Lights the surface with all of the positive (or negative) suns at once,
+ * pushing the rays of many suns into one stream before tracing. Rays are
+ * pushed sun by sun, so every sample adds up its suns in the same order as
+ * lighting with one sun at a time would.
+ *
+ * With -sunsamples_subset n, each sample instead only traces n of the suns,
+ * picked in proportion to the (cosine weighted) light they'd cast, and
+ * scaled so the expected result is unchanged.
+ * =============
+ */
+static void LightFace_Sky(
+    const mbsp_t *bsp, const std::vector<sun_t> &suns, bool negative, lightsurf_t *lightsurf, lightmapdict_t *lightmaps)
+{
+    const settings::worldspawn_keys &cfg = *lightsurf->cfg;
+    const qplane3f &plane = lightsurf->plane;
+
+    // check lighting channels (currently sunlight is always on CHANNEL_MASK_DEFAULT)
+    if (!(lightsurf->object_channel_mask & CHANNEL_MASK_DEFAULT)) {
+        return;
+    }
+
+    sun_candidates.clear();
+
+    for (const sun_t &sun : suns) {
+        if (negative ? !(sun.sunlight < 0) : !(sun.sunlight > 0)) {
+            continue;
+        }
+
+        // FIXME: Normalized sun vector should be stored in the sun_t. Also clarify which way the vector points
+        // (towards or away..)
+        qvec3f incoming = qv::normalize(sun.sunvec);
+
+        /* Don't bother if surface facing away from sun */
+        const float dp = qv::dot(incoming, plane.normal);
+        if (dp < -LIGHT_ANGLE_EPSILON && !lightsurf->curved && !lightsurf->twosided) {
+            continue;
+        }
+
+        sun_candidates.push_back({&sun, incoming});
+    }
+
+    if (sun_candidates.empty()) {
+        return;
+    }
+
+    raystream_intersection_t &rs = Embree_LocalRayStreams().intersection;
+    raystats::counters_t &stats = raystats::local(raystats::category_t::sun);
+    rs.clearPushedRays();
+    sun_ray_candidate.clear();
+
+    const size_t numsamples = lightsurf->samples.size();
+    const size_t subset = light_options.sunsamples_subset.value();
+    qvec3f color, normalcontrib;
+
+    if (!subset || subset >= sun_candidates.size()) {
+        for (int k = 0; k < sun_candidates.size(); k++) {
+            if (rs.numPushedRays() && rs.numPushedRays() + numsamples > SUN_BATCH_RAYS) {
+                LightFace_TraceSunRays(bsp, lightsurf, lightmaps, rs, stats);
+            }
+
+            const sun_candidate_t &candidate = sun_candidates[k];
+
+            /* Check each point... */
+            for (int i = 0; i < numsamples; i++) {
+                const auto &sample = lightsurf->samples[i];
+
+                if (sample.occluded)
+                    continue;
+
+                if (!SunSampleLight(cfg, lightsurf, candidate, sample, color, normalcontrib))
+                    continue;
+
+                rs.pushRay(i, sample.point, candidate.incoming, MAX_SKY_DIST, &color, &normalcontrib);
+                sun_ray_candidate.push_back(k);
+            }
+        }
+    } else {
+        sun_weights.resize(sun_candidates.size());
+
+        for (int i = 0; i < numsamples; i++) {
+            const auto &sample = lightsurf->samples[i];
+
+            if (sample.occluded)
+                continue;
+
+            float total = 0.0f;
+
+            for (int k = 0; k < sun_candidates.size(); k++) {
+                float weight = 0.0f;
+
+                if (SunSampleLight(cfg, lightsurf, sun_candidates[k], sample, color, normalcontrib)) {
+                    weight = fabs(LightSample_Brightness(color));
+                }
+
+                sun_weights[k] = weight;
+                total += weight;
+            }
+
+            if (total <= 0.0f)
+                continue;
+
+            if (rs.numPushedRays() + subset > SUN_BATCH_RAYS) {
+                LightFace_TraceSunRays(bsp, lightsurf, lightmaps, rs, stats);
+            }
+
+            // systematic sampling: `subset` evenly spaced picks along the suns' summed weights, with the
+            // offset of the first one varying between neighbouring samples
+            const float step = total / subset;
+            const float offset = std::fmod((i + 0.5f) * 0.618034f, 1.0f);
+            float next = offset * step;
+            float sum = 0.0f;
+
+            for (int k = 0; k < sun_candidates.size(); k++) {
+                if (sun_weights[k] <= 0.0f)
+                    continue;
+
+                sum += sun_weights[k];
+
+                int picks = 0;
+                for (; next < sum; next += step) {
+                    picks++;
+                }
+
+                if (!picks)
+                    continue;
+
+                SunSampleLight(cfg, lightsurf, sun_candidates[k], sample, color, normalcontrib);
+
+                const float scale = picks * step / sun_weights[k];
+                color *= scale;
+                normalcontrib *= scale;
+
+                rs.pushRay(i, sample.point, sun_candidates[k].incoming, MAX_SKY_DIST, &color, &normalcontrib);
+                sun_ray_candidate.push_back(k);
+            }
+        }
+    }
+
+    LightFace_TraceSunRays(bsp, lightsurf, lightmaps, rs, stats);
+}
+
+static void LightPoint_Sky(const mbsp_t *bsp, raystream_intersection_t &rs, const sun_t *sun,
+    std::span<const qvec3f> surfpoints, std::span<lightgrid_samples_t> results)
 {
     // FIXME: Normalized sun vector should be stored in the sun_t. Also clarify which way the vector points (towards or
     // away..)
@@ -1516,57 +1621,59 @@ static void LightPoint_Sky(const mbsp_t *bsp, raystream_intersection_t &rs, cons
 
     rs.clearPushedRays();
 
-    // only 1 ray
-    {
-        qvec3f color{};
+    // the color doesn't depend on the point, just the sun
+    qvec3f color{};
 
-        for (int axis = 0; axis < 3; ++axis) {
-            for (int sign = -1; sign <= +1; sign += 2) {
+    for (int axis = 0; axis < 3; ++axis) {
+        for (int sign = -1; sign <= +1; sign += 2) {
 
-                qvec3f cube_color;
+            qvec3f cube_color;
 
-                qvec3f cube_normal{};
-                cube_normal[axis] = sign;
+            qvec3f cube_normal{};
+            cube_normal[axis] = sign;
 
-                float angle = qv::dot(incoming, cube_normal);
-                angle = std::max(0.0f, angle);
-                angle = (1.0f - sun->anglescale) + sun->anglescale * angle;
+            float angle = qv::dot(incoming, cube_normal);
+            angle = std::max(0.0f, angle);
+            angle = (1.0f - sun->anglescale) + sun->anglescale * angle;
 
-                float value = angle * sun->sunlight;
-                cube_color = sun->sunlight_color * (value / 255.0f);
+            float value = angle * sun->sunlight;
+            cube_color = sun->sunlight_color * (value / 255.0f);
 
 #ifdef LIGHTPOINT_TAKE_MAX
-                if (qv::length2(cube_color) > qv::length2(color)) {
-                    color = cube_color;
-                }
+            if (qv::length2(cube_color) > qv::length2(color)) {
+                color = cube_color;
+            }
 #else
-                color += cube_color / 6;
+            color += cube_color / 6;
 #endif
-            }
         }
+    }
 
-        /* Quick distance check first */
-        if (fabs(LightSample_Brightness(color)) <= light_options.gate.value()) {
-            return;
-        }
+    /* Quick distance check first */
+    if (fabs(LightSample_Brightness(color)) <= light_options.gate.value()) {
+        return;
+    }
 
-        qvec3f normalcontrib{}; // unused
+    // 1 ray per point
+    qvec3f normalcontrib{}; // unused
 
-        rs.pushRay(0, surfpoint, incoming, MAX_SKY_DIST, &color, &normalcontrib);
-    }
+    rs.pushRays(surfpoints, incoming, MAX_SKY_DIST, &color, &normalcontrib);
 
     // We need to check if the first hit face is a sky face, so we need
     // to test intersection (not occlusion)
+    raystats::counters_t &stats = raystats::local(raystats::category_t::sun);
     rs.tracePushedRaysIntersection(nullptr, CHANNEL_MASK_DEFAULT);
+    CountTrace(stats, rs);
 
     // add result
     const int N = rs.numPushedRays();
     for (int j = 0; j < N; j++) {
         if (rs.getPushedRayHitType(j) != hittype_t::SKY) {
+            stats.occluded++;
             continue;
         }
 
-        result.add(rs.getPushedRayColor(j), sun->style);
+        results[rs.getRay(j).index].add(rs.getPushedRayColor(j), sun->style);
     }
 }
 
@@ -1739,7 +1846,7 @@ static void LightFace_LocalMin(
             continue;
         }
 
-        raystream_occlusion_t &rs = occlusion_stream;
+        raystream_occlusion_t &rs = Embree_LocalRayStreams().occlusion;
         rs.clearPushedRays();
 
         lightmap_t *lightmap = Lightmap_ForStyle(lightmaps, entity->style.value(), lightsurf);
@@ -1762,14 +1869,14 @@ static void LightFace_LocalMin(
         }
 
         // local minlight just needs occlusion, not closest hit
+        raystats::counters_t &stats = raystats::local(raystats::category_t::minlight);
         rs.tracePushedRaysOcclusion(modelinfo, CHANNEL_MASK_DEFAULT);
-#if 0
-        total_light_rays += rs.numPushedRays();
-#endif
+        CountTrace(stats, rs);
 
         const int N = rs.numPushedRays();
         for (int j = 0; j < N; j++) {
             if (rs.getPushedRayOccluded(j)) {
+                stats.occluded++;
                 continue;
             }
 
@@ -1786,10 +1893,6 @@ static void LightFace_LocalMin(
             } else {
                 hit = Light_ClampMin(sample, value, entity->color.value()) || hit;
             }
-
-#if 0
-            total_light_ray_hits++;
-#endif
         }
 
         if (hit) {
@@ -1999,11 +2102,11 @@ SurfaceLight_SphereCull(const surfacelight_t *vpl, const lightsurf_t *lightsurf,
     return qv::gate(color, (float)bouncelight_gate);
 }
 
-static bool SurfaceLight_VisCull(const mbsp_t *bsp, const std::vector<uint8_t> *pvs, const lightsurf_t *lightsurf_b)
+static bool SurfaceLight_VisCull(const mbsp_t *bsp, const uint64_t *pvs, const lightsurf_t *lightsurf_b)
 {
     if (pvs && light_options.visapprox.value() == visapprox_t::VIS) {
         for (auto &leaf : lightsurf_b->leaves) {
-            if (VisCullEntity(bsp, *pvs, leaf)) {
+            if (VisCullEntity(bsp, pvs, leaf)) {
                 return true;
             }
         }
@@ -2033,12 +2136,15 @@ LightFace_SurfaceLight(const mbsp_t *bsp, lightsurf_t *lightsurf, lightmapdict_t
                 continue;
             else if (SurfaceLight_SphereCull(&vpl, lightsurf, vpl_setting, surflight_gate, hotspot_clamp))
                 continue;
-            else if (SurfaceLight_VisCull(bsp, &lightsurf->pvs, surf_ptr))
+            else if (SurfaceLight_VisCull(bsp, lightsurf->pvs.data(), surf_ptr))
                 continue;
 
-            raystream_occlusion_t &rs = occlusion_stream;
+            raystream_occlusion_t &rs = Embree_LocalRayStreams().occlusion;
+            raystats::counters_t &stats = raystats::local(
+                bounce_depth.has_value() ? raystats::category_t::bounce : raystats::category_t::surflight);
 
             for (int c = 0; c < vpl.points.size(); c++) {
+                stats.vpls++;
                 rs.clearPushedRays();
 
                 for (int i = 0; i < lightsurf->samples.size(); i++) {
@@ -2075,10 +2181,8 @@ LightFace_SurfaceLight(const mbsp_t *bsp, lightsurf_t *lightsurf, lightmapdict_t
                 if (!rs.numPushedRays())
                     continue;
 
-#if 0
-                total_surflight_rays += rs.numPushedRays();
-#endif
                 rs.tracePushedRaysOcclusion(lightsurf->modelinfo, CHANNEL_MASK_DEFAULT);
+                CountTrace(stats, rs);
 
                 const int lightmapstyle = vpl_setting.style;
                 lightmap_t *lightmap = Lightmap_ForStyle(lightmaps, lightmapstyle, lightsurf);
@@ -2086,8 +2190,10 @@ LightFace_SurfaceLight(const mbsp_t *bsp, lightsurf_t *lightsurf, lightmapdict_t
                 bool hit = false;
                 const int numrays = rs.numPushedRays();
                 for (int j = 0; j < numrays; j++) {
-                    if (rs.getPushedRayOccluded(j))
+                    if (rs.getPushedRayOccluded(j)) {
+                        stats.occluded++;
                         continue;
+                    }
 
                     const ray_io &ray = rs.getRay(j);
                     const int i = ray.index;
@@ -2105,9 +2211,6 @@ LightFace_SurfaceLight(const mbsp_t *bsp, lightsurf_t *lightsurf, lightmapdict_t
                     lightmap->bounce_color += indirect;
 
                     hit = true;
-#if 0
-                    ++total_surflight_ray_hits;
-#endif
                 }
 
                 // If surface light contributed anything, save.
@@ -2119,78 +2222,102 @@ LightFace_SurfaceLight(const mbsp_t *bsp, lightsurf_t *lightsurf, lightmapdict_t
 }
 
 static void // mxd
-LightPoint_SurfaceLight(const mbsp_t *bsp, const std::vector<uint8_t> *pvs, raystream_occlusion_t &rs, bool bounce,
-    float standard_scale, float sky_scale, float hotspot_clamp, const qvec3f &surfpoint, lightgrid_samples_t &result)
+LightPoint_SurfaceLight(const mbsp_t *bsp, std::span<const uint64_t *const> pvs, raystream_occlusion_t &rs,
+    bool bounce, float standard_scale, float sky_scale, float hotspot_clamp, std::span<const qvec3f> surfpoints,
+    std::span<lightgrid_samples_t> results)
 {
     const settings::worldspawn_keys &cfg = light_options;
     const float surflight_gate = light_options.emissivequality.value() == emissivequality_t::HIGH ? 0 : 0.01f;
 
+    raystats::counters_t &stats =
+        raystats::local(bounce ? raystats::category_t::bounce : raystats::category_t::surflight);
+
+    // per point: whether the current surface is in its PVS
+    std::vector<uint8_t> visible(surfpoints.size());
+
     for (const auto &surf : EmissiveLightSurfaces()) {
         const surfacelight_t &vpl = *surf->vpl;
 
-        if (SurfaceLight_VisCull(bsp, pvs, surf)) {
+        bool any_visible = false;
+        for (size_t i = 0; i < surfpoints.size(); i++) {
+            visible[i] = !SurfaceLight_VisCull(bsp, pvs[i], surf);
+            any_visible |= (visible[i] != 0);
+        }
+
+        if (!any_visible) {
             continue;
         }
 
         for (int c = 0; c < vpl.points.size(); c++) {
-            // 1 ray
+            // 1 ray per point
             for (auto &vpl_settings : vpl.styles) {
                 if (vpl_settings.bounce_level.has_value() != bounce)
                     continue;
 
-                qvec3f pos = vpl.points[c];
-                qvec3f dir = surfpoint - pos;
-                float dist = qv::length(dir);
+                rs.clearPushedRays();
 
-                if (dist == 0.0f)
-                    dir = {0, 0, 1};
-                else
-                    dir /= dist;
+                for (size_t i = 0; i < surfpoints.size(); i++) {
+                    if (!visible[i]) {
+                        continue;
+                    }
 
-                qvec3f indirect{};
+                    stats.vpls++;
 
-                rs.clearPushedRays();
+                    qvec3f pos = vpl.points[c];
+                    qvec3f dir = surfpoints[i] - pos;
+                    float dist = qv::length(dir);
+
+                    if (dist == 0.0f)
+                        dir = {0, 0, 1};
+                    else
+                        dir /= dist;
 
-                for (int axis = 0; axis < 3; ++axis) {
-                    for (int sign = -1; sign <= +1; sign += 2) {
+                    qvec3f indirect{};
 
-                        qvec3f cube_color;
+                    for (int axis = 0; axis < 3; ++axis) {
+                        for (int sign = -1; sign <= +1; sign += 2) {
 
-                        qvec3f cube_normal{};
-                        cube_normal[axis] = sign;
+                            qvec3f cube_color;
 
-                        cube_color = GetSurfaceLighting(cfg, vpl, vpl_settings, dir, dist, cube_normal, true,
-                            standard_scale, sky_scale, hotspot_clamp);
+                            qvec3f cube_normal{};
+                            cube_normal[axis] = sign;
+
+                            cube_color = GetSurfaceLighting(cfg, vpl, vpl_settings, dir, dist, cube_normal, true,
+                                standard_scale, sky_scale, hotspot_clamp);
 
 #ifdef LIGHTPOINT_TAKE_MAX
-                        if (qv::length2(cube_color) > qv::length2(indirect)) {
-                            indirect = cube_color;
-                        }
+                            if (qv::length2(cube_color) > qv::length2(indirect)) {
+                                indirect = cube_color;
+                            }
 #else
-                        indirect += cube_color / 6.0f;
+                            indirect += cube_color / 6.0f;
 #endif
+                        }
                     }
-                }
 
-                if (!qv::gate(indirect, surflight_gate)) { // Each point contributes very little to the final result
-                    rs.pushRay(0, pos, dir, dist, &indirect);
+                    if (!qv::gate(indirect, surflight_gate)) { // Each point contributes very little to the final result
+                        rs.pushRay(i, pos, dir, dist, &indirect);
+                    }
                 }
 
                 if (!rs.numPushedRays())
                     continue;
 
                 rs.tracePushedRaysOcclusion(nullptr, CHANNEL_MASK_DEFAULT);
+                CountTrace(stats, rs);
 
                 const int numrays = rs.numPushedRays();
                 for (int j = 0; j < numrays; j++) {
-                    if (rs.getPushedRayOccluded(j))
+                    if (rs.getPushedRayOccluded(j)) {
+                        stats.occluded++;
                         continue;
+                    }
 
                     qvec3f indirect = rs.getPushedRayColor(j);
 
                     // Q_assert(!std::isnan(indirect[0]));
 
-                    result.add(indirect, vpl_settings.style);
+                    results[rs.getRay(j).index].add(indirect, vpl_settings.style);
                 }
             }
         }
@@ -2267,10 +2394,30 @@ static void LightFace_DebugNeighbours(const mbsp_t *bsp, lightsurf_t *lightsurf,
 constexpr size_t DIRT_NUM_ANGLE_STEPS = 16;
 constexpr size_t DIRT_NUM_ELEVATION_STEPS = 3;
 constexpr size_t DIRT_NUM_VECTORS = (DIRT_NUM_ANGLE_STEPS * DIRT_NUM_ELEVATION_STEPS);
+// adaptive dirt traces this many vectors per round: every elevation, at angles 90 degrees apart
+constexpr size_t DIRT_ADAPTIVE_BATCH = (4 * DIRT_NUM_ELEVATION_STEPS);
+
+static_assert((DIRT_NUM_ANGLE_STEPS & (DIRT_NUM_ANGLE_STEPS - 1)) == 0, "angle steps must be a power of 2");
+static_assert(DIRT_NUM_VECTORS % DIRT_ADAPTIVE_BATCH == 0);
 
 static qvec3f dirtVectors[DIRT_NUM_VECTORS];
+// dirtVectors indices in stratified order: each round of DIRT_ADAPTIVE_BATCH fills
+// in the angles halfway between the ones traced so far
+static int dirtVectorOrder[DIRT_NUM_VECTORS];
 int numDirtVectors = 0;
 
+// reverses the low `bits` bits of i
+static int ReverseBits(int i, int bits)
+{
+    int result = 0;
+
+    for (int b = 0; b < bits; b++) {
+        result = (result << 1) | ((i >> b) & 1);
+    }
+
+    return result;
+}
+
 /*
  * ============
  * SetupDirt
@@ -2329,6 +2476,20 @@ void SetupDirt(settings::worldspawn_keys &cfg)
         }
     }
 
+    /* order them for adaptive dirt: bit-reversed angles, all elevations of each */
+    int angleBits = 0;
+    while ((1 << angleBits) < DIRT_NUM_ANGLE_STEPS) {
+        angleBits++;
+    }
+
+    for (int i = 0; i < DIRT_NUM_ANGLE_STEPS; i++) {
+        const int angleIndex = ReverseBits(i, angleBits);
+
+        for (int j = 0; j < DIRT_NUM_ELEVATION_STEPS; j++) {
+            dirtVectorOrder[i * DIRT_NUM_ELEVATION_STEPS + j] = angleIndex * DIRT_NUM_ELEVATION_STEPS + j;
+        }
+    }
+
     /* emit some statistics */
     logging::print("{:9} dirtmap vectors\n", numDirtVectors);
 }
@@ -2358,6 +2519,10 @@ inline qvec3f GetDirtVector(const settings::worldspawn_keys &cfg, int i)
 /*
  * ============
  * LightFace_CalculateDirt
+ *
+ * with _dirtadaptive, vectors are traced in rounds of DIRT_ADAPTIVE_BATCH, and
+ * samples stop after a round once the variance of their rays' occlusion is
+ * below _dirtadaptive. the vector table is the cap on how many rays are traced.
  * ============
  */
 static void LightFace_CalculateDirt(lightsurf_t *lightsurf)
@@ -2369,39 +2534,79 @@ static void LightFace_CalculateDirt(lightsurf_t *lightsurf)
     // batch implementation:
 
     thread_local static std::vector<qvec3f> myUps, myRts;
-
-    myUps.resize(lightsurf->samples.size());
-    myRts.resize(lightsurf->samples.size());
+    // per sample: rays traced, sum of squared per-ray occlusion, and whether it's done
+    thread_local static std::vector<int> numRays;
+    thread_local static std::vector<float> occlusionSquared;
+    thread_local static std::vector<uint8_t> converged;
+
+    const size_t numSamples = lightsurf->samples.size();
+    const float dirtDepth = cfg.dirtdepth.value();
+    const float varianceThreshold = cfg.dirtadaptive.value();
+    const bool adaptive = varianceThreshold > 0;
+
+    myUps.resize(numSamples);
+    myRts.resize(numSamples);
+    numRays.assign(numSamples, 0);
+    occlusionSquared.assign(numSamples, 0.0f);
+    converged.assign(numSamples, false);
 
     // init
-    for (int i = 0; i < lightsurf->samples.size(); i++) {
+    for (int i = 0; i < numSamples; i++) {
         lightsurf->samples[i].occlusion = 0;
     }
 
     // this stuff is just per-point
-    for (int i = 0; i < lightsurf->samples.size(); i++) {
+    for (int i = 0; i < numSamples; i++) {
         const auto [tangent, bitangent] = qv::MakeTangentAndBitangentUnnormalized(lightsurf->samples[i].normal);
 
         myUps[i] = qv::normalize(tangent);
         myRts[i] = qv::normalize(bitangent);
     }
 
+    raystats::counters_t &stats = raystats::local(raystats::category_t::dirt);
+
     for (int j = 0; j < numDirtVectors; j++) {
-        raystream_intersection_t &rs = intersection_stream;
+        if (adaptive && j > 0 && (j % DIRT_ADAPTIVE_BATCH) == 0) {
+            // end of a round; retire the samples that have settled
+            bool any_active = false;
+
+            for (int i = 0; i < numSamples; i++) {
+                if (converged[i] || !numRays[i]) {
+                    continue;
+                }
+
+                const float mean = 1.0f - (lightsurf->samples[i].occlusion / numRays[i]) / dirtDepth;
+                const float variance = occlusionSquared[i] / numRays[i] - mean * mean;
+
+                if (variance < varianceThreshold) {
+                    converged[i] = true;
+                } else {
+                    any_active = true;
+                }
+            }
+
+            if (!any_active) {
+                break;
+            }
+        }
+
+        raystream_intersection_t &rs = Embree_LocalRayStreams().intersection;
         rs.clearPushedRays();
 
+        const int vectorIndex = adaptive ? dirtVectorOrder[j] : j;
+
         // fill in input buffers
 
-        for (int i = 0; i < lightsurf->samples.size(); i++) {
+        for (int i = 0; i < numSamples; i++) {
             const auto &sample = lightsurf->samples[i];
 
-            if (sample.occluded)
+            if (sample.occluded || converged[i])
                 continue;
 
-            qvec3f dirtvec = GetDirtVector(cfg, j);
+            qvec3f dirtvec = GetDirtVector(cfg, vectorIndex);
             qvec3f dir = TransformToTangentSpace(sample.normal, myUps[i], myRts[i], dirtvec);
 
-            rs.pushRay(i, sample.point, dir, cfg.dirtdepth.value());
+            rs.pushRay(i, sample.point, dir, dirtDepth);
         }
 
         // trace the batch. need closest hit for dirt, so intersection.
@@ -2409,24 +2614,31 @@ static void LightFace_CalculateDirt(lightsurf_t *lightsurf)
         // use the model's own channel mask as the shadow mask, e.g. so a model in channel 2's AO rays will only hit
         // other things in channel 2
         rs.tracePushedRaysIntersection(lightsurf->modelinfo, lightsurf->object_channel_mask);
+        CountTrace(stats, rs);
 
         // accumulate hitdists
         for (int k = 0; k < rs.numPushedRays(); k++) {
             const ray_io &ray = rs.getRay(k);
             const int i = ray.index;
+            float hitdist = dirtDepth;
+
             if (rs.getPushedRayHitType(k) == hittype_t::SOLID) {
-                const float dist = rs.getPushedRayHitDist(k);
-                lightsurf->samples[i].occlusion += std::min(cfg.dirtdepth.value(), dist);
-            } else {
-                lightsurf->samples[i].occlusion += cfg.dirtdepth.value();
+                stats.occluded++;
+                hitdist = std::min(dirtDepth, rs.getPushedRayHitDist(k));
             }
+
+            lightsurf->samples[i].occlusion += hitdist;
+
+            const float occlusion = 1.0f - (hitdist / dirtDepth);
+            occlusionSquared[i] += occlusion * occlusion;
+            numRays[i]++;
         }
     }
 
     // process the results.
-    for (int i = 0; i < lightsurf->samples.size(); i++) {
-        float avgHitdist = lightsurf->samples[i].occlusion / (float)numDirtVectors;
-        lightsurf->samples[i].occlusion = 1.0f - (avgHitdist / cfg.dirtdepth.value());
+    for (int i = 0; i < numSamples; i++) {
+        float avgHitdist = numRays[i] ? lightsurf->samples[i].occlusion / (float)numRays[i] : 0.0f;
+        lightsurf->samples[i].occlusion = 1.0f - (avgHitdist / dirtDepth);
     }
 }
 
@@ -2597,6 +2809,8 @@ lightsurf_t CreateLightmapSurface(const mbsp_t *bsp, const mface_t *face, const
  */
 void DirectLightFace(const mbsp_t *bsp, lightsurf_t &lightsurf, const settings::worldspawn_keys &cfg)
 {
+    profilefunc();
+
     auto face = lightsurf.face;
     const modelinfo_t *modelinfo = ModelInfoForFace(bsp, Face_GetNum(bsp, face));
 
@@ -2613,10 +2827,6 @@ void DirectLightFace(const mbsp_t *bsp, lightsurf_t &lightsurf, const settings::
      */
 
     if (light_options.debugmode == debugmodes::none) {
-#if 0
-        total_samplepoints += lightsurf.samples.size();
-#endif
-
         const surfflags_t &extended_flags = extended_texinfo_flags[face->texinfo];
 
         /* positive lights */
@@ -2629,9 +2839,7 @@ void DirectLightFace(const mbsp_t *bsp, lightsurf_t &lightsurf, const settings::
                 if (entity->light.value() > 0)
                     LightFace_Entity(bsp, entity.get(), &lightsurf, lightmaps);
             }
-            for (const sun_t &sun : GetSuns())
-                if (sun.sunlight > 0)
-                    LightFace_Sky(bsp, &sun, &lightsurf, lightmaps);
+            LightFace_Sky(bsp, GetSuns(), false, &lightsurf, lightmaps);
 
             // mxd. Add surface lights...
             // FIXME: negative surface lights
@@ -2664,6 +2872,8 @@ void DirectLightFace(const mbsp_t *bsp, lightsurf_t &lightsurf, const settings::
 void IndirectLightFace(
     const mbsp_t *bsp, lightsurf_t &lightsurf, const settings::worldspawn_keys &cfg, size_t bounce_depth)
 {
+    profilefunc();
+
     auto face = lightsurf.face;
     const modelinfo_t *modelinfo = ModelInfoForFace(bsp, Face_GetNum(bsp, face));
     lightmapdict_t *lightmaps = &lightsurf.lightmapsByStyle;
@@ -2695,10 +2905,6 @@ void PostProcessLightFace(const mbsp_t *bsp, lightsurf_t &lightsurf, const setti
     lightmapdict_t *lightmaps = &lightsurf.lightmapsByStyle;
 
     if (light_options.debugmode == debugmodes::none) {
-#if 0
-        total_samplepoints += lightsurf.samples.size();
-#endif
-
         const surfflags_t &extended_flags = extended_texinfo_flags[face->texinfo];
 
         float minlight = 0;
@@ -2746,9 +2952,7 @@ void PostProcessLightFace(const mbsp_t *bsp, lightsurf_t &lightsurf, const setti
                 if (entity->light.value() < 0)
                     LightFace_Entity(bsp, entity.get(), &lightsurf, lightmaps);
             }
-            for (const sun_t &sun : GetSuns())
-                if (sun.sunlight < 0)
-                    LightFace_Sky(bsp, &sun, &lightsurf, lightmaps);
+            LightFace_Sky(bsp, GetSuns(), true, &lightsurf, lightmaps);
         }
     }
 
@@ -2878,17 +3082,23 @@ bool lightgrid_samples_t::operator==(const lightgrid_samples_t &other) const
     return samples_by_style == other.samples_by_style;
 }
 
-lightgrid_samples_t CalcLightgridAtPoint(const mbsp_t *bsp, const qvec3f &world_point)
+void CalcLightgridAtPoints(
+    const mbsp_t *bsp, std::span<const qvec3f> world_points, std::span<lightgrid_samples_t> results)
 {
-    // TODO: use more than 1 ray for better performance
-    raystream_occlusion_t rs(1);
-    raystream_intersection_t rsi(1);
+    Q_assert(world_points.size() == results.size());
 
-    const auto *pvs = Mod_LeafPvs(bsp, BSP_FindLeafAtPoint(bsp, &bsp->dmodels[0], world_point));
+    // one ray per point per light, traced together
+    raystream_pool_t &streams = Embree_LocalRayStreams();
+    raystream_occlusion_t &rs = streams.occlusion;
+    raystream_intersection_t &rsi = streams.intersection;
 
-    auto &cfg = light_options;
+    std::vector<const uint64_t *> pvs(world_points.size());
+    for (size_t i = 0; i < world_points.size(); i++) {
+        pvs[i] = Mod_LeafPvs(bsp, BSP_FindLeafAtPoint(bsp, &bsp->dmodels[0], world_points[i]));
+        results[i] = {};
+    }
 
-    lightgrid_samples_t result;
+    auto &cfg = light_options;
 
     // from DirectLightFace
 
@@ -2905,17 +3115,17 @@ lightgrid_samples_t CalcLightgridAtPoint(const mbsp_t *bsp, const qvec3f &world_
         if (entity->nostaticlight.value())
             continue;
         if (entity->light.value() > 0)
-            LightPoint_Entity(bsp, rs, entity.get(), world_point, result);
+            LightPoint_Entity(bsp, rs, entity.get(), world_points, results);
     }
 
     for (const sun_t &sun : GetSuns())
         if (sun.sunlight > 0)
-            LightPoint_Sky(bsp, rsi, &sun, world_point, result);
+            LightPoint_Sky(bsp, rsi, &sun, world_points, results);
 
     // mxd. Add surface lights...
     // FIXME: negative surface lights
-    LightPoint_SurfaceLight(
-        bsp, pvs, rs, false, cfg.surflightscale.value(), cfg.surflightskyscale.value(), 16.0f, world_point, result);
+    LightPoint_SurfaceLight(bsp, pvs, rs, false, cfg.surflightscale.value(), cfg.surflightskyscale.value(), 16.0f,
+        world_points, results);
 
 #if 0
     // FIXME: port to lightgrid
@@ -2936,34 +3146,32 @@ lightgrid_samples_t CalcLightgridAtPoint(const mbsp_t *bsp, const qvec3f &world_
         if (entity->nostaticlight.value())
             continue;
         if (entity->light.value() < 0)
-            LightPoint_Entity(bsp, rs, entity.get(), world_point, result);
+            LightPoint_Entity(bsp, rs, entity.get(), world_points, results);
     }
     for (const sun_t &sun : GetSuns())
         if (sun.sunlight < 0)
-            LightPoint_Sky(bsp, rsi, &sun, world_point, result);
+            LightPoint_Sky(bsp, rsi, &sun, world_points, results);
 
     // from IndirectLightFace
 
     /* add bounce lighting */
     // note: scale here is just to keep it close-ish to the old code
-    LightPoint_SurfaceLight(
-        bsp, pvs, rs, true, cfg.bouncescale.value() * 0.5, cfg.bouncescale.value(), 128.0f, world_point, result);
+    LightPoint_SurfaceLight(bsp, pvs, rs, true, cfg.bouncescale.value() * 0.5, cfg.bouncescale.value(), 128.0f,
+        world_points, results);
 
-    LightPoint_ScaleAndClamp(result);
+    for (auto &result : results) {
+        LightPoint_ScaleAndClamp(result);
+    }
+}
 
+lightgrid_samples_t CalcLightgridAtPoint(const mbsp_t *bsp, const qvec3f &world_point)
+{
+    lightgrid_samples_t result;
+    CalcLightgridAtPoints(bsp, {&world_point, 1}, {&result, 1});
     return result;
 }
 
 void ResetLtFace()
 {
-#if 0
-    total_light_rays = 0;
-    total_light_ray_hits = 0;
-    total_samplepoints = 0;
-
-    total_bounce_rays = 0;
-    total_bounce_ray_hits = 0;
-    total_surflight_rays = 0;
-    total_surflight_ray_hits = 0;
-#endif
+    raystats::reset();
 }
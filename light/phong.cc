@@ -33,10 +33,11 @@
 #include <unordered_map>
 #include <set>
 #include <algorithm>
-#include <mutex>
+#include <numeric>
+#include <span>
 
 #include <common/qvec.hh>
-#include <tbb/parallel_for_each.h>
+#include <tbb/parallel_for.h>
 
 face_cache_t::face_cache_t() { };
 
@@ -177,17 +178,41 @@ static float AngleBetweenPoints(const qvec3f &p1, const qvec3f &p2, const qvec3f
     return result;
 }
 
+/**
+ * Rows of face pointers stored back to back, e.g. the faces using each vertex.
+ * Row i is faces[offsets[i]] .. faces[offsets[i + 1]].
+ */
+struct face_rows_t
+{
+    std::vector<uint32_t> offsets;
+    std::vector<const mface_t *> faces;
+
+    std::span<const mface_t *const> row(size_t i) const
+    {
+        if (i + 1 >= offsets.size()) {
+            return {};
+        }
+        return {faces.data() + offsets[i], faces.data() + offsets[i + 1]};
+    }
+};
+
 static bool s_builtPhongCaches;
-static std::unordered_map<const mface_t *, std::vector<face_normal_t>> vertex_normals;
-static std::map<const mface_t *, std::set<const mface_t *>> smoothFaces;
-static std::map<int, std::vector<const mface_t *>> vertsToFaces;
-static std::map<int, std::vector<const mface_t *>> planesToFaces;
+static const mface_t *s_firstFace;
+// per face: one slot per vertex, in face order; offsets[facenum] is the first
+static std::vector<uint32_t> vertex_normal_offsets;
+static std::vector<face_normal_t> vertex_normals;
+// per face: the faces to smooth with, sorted
+static face_rows_t smoothFaces;
+static face_rows_t vertsToFaces;
+static face_rows_t planesToFaces;
 static edgeToFaceMap_t EdgeToFaceMap;
 static std::vector<face_cache_t> FaceCache;
 
 void ResetPhong()
 {
     s_builtPhongCaches = false;
+    s_firstFace = nullptr;
+    vertex_normal_offsets = {};
     vertex_normals = {};
     smoothFaces = {};
     vertsToFaces = {};
@@ -196,14 +221,12 @@ void ResetPhong()
     FaceCache = {};
 }
 
-std::vector<const mface_t *> FacesUsingVert(int vertnum)
+std::span<const mface_t *const> FacesUsingVert(int vertnum)
 {
-    const auto &vertsToFaces_const = vertsToFaces;
-
-    auto it = vertsToFaces_const.find(vertnum);
-    if (it != vertsToFaces_const.end())
-        return it->second;
-    return {};
+    if (vertnum < 0) {
+        return {};
+    }
+    return vertsToFaces.row(vertnum);
 }
 
 const edgeToFaceMap_t &GetEdgeToFaceMap()
@@ -215,43 +238,26 @@ const edgeToFaceMap_t &GetEdgeToFaceMap()
 // Uses `smoothFaces` static var
 bool FacesSmoothed(const mface_t *f1, const mface_t *f2)
 {
-    Q_assert(s_builtPhongCaches);
+    const auto faces = GetSmoothFaces(f1);
 
-    const auto &facesIt = smoothFaces.find(f1);
-    if (facesIt == smoothFaces.end())
-        return false;
-
-    const std::set<const mface_t *> &faceSet = facesIt->second;
-    if (faceSet.find(f2) == faceSet.end())
-        return false;
-
-    return true;
+    return std::binary_search(faces.begin(), faces.end(), f2);
 }
 
-const std::set<const mface_t *> &GetSmoothFaces(const mface_t *face)
+std::span<const mface_t *const> GetSmoothFaces(const mface_t *face)
 {
     Q_assert(s_builtPhongCaches);
 
-    static std::set<const mface_t *> empty;
-    const auto it = smoothFaces.find(face);
-
-    if (it == smoothFaces.end())
-        return empty;
-
-    return it->second;
+    if (face < s_firstFace) {
+        return {};
+    }
+    return smoothFaces.row(face - s_firstFace);
 }
 
-const std::vector<const mface_t *> &GetPlaneFaces(const mface_t *face)
+std::span<const mface_t *const> GetPlaneFaces(const mface_t *face)
 {
     Q_assert(s_builtPhongCaches);
 
-    static std::vector<const mface_t *> empty;
-    const auto it = planesToFaces.find(face->planenum);
-
-    if (it == planesToFaces.end())
-        return empty;
-
-    return it->second;
+    return planesToFaces.row(face->planenum);
 }
 
 // Adapted from https://github.com/NVIDIAGameWorks/donut/blob/main/src/engine/GltfImporter.cpp#L684
@@ -276,14 +282,14 @@ const face_normal_t &GetSurfaceVertexNormal(const mbsp_t *bsp, const mface_t *f,
 {
     Q_assert(s_builtPhongCaches);
 
-    // handle degenerate faces
-    const auto it = vertex_normals.find(f);
-    if (it == vertex_normals.end()) {
-        static const face_normal_t empty{};
-        return empty;
-    }
-    const auto &face_normals_vec = it->second;
-    return face_normals_vec.at(vertindex);
+    const size_t facenum = f - s_firstFace;
+    Q_assert(facenum + 1 < vertex_normal_offsets.size());
+
+    const uint32_t slot = vertex_normal_offsets[facenum] + vertindex;
+    Q_assert(vertindex >= 0 && slot < vertex_normal_offsets[facenum + 1]);
+
+    // degenerate faces keep the zero normals their slots were created with
+    return vertex_normals[slot];
 }
 
 const mface_t *Face_EdgeIndexSmoothed(const mbsp_t *bsp, const mface_t *f, const int edgeindex)
@@ -369,9 +375,10 @@ static edgeToFaceMap_t MakeEdgeToFaceMap(const mbsp_t *bsp)
 
 static std::vector<face_normal_t> Face_VertexNormals(const mbsp_t *bsp, const mface_t *face)
 {
-    std::vector<face_normal_t> normals(face->numedges);
-    tbb::parallel_for(0, face->numedges, [&](size_t i) { normals[i] = GetSurfaceVertexNormal(bsp, face, i); });
-    return normals;
+    const size_t facenum = face - s_firstFace;
+
+    return {vertex_normals.begin() + vertex_normal_offsets[facenum],
+        vertex_normals.begin() + vertex_normal_offsets[facenum + 1]};
 }
 
 #include <common/parallel.hh>
@@ -421,253 +428,322 @@ inline bool isDegenerate(const qvec3f &a, const qvec3f &b, const qvec3f &c)
     return false;
 }
 
-void CalculateVertexNormals(const mbsp_t *bsp)
+/**
+ * Builds face rows for ids 0..numrows-1. `keys(face, emit)` must call emit(id)
+ * for every id the face belongs to, the same way on both calls; faces are
+ * stored in face order within each row.
+ */
+template<typename Keys>
+static face_rows_t MakeFaceRows(const mbsp_t *bsp, size_t numrows, Keys &&keys)
 {
-    logging::funcheader();
+    face_rows_t result;
+    result.offsets.assign(numrows + 1, 0);
 
-    Q_assert(!s_builtPhongCaches);
-    s_builtPhongCaches = true;
+    for (auto &f : bsp->dfaces) {
+        keys(f, [&](size_t id) { result.offsets[id + 1]++; });
+    }
 
-    EdgeToFaceMap = MakeEdgeToFaceMap(bsp);
+    std::partial_sum(result.offsets.begin(), result.offsets.end(), result.offsets.begin());
+    result.faces.resize(result.offsets.back());
 
-    // read _phong and _phong_angle from entities for compatibility with other qbsp's, at the expense of no
-    // support on func_detail/func_group
-    for (size_t i = 0; i < bsp->dmodels.size(); i++) {
-        const modelinfo_t *info = ModelInfoForModel(bsp, i);
-        const uint8_t phongangle_byte = (uint8_t)std::clamp((int)rint(info->getResolvedPhongAngle()), 0, 255);
+    std::vector<uint32_t> next(result.offsets.begin(), result.offsets.end() - 1);
 
-        if (!phongangle_byte)
-            continue;
+    for (auto &f : bsp->dfaces) {
+        keys(f, [&](size_t id) { result.faces[next[id]++] = &f; });
+    }
 
-        for (int j = info->model->firstface; j < info->model->firstface + info->model->numfaces; j++) {
-            const mface_t *f = BSP_GetFace(bsp, j);
+    return result;
+}
 
-            extended_texinfo_flags[f->texinfo].phong_angle = phongangle_byte;
-        }
-    }
+/**
+ * Everything about a face that the smoothing needs, worked out once per face
+ * rather than once per neighbouring face.
+ */
+struct face_phong_t
+{
+    // Q2 shading group (or _phong_group)
+    int phong_value;
+    float phong_angle;
+    float phong_angle_concave;
+    // wants phong and isn't _phong 0'd out
+    bool smoothed;
+
+    qvec3f normal;
+    qplane3f plane;
+    qvec3f centroid;
+    float area;
+    qvec3f tangent, bitangent;
+};
+
+static face_phong_t MakeFacePhong(const mbsp_t *bsp, const mface_t *f)
+{
+    face_phong_t result;
 
-    for (auto &f : bsp->dfaces) {
-        // build "plane -> faces" map
-        planesToFaces[f.planenum].push_back(&f);
+    result.phong_value = Q2_FacePhongValue(bsp, f);
 
-        // build "vert index -> faces" map
-        for (size_t j = 0; j < f.numedges; j++) {
-            const int v = Face_VertexAtIndex(bsp, &f, j);
-            vertsToFaces[v].push_back(&f);
-        }
+    // any face normal within this many degrees can be smoothed with this face
+    result.phong_angle = extended_texinfo_flags[f->texinfo].phong_angle;
+    if (result.phong_angle == 0 && result.phong_value != 0) {
+        // if Q2 style phong is requested, but Q1 is not in use, set the default phong angle
+        result.phong_angle = modelinfo_t::DEFAULT_PHONG_ANGLE;
+    }
+    result.phong_angle_concave = extended_texinfo_flags[f->texinfo].phong_angle_concave;
+    if (result.phong_angle_concave == 0) {
+        result.phong_angle_concave = result.phong_angle;
     }
+    result.smoothed = (result.phong_angle || result.phong_angle_concave) && !extended_texinfo_flags[f->texinfo].no_phong;
 
-    // build the "face -> faces to smooth with" map
-    for (auto &f : bsp->dfaces) {
-        // Q2 shading groups
-        const int f_phongValue = Q2_FacePhongValue(bsp, &f);
-
-        // Q1 phong angle stuff
-        auto *f_texinfo = Face_Texinfo(bsp, &f);
-        const auto f_points = Face_Points(bsp, &f);
-        const qvec3f f_norm = Face_Normal(bsp, &f);
-        const qplane3f f_plane = Face_Plane(bsp, &f);
-
-        // any face normal within this many degrees can be smoothed with this face
-        float f_phong_angle = extended_texinfo_flags[f.texinfo].phong_angle;
-        if (f_phong_angle == 0 && f_phongValue != 0) {
-            // if Q2 style phong is requested, but Q1 is not in use, set the default phong angle
-            f_phong_angle = modelinfo_t::DEFAULT_PHONG_ANGLE;
-        }
-        float f_phong_angle_concave = extended_texinfo_flags[f.texinfo].phong_angle_concave;
-        if (f_phong_angle_concave == 0) {
-            f_phong_angle_concave = f_phong_angle;
-        }
-        const bool f_wants_phong = (f_phong_angle || f_phong_angle_concave);
+    const auto points = Face_Points(bsp, f);
+    result.normal = Face_Normal(bsp, f);
+    result.plane = Face_Plane(bsp, f);
+    result.centroid = qv::PolyCentroid(points.begin(), points.end());
+    result.area = qv::PolyArea(points.begin(), points.end());
 
-        if (!f_wants_phong)
-            continue;
+    auto t = TexSpaceToWorld(bsp, f);
+    result.tangent = t.col(0).xyz();
+    result.bitangent = qv::normalize(t.col(1).xyz());
 
-        if (extended_texinfo_flags[f.texinfo].no_phong)
-            continue;
+    return result;
+}
 
-        for (int j = 0; j < f.numedges; j++) {
-            const int v = Face_VertexAtIndex(bsp, &f, j);
-            // walk over all faces incident to f (we will walk over neighbours multiple times, doesn't matter)
-            for (const mface_t *f2 : vertsToFaces[v]) {
-                if (f2 == &f)
-                    continue;
+/**
+ * Returns the faces sharing a vertex with f that f should be smoothed with,
+ * sorted and without duplicates.
+ */
+static std::vector<const mface_t *> FindSmoothFaces(
+    const mbsp_t *bsp, const mface_t *f, const std::vector<face_phong_t> &phong)
+{
+    std::vector<const mface_t *> result;
 
-                // FIXME: factor out and share with above?
-                const int f2_phongValue = Q2_FacePhongValue(bsp, f2);
-                float f2_phong_angle = extended_texinfo_flags[f2->texinfo].phong_angle;
-                if (f2_phong_angle == 0 && f2_phongValue != 0) {
-                    // if Q2 style phong is requested, but Q1 is not in use, set the default phong angle
-                    f2_phong_angle = modelinfo_t::DEFAULT_PHONG_ANGLE;
-                }
-                float f2_phong_angle_concave = extended_texinfo_flags[f2->texinfo].phong_angle_concave;
-                if (f2_phong_angle_concave == 0) {
-                    f2_phong_angle_concave = f2_phong_angle;
-                }
-                const bool f2_wants_phong = (f2_phong_angle || f2_phong_angle_concave);
+    const face_phong_t &fp = phong[f - s_firstFace];
 
-                if (!f2_wants_phong)
-                    continue;
+    if (!fp.smoothed) {
+        return result;
+    }
 
-                if (extended_texinfo_flags[f2->texinfo].no_phong)
-                    continue;
+    auto *f_texinfo = Face_Texinfo(bsp, f);
 
-                auto *f2_texinfo = Face_Texinfo(bsp, f2);
-                if (f2_texinfo != nullptr && f_texinfo != nullptr) {
-                    if (!bsp->loadversion->game->surfflags_may_phong(f_texinfo->flags, f2_texinfo->flags)) {
-                        // phong may be blocked by the gamedef, e.g. warping and non-warping never phong
-                        continue;
-                    }
-                }
+    for (int j = 0; j < f->numedges; j++) {
+        const int v = Face_VertexAtIndex(bsp, f, j);
+        // walk over all faces incident to f (we will walk over neighbours multiple times, doesn't matter)
+        for (const mface_t *f2 : vertsToFaces.row(v)) {
+            if (f2 == f)
+                continue;
 
-                const auto f2_points = Face_Points(bsp, f2);
-                const qvec3f f2_centroid = qv::PolyCentroid(f2_points.begin(), f2_points.end());
-                const qvec3f f2_norm = Face_Normal(bsp, f2);
+            const face_phong_t &f2p = phong[f2 - s_firstFace];
 
-                const float cosangle = qv::dot(f_norm, f2_norm);
+            if (!f2p.smoothed)
+                continue;
 
-                const bool concave = f_plane.distance_to(f2_centroid) > 0.1;
-                const float f_threshold = concave ? f_phong_angle_concave : f_phong_angle;
-                const float f2_threshold = concave ? f2_phong_angle_concave : f2_phong_angle;
-                const float min_threshold = std::min(f_threshold, f2_threshold);
-                const float cosmaxangle = cos(DEG2RAD(min_threshold));
+            if (fp.phong_value != f2p.phong_value) {
+                // mismatched smoothing groups never phong
+                continue;
+            }
 
-                if (f_phongValue != f2_phongValue) {
-                    // mismatched smoothing groups never phong
+            auto *f2_texinfo = Face_Texinfo(bsp, f2);
+            if (f2_texinfo != nullptr && f_texinfo != nullptr) {
+                if (!bsp->loadversion->game->surfflags_may_phong(f_texinfo->flags, f2_texinfo->flags)) {
+                    // phong may be blocked by the gamedef, e.g. warping and non-warping never phong
                     continue;
                 }
+            }
 
-                // check the angle between the face normals
-                if (cosangle >= cosmaxangle) {
-                    smoothFaces[&f].insert(f2);
-                }
+            const float cosangle = qv::dot(fp.normal, f2p.normal);
+
+            const bool concave = fp.plane.distance_to(f2p.centroid) > 0.1;
+            const float f_threshold = concave ? fp.phong_angle_concave : fp.phong_angle;
+            const float f2_threshold = concave ? f2p.phong_angle_concave : f2p.phong_angle;
+            const float min_threshold = std::min(f_threshold, f2_threshold);
+            const float cosmaxangle = cos(DEG2RAD(min_threshold));
+
+            // check the angle between the face normals
+            if (cosangle >= cosmaxangle) {
+                result.push_back(f2);
             }
         }
     }
 
-    logging::print(logging::flag::VERBOSE, "        {} faces for smoothing\n", smoothFaces.size());
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
 
-    // finally do the smoothing for each face
-    std::mutex normalsMutex;
+    return result;
+}
 
-    logging::parallel_for_each(bsp->dfaces, [bsp, &normalsMutex](const mface_t &f) {
-        if (f.numedges < 3) {
-            logging::funcprint("face {} is degenerate with {} edges\n", Face_GetNum(bsp, &f), f.numedges);
-            for (int j = 0; j < f.numedges; j++) {
-                logging::print("                         vert at {}\n", Face_PointAtIndex(bsp, &f, j));
+/**
+ * Smooths the normals at f's vertices over f and its smooth faces, writing them
+ * to `out` (one per vertex of f, in order).
+ */
+static void SmoothFaceNormals(
+    const mbsp_t *bsp, const mface_t *f, const std::vector<face_phong_t> &phong, face_normal_t *out)
+{
+    const face_phong_t &fp = phong[f - s_firstFace];
+
+    // index of the first vertex of f using vertnum, or -1; faces with repeated
+    // verts get one normal per distinct vertex, copied to the repeats below
+    auto slotForVert = [&](int vertnum) {
+        for (int j = 0; j < f->numedges; j++) {
+            if (Face_VertexAtIndex(bsp, f, j) == vertnum) {
+                return j;
             }
-            return;
         }
+        return -1;
+    };
 
-        const qvec3f f_norm = Face_Normal(bsp, &f); // get the face normal
+    auto accumulate = [&](const mface_t *f2) {
+        const face_phong_t &f2p = phong[f2 - s_firstFace];
 
-        // face tangent
-        auto t1 = TexSpaceToWorld(bsp, &f);
-        std::tuple<qvec3f, qvec3f> tangents(t1.col(0).xyz(), qv::normalize(t1.col(1).xyz()));
+        // walk the vertices of f2, and add their contribution to the ones shared with f
+        for (int j = 0; j < f2->numedges; j++) {
+            const int curr_vert_num = Face_VertexAtIndex(bsp, f2, j);
+            const int slot = slotForVert(curr_vert_num);
 
-        // gather up f and neighboursToSmooth
-        std::vector<const mface_t *> fPlusNeighbours;
-        fPlusNeighbours.push_back(&f);
-        auto neighboursIt = smoothFaces.find(&f);
-
-        if (neighboursIt != smoothFaces.end()) {
-            const auto &neighboursToSmooth = neighboursIt->second;
-            std::copy(neighboursToSmooth.begin(), neighboursToSmooth.end(), std::back_inserter(fPlusNeighbours));
-        }
+            if (slot == -1) {
+                continue;
+            }
 
-        // global vertex index -> smoothed normal
-        std::unordered_map<int, face_normal_t> smoothedNormals;
+            const int prev_vert_num = Face_VertexAtIndex(bsp, f2, ((j - 1) + f2->numedges) % f2->numedges);
+            const int next_vert_num = Face_VertexAtIndex(bsp, f2, (j + 1) % f2->numedges);
 
-        // walk fPlusNeighbours
-        for (auto f2 : fPlusNeighbours) {
-            const auto f2_poly = Face_Points(bsp, f2);
-            const float f2_area = qv::PolyArea(f2_poly.begin(), f2_poly.end());
-            const qvec3f f2_norm = Face_Normal(bsp, f2);
+            const qvec3f &prev_vert_pos = Vertex_GetPos(bsp, prev_vert_num);
+            const qvec3f &curr_vert_pos = Vertex_GetPos(bsp, curr_vert_num);
+            const qvec3f &next_vert_pos = Vertex_GetPos(bsp, next_vert_num);
 
-            // f2 face tangent
-            auto t2 = TexSpaceToWorld(bsp, f2);
-            std::tuple<qvec3f, qvec3f> f2_tangents(t2.col(0).xyz(), qv::normalize(t2.col(1).xyz()));
+            const float angle_radians = AngleBetweenPoints(prev_vert_pos, curr_vert_pos, next_vert_pos);
 
-            // walk the vertices of f2, and add their contribution to smoothedNormals
-            for (int j = 0; j < f2->numedges; j++) {
-                const int prev_vert_num = Face_VertexAtIndex(bsp, f2, ((j - 1) + f2->numedges) % f2->numedges);
-                const int curr_vert_num = Face_VertexAtIndex(bsp, f2, j);
-                const int next_vert_num = Face_VertexAtIndex(bsp, f2, (j + 1) % f2->numedges);
+            float weight = f2p.area * angle_radians;
+            if (!std::isfinite(weight)) {
+                // TODO: not sure if needed?
+                weight = 0;
+            }
 
-                const qvec3f &prev_vert_pos = Vertex_GetPos(bsp, prev_vert_num);
-                const qvec3f &curr_vert_pos = Vertex_GetPos(bsp, curr_vert_num);
-                const qvec3f &next_vert_pos = Vertex_GetPos(bsp, next_vert_num);
+            auto &n = out[slot];
+            n.normal += f2p.normal * weight;
+            n.tangent += f2p.tangent * weight;
+            n.bitangent += f2p.bitangent * weight;
+        }
+    };
 
-                const float angle_radians = AngleBetweenPoints(prev_vert_pos, curr_vert_pos, next_vert_pos);
+    // f first, then its neighbours in face order, so the sums come out the same every run
+    accumulate(f);
+    for (const mface_t *f2 : smoothFaces.row(f - s_firstFace)) {
+        accumulate(f2);
+    }
 
-                float weight = f2_area * angle_radians;
-                if (!std::isfinite(weight)) {
-                    // TODO: not sure if needed?
-                    weight = 0;
-                }
+    // normalize vertex normals
+    for (int j = 0; j < f->numedges; j++) {
+        face_normal_t &vertNormal = out[j];
+        const int first = slotForVert(Face_VertexAtIndex(bsp, f, j));
 
-                auto &n = smoothedNormals[curr_vert_num];
-                n.normal += f2_norm * weight;
-                n.tangent += std::get<0>(f2_tangents) * weight;
-                n.bitangent += std::get<1>(f2_tangents) * weight;
-            }
+        if (first != j) {
+            vertNormal = out[first];
+            continue;
         }
 
-        // normalize vertex normals (NOTE: updates smoothedNormals map)
-        for (auto &pair : smoothedNormals) {
-            face_normal_t &vertNormal = pair.second;
-            if (0 == qv::length(vertNormal.normal)) {
-                // this happens when there are colinear vertices, which give zero-area triangles,
-                // so there is no contribution to the normal of the triangle in the middle of the
-                // line. Not really an error, just set it to use the face normal.
-#if 0
-                const int vertIndex = pair.first;
-                logging::print("Failed to calculate normal for vertex {} at ({} {} {})\n",
-                         vertIndex,
-                         bsp->dvertexes[vertIndex].point[0],
-                         bsp->dvertexes[vertIndex].point[1],
-                         bsp->dvertexes[vertIndex].point[2]);
-#endif
-                vertNormal = {f_norm, std::get<0>(tangents), std::get<1>(tangents)};
-            } else {
-                vertNormal = {qv::normalize(vertNormal.normal), qv::normalize(vertNormal.tangent),
-                    qv::normalize(vertNormal.bitangent)};
-            }
+        if (0 == qv::length(vertNormal.normal)) {
+            // this happens when there are colinear vertices, which give zero-area triangles,
+            // so there is no contribution to the normal of the triangle in the middle of the
+            // line. Not really an error, just set it to use the face normal.
+            vertNormal = {fp.normal, fp.tangent, fp.bitangent};
+        } else {
+            vertNormal = {qv::normalize(vertNormal.normal), qv::normalize(vertNormal.tangent),
+                qv::normalize(vertNormal.bitangent)};
+        }
 
-            // FIXME: why
+        // FIXME: why
+        if (std::isnan(vertNormal.tangent[0])) {
+            vertNormal.tangent = fp.tangent;
             if (std::isnan(vertNormal.tangent[0])) {
-                vertNormal.tangent = std::get<0>(tangents);
-                if (std::isnan(vertNormal.tangent[0])) {
-                    vertNormal.tangent = {0, 0, 0};
-                }
+                vertNormal.tangent = {0, 0, 0};
             }
+        }
+        if (std::isnan(vertNormal.bitangent[0])) {
+            vertNormal.bitangent = fp.bitangent;
             if (std::isnan(vertNormal.bitangent[0])) {
-                vertNormal.bitangent = std::get<1>(tangents);
-                if (std::isnan(vertNormal.bitangent[0])) {
-                    vertNormal.bitangent = {0, 0, 0};
-                }
+                vertNormal.bitangent = {0, 0, 0};
             }
         }
+    }
+}
 
-        // sanity check
-        if (neighboursIt != smoothFaces.end()) {
-            const auto &neighboursToSmooth = neighboursIt->second;
-            if (!neighboursToSmooth.size()) {
-                for (auto &vertIndexNormalPair : smoothedNormals) {
-                    Q_assert(qv::epsilonEqual(vertIndexNormalPair.second.normal, f_norm, (float)LIGHT_EQUAL_EPSILON));
-                }
-            }
+void CalculateVertexNormals(const mbsp_t *bsp)
+{
+    logging::funcheader();
+
+    Q_assert(!s_builtPhongCaches);
+    s_builtPhongCaches = true;
+    s_firstFace = bsp->dfaces.data();
+
+    EdgeToFaceMap = MakeEdgeToFaceMap(bsp);
+
+    // read _phong and _phong_angle from entities for compatibility with other qbsp's, at the expense of no
+    // support on func_detail/func_group
+    for (size_t i = 0; i < bsp->dmodels.size(); i++) {
+        const modelinfo_t *info = ModelInfoForModel(bsp, i);
+        const uint8_t phongangle_byte = (uint8_t)std::clamp((int)rint(info->getResolvedPhongAngle()), 0, 255);
+
+        if (!phongangle_byte)
+            continue;
+
+        for (int j = info->model->firstface; j < info->model->firstface + info->model->numfaces; j++) {
+            const mface_t *f = BSP_GetFace(bsp, j);
+
+            extended_texinfo_flags[f->texinfo].phong_angle = phongangle_byte;
         }
+    }
 
-        // now, record all of the smoothed normals that are actually part of `f`
+    // build "plane -> faces" and "vert index -> faces" rows
+    planesToFaces = MakeFaceRows(bsp, bsp->dplanes.size(), [](const mface_t &f, auto &&emit) { emit(f.planenum); });
+    vertsToFaces = MakeFaceRows(bsp, bsp->dvertexes.size(), [bsp](const mface_t &f, auto &&emit) {
         for (int j = 0; j < f.numedges; j++) {
-            int v = Face_VertexAtIndex(bsp, &f, j);
-            Q_assert(smoothedNormals.find(v) != smoothedNormals.end());
+            emit(Face_VertexAtIndex(bsp, &f, j));
+        }
+    });
+
+    std::vector<face_phong_t> phong(bsp->dfaces.size());
+    tbb::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(),
+        [&](size_t i) { phong[i] = MakeFacePhong(bsp, &bsp->dfaces[i]); });
+
+    // build the "face -> faces to smooth with" rows; each face fills in its own list,
+    // then they're packed back to back
+    {
+        std::vector<std::vector<const mface_t *>> neighbours(bsp->dfaces.size());
+        tbb::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(),
+            [&](size_t i) { neighbours[i] = FindSmoothFaces(bsp, &bsp->dfaces[i], phong); });
+
+        smoothFaces.offsets.assign(bsp->dfaces.size() + 1, 0);
+        for (size_t i = 0; i < neighbours.size(); i++) {
+            smoothFaces.offsets[i + 1] = smoothFaces.offsets[i] + neighbours[i].size();
+        }
+        smoothFaces.faces.resize(smoothFaces.offsets.back());
+        tbb::parallel_for(static_cast<size_t>(0), neighbours.size(), [&](size_t i) {
+            std::copy(neighbours[i].begin(), neighbours[i].end(), smoothFaces.faces.begin() + smoothFaces.offsets[i]);
+        });
+    }
+
+    logging::print(logging::flag::VERBOSE, "        {} faces for smoothing\n",
+        std::count_if(bsp->dfaces.begin(), bsp->dfaces.end(),
+            [](const mface_t &f) { return !smoothFaces.row(&f - s_firstFace).empty(); }));
+
+    // one output slot per face vertex; degenerate faces keep zeroed normals
+    vertex_normal_offsets.assign(bsp->dfaces.size() + 1, 0);
+    for (size_t i = 0; i < bsp->dfaces.size(); i++) {
+        vertex_normal_offsets[i + 1] = vertex_normal_offsets[i] + std::max(0, bsp->dfaces[i].numedges);
+    }
+    vertex_normals.assign(vertex_normal_offsets.back(), face_normal_t{});
+
+    // finally do the smoothing for each face, straight into its own slots
+    logging::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(), [&](size_t i) {
+        const mface_t &f = bsp->dfaces[i];
 
-            normalsMutex.lock();
-            vertex_normals[&f].push_back(smoothedNormals[v]);
-            normalsMutex.unlock();
+        if (f.numedges < 3) {
+            logging::funcprint("face {} is degenerate with {} edges\n", i, f.numedges);
+            for (int j = 0; j < f.numedges; j++) {
+                logging::print("                         vert at {}\n", Face_PointAtIndex(bsp, &f, j));
+            }
+            return;
         }
+
+        SmoothFaceNormals(bsp, &f, phong, vertex_normals.data() + vertex_normal_offsets[i]);
     });
 
     FaceCache = MakeFaceCache(bsp);
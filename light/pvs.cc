@@ -0,0 +1,205 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#include <light/pvs.hh>
+
+#include <common/bspfile.hh>
+#include <common/bsputils.hh>
+#include <common/log.hh>
+
+#include <algorithm>
+#include <string_view>
+
+// appends the row, unless an identical one is already stored; returns its index
+int32_t pvs_table_t::add_row(
+    const uint8_t *bytes, size_t numbytes, std::unordered_map<uint64_t, std::vector<int32_t>> &rows_by_hash)
+{
+    const uint64_t hash = std::hash<std::string_view>{}(std::string_view(reinterpret_cast<const char *>(bytes), numbytes));
+    auto &candidates = rows_by_hash[hash];
+
+    const size_t start = rows.size();
+    rows.resize(start + words_per_row, 0);
+
+    // bit n of the row is bit (n & 63) of word (n >> 6), regardless of host byte order
+    for (size_t i = 0; i < numbytes; i++) {
+        rows[start + (i >> 3)] |= static_cast<uint64_t>(bytes[i]) << ((i & 7) * 8);
+    }
+
+    for (const int32_t row : candidates) {
+        if (std::equal(rows.begin() + row * words_per_row, rows.begin() + (row + 1) * words_per_row,
+                rows.begin() + start)) {
+            rows.resize(start);
+            return row;
+        }
+    }
+
+    const int32_t row = static_cast<int32_t>(start / words_per_row);
+    candidates.push_back(row);
+    return row;
+}
+
+void pvs_table_t::build(const mbsp_t *bsp, const std::unordered_map<int, std::vector<uint8_t>> *uncompressed_vis)
+{
+    clear();
+
+    const size_t numbytes = DecompressedVisSize(bsp);
+
+    if (bsp->dvis.bits.empty() || !numbytes) {
+        return;
+    }
+
+    words_per_row = (numbytes + 7) / 8;
+    first_leaf = bsp->dleafs.data();
+
+    std::unordered_map<uint64_t, std::vector<int32_t>> rows_by_hash;
+    std::vector<uint8_t> scratch(numbytes, 0);
+
+    add_row(scratch.data(), numbytes, rows_by_hash);
+    std::fill(scratch.begin(), scratch.end(), 0xff);
+    add_row(scratch.data(), numbytes, rows_by_hash);
+
+    // visofs (or cluster) -> row; many leafs share one when func_detail is used
+    std::unordered_map<int, int32_t> row_for_key;
+    const bool is_q2 = bsp->loadversion->game->id == GAME_QUAKE_II;
+
+    leaf_rows.assign(bsp->dleafs.size(), -1);
+    leaf_bits.assign(bsp->dleafs.size(), -1);
+
+    for (size_t leafnum = 0; leafnum < bsp->dleafs.size(); leafnum++) {
+        const mleaf_t &leaf = bsp->dleafs[leafnum];
+        int key;
+        size_t offset;
+
+        if (is_q2) {
+            if (leaf.cluster < 0) {
+                continue;
+            }
+
+            key = leaf.cluster;
+
+            if (leaf.cluster >= bsp->dvis.bit_offsets.size() ||
+                bsp->dvis.get_bit_offset(VIS_PVS, leaf.cluster) >= bsp->dvis.bits.size()) {
+                logging::print("pvs_table_t::build: invalid visofs for cluster {}\n", leaf.cluster);
+                continue;
+            }
+
+            offset = bsp->dvis.get_bit_offset(VIS_PVS, leaf.cluster);
+            leaf_bits[leafnum] = leaf.cluster;
+        } else {
+            const int visleaf = LeafnumToVisleaf(leafnum);
+
+            // leaf 0 is the shared solid leaf, which can't be seen into
+            if (leafnum != 0 && visleaf < bsp->dmodels[0].visleafs && visleaf < numbytes * 8) {
+                leaf_bits[leafnum] = visleaf;
+            }
+
+            if (leaf.visofs < 0) {
+                continue;
+            }
+
+            key = leaf.visofs;
+
+            if (leaf.visofs >= bsp->dvis.bits.size()) {
+                logging::print("pvs_table_t::build: invalid visofs for leaf {}\n", leafnum);
+                continue;
+            }
+
+            offset = leaf.visofs;
+        }
+
+        if (auto it = row_for_key.find(key); it != row_for_key.end()) {
+            leaf_rows[leafnum] = it->second;
+            continue;
+        }
+
+        std::fill(scratch.begin(), scratch.end(), 0);
+
+        if (uncompressed_vis) {
+            auto it = uncompressed_vis->find(key);
+
+            if (it == uncompressed_vis->end()) {
+                continue;
+            }
+
+            std::copy_n(it->second.begin(), std::min(numbytes, it->second.size()), scratch.begin());
+        } else {
+            DecompressVis(bsp->dvis.bits.data() + offset, bsp->dvis.bits.data() + bsp->dvis.bits.size(),
+                scratch.data(), scratch.data() + numbytes);
+        }
+
+        leaf_rows[leafnum] = row_for_key[key] = add_row(scratch.data(), numbytes, rows_by_hash);
+    }
+
+    rows.shrink_to_fit();
+
+    logging::print(logging::flag::STAT, "PVS: {} unique rows for {} visdata offsets ({} KiB)\n", num_rows(),
+        row_for_key.size(), memory_bytes() / 1024);
+}
+
+void pvs_table_t::clear()
+{
+    words_per_row = 0;
+    rows = {};
+    leaf_rows = {};
+    leaf_bits = {};
+    first_leaf = nullptr;
+}
+
+size_t pvs_table_t::memory_bytes() const
+{
+    return rows.capacity() * sizeof(uint64_t) + leaf_rows.capacity() * sizeof(int32_t) +
+           leaf_bits.capacity() * sizeof(int32_t);
+}
+
+const uint64_t *pvs_table_t::none_visible() const
+{
+    return words_per_row ? rows.data() : nullptr;
+}
+
+const uint64_t *pvs_table_t::all_visible() const
+{
+    return words_per_row ? rows.data() + words_per_row : nullptr;
+}
+
+void pvs_row_t::set(const uint64_t *row)
+{
+    shared = row;
+    merged.clear();
+}
+
+void pvs_row_t::merge(const uint64_t *row, size_t words)
+{
+    if (!data()) {
+        shared = row;
+        return;
+    }
+
+    // leafs sharing a row (e.g. func_detail) don't need a copy
+    if (row == data()) {
+        return;
+    }
+
+    if (merged.empty()) {
+        merged.assign(shared, shared + words);
+    }
+
+    for (size_t i = 0; i < words; i++) {
+        merged[i] |= row[i];
+    }
+}
@@ -0,0 +1,267 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#include <light/raystats.hh>
+
+#include <common/cmdlib.hh>
+#include <common/json.hh>
+#include <common/log.hh>
+
+#include <array>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace raystats
+{
+static constexpr size_t num_categories = static_cast<size_t>(category_t::count);
+
+static constexpr const char *category_names[num_categories] = {
+    "light", "sun", "surflight", "bounce", "minlight", "dirt"};
+
+using pass_counters_t = std::array<counters_t, num_categories>;
+
+// counters of one thread, indexed by pass; only that thread writes to them,
+// they're only read once the parallel loops are done
+struct thread_counters_t
+{
+    std::vector<pass_counters_t> passes;
+};
+
+struct pass_t
+{
+    std::string name;
+    time_point start;
+    std::optional<time_point> end;
+};
+
+// guards registry
+static std::mutex registry_lock;
+// one per thread that has ever counted anything; never shrinks, as threads
+// keep a pointer to theirs
+static std::vector<std::unique_ptr<thread_counters_t>> registry;
+
+// only touched from the main thread
+static std::vector<pass_t> passes;
+static std::atomic<int> current_pass = -1;
+// bumped by end_pass() and reset(); the active_* values below of any thread
+// are only used while their epoch still matches, so a filter callback after
+// a pass has ended isn't counted against it (or against whatever pass reuses
+// its index after a reset)
+static std::atomic<uint32_t> epoch = 0;
+
+static thread_local thread_counters_t *local_counters = nullptr;
+// what the last local() call on this thread returned; kept as indices rather
+// than a pointer, as passes may be resized or cleared in the meantime
+static thread_local int active_pass = -1;
+static thread_local category_t active_category;
+static thread_local uint32_t active_epoch = 0;
+// counts made outside of a pass end up here
+static thread_local counters_t discarded;
+
+counters_t &counters_t::operator+=(const counters_t &other)
+{
+    traces += other.traces;
+    rays += other.rays;
+    occluded += other.occluded;
+    filtered += other.filtered;
+    vpls += other.vpls;
+    return *this;
+}
+
+void begin_pass(const std::string &name)
+{
+    end_pass();
+
+    passes.push_back({name, I_FloatTime()});
+    current_pass = static_cast<int>(passes.size() - 1);
+}
+
+void end_pass()
+{
+    if (current_pass == -1) {
+        return;
+    }
+
+    passes[current_pass].end = I_FloatTime();
+    current_pass = -1;
+    epoch++;
+    active_pass = -1;
+}
+
+counters_t &local(category_t category)
+{
+    const int pass = current_pass.load(std::memory_order_relaxed);
+
+    active_pass = pass;
+    active_category = category;
+    active_epoch = epoch.load(std::memory_order_relaxed);
+
+    if (pass == -1) {
+        return discarded;
+    }
+
+    if (!local_counters) {
+        std::unique_lock lock(registry_lock);
+        local_counters = registry.emplace_back(std::make_unique<thread_counters_t>()).get();
+    }
+
+    if (local_counters->passes.size() <= pass) {
+        local_counters->passes.resize(pass + 1);
+    }
+
+    return local_counters->passes[pass][static_cast<size_t>(category)];
+}
+
+void count_filtered()
+{
+    if (active_pass == -1 || active_epoch != epoch.load(std::memory_order_relaxed) ||
+        active_pass >= local_counters->passes.size()) {
+        return;
+    }
+
+    local_counters->passes[active_pass][static_cast<size_t>(active_category)].filtered++;
+}
+
+// sums up the counters of all threads, per pass
+static std::vector<pass_counters_t> collect()
+{
+    std::unique_lock lock(registry_lock);
+    std::vector<pass_counters_t> totals(passes.size());
+
+    for (auto &thread : registry) {
+        for (size_t i = 0; i < thread->passes.size() && i < totals.size(); i++) {
+            for (size_t c = 0; c < num_categories; c++) {
+                totals[i][c] += thread->passes[i][c];
+            }
+        }
+    }
+
+    return totals;
+}
+
+static double pass_seconds(const pass_t &pass)
+{
+    return (pass.end.value_or(I_FloatTime()) - pass.start).count();
+}
+
+static uint64_t pass_rays(const pass_counters_t &counters)
+{
+    uint64_t rays = 0;
+
+    for (auto &c : counters) {
+        rays += c.rays;
+    }
+
+    return rays;
+}
+
+static double percent(uint64_t n, uint64_t total)
+{
+    return total ? (n * 100.0) / total : 0.0;
+}
+
+void print()
+{
+    if (passes.empty()) {
+        return;
+    }
+
+    const auto totals = collect();
+
+    logging::print(logging::flag::STAT, "\nray stats:\n");
+    logging::print(logging::flag::STAT, "{:<12} {:<10} {:>12} {:>14} {:>20} {:>12} {:>12}\n", "pass", "category",
+        "traces", "rays", "occluded", "filtered", "vpls");
+
+    for (size_t i = 0; i < passes.size(); i++) {
+        for (size_t c = 0; c < num_categories; c++) {
+            const counters_t &counters = totals[i][c];
+
+            if (!counters.traces) {
+                continue;
+            }
+
+            logging::print(logging::flag::STAT, "{:<12} {:<10} {:>12} {:>14} {:>12} ({:5.1f}%) {:>12} {:>12}\n",
+                passes[i].name, category_names[c], counters.traces, counters.rays, counters.occluded,
+                percent(counters.occluded, counters.rays), counters.filtered, counters.vpls);
+        }
+
+        const double seconds = pass_seconds(passes[i]);
+        const uint64_t rays = pass_rays(totals[i]);
+
+        logging::print(logging::flag::STAT, "{:<12} {} rays in {:.3f} seconds, {:.0f} rays/sec\n", passes[i].name,
+            rays, seconds, seconds > 0 ? rays / seconds : 0.0);
+    }
+}
+
+void write_json(const fs::path &path)
+{
+    const auto totals = collect();
+    json j = json::array();
+
+    for (size_t i = 0; i < passes.size(); i++) {
+        const double seconds = pass_seconds(passes[i]);
+        const uint64_t rays = pass_rays(totals[i]);
+
+        json categories = json::object();
+
+        for (size_t c = 0; c < num_categories; c++) {
+            const counters_t &counters = totals[i][c];
+
+            categories[category_names[c]] = {
+                {"traces", counters.traces},
+                {"rays", counters.rays},
+                {"occluded", counters.occluded},
+                {"filtered", counters.filtered},
+                {"vpls", counters.vpls},
+            };
+        }
+
+        j.push_back({
+            {"name", passes[i].name},
+            {"seconds", seconds},
+            {"rays", rays},
+            {"rays_per_second", seconds > 0 ? rays / seconds : 0.0},
+            {"categories", categories},
+        });
+    }
+
+    std::ofstream(path, std::ios_base::out | std::ios_base::trunc) << std::setw(4) << json{{"passes", j}};
+
+    logging::print("wrote ray stats to {}\n", path);
+}
+
+void reset()
+{
+    std::unique_lock lock(registry_lock);
+
+    for (auto &thread : registry) {
+        thread->passes.clear();
+    }
+
+    passes.clear();
+    current_pass = -1;
+    epoch++;
+    active_pass = -1;
+}
+} // namespace raystats
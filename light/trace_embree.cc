@@ -20,10 +20,12 @@
 #include <light/trace_embree.hh>
 
 #include <light/light.hh>
+#include <light/raystats.hh>
 #include <light/trace.hh> // for SampleTexture
 
 #include <common/bsputils.hh>
 #include <common/polylib.hh>
+#include <atomic>
 #include <vector>
 #include <climits>
 #include <set>
@@ -40,8 +42,12 @@ RTCScene scene;
 
 static const mbsp_t *bsp_static;
 
+static std::atomic<size_t> raystream_reserve = 0;
+thread_local static raystream_pool_t raystream_pool;
+
 void ResetEmbree()
 {
+    raystream_reserve = 0;
     skygeom = {};
     solidgeom = {};
     filtergeom = {};
@@ -299,6 +305,26 @@ inline qvec3f Embree_RayEndpoint(RTCRayN *ray, const qvec3f &dir, size_t N, size
     return org + (dir * tfar);
 }
 
+void Embree_ReserveRayStreams(size_t rays)
+{
+    raystream_reserve = rays;
+}
+
+raystream_pool_t &Embree_LocalRayStreams()
+{
+    // reserve on first use in each worker, rather than growing a ray at a time during the first faces
+    const size_t reserve = raystream_reserve.load(std::memory_order_relaxed);
+
+    if (raystream_pool.occlusion.capacity() < reserve) {
+        raystream_pool.occlusion.reserve(reserve);
+    }
+    if (raystream_pool.intersection.capacity() < reserve) {
+        raystream_pool.intersection.reserve(reserve);
+    }
+
+    return raystream_pool;
+}
+
 static void AddGlassToRay(ray_source_info *context, unsigned rayIndex, float opacity, const qvec3f &glasscolor);
 static void AddDynamicOccluderToRay(ray_source_info *context, unsigned rayIndex, int style);
 
@@ -379,6 +405,8 @@ static void Embree_FilterFuncN(const struct RTCFilterFunctionNArguments *args)
 
         // test fence textures and glass
         if (hit_triinfo.is_fence || hit_triinfo.is_glass) {
+            raystats::count_filtered();
+
             qvec3f rayDir =
                 qv::normalize(qvec3f{RTCRayN_dir_x(ray, N, i), RTCRayN_dir_y(ray, N, i), RTCRayN_dir_z(ray, N, i)});
             qvec3f hitpoint = Embree_RayEndpoint(ray, rayDir, N, i);
@@ -22,6 +22,7 @@
 #include <light/write.hh>
 
 #include <common/log.hh>
+#include <common/profiler.hh>
 #include <common/parallel.hh>
 #include <common/litfile.hh>
 
@@ -83,19 +84,16 @@ void WriteLuxFile(const mbsp_t *bsp, const fs::path &filename, int version, cons
 }
 
 /*
- * Return space for the lightmap and colourmap at the same time so it can
- * be done in a thread-safe manner.
- *
- * size is the number of greyscale pixels = number of bytes to allocate
- * and return in *lightdata
+ * Return space for a lightmap block of `size` greyscale bytes; the colour, lux
+ * and HDR data go at the same offset (times 3, 3 and 4) in their own buffers.
  */
-static inline int GetFileSpace(std::atomic_size_t &offset, size_t size)
+static inline int GetFileSpace(size_t &offset, size_t size)
 {
-    size_t v = offset.fetch_add(align_value<4>(size));
+    const size_t v = offset;
+    offset += align_value<4>(size);
 
-    // early check
-    if (v > std::numeric_limits<int>::max())
-        FError("exceeded max lightmap space");
+    if (offset > static_cast<size_t>(light_options.maxlightdata.value()))
+        FError("exceeded max lightmap space ({} bytes, limit {})", offset, light_options.maxlightdata.value());
 
     return v;
 }
@@ -103,109 +101,77 @@ static inline int GetFileSpace(std::atomic_size_t &offset, size_t size)
 std::atomic<uint32_t> fully_transparent_lightmaps;
 static bool warned_about_light_map_overflow, warned_about_light_style_overflow;
 
-static std::vector<qvec4f> LightmapColorsToGLMVector(const lightsurf_t *lightsurf, const lightmap_t *lm)
+// per-thread bump allocator for the float images of the lightmap being written.
+// reset() hands everything back at once and keeps the blocks, so once the biggest
+// face has come along, writing a lightmap doesn't allocate at all.
+class lightmap_arena_t
+{
+    struct block_t
+    {
+        std::unique_ptr<qvec4f[]> data;
+        size_t size, used = 0;
+    };
+
+    std::vector<block_t> blocks;
+    size_t current = 0;
+
+public:
+    // n uninitialized samples, valid until the next reset()
+    qvec4f *take(size_t n)
+    {
+        for (; current < blocks.size(); current++) {
+            block_t &block = blocks[current];
+
+            if (block.size - block.used >= n) {
+                qvec4f *result = block.data.get() + block.used;
+                block.used += n;
+                return result;
+            }
+        }
+
+        const size_t size = std::max(n, static_cast<size_t>(16384));
+        block_t &block = blocks.emplace_back(block_t{std::make_unique_for_overwrite<qvec4f[]>(size), size, n});
+        return block.data.get();
+    }
+
+    void reset()
+    {
+        for (block_t &block : blocks) {
+            block.used = 0;
+        }
+
+        current = 0;
+    }
+};
+
+static thread_local lightmap_arena_t lightmap_arena;
+// the input column for each output column of the lightmap being written
+static thread_local std::vector<int> lightmap_columns;
+
+static void LightmapColorsToImage(const lightsurf_t *lightsurf, const lightmap_t *lm, qvec4f *res)
 {
-    std::vector<qvec4f> res;
     for (int i = 0; i < lightsurf->samples.size(); i++) {
         const qvec3f &color = lm->samples[i].color;
         const float alpha = lightsurf->samples[i].occluded ? 0.0f : 1.0f;
-        res.emplace_back(color[0], color[1], color[2], alpha);
+        res[i] = {color[0], color[1], color[2], alpha};
     }
-    return res;
 }
 
-static std::vector<qvec4f> LightmapNormalsToGLMVector(const lightsurf_t *lightsurf, const lightmap_t *lm)
+static void LightmapNormalsToImage(const lightsurf_t *lightsurf, const lightmap_t *lm, qvec4f *res)
 {
-    std::vector<qvec4f> res;
     for (int i = 0; i < lightsurf->samples.size(); i++) {
         const qvec3f &color = lm->samples[i].direction;
         const float alpha = lightsurf->samples[i].occluded ? 0.0f : 1.0f;
-        res.emplace_back(color[0], color[1], color[2], alpha);
-    }
-    return res;
-}
-
-// Special handling of alpha channel:
-// - "alpha channel" is expected to be 0 or 1. This gets set to 0 if the sample
-// point is occluded (bmodel sticking outside of the world, or inside a shadow-
-// casting bmodel that is overlapping a world face), otherwise it's 1.
-//
-// - If alpha is 0 the sample doesn't contribute to the filter kernel.
-// - If all the samples in the filter kernel have alpha=0, write a sample with alpha=0
-//   (but still average the colors, important so that minlight still works properly
-//    for bmodels that go outside of the world).
-static std::vector<qvec4f> IntegerDownsampleImage(const std::vector<qvec4f> &input, int w, int h, int factor)
-{
-    Q_assert(factor >= 1);
-    if (factor == 1)
-        return input;
-
-    const int outw = w / factor;
-    const int outh = h / factor;
-
-    std::vector<qvec4f> res(static_cast<size_t>(outw * outh));
-
-    for (int y = 0; y < outh; y++) {
-        for (int x = 0; x < outw; x++) {
-
-            float totalWeight = 0.0f;
-            qvec3f totalColor{};
-
-            // These are only used if all the samples in the kernel have alpha = 0
-            float totalWeightIgnoringOcclusion = 0.0f;
-            qvec3f totalColorIgnoringOcclusion{};
-
-            const int extraradius = 0;
-            const int kernelextent = factor + (2 * extraradius);
-
-            for (int y0 = 0; y0 < kernelextent; y0++) {
-                for (int x0 = 0; x0 < kernelextent; x0++) {
-                    const int x1 = (x * factor) - extraradius + x0;
-                    const int y1 = (y * factor) - extraradius + y0;
-
-                    // check if the kernel goes outside of the source image
-                    if (x1 < 0 || x1 >= w)
-                        continue;
-                    if (y1 < 0 || y1 >= h)
-                        continue;
-
-                    // read the input sample
-                    const float weight = 1.0f;
-                    const qvec4f &inSample = input.at((y1 * w) + x1);
-
-                    totalColorIgnoringOcclusion += qvec3f(inSample) * weight;
-                    totalWeightIgnoringOcclusion += weight;
-
-                    // Occluded sample points don't contribute to the filter
-                    if (inSample[3] == 0.0f)
-                        continue;
-
-                    totalColor += qvec3f(inSample) * weight;
-                    totalWeight += weight;
-                }
-            }
-
-            const int outIndex = (y * outw) + x;
-            if (totalWeight > 0.0f) {
-                const qvec3f tmp = totalColor / totalWeight;
-                const qvec4f resultColor = qvec4f(tmp[0], tmp[1], tmp[2], 1.0f);
-                res[outIndex] = resultColor;
-            } else {
-                const qvec3f tmp = totalColorIgnoringOcclusion / totalWeightIgnoringOcclusion;
-                const qvec4f resultColor = qvec4f(tmp[0], tmp[1], tmp[2], 0.0f);
-                res[outIndex] = resultColor;
-            }
-        }
+        res[i] = {color[0], color[1], color[2], alpha};
     }
-
-    return res;
 }
 
-static std::vector<qvec4f> FloodFillTransparent(const std::vector<qvec4f> &input, int w, int h)
+static void FloodFillTransparent(qvec4f *res, int w, int h, bool highlightseams)
 {
     // transparent pixels take the average of their neighbours.
-
-    std::vector<qvec4f> res(input);
+    // each sweep reads the pixels filled earlier in the same sweep, as it always has.
+    // with highlightseams, they're all painted red in the first sweep instead.
+    const int size = w * h;
 
     while (1) {
         int unhandled_pixels = 0;
@@ -213,34 +179,34 @@ static std::vector<qvec4f> FloodFillTransparent(const std::vector<qvec4f> &input
         for (int y = 0; y < h; y++) {
             for (int x = 0; x < w; x++) {
                 const int i = (y * w) + x;
-                const qvec4f &inSample = res.at(i);
 
-                if (inSample[3] == 0) {
+                if (res[i][3] == 0) {
+                    if (highlightseams) {
+                        res[i] = qvec4f(255, 0, 0, 1);
+                        continue;
+                    }
+
                     // average the neighbouring non-transparent samples
 
                     int opaque_neighbours = 0;
                     qvec3f neighbours_sum{};
-                    for (int y0 = -1; y0 <= 1; y0++) {
-                        for (int x0 = -1; x0 <= 1; x0++) {
-                            const int x1 = x + x0;
-                            const int y1 = y + y0;
 
-                            if (x1 < 0 || x1 >= w)
-                                continue;
-                            if (y1 < 0 || y1 >= h)
-                                continue;
+                    const int y_first = std::max(y - 1, 0), y_last = std::min(y + 1, h - 1);
+                    const int x_first = std::max(x - 1, 0), x_last = std::min(x + 1, w - 1);
 
-                            const qvec4f neighbourSample = res.at((y1 * w) + x1);
+                    for (int y1 = y_first; y1 <= y_last; y1++) {
+                        for (int x1 = x_first; x1 <= x_last; x1++) {
+                            const qvec4f &neighbourSample = res[(y1 * w) + x1];
                             if (neighbourSample[3] == 1) {
                                 opaque_neighbours++;
-                                neighbours_sum += qvec3f(neighbourSample);
+                                neighbours_sum += neighbourSample.xyz();
                             }
                         }
                     }
 
                     if (opaque_neighbours > 0) {
                         neighbours_sum *= (1.0f / (float)opaque_neighbours);
-                        res.at(i) = qvec4f(neighbours_sum[0], neighbours_sum[1], neighbours_sum[2], 1.0f);
+                        res[i] = qvec4f(neighbours_sum[0], neighbours_sum[1], neighbours_sum[2], 1.0f);
 
                         // this sample is now opaque
                     } else {
@@ -253,7 +219,7 @@ static std::vector<qvec4f> FloodFillTransparent(const std::vector<qvec4f> &input
             }
         }
 
-        if (unhandled_pixels == input.size()) {
+        if (unhandled_pixels == size) {
             // logging::funcprint("warning, fully transparent lightmap\n");
             fully_transparent_lightmaps++;
             break;
@@ -262,90 +228,160 @@ static std::vector<qvec4f> FloodFillTransparent(const std::vector<qvec4f> &input
         if (unhandled_pixels == 0)
             break; // all done
     }
-
-    return res;
 }
 
-static std::vector<qvec4f> HighlightSeams(const std::vector<qvec4f> &input, int w, int h)
+// Special handling of alpha channel:
+// - "alpha channel" is expected to be 0 or 1. This gets set to 0 if the sample
+// point is occluded (bmodel sticking outside of the world, or inside a shadow-
+// casting bmodel that is overlapping a world face), otherwise it's 1.
+//
+// - If alpha is 0 the sample doesn't contribute to the filter kernel.
+// - If all the samples in the filter kernel have alpha=0, write a sample with alpha=0
+//   (but still average the colors, important so that minlight still works properly
+//    for bmodels that go outside of the world).
+template<typename F>
+static inline qvec4f AverageKernel(int kernel_w, int kernel_h, F &&sample)
 {
-    std::vector<qvec4f> res(input);
+    float totalWeight = 0.0f;
+    qvec3f totalColor{};
 
-    for (int y = 0; y < h; y++) {
-        for (int x = 0; x < w; x++) {
-            const int i = (y * w) + x;
-            const qvec4f &inSample = res.at(i);
+    // These are only used if all the samples in the kernel have alpha = 0
+    float totalWeightIgnoringOcclusion = 0.0f;
+    qvec3f totalColorIgnoringOcclusion{};
 
-            if (inSample[3] == 0) {
-                res.at(i) = qvec4f(255, 0, 0, 1);
-            }
+    for (int y0 = 0; y0 < kernel_h; y0++) {
+        for (int x0 = 0; x0 < kernel_w; x0++) {
+            const qvec4f &inSample = sample(x0, y0);
+            const qvec3f inColor = inSample.xyz();
+
+            totalColorIgnoringOcclusion += inColor;
+            totalWeightIgnoringOcclusion += 1.0f;
+
+            // Occluded sample points don't contribute to the filter
+            if (inSample[3] == 0.0f)
+                continue;
+
+            totalColor += inColor;
+            totalWeight += 1.0f;
         }
     }
 
-    return res;
+    if (totalWeight > 0.0f) {
+        const qvec3f tmp = totalColor / totalWeight;
+        return qvec4f(tmp[0], tmp[1], tmp[2], 1.0f);
+    } else {
+        const qvec3f tmp = totalColorIgnoringOcclusion / totalWeightIgnoringOcclusion;
+        return qvec4f(tmp[0], tmp[1], tmp[2], 0.0f);
+    }
 }
 
-static std::vector<qvec4f> BoxBlurImage(const std::vector<qvec4f> &input, int w, int h, int radius)
+/*
+ * Hands out the rows of a lightmap box blurred by `soft` and then downsampled
+ * by `extra`, one output row at a time. Only the `extra` blurred rows behind
+ * the current output row are kept, so the full size blurred image is never
+ * stored, and the caller can quantize each row while it's still in cache.
+ * Rows must be asked for in increasing order; asking for the same row again
+ * is free.
+ */
+class lightmap_rows_t
 {
-    std::vector<qvec4f> res(input.size());
+    const qvec4f *image;
+    int w, h, extra, soft;
+    int outw;
+    qvec4f *tile = nullptr; // extra blurred rows
+    qvec4f *out_row = nullptr;
+    int current = -1;
+
+    // 2017-09-16: this is a hack, but clamping the
+    // x/y instead of discarding the samples outside of the
+    // kernel looks better in some cases:
+    // https://github.com/ericwa/ericw-tools/issues/171
+    void blur_row(int y, qvec4f *res) const
+    {
+        const int size = 2 * soft + 1;
 
-    for (int y = 0; y < h; y++) {
         for (int x = 0; x < w; x++) {
+            res[x] = AverageKernel(size, size, [&](int x0, int y0) -> const qvec4f & {
+                return image[(std::clamp(y + y0 - soft, 0, h - 1) * w) + std::clamp(x + x0 - soft, 0, w - 1)];
+            });
+        }
+    }
 
-            float totalWeight = 0.0f;
-            qvec3f totalColor{};
+public:
+    lightmap_rows_t(lightmap_arena_t &arena, const qvec4f *image, int w, int h, int extra, int soft)
+        : image(image),
+          w(w),
+          h(h),
+          extra(extra),
+          soft(soft),
+          outw(w / extra)
+    {
+        Q_assert(extra >= 1);
+
+        if (soft > 0) {
+            tile = arena.take(static_cast<size_t>(w) * extra);
+        }
 
-            // These are only used if all the samples in the kernel have alpha = 0
-            float totalWeightIgnoringOcclusion = 0.0f;
-            qvec3f totalColorIgnoringOcclusion{};
+        if (extra > 1) {
+            out_row = arena.take(outw);
+        }
+    }
 
-            for (int y0 = -radius; y0 <= radius; y0++) {
-                for (int x0 = -radius; x0 <= radius; x0++) {
-                    const int x1 = std::clamp(x + x0, 0, w - 1);
-                    const int y1 = std::clamp(y + y0, 0, h - 1);
+    const qvec4f *row(int y)
+    {
+        if (extra == 1 && soft <= 0) {
+            return image + (y * w);
+        }
 
-                    // check if the kernel goes outside of the source image
+        if (y == current) {
+            return extra > 1 ? out_row : tile;
+        }
 
-                    // 2017-09-16: this is a hack, but clamping the
-                    // x/y instead of discarding the samples outside of the
-                    // kernel looks better in some cases:
-                    // https://github.com/ericwa/ericw-tools/issues/171
-#if 0
-                    if (x1 < 0 || x1 >= w)
-                        continue;
-                    if (y1 < 0 || y1 >= h)
-                        continue;
-#endif
+        Q_assert(y > current);
+        current = y;
 
-                    // read the input sample
-                    const float weight = 1.0f;
-                    const qvec4f &inSample = input.at((y1 * w) + x1);
+        // the source rows of this output row; the kernel never goes outside of the
+        // source image, since outw * extra <= w
+        const qvec4f *rows = image + (y * extra * w);
 
-                    totalColorIgnoringOcclusion += qvec3f(inSample) * weight;
-                    totalWeightIgnoringOcclusion += weight;
+        if (soft > 0) {
+            for (int y0 = 0; y0 < extra; y0++) {
+                blur_row(y * extra + y0, tile + (y0 * w));
+            }
 
-                    // Occluded sample points don't contribute to the filter
-                    if (inSample[3] == 0.0f)
-                        continue;
+            rows = tile;
+        }
 
-                    totalColor += qvec3f(inSample) * weight;
-                    totalWeight += weight;
-                }
-            }
+        if (extra == 1) {
+            return tile;
+        }
 
-            const int outIndex = (y * w) + x;
-            if (totalWeight > 0.0f) {
-                const qvec3f tmp = totalColor / totalWeight;
-                const qvec4f resultColor = qvec4f(tmp[0], tmp[1], tmp[2], 1.0f);
-                res[outIndex] = resultColor;
-            } else {
-                const qvec3f tmp = totalColorIgnoringOcclusion / totalWeightIgnoringOcclusion;
-                const qvec4f resultColor = qvec4f(tmp[0], tmp[1], tmp[2], 0.0f);
-                res[outIndex] = resultColor;
-            }
+        for (int x = 0; x < outw; x++) {
+            out_row[x] = AverageKernel(
+                extra, extra, [&](int x0, int y0) -> const qvec4f & { return rows[(y0 * w) + (x * extra) + x0]; });
         }
+
+        return out_row;
+    }
+};
+
+void PostProcessLightmap(std::vector<qvec4f> &image, int width, int height, int extra, int soft, bool highlightseams)
+{
+    lightmap_arena_t &arena = lightmap_arena;
+    arena.reset();
+
+    // removes all transparent pixels by averaging from adjacent pixels
+    FloodFillTransparent(image.data(), width, height, highlightseams);
+
+    const int outw = width / extra, outh = height / extra;
+    lightmap_rows_t rows(arena, image.data(), width, height, extra, soft);
+    qvec4f *res = arena.take(static_cast<size_t>(outw) * outh);
+
+    for (int y = 0; y < outh; y++) {
+        std::copy_n(rows.row(y), outw, res + (y * outw));
     }
 
-    return res;
+    image.assign(res, res + (outw * outh));
 }
 
 static constexpr float HDR_ONE = 128.0f; // logical value for 1.0 lighting (quake's overbrights give 255).
@@ -362,43 +398,50 @@ static void WriteSingleLightmap(const mbsp_t *bsp, const mface_t *face, const li
     const int oversampled_width = actual_width * light_options.extra.value();
     const int oversampled_height = actual_height * light_options.extra.value();
 
-    // allocate new float buffers for the output colors and directions
-    // these are the actual output width*height, without oversampling.
+    // one pass over the output rows: each is filtered from the oversampled
+    // lightmap just before it's quantized, using buffers from the per-thread arena
+    lightmap_arena_t &arena = lightmap_arena;
+    arena.reset();
 
-    std::vector<qvec4f> fullres = LightmapColorsToGLMVector(lightsurf, lm);
-
-    if (light_options.highlightseams.value()) {
-        fullres = HighlightSeams(fullres, oversampled_width, oversampled_height);
-    }
+    qvec4f *color_image = arena.take(lightsurf->samples.size());
+    LightmapColorsToImage(lightsurf, lm, color_image);
 
     // removes all transparent pixels by averaging from adjacent pixels
-    fullres = FloodFillTransparent(fullres, oversampled_width, oversampled_height);
+    FloodFillTransparent(
+        color_image, oversampled_width, oversampled_height, light_options.highlightseams.value());
 
-    if (light_options.soft.value() > 0) {
-        fullres = BoxBlurImage(fullres, oversampled_width, oversampled_height, light_options.soft.value());
-    }
+    lightmap_rows_t color_rows(arena, color_image, oversampled_width, oversampled_height, light_options.extra.value(),
+        light_options.soft.value());
 
-    const std::vector<qvec4f> output_color =
-        IntegerDownsampleImage(fullres, oversampled_width, oversampled_height, light_options.extra.value());
-    std::optional<std::vector<qvec4f>> output_dir;
+    std::optional<lightmap_rows_t> dir_rows;
 
     if (lux) {
-        output_dir = IntegerDownsampleImage(LightmapNormalsToGLMVector(lightsurf, lm), oversampled_width,
-            oversampled_height, light_options.extra.value());
+        qvec4f *dir_image = arena.take(lightsurf->samples.size());
+        LightmapNormalsToImage(lightsurf, lm, dir_image);
+        dir_rows.emplace(arena, dir_image, oversampled_width, oversampled_height, light_options.extra.value(), 0);
     }
 
     // copy from the float buffers to byte buffers in .bsp / .lit / .lux
     const int output_width = output_extents.width();
     const int output_height = output_extents.height();
 
+    // the input column for each output column, worked out once per face rather than per luxel
+    std::vector<int> &columns = lightmap_columns;
+    columns.resize(output_width);
+    for (int s = 0; s < output_width; s++) {
+        columns[s] = (s / (float)output_width) * actual_width;
+    }
+
     for (int t = 0; t < output_height; t++) {
+        const int input_sample_t = (t / (float)output_height) * actual_height;
+        const qvec4f *color_row = color_rows.row(input_sample_t);
+        const qvec4f *dir_row = dir_rows ? dir_rows->row(input_sample_t) : nullptr;
+
         for (int s = 0; s < output_width; s++) {
-            const int input_sample_s = (s / (float)output_width) * actual_width;
-            const int input_sample_t = (t / (float)output_height) * actual_height;
-            const int sampleindex = (input_sample_t * actual_width) + input_sample_s;
+            const int input_sample_s = columns[s];
 
             if (lit || out) {
-                qvec4f color = output_color.at(sampleindex);
+                qvec4f color = color_row[input_sample_s];
 
                 if (hdr) {
                     uint32_t c = HDR_PackE5BRG9(color / HDR_ONE);
@@ -441,7 +484,7 @@ static void WriteSingleLightmap(const mbsp_t *bsp, const mface_t *face, const li
             }
 
             if (lux) {
-                qvec3f direction = output_dir->at(sampleindex).xyz();
+                qvec3f direction = dir_row[input_sample_s].xyz();
                 qvec3f temp = {qv::dot(direction, lightsurf->snormal), qv::dot(direction, lightsurf->tnormal),
                     qv::dot(direction, lightsurf->plane.normal)};
 
@@ -471,20 +514,25 @@ static void WriteSingleLightmap_FromDecoupled(const mbsp_t *bsp, const mface_t *
     uint8_t *hdr)
 {
     // this is the lightmap data in the "decoupled" coordinate system
-    std::vector<qvec4f> fullres = LightmapColorsToGLMVector(lightsurf, lm);
+    lightmap_arena_t &arena = lightmap_arena;
+    arena.reset();
+
+    const size_t fullres_size = lightsurf->samples.size();
+    qvec4f *fullres = arena.take(fullres_size);
+    LightmapColorsToImage(lightsurf, lm, fullres);
 
     // maps a luxel in the vanilla lightmap to the corresponding position in the decoupled lightmap
     const qmat4x4f vanillaLMToDecoupled =
         lightsurf->extents.worldToLMMatrix * lightsurf->vanilla_extents.lmToWorldMatrix;
 
     // samples the "decoupled" lightmap at an integer coordinate, with clamping
-    auto tex = [&lightsurf, &fullres](int x, int y) -> qvec4f {
+    auto tex = [&lightsurf, fullres, fullres_size](int x, int y) -> qvec4f {
         const int x_clamped = std::clamp(x, 0, lightsurf->width - 1);
         const int y_clamped = std::clamp(y, 0, lightsurf->height - 1);
 
         const int sampleindex = (y_clamped * lightsurf->width) + x_clamped;
         assert(sampleindex >= 0);
-        assert(sampleindex < fullres.size());
+        assert(sampleindex < fullres_size);
 
         return fullres[sampleindex];
     };
@@ -695,7 +743,26 @@ static void SaveLitOnlyLightmapSurface(const mbsp_t *bsp, mface_t *face, lightsu
 struct lightmap_intermediate_data_t
 {
     std::vector<const lightmap_t *> sorted;
+    // into the buffers below, until the blocks are placed in the file
     int lightofs = -1, vanilla_lightofs = -1;
+
+    // the face's own lightmap data; it's written here first and hashed, so that file
+    // space is only handed out to blocks no other face already has
+    std::vector<uint8_t> filebase, lit_filebase, lux_filebase, hdr_filebase;
+
+    // the block at lightofs, and for decoupled lightmaps the vanilla one at vanilla_lightofs
+    struct block_t
+    {
+        int offset, size; // in bytes of filebase; lit/lux are 3 times that, hdr 4 times
+        size_t hash = 0;
+        int file_offset = -1;
+        bool shared = false; // an identical block of an earlier face is used instead
+    };
+
+    std::vector<block_t> blocks;
+
+    // the lightofs fields SaveLightmapSurface set, which have to be moved along with their block
+    std::vector<int32_t *> offsets;
 };
 
 // temp
@@ -703,7 +770,7 @@ extern std::vector<facesup_t> faces_sup; // lit2/bspx stuff
 extern std::vector<bspx_decoupled_lm_perface> facesup_decoupled_global;
 
 int CalculateLightmapStyles(const mbsp_t *bsp, mface_t *face, facesup_t *facesup, lightsurf_t *lightsurf,
-    const faceextents_t &extents, std::atomic_size_t &lightmap_size, lightmap_intermediate_data_t &id)
+    const faceextents_t &extents, lightmap_intermediate_data_t &id)
 {
     lightmapdict_t &lightmaps = lightsurf->lightmapsByStyle;
 
@@ -977,11 +1044,116 @@ void SaveLightmapSurface(const mbsp_t *bsp, mface_t *face, facesup_t *facesup,
     }
 }
 
+// the file buffers, or a face's own ones, with how many bytes they hold per greyscale byte
+static std::array<std::pair<std::vector<uint8_t> *, int>, 4> LightmapBuffers(std::vector<uint8_t> &filebase,
+    std::vector<uint8_t> &lit_filebase, std::vector<uint8_t> &lux_filebase, std::vector<uint8_t> &hdr_filebase)
+{
+    return {{{&filebase, 1}, {&lit_filebase, 3}, {&lux_filebase, 3}, {&hdr_filebase, 4}}};
+}
+
+static std::string_view LightmapBlockBytes(
+    const std::vector<uint8_t> &buffer, int scale, const lightmap_intermediate_data_t::block_t &block)
+{
+    return std::string_view(
+        reinterpret_cast<const char *>(buffer.data()) + (size_t)block.offset * scale, (size_t)block.size * scale);
+}
+
+static void HashLightmapBlocks(lightmap_intermediate_data_t &id)
+{
+    for (auto &block : id.blocks) {
+        size_t hash = std::hash<int>{}(block.size);
+
+        for (auto &[buffer, scale] : LightmapBuffers(id.filebase, id.lit_filebase, id.lux_filebase, id.hdr_filebase)) {
+            if (!buffer->empty()) {
+                hash = hash * 31 + std::hash<std::string_view>{}(LightmapBlockBytes(*buffer, scale, block));
+            }
+        }
+
+        block.hash = hash;
+    }
+}
+
+/*
+ * Hands out file space to every face's lightmap blocks, in face order so the output
+ * doesn't depend on thread scheduling. Unless dedup is off, a block that's byte-for-byte
+ * identical in every output (bsp, .lit, .lux, HDR) to one already placed shares its space,
+ * so only the unique blocks count against the lightmap space limit.
+ */
+static size_t PlaceLightmapBlocks(std::vector<lightmap_intermediate_data_t> &intermediate_data)
+{
+    profilefunc();
+
+    const bool dedup = !light_options.nolightmapdedup.value();
+    // (face, block) of the blocks that got space of their own
+    std::unordered_map<size_t, std::vector<std::pair<size_t, size_t>>> blocks_by_hash;
+    size_t lightmap_size = 0, num_blocks = 0, num_shared = 0;
+
+    for (size_t i = 0; i < intermediate_data.size(); i++) {
+        lightmap_intermediate_data_t &id = intermediate_data[i];
+        const auto buffers = LightmapBuffers(id.filebase, id.lit_filebase, id.lux_filebase, id.hdr_filebase);
+
+        for (size_t b = 0; b < id.blocks.size(); b++) {
+            auto &block = id.blocks[b];
+            num_blocks++;
+
+            if (dedup) {
+                auto &candidates = blocks_by_hash[block.hash];
+
+                for (auto [j, other_b] : candidates) {
+                    lightmap_intermediate_data_t &other_id = intermediate_data[j];
+                    const auto &other = other_id.blocks[other_b];
+
+                    if (other.size != block.size) {
+                        continue;
+                    }
+
+                    const auto other_buffers = LightmapBuffers(
+                        other_id.filebase, other_id.lit_filebase, other_id.lux_filebase, other_id.hdr_filebase);
+                    bool equal = true;
+
+                    for (size_t k = 0; k < buffers.size(); k++) {
+                        auto &[buffer, scale] = buffers[k];
+
+                        if (!buffer->empty() && LightmapBlockBytes(*buffer, scale, block) !=
+                                                    LightmapBlockBytes(*other_buffers[k].first, scale, other)) {
+                            equal = false;
+                            break;
+                        }
+                    }
+
+                    if (equal) {
+                        block.file_offset = other.file_offset;
+                        block.shared = true;
+                        break;
+                    }
+                }
+
+                if (!block.shared) {
+                    candidates.emplace_back(i, b);
+                }
+            }
+
+            if (block.shared) {
+                num_shared++;
+            } else {
+                block.file_offset = GetFileSpace(lightmap_size, block.size);
+            }
+        }
+    }
+
+    if (dedup) {
+        logging::print(logging::flag::STAT, "shared {} of {} lightmap blocks\n", num_shared, num_blocks);
+    }
+
+    return lightmap_size;
+}
+
 void SaveLightmapSurfaces(bspdata_t *bspdata, const fs::path &source)
 {
     mbsp_t *bsp = &std::get<mbsp_t>(bspdata->bsp);
 
     logging::funcheader();
+    profilefunc();
 
     warned_about_light_map_overflow = warned_about_light_style_overflow = false;
     fully_transparent_lightmaps = 0;
@@ -1026,12 +1198,11 @@ void SaveLightmapSurfaces(bspdata_t *bspdata, const fs::path &source)
                 bsp, f, &surf, surf.extents, surf.extents, filebase, lit_filebase, lux_filebase, hdr_filebase);
         });
     } else {
-        std::atomic_size_t lightmap_size = 0;
         std::vector<lightmap_intermediate_data_t> intermediate_data;
         intermediate_data.resize(bsp->dfaces.size());
 
-        // calculate finish lightmaps and calculate lightofs for each face.
-        // the lightofs will be set to the size in bytes.
+        // finish the lightmaps and write each face's into buffers of its own, with the
+        // lightofs relative to those, and hash them
         logging::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(), [&](size_t i) {
             auto &surf = LightSurfaces()[i];
 
@@ -1043,34 +1214,92 @@ void SaveLightmapSurfaces(bspdata_t *bspdata, const fs::path &source)
 
             auto f = &bsp->dfaces[i];
             const modelinfo_t *face_modelinfo = ModelInfoForFace(bsp, i);
+            lightmap_intermediate_data_t &id = intermediate_data[i];
             int num_styles;
+            int num_samples = surf.extents.numsamples();
+            bool write_vanilla = false;
 
             if (!facesup_decoupled_global.empty()) {
-                num_styles =
-                    CalculateLightmapStyles(bsp, f, nullptr, &surf, surf.extents, lightmap_size, intermediate_data[i]);
+                num_styles = CalculateLightmapStyles(bsp, f, nullptr, &surf, surf.extents, id);
+                write_vanilla = !light_options.novanilla.value();
+            } else if (faces_sup.empty()) {
+                num_styles = CalculateLightmapStyles(bsp, f, nullptr, &surf, surf.extents, id);
+            } else if (light_options.novanilla.value() || faces_sup[i].lmscale == face_modelinfo->lightmapscale) {
+                num_styles = CalculateLightmapStyles(bsp, f, &faces_sup[i], &surf, surf.extents, id);
+            } else {
+                num_styles = CalculateLightmapStyles(bsp, f, nullptr, &surf, surf.extents, id);
+                // the vanilla lightmap is written to the same place first
+                num_samples = std::max(num_samples, surf.vanilla_extents.numsamples());
+            }
+
+            if (!num_styles) {
+                return;
+            }
+
+            id.lightofs = 0;
+            id.blocks.push_back({0, num_samples * num_styles});
+
+            if (write_vanilla) {
+                id.vanilla_lightofs = static_cast<int>(align_value<4>(static_cast<size_t>(num_samples * num_styles)));
+                id.blocks.push_back({id.vanilla_lightofs, surf.vanilla_extents.numsamples() * num_styles});
+            }
+
+            const size_t size = id.blocks.back().offset + id.blocks.back().size;
+
+            if (!bsp->loadversion->game->has_rgb_lightmap) {
+                id.filebase.resize(size);
+            }
+
+            if (bsp->loadversion->game->has_rgb_lightmap || light_options.write_litfile) {
+                id.lit_filebase.resize(size * 3);
+            }
+
+            if (light_options.write_luxfile) {
+                id.lux_filebase.resize(size * 3);
+            }
 
-                if (!light_options.novanilla.value()) {
-                    intermediate_data[i].vanilla_lightofs =
-                        GetFileSpace(lightmap_size, surf.vanilla_extents.numsamples() * num_styles);
+            if (light_options.write_litfile & lightfile::hdr) {
+                id.hdr_filebase.resize(size * 4);
+            }
+
+            if (!facesup_decoupled_global.empty()) {
+                SaveLightmapSurface(bsp, f, nullptr, &facesup_decoupled_global[i], &surf, surf.extents, surf.extents,
+                    id.filebase, id.lit_filebase, id.lux_filebase, id.hdr_filebase, id);
+                id.offsets.push_back(&facesup_decoupled_global[i].offset);
+                if (write_vanilla) {
+                    id.offsets.push_back(&f->lightofs);
                 }
             } else if (faces_sup.empty()) {
-                num_styles =
-                    CalculateLightmapStyles(bsp, f, nullptr, &surf, surf.extents, lightmap_size, intermediate_data[i]);
+                SaveLightmapSurface(bsp, f, nullptr, nullptr, &surf, surf.extents, surf.extents, id.filebase,
+                    id.lit_filebase, id.lux_filebase, id.hdr_filebase, id);
+                id.offsets.push_back(&f->lightofs);
             } else if (light_options.novanilla.value() || faces_sup[i].lmscale == face_modelinfo->lightmapscale) {
-                num_styles = CalculateLightmapStyles(
-                    bsp, f, &faces_sup[i], &surf, surf.extents, lightmap_size, intermediate_data[i]);
+                if (faces_sup[i].lmscale == face_modelinfo->lightmapscale) {
+                    f->lightofs = faces_sup[i].lightofs;
+                } else {
+                    f->lightofs = -1;
+                }
+                SaveLightmapSurface(bsp, f, &faces_sup[i], nullptr, &surf, surf.extents, surf.extents, id.filebase,
+                    id.lit_filebase, id.lux_filebase, id.hdr_filebase, id);
+                id.offsets.push_back(&faces_sup[i].lightofs);
+                for (int j = 0; j < MAXLIGHTMAPS; j++) {
+                    f->styles[j] =
+                        faces_sup[i].styles[j] == INVALID_LIGHTSTYLE ? INVALID_LIGHTSTYLE_OLD : faces_sup[i].styles[j];
+                }
             } else {
-                num_styles =
-                    CalculateLightmapStyles(bsp, f, nullptr, &surf, surf.extents, lightmap_size, intermediate_data[i]);
-                intermediate_data[i].vanilla_lightofs =
-                    GetFileSpace(lightmap_size, surf.vanilla_extents.numsamples() * num_styles);
+                SaveLightmapSurface(bsp, f, nullptr, nullptr, &surf, surf.extents, surf.vanilla_extents, id.filebase,
+                    id.lit_filebase, id.lux_filebase, id.hdr_filebase, id);
+                SaveLightmapSurface(bsp, f, &faces_sup[i], nullptr, &surf, surf.extents, surf.extents, id.filebase,
+                    id.lit_filebase, id.lux_filebase, id.hdr_filebase, id);
+                id.offsets.push_back(&f->lightofs);
+                id.offsets.push_back(&faces_sup[i].lightofs);
             }
 
-            if (num_styles) {
-                intermediate_data[i].lightofs = GetFileSpace(lightmap_size, surf.extents.numsamples() * num_styles);
-            }
+            HashLightmapBlocks(id);
         });
 
+        const size_t lightmap_size = PlaceLightmapBlocks(intermediate_data);
+
         // allocate required space
         if (!bsp->loadversion->game->has_rgb_lightmap) {
             filebase.resize(lightmap_size);
@@ -1091,40 +1320,44 @@ void SaveLightmapSurfaces(bspdata_t *bspdata, const fs::path &source)
         logging::print(logging::flag::STAT, "lightmap size (total): {}\n",
             filebase.size() + lit_filebase.size() + lux_filebase.size() + hdr_filebase.size());
 
+        // Q2/HL faces store offsets into the RGB lightmap
+        const int ofs_scale = bsp->loadversion->game->has_rgb_lightmap ? 3 : 1;
+        const auto file_buffers = LightmapBuffers(filebase, lit_filebase, lux_filebase, hdr_filebase);
+
+        // copy the blocks into place and point the faces at them
         logging::parallel_for(static_cast<size_t>(0), bsp->dfaces.size(), [&](size_t i) {
-            auto &surf = LightSurfaces()[i];
+            lightmap_intermediate_data_t &id = intermediate_data[i];
+            const auto buffers = LightmapBuffers(id.filebase, id.lit_filebase, id.lux_filebase, id.hdr_filebase);
 
-            if (surf.samples.empty()) {
-                return;
-            }
+            for (auto &block : id.blocks) {
+                if (block.shared) {
+                    continue;
+                }
 
-            auto f = &bsp->dfaces[i];
-            const modelinfo_t *face_modelinfo = ModelInfoForFace(bsp, i);
+                for (size_t k = 0; k < buffers.size(); k++) {
+                    auto &[buffer, scale] = buffers[k];
 
-            if (!facesup_decoupled_global.empty()) {
-                SaveLightmapSurface(bsp, f, nullptr, &facesup_decoupled_global[i], &surf, surf.extents, surf.extents,
-                    filebase, lit_filebase, lux_filebase, hdr_filebase, intermediate_data[i]);
-            } else if (faces_sup.empty()) {
-                SaveLightmapSurface(bsp, f, nullptr, nullptr, &surf, surf.extents, surf.extents, filebase, lit_filebase,
-                    lux_filebase, hdr_filebase, intermediate_data[i]);
-            } else if (light_options.novanilla.value() || faces_sup[i].lmscale == face_modelinfo->lightmapscale) {
-                if (faces_sup[i].lmscale == face_modelinfo->lightmapscale) {
-                    f->lightofs = faces_sup[i].lightofs;
-                } else {
-                    f->lightofs = -1;
+                    if (!buffer->empty()) {
+                        std::copy_n(buffer->begin() + (size_t)block.offset * scale, (size_t)block.size * scale,
+                            file_buffers[k].first->begin() + (size_t)block.file_offset * scale);
+                    }
                 }
-                SaveLightmapSurface(bsp, f, &faces_sup[i], nullptr, &surf, surf.extents, surf.extents, filebase,
-                    lit_filebase, lux_filebase, hdr_filebase, intermediate_data[i]);
-                for (int j = 0; j < MAXLIGHTMAPS; j++) {
-                    f->styles[j] =
-                        faces_sup[i].styles[j] == INVALID_LIGHTSTYLE ? INVALID_LIGHTSTYLE_OLD : faces_sup[i].styles[j];
+            }
+
+            for (int32_t *ofs : id.offsets) {
+                if (*ofs < 0) {
+                    continue;
+                }
+
+                for (auto &block : id.blocks) {
+                    if (*ofs == block.offset * ofs_scale) {
+                        *ofs = block.file_offset * ofs_scale;
+                        break;
+                    }
                 }
-            } else {
-                SaveLightmapSurface(bsp, f, nullptr, nullptr, &surf, surf.extents, surf.vanilla_extents, filebase,
-                    lit_filebase, lux_filebase, hdr_filebase, intermediate_data[i]);
-                SaveLightmapSurface(bsp, f, &faces_sup[i], nullptr, &surf, surf.extents, surf.extents, filebase,
-                    lit_filebase, lux_filebase, hdr_filebase, intermediate_data[i]);
             }
+
+            id = {};
         });
     }
 
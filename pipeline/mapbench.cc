@@ -0,0 +1,449 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+/*
+ * pipeline/mapbench.cc
+ *
+ * Compiles a set of maps with the in-process pipeline, records the time spent
+ * in each phase (from the profiler), peak memory use and some statistics about
+ * the output to JSON, and optionally compares the times against a baseline.
+ */
+
+#include <pipeline/pipeline.hh>
+
+#include <common/bspfile.hh>
+#include <common/bsputils.hh>
+#include <common/cmdlib.hh>
+#include <common/json.hh>
+#include <common/log.hh>
+#include <common/profiler.hh>
+#include <common/prtfile.hh>
+#include <common/settings.hh>
+
+#include <algorithm>
+#include <bit>
+#include <fstream>
+#include <iomanip>
+#include <map>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// passed on as -threads when it isn't given, so results from different machines compare
+// the same amount of parallelism
+constexpr int32_t MAPBENCH_DEFAULT_THREADS = 4;
+
+namespace settings
+{
+static setting_group mapbench_group{"Benchmark", 100, expected_source::commandline};
+
+class mapbench_settings : public common_settings
+{
+public:
+    setting_path output{this, "output", "mapbench.json", &mapbench_group, "path to write the results to, as JSON"};
+    setting_path baseline{this, "baseline", "", &mapbench_group,
+        "results of an earlier run to compare against; exits with an error if a phase got slower than -tolerance"};
+    setting_scalar tolerance{
+        this, "tolerance", 10.0f, 0.0f, 1000.0f, &mapbench_group, "how much slower, in percent, a phase may get"};
+    setting_scalar minseconds{this, "minseconds", 0.1f, 0.0f, std::numeric_limits<float>::max(), &mapbench_group,
+        "phases that took less than this many seconds in the baseline are too noisy to compare"};
+    setting_int32 repeat{this, "repeat", 1, 1, 100, &mapbench_group,
+        "compile each map this many times and keep the fastest time of each phase"};
+    setting_path workdir{this, "workdir", "", &mapbench_group,
+        "directory to write the compiled maps to; defaults to a \"mapbench\" directory in the temp directory"};
+    setting_string qbsp{
+        this, "qbsp", "", "\"options\"", &mapbench_group, "extra options for qbsp, for maps given on the command line"};
+    setting_string vis{
+        this, "vis", "", "\"options\"", &mapbench_group, "extra options for vis, for maps given on the command line"};
+    setting_string light{this, "light", "", "\"options\"", &mapbench_group,
+        "extra options for light, for maps given on the command line"};
+
+    void set_parameters(int argc, const char **argv) override
+    {
+        common_settings::set_parameters(argc, argv);
+        program_description =
+            "mapbench compiles a set of maps with qbsp, vis and light, and records how long\n"
+            "each phase took. with no maps given, a fixed set of the test maps is used.\n\n";
+        remainder_name = "[mapname.map | directory]...";
+    }
+
+    void initialize(int argc, const char **argv) override
+    {
+        try {
+            common_settings::initialize(argc - 1, argv + 1);
+        } catch (parse_exception &ex) {
+            print_help(false);
+            logging::print("ERROR OCCURRED WHEN TRYING TO PARSE ARGUMENTS:\n");
+            logging::print(ex.what());
+            logging::print("\n\n");
+            throw settings::quit_after_help_exception();
+        }
+    }
+};
+} // namespace settings
+
+struct bench_map_t
+{
+    fs::path path;
+    std::vector<std::string> qbsp_args, vis_args, light_args;
+};
+
+// used when no maps are given; a mix of sizes and games that all compile without leaking
+static std::vector<bench_map_t> DefaultMaps()
+{
+    const fs::path testmaps = TESTMAPS_DIR;
+    const std::string wal_metadata = (testmaps / "q2_wal_metadata").string();
+
+    return {
+        {testmaps / "qbspfeatures.map"},
+        {testmaps / "q1_mountain.map"},
+        {testmaps / "light_general.map", {}, {}, {"-bounce", "2"}},
+        {testmaps / "base1-test.map", {"-q2bsp", "-path", wal_metadata}, {},
+            {"-nodefaultpaths", "-path", wal_metadata}},
+    };
+}
+
+// maps given on the command line; directories are searched for .map files
+static std::vector<bench_map_t> MapsFromCommandLine(const settings::mapbench_settings &options)
+{
+    std::vector<fs::path> paths;
+
+    for (auto &arg : options.remainder) {
+        if (fs::is_directory(arg)) {
+            std::vector<fs::path> found;
+
+            for (auto &entry : fs::directory_iterator(arg)) {
+                if (entry.is_regular_file() && string_iequals(entry.path().extension().string(), ".map")) {
+                    found.push_back(entry.path());
+                }
+            }
+
+            std::sort(found.begin(), found.end());
+            paths.insert(paths.end(), found.begin(), found.end());
+        } else {
+            paths.push_back(DefaultExtension(arg, "map"));
+        }
+    }
+
+    std::vector<bench_map_t> maps;
+
+    for (auto &path : paths) {
+        maps.push_back({path, SplitPipelineArgs(options.qbsp.value()), SplitPipelineArgs(options.vis.value()),
+            SplitPipelineArgs(options.light.value())});
+    }
+
+    return maps;
+}
+
+// start measuring peak memory use from here, if the OS lets us
+static void ResetPeakRSS()
+{
+#if defined(__linux__)
+    // "5" resets the VmHWM ("high water mark") reported in /proc/self/status
+    std::ofstream("/proc/self/clear_refs") << "5";
+#endif
+}
+
+// peak resident set size in bytes since ResetPeakRSS(); on systems where
+// that can't be reset, since the start of the process
+static uint64_t PeakRSS()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.PeakWorkingSetSize;
+    }
+    return 0;
+#else
+#if defined(__linux__)
+    std::ifstream status("/proc/self/status");
+    std::string line;
+
+    while (std::getline(status, line)) {
+        if (line.starts_with("VmHWM:")) {
+            return std::stoull(line.substr(6)) * 1024;
+        }
+    }
+#endif
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#if defined(__APPLE__)
+    return usage.ru_maxrss;
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+// statistics about the compiled map, to notice when a change affects the output
+static json OutputStats(fs::path bsp_path)
+{
+    bspdata_t bspdata;
+    LoadBSPFile(bsp_path, &bspdata);
+    ConvertBSPFormat(&bspdata, &bspver_generic);
+
+    const mbsp_t &bsp = std::get<mbsp_t>(bspdata.bsp);
+
+    size_t num_portals = 0;
+    const fs::path prt_path = fs::path(bsp_path).replace_extension(".prt");
+
+    if (fs::exists(prt_path)) {
+        num_portals = LoadPrtFile(prt_path, bspdata.loadversion).portals.size();
+    }
+
+    // average number of leafs (clusters for Q2) visible from each leaf (cluster)
+    double average_visible = 0;
+
+    if (!bsp.dvis.bits.empty()) {
+        const auto all_vis = DecompressAllVis(&bsp);
+        size_t total_visible = 0, num_rows = 0;
+
+        auto count_visible = [](const std::vector<uint8_t> &row) {
+            size_t count = 0;
+            for (uint8_t byte : row) {
+                count += std::popcount(byte);
+            }
+            return count;
+        };
+
+        if (bsp.loadversion->game->id == GAME_QUAKE_II) {
+            for (auto &[cluster, row] : all_vis) {
+                total_visible += count_visible(row);
+                num_rows++;
+            }
+        } else {
+            for (auto &leaf : bsp.dleafs) {
+                if (auto it = all_vis.find(leaf.visofs); it != all_vis.end()) {
+                    total_visible += count_visible(it->second);
+                    num_rows++;
+                }
+            }
+        }
+
+        if (num_rows) {
+            average_visible = static_cast<double>(total_visible) / num_rows;
+        }
+    }
+
+    return {
+        {"nodes", bsp.dnodes.size()},
+        {"leafs", bsp.dleafs.size()},
+        {"faces", bsp.dfaces.size()},
+        {"portals", num_portals},
+        {"average_visible_leafs", average_visible},
+        {"lightmap_bytes", bsp.dlightdata.size()},
+    };
+}
+
+static json RunMap(const bench_map_t &map, const settings::mapbench_settings &options, const fs::path &workdir,
+    const std::vector<std::string> &common_args)
+{
+    const fs::path bsp_path = workdir / fs::path(map.path).replace_extension(".bsp").filename();
+    const fs::path profile_path = fs::path(bsp_path).replace_extension(".trace.json");
+
+    pipeline_args_t args;
+    args.map_path = map.path;
+    args.bsp_path = bsp_path;
+    args.common_args = common_args;
+    args.common_args.push_back("-profile");
+    args.common_args.push_back(profile_path.string());
+    args.qbsp_args = map.qbsp_args;
+    args.vis_args = map.vis_args;
+    args.light_args = map.light_args;
+
+    // fastest time of each phase over all runs
+    std::vector<std::pair<std::string, double>> phases;
+    double seconds = std::numeric_limits<double>::max();
+    uint64_t peak_rss = 0;
+
+    for (int32_t run = 0; run < options.repeat.value(); run++) {
+        ResetPeakRSS();
+
+        auto start = I_FloatTime();
+        RunPipeline(args);
+        auto end = I_FloatTime();
+
+        seconds = std::min(seconds, (end - start).count());
+        peak_rss = std::max(peak_rss, PeakRSS());
+
+        for (auto &[name, phase_seconds] : profiler::phase_times()) {
+            auto it = std::find_if(phases.begin(), phases.end(), [&](auto &phase) { return phase.first == name; });
+
+            if (it == phases.end()) {
+                phases.emplace_back(name, phase_seconds);
+            } else {
+                it->second = std::min(it->second, phase_seconds);
+            }
+        }
+
+        profiler::stop();
+    }
+
+    json phases_json = json::object();
+
+    for (auto &[name, phase_seconds] : phases) {
+        phases_json[name] = phase_seconds;
+    }
+
+    return {
+        {"name", map.path.filename().string()},
+        {"seconds", seconds},
+        {"peak_rss_bytes", peak_rss},
+        {"phases", phases_json},
+        {"stats", OutputStats(bsp_path)},
+    };
+}
+
+// prints how each map's phases compare to the baseline; returns the number of regressions
+static size_t CompareToBaseline(const json &results, const json &baseline, double tolerance, double minseconds)
+{
+    std::map<std::string, const json *> baseline_maps;
+
+    for (auto &map : baseline.at("maps")) {
+        baseline_maps[map.at("name").get<std::string>()] = &map;
+    }
+
+    size_t regressions = 0;
+
+    logging::print("\ncompared to baseline ({}), tolerance {}%:\n", baseline.value("version", "unknown"), tolerance);
+    logging::print("{:<32} {:<32} {:>10} {:>10} {:>8}\n", "map", "phase", "baseline", "current", "change");
+
+    for (auto &map : results.at("maps")) {
+        const std::string map_name = map.at("name").get<std::string>();
+        auto it = baseline_maps.find(map_name);
+
+        if (it == baseline_maps.end()) {
+            logging::print("{:<32} not in baseline\n", map_name);
+            continue;
+        }
+
+        const json &baseline_map = *it->second;
+
+        auto compare = [&](const std::string &phase, double before, double after) {
+            if (before < minseconds) {
+                return;
+            }
+
+            const double change = ((after / before) - 1.0) * 100.0;
+            const bool regressed = change > tolerance;
+
+            logging::print("{:<32} {:<32} {:>10.3f} {:>10.3f} {:>+7.1f}%{}\n", map_name, phase, before, after, change,
+                regressed ? " SLOWER" : "");
+
+            if (regressed) {
+                regressions++;
+            }
+        };
+
+        compare("(total)", baseline_map.at("seconds").get<double>(), map.at("seconds").get<double>());
+
+        for (auto &[phase, seconds] : map.at("phases").items()) {
+            if (auto before = baseline_map.at("phases").find(phase); before != baseline_map.at("phases").end()) {
+                compare(phase, before->get<double>(), seconds.get<double>());
+            }
+        }
+    }
+
+    return regressions;
+}
+
+static int mapbench_main(int argc, const char **argv)
+{
+    settings::mapbench_settings options;
+
+    options.preinitialize(argc, argv);
+    options.initialize(argc, argv);
+    options.postinitialize(argc, argv);
+
+    const std::vector<bench_map_t> maps = options.remainder.empty() ? DefaultMaps() : MapsFromCommandLine(options);
+
+    fs::path workdir = options.workdir.value();
+    if (workdir.empty()) {
+        workdir = fs::temp_directory_path() / "mapbench";
+    }
+    fs::create_directories(workdir);
+
+    // the stages keep their output quiet so the results are easy to find; a fixed
+    // thread count keeps the times comparable between machines and runs
+    std::vector<std::string> common_args{"-quiet"};
+    const int32_t threads = options.threads.value() ? options.threads.value() : MAPBENCH_DEFAULT_THREADS;
+    common_args.push_back("-threads");
+    common_args.push_back(std::to_string(threads));
+
+    json results = {
+        {"version", ERICWTOOLS_VERSION},
+        {"threads", threads},
+        {"repeat", options.repeat.value()},
+        {"maps", json::array()},
+    };
+
+    for (auto &map : maps) {
+        logging::print("mapbench: {}\n", map.path);
+
+        json result = RunMap(map, options, workdir, common_args);
+
+        logging::print("mapbench: {} took {:.3f} seconds, peak RSS {} MiB\n", map.path.filename(),
+            result.at("seconds").get<double>(), result.at("peak_rss_bytes").get<uint64_t>() / (1024 * 1024));
+
+        results.at("maps").push_back(std::move(result));
+    }
+
+    std::ofstream(options.output.value(), std::ios_base::out | std::ios_base::trunc) << std::setw(4) << results;
+    logging::print("wrote {}\n", options.output.value());
+
+    if (options.baseline.value().empty()) {
+        return 0;
+    }
+
+    std::ifstream baseline_file(options.baseline.value());
+
+    if (!baseline_file) {
+        FError("can't open baseline {}", options.baseline.value());
+    }
+
+    const size_t regressions = CompareToBaseline(
+        results, json::parse(baseline_file), options.tolerance.value(), options.minseconds.value());
+
+    if (regressions) {
+        logging::print("\n{} phase(s) got more than {}% slower\n", regressions, options.tolerance.value());
+        return 1;
+    }
+
+    logging::print("\nno phase got more than {}% slower\n", options.tolerance.value());
+    return 0;
+}
+
+int main(int argc, const char **argv)
+{
+    logging::preinitialize();
+
+    try {
+        return mapbench_main(argc, argv);
+    } catch (const settings::quit_after_help_exception &) {
+        return 0;
+    } catch (const std::exception &e) {
+        exit_on_exception(e);
+    }
+}
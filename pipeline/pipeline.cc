@@ -0,0 +1,195 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#include <pipeline/pipeline.hh>
+
+#include <common/bspfile.hh>
+#include <common/cmdlib.hh>
+#include <common/log.hh>
+#include <qbsp/qbsp.hh>
+#include <vis/vis.hh>
+#include <light/light.hh>
+
+#include <cctype>
+#include <unordered_map>
+
+#include <fmt/chrono.h>
+
+namespace settings
+{
+setting_group pipeline_group{"Pipeline", 100, expected_source::commandline};
+
+void pipeline_settings::initialize(int argc, const char **argv)
+{
+    try {
+        token_parser_t p(argc - 1, argv + 1, {"command line"});
+
+        // parse one option at a time, so that the exact tokens of every common
+        // option can be handed on to each of the stages
+        while (true) {
+            const size_t start = p.cur;
+            const setting_base *setting = parse_setting(p);
+
+            if (!setting) {
+                break;
+            }
+
+            if (setting->group() != &pipeline_group) {
+                common_args.insert(common_args.end(), p.tokens.begin() + start, p.tokens.begin() + p.cur);
+            }
+        }
+
+        remainder.assign(p.tokens.begin() + p.cur, p.tokens.end());
+
+        if (remainder.size() <= 0 || remainder.size() > 2) {
+            print_help(true);
+        }
+    } catch (parse_exception &ex) {
+        print_help(false);
+        logging::print("ERROR OCCURRED WHEN TRYING TO PARSE ARGUMENTS:\n");
+        logging::print(ex.what());
+        logging::print("\n\n");
+        throw settings::quit_after_help_exception();
+    }
+}
+} // namespace settings
+
+static std::vector<std::string> StageArgs(
+    const std::vector<std::string> &common_args, const std::vector<std::string> &stage_args)
+{
+    std::vector<std::string> args{
+        "", // the exe path, which is ignored
+    };
+    args.insert(args.end(), common_args.begin(), common_args.end());
+    args.insert(args.end(), stage_args.begin(), stage_args.end());
+    return args;
+}
+
+void RunPipeline(const pipeline_args_t &args)
+{
+    fs::path bsp_path = args.bsp_path;
+    if (bsp_path.empty()) {
+        bsp_path = fs::path(args.map_path).replace_extension("bsp");
+    }
+
+    qbsp_output_t output;
+
+    {
+        auto qbsp_args = StageArgs(args.common_args, args.qbsp_args);
+        qbsp_args.push_back(args.map_path.string());
+        qbsp_args.push_back(bsp_path.string());
+
+        InitQBSP(qbsp_args);
+        ProcessFile(&output);
+        logging::close();
+    }
+
+    // e.g. -onlyents or -convert; qbsp already wrote whatever it produces
+    if (!output.bspdata.version) {
+        return;
+    }
+
+    std::unordered_map<int, std::vector<uint8_t>> uncompressed_vis;
+
+    if (args.run_vis) {
+        if (!output.prtfile) {
+            logging::print("WARNING: no portals were generated (map leaked?), skipping vis\n");
+        } else {
+            auto vis_args = StageArgs(args.common_args, args.vis_args);
+            vis_args.push_back(bsp_path.string());
+
+            vis_main(vis_args, output.bspdata, *output.prtfile);
+
+            uncompressed_vis = ExportUncompressedVis(&std::get<mbsp_t>(output.bspdata.bsp));
+        }
+    }
+
+    if (args.run_light) {
+        auto light_args = StageArgs(args.common_args, args.light_args);
+        light_args.push_back(bsp_path.string());
+
+        light_main(light_args, output.bspdata, uncompressed_vis.empty() ? nullptr : &uncompressed_vis);
+    } else {
+        // nothing else will write it
+        if (output.bspdata.version == &bspver_generic) {
+            ConvertBSPFormat(&output.bspdata, output.bspdata.loadversion);
+        }
+        WriteBSPFile(bsp_path, &output.bspdata);
+        logging::print("Wrote {}\n", bsp_path);
+    }
+}
+
+std::vector<std::string> SplitPipelineArgs(const std::string &str)
+{
+    std::vector<std::string> result;
+    std::string current;
+    bool inside_quotes = false, have_arg = false;
+
+    for (char c : str) {
+        if (c == '"') {
+            inside_quotes = !inside_quotes;
+            have_arg = true;
+        } else if (!inside_quotes && std::isspace(static_cast<unsigned char>(c))) {
+            if (have_arg) {
+                result.push_back(std::move(current));
+                current.clear();
+                have_arg = false;
+            }
+        } else {
+            current.push_back(c);
+            have_arg = true;
+        }
+    }
+
+    if (have_arg) {
+        result.push_back(std::move(current));
+    }
+
+    return result;
+}
+
+int pipeline_main(int argc, const char **argv)
+{
+    settings::pipeline_settings options;
+
+    options.preinitialize(argc, argv);
+    options.initialize(argc, argv);
+    options.postinitialize(argc, argv);
+
+    pipeline_args_t args;
+    args.map_path = DefaultExtension(options.remainder[0], "map");
+    if (options.remainder.size() == 2) {
+        args.bsp_path = options.remainder[1];
+    }
+    args.qbsp_args = SplitPipelineArgs(options.qbsp.value());
+    args.vis_args = SplitPipelineArgs(options.vis.value());
+    args.light_args = SplitPipelineArgs(options.light.value());
+    args.run_vis = !options.novis.value();
+    args.run_light = !options.nolight.value();
+
+    args.common_args = options.common_args;
+
+    auto start = I_FloatTime();
+    RunPipeline(args);
+    auto end = I_FloatTime();
+
+    logging::print("\n{:.3} seconds elapsed in total\n", (end - start));
+
+    return 0;
+}
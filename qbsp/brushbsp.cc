@@ -24,14 +24,17 @@
 #include <climits>
 
 #include <common/log.hh>
+#include <common/profiler.hh>
 #include <qbsp/brush.hh>
 #include <qbsp/map.hh>
 #include <qbsp/portals.hh>
 #include <qbsp/qbsp.hh>
 #include <qbsp/tree.hh>
 
+#include <algorithm>
 #include <list>
 #include <atomic>
+#include <tuple>
 
 #include "tbb/task_group.h"
 
@@ -59,6 +62,8 @@ struct bspstats_t : logging::stat_tracker_t
     stat &c_qbsp3 = register_stat("expensive split nodes");
     // total number of nodes created by midsplit
     stat &c_midsplit = register_stat("mid-split nodes");
+    // total number of nodes created by the surface area heuristic
+    stat &c_sahsplit = register_stat("sah-split nodes");
     // total number of leafs
     stat &c_leafs = register_stat("leaves");
     // number of bogus brushes (beyond world extents)
@@ -69,8 +74,24 @@ struct bspstats_t : logging::stat_tracker_t
     stat &c_brushesonesided = register_stat("brushes split only on one side");
     // tiny volumes after clipping
     stat &c_tinyvolumes = register_stat("tiny volumes removed after splits");
+    // brush/side array/winding allocations made while building the tree
+    stat &c_allocations = register_stat("pool allocations");
+    stat &c_frees = register_stat("pool frees");
+    stat &c_allocated_kb = register_stat("KiB allocated from pools");
 };
 
+// brushes, side arrays and windings allocated from the pools during `scope`,
+// and how many of those were freed again before it ended
+static void AddAllocationStats(const pool::scope_t &scope, logging::stat_tracker_t::stat &allocations,
+    logging::stat_tracker_t::stat &frees, logging::stat_tracker_t::stat &allocated_kb)
+{
+    const pool::counts_t counts = scope.counts();
+
+    allocations += counts.allocations;
+    frees += counts.frees;
+    allocated_kb += counts.bytes / 1024;
+}
+
 /*
 ==================
 BrushFromBounds
@@ -345,11 +366,9 @@ Creates a leaf node.
 Called in parallel.
 ==================
 */
-static void LeafNode(node_t *leafnode, bspbrush_t::container brushes, bspstats_t &stats)
+static void LeafNode(tree_t &tree, node_t *leafnode, bspbrush_t::container brushes, bspstats_t &stats)
 {
-    leafnode->make_leaf();
-
-    auto *leafdata = leafnode->get_leafdata();
+    auto *leafdata = tree.make_leaf(leafnode);
 
     leafdata->contents = qbsp_options.target_game->create_empty_contents();
     for (auto &brush : brushes) {
@@ -362,7 +381,7 @@ static void LeafNode(node_t *leafnode, bspbrush_t::container brushes, bspstats_t
     qbsp_options.target_game->count_contents_in_stats(leafdata->contents, *stats.leafstats);
 
     if (qbsp_options.debugleak.value() || qbsp_options.debugbspbrushes.value()) {
-        leafdata->bsp_brushes = brushes;
+        leafdata->bsp_brushes = std::make_unique<bspbrush_t::container>(std::move(brushes));
     } else {
         leafnode->volume.reset();
     }
@@ -577,7 +596,7 @@ static twosided<bspbrush_t::ptr> SplitBrush(
 inline void CheckPlaneAgainstParents(size_t planenum, node_t *node)
 {
     for (node_t *p = node->parent; p; p = p->parent) {
-        if (p->get_nodedata()->planenum == planenum) {
+        if (p->planenum == planenum) {
             Error("Tried parent");
         }
     }
@@ -927,6 +946,172 @@ static side_t *ChooseMidPlaneFromList(const bspbrush_t::container &brushes, cons
     return bestaxialplane ? bestaxialplane : bestanyplane;
 }
 
+// number of bins per axis used by ChooseSAHPlaneFromList
+constexpr size_t SAH_NUM_BINS = 32;
+// relative cost of a brush straddling the split plane (it will be split
+// into two fragments, which both need to be processed further down)
+constexpr double SAH_SPLIT_COST = 1.0;
+// relative cost of the portal created on the split plane, scaled by its
+// area relative to the node surface area
+constexpr double SAH_PORTAL_COST = 1.0;
+
+inline double HalfSurfaceArea(const qvec3d &size)
+{
+    return size[0] * size[1] + size[1] * size[2] + size[2] * size[0];
+}
+
+/*
+==================
+ChooseSAHPlaneFromList
+
+Surface area heuristic split, as used by BVH builders. The brush bounds
+are binned along each axis of the node, so the number of brushes that end
+up in front, behind or straddling any axial plane can be looked up in constant
+time. The estimated cost of a split is:
+
+    (area(front) * front + area(back) * back) / area(node)
+        + SAH_SPLIT_COST * straddling
+        + SAH_PORTAL_COST * area(portal) / area(node)
+
+where the first term approximates the number of leafs we'll produce below
+the node, and the last one the size of the portal the split will create.
+
+Only axial planes are considered; returns nullptr if there are none, in
+which case the caller should fall back to ChooseMidPlaneFromList.
+==================
+*/
+static side_t *ChooseSAHPlaneFromList(const bspbrush_t::container &brushes, const node_t *node)
+{
+    const aabb3d &bounds = node->bounds;
+    const qvec3d node_size = bounds.size();
+    const double node_area = HalfSurfaceArea(node_size);
+
+    if (node_area <= 0) {
+        return nullptr;
+    }
+
+    // per-axis histograms of where brushes start and end.
+    // a brush whose maxs falls in bin i is entirely behind any
+    // plane at or past the end of bin i, and likewise for mins.
+    std::array<std::array<size_t, SAH_NUM_BINS>, 3> max_bins{}, min_bins{};
+
+    for (auto &brush : brushes) {
+        for (size_t axis = 0; axis < 3; axis++) {
+            if (node_size[axis] <= 0) {
+                continue;
+            }
+
+            const double scale = SAH_NUM_BINS / node_size[axis];
+            auto to_bin = [&](double v) {
+                return static_cast<size_t>(std::clamp((v - bounds.mins()[axis]) * scale, 0.0, SAH_NUM_BINS - 1.0));
+            };
+
+            min_bins[axis][to_bin(brush->bounds.mins()[axis])]++;
+            max_bins[axis][to_bin(brush->bounds.maxs()[axis])]++;
+        }
+    }
+
+    // prefix sums: back_counts[axis][i] = brushes ending in bins [0, i),
+    // front_counts[axis][i] = brushes starting in bins [i, SAH_NUM_BINS)
+    std::array<std::array<size_t, SAH_NUM_BINS + 1>, 3> back_counts{}, front_counts{};
+
+    for (size_t axis = 0; axis < 3; axis++) {
+        for (size_t i = 0; i < SAH_NUM_BINS; i++) {
+            back_counts[axis][i + 1] = back_counts[axis][i] + max_bins[axis][i];
+        }
+        for (size_t i = SAH_NUM_BINS; i > 0; i--) {
+            front_counts[axis][i - 1] = front_counts[axis][i] + min_bins[axis][i - 1];
+        }
+    }
+
+    auto split_cost = [&](size_t axis, double dist) {
+        // round the plane to the nearest bin boundary; the counts are only
+        // known there, so the areas are taken there too
+        const double t_exact = std::clamp((dist - bounds.mins()[axis]) / node_size[axis], 0.0, 1.0);
+        const size_t boundary = static_cast<size_t>(t_exact * SAH_NUM_BINS + 0.5);
+        const double t = static_cast<double>(boundary) / SAH_NUM_BINS;
+
+        const double num_back = back_counts[axis][boundary];
+        const double num_front = front_counts[axis][boundary];
+        const double num_straddle = std::max(0.0, brushes.size() - num_front - num_back);
+
+        qvec3d back_size = node_size, front_size = node_size;
+        back_size[axis] = t * node_size[axis];
+        front_size[axis] = (1.0 - t) * node_size[axis];
+
+        qvec3d portal_size = node_size;
+        portal_size[axis] = 0;
+
+        return (HalfSurfaceArea(back_size) * (num_back + num_straddle) +
+                   HalfSurfaceArea(front_size) * (num_front + num_straddle)) /
+                   node_area +
+               SAH_SPLIT_COST * num_straddle + SAH_PORTAL_COST * HalfSurfaceArea(portal_size) / node_area;
+    };
+
+    std::vector<std::tuple<double, side_t *>> candidates;
+
+    // same search order as ChooseMidPlaneFromList
+    constexpr int numpasses = 4;
+    for (int pass = 0; pass < numpasses; pass++) {
+        bool has_nonaxial = false;
+
+        for (auto &brush : brushes) {
+            if ((pass >= 2) != brush->contents.is_any_detail(qbsp_options.target_game))
+                continue;
+            for (auto &side : brush->sides) {
+                if (side.bevel)
+                    continue; // never use a bevel as a spliter
+                if (!side.w)
+                    continue; // nothing visible, so it can't split
+                if (side.onnode)
+                    continue; // allready a node splitter
+                if (side.get_texinfo().flags.is_hintskip)
+                    continue; // skip surfaces are never chosen
+                if (side.is_visible() != (pass == 0 || pass == 2))
+                    continue; // only check visible faces on pass 0/2
+
+                const qbsp_plane_t &plane = side.get_positive_plane();
+
+                if (plane.get_type() >= plane_type_t::PLANE_ANYX) {
+                    has_nonaxial = true;
+                    continue; // can't be evaluated with the bins
+                }
+
+                const size_t axis = static_cast<size_t>(plane.get_type());
+
+                if (node_size[axis] <= 0)
+                    continue;
+
+                candidates.emplace_back(split_cost(axis, plane.get_dist()), &side);
+            }
+        }
+
+        // only run the (relatively) expensive volume check on the
+        // candidates in cost order until one of them is valid
+        std::stable_sort(candidates.begin(), candidates.end(),
+            [](const auto &a, const auto &b) { return std::get<0>(a) < std::get<0>(b); });
+
+        for (auto &[cost, side] : candidates) {
+#if CHECK_PLANE_AGAINST_VOLUME
+            if (!CheckPlaneAgainstVolume(side->planenum & ~1, node)) {
+                continue; // would produce a tiny volume
+            }
+#endif
+            return side;
+        }
+
+        // don't skip to the next pass if this one could still
+        // be split by a non-axial plane
+        if (has_nonaxial) {
+            return nullptr;
+        }
+
+        candidates.clear();
+    }
+
+    return nullptr;
+}
+
 /*
 ================
 SelectSplitPlane
@@ -968,6 +1153,26 @@ static side_t *SelectSplitPlane(
             }
         }
 
+        if (split_type == tree_split_t::FAST &&
+            qbsp_options.midsplitmethod.value() == settings::midsplitmethod_t::SAH) {
+            split_type = tree_split_t::SAH;
+        }
+
+        if (split_type == tree_split_t::SAH) {
+            if (auto sah_plane = ChooseSAHPlaneFromList(brushes, node)) {
+                stats.c_sahsplit++;
+
+                for (auto &b : brushes) {
+                    b->side = TestBrushToPlanenum(*b, sah_plane->planenum & ~1, nullptr, nullptr, nullptr);
+                }
+
+                return sah_plane;
+            }
+
+            // no usable axial planes; use the regular midsplit
+            split_type = tree_split_t::FAST;
+        }
+
         if (split_type == tree_split_t::FAST) {
             if (auto mid_plane = ChooseMidPlaneFromList(brushes, node)) {
                 stats.c_midsplit++;
@@ -1087,7 +1292,7 @@ static side_t *SelectSplitPlane(
         // other passes
         if (bestside) {
             if (pass >= 2)
-                node->get_nodedata()->detail_separator = true; // not needed for vis
+                node->detail_separator = true; // not needed for vis
             break;
         }
     }
@@ -1182,10 +1387,8 @@ static void BuildTree_r(tree_t &tree, int level, node_t *node, bspbrush_t::conta
         // this is a leaf node
         clock();
 
-        node->make_leaf();
-
         stats.c_leafs++;
-        LeafNode(node, std::move(brushes), stats);
+        LeafNode(tree, node, std::move(brushes), stats);
 
         return;
     }
@@ -1199,23 +1402,23 @@ static void BuildTree_r(tree_t &tree, int level, node_t *node, bspbrush_t::conta
     size_t bestplane = bestside->planenum & ~1;
     Q_assert(!(bestplane & 1));
 
-    nodedata_t *nodedata = node->get_nodedata();
-    nodedata->planenum = bestplane;
+    tree.make_node(node);
+    node->planenum = bestplane;
 
     auto &plane = map.get_plane(bestplane);
     auto children = SplitBrushList(std::move(brushes), bestplane, stats);
 
     // allocate children before recursing
     for (int i = 0; i < 2; i++) {
-        auto &newnode = nodedata->children[i] = tree.create_node();
+        auto &newnode = node->children[i] = tree.create_node();
         newnode->parent = node;
         newnode->bounds = node->bounds;
     }
 
     for (int i = 0; i < 3; i++) {
         if (plane.get_normal()[i] == 1.0) {
-            nodedata->children[0]->bounds[0][i] = plane.get_dist();
-            nodedata->children[1]->bounds[1][i] = plane.get_dist();
+            node->children[0]->bounds[0][i] = plane.get_dist();
+            node->children[1]->bounds[1][i] = plane.get_dist();
             break;
         }
     }
@@ -1224,17 +1427,17 @@ static void BuildTree_r(tree_t &tree, int level, node_t *node, bspbrush_t::conta
     if (node->volume) {
         auto children_volumes = SplitBrush(std::move(node->volume), bestplane, stats);
         node->volume = nullptr;
-        nodedata->children[0]->volume = std::move(children_volumes[0]);
-        nodedata->children[1]->volume = std::move(children_volumes[1]);
+        node->children[0]->volume = std::move(children_volumes[0]);
+        node->children[1]->volume = std::move(children_volumes[1]);
     }
 
     // recursively process children
     tbb::task_group g;
     g.run([&]() {
-        BuildTree_r(tree, level + 1, nodedata->children[0], std::move(children[0]), split_type, stats, clock);
+        BuildTree_r(tree, level + 1, node->children[0], std::move(children[0]), split_type, stats, clock);
     });
     g.run([&]() {
-        BuildTree_r(tree, level + 1, nodedata->children[1], std::move(children[1]), split_type, stats, clock);
+        BuildTree_r(tree, level + 1, node->children[1], std::move(children[1]), split_type, stats, clock);
     });
     g.wait();
 }
@@ -1255,6 +1458,7 @@ BrushBSP
 void BrushBSP(tree_t &tree, mapentity_t &entity, const bspbrush_t::container &brushlist, tree_split_t split_type)
 {
     logging::header(__func__);
+    profilefunc();
 
     // NOTE: entity bounds may include brushes that were deleted
     // from the brush list (e.g. clip brushes in Q1 hull 0 still need to affect the model/node bounds)
@@ -1271,19 +1475,17 @@ void BrushBSP(tree_t &tree, mapentity_t &entity, const bspbrush_t::container &br
         auto headnode = tree.create_node();
         headnode->bounds = entity.bounds;
 
-        auto *nodedata = headnode->get_nodedata();
+        tree.make_node(headnode);
 
         // The choice of plane is mostly unimportant, but having it at (0, 0, 0) affects
         // the node bounds calculation.
-        nodedata->planenum = 0;
-        nodedata->children[0] = tree.create_node();
-        nodedata->children[0]->make_leaf();
-        nodedata->children[0]->get_leafdata()->contents = qbsp_options.target_game->create_empty_contents();
-        nodedata->children[0]->parent = headnode;
-        nodedata->children[1] = tree.create_node();
-        nodedata->children[1]->make_leaf();
-        nodedata->children[1]->get_leafdata()->contents = qbsp_options.target_game->create_empty_contents();
-        nodedata->children[1]->parent = headnode;
+        headnode->planenum = 0;
+        headnode->children[0] = tree.create_node();
+        tree.make_leaf(headnode->children[0])->contents = qbsp_options.target_game->create_empty_contents();
+        headnode->children[0]->parent = headnode;
+        headnode->children[1] = tree.create_node();
+        tree.make_leaf(headnode->children[1])->contents = qbsp_options.target_game->create_empty_contents();
+        headnode->children[1]->parent = headnode;
 
         tree.headnode = headnode;
 
@@ -1339,13 +1541,15 @@ void BrushBSP(tree_t &tree, mapentity_t &entity, const bspbrush_t::container &br
     stats.leafstats = qbsp_options.target_game->create_content_stats();
 
     {
+        pool::scope_t allocs;
         logging::percent_clock clock;
         BuildTree_r(tree, 0, tree.headnode, brushlist, split_type, stats, clock);
+        AddAllocationStats(allocs, stats.c_allocations, stats.c_frees, stats.c_allocated_kb);
     }
 
     stats.print_stats();
 
-    CountLeafs(tree.headnode);
+    CountLeafs(tree);
 }
 
 /*
@@ -1434,6 +1638,9 @@ struct chopstats_t : logging::stat_tracker_t
 {
     stat &c_swallowed = register_stat("brushes swallowed");
     stat &c_from_split = register_stat("brushes created from the chompening");
+    stat &c_allocations = register_stat("pool allocations");
+    stat &c_frees = register_stat("pool frees");
+    stat &c_allocated_kb = register_stat("KiB allocated from pools");
 };
 
 /*
@@ -1458,6 +1665,7 @@ void ChopBrushes(bspbrush_t::container &brushes, bool allow_fragmentation)
     // clear original list
     brushes.clear();
 
+    pool::scope_t allocs;
     logging::percent_clock clock(list.size());
     chopstats_t stats;
 
@@ -1550,6 +1758,7 @@ newlist:
 
     brushes.insert(brushes.begin(), std::make_move_iterator(list.begin()), std::make_move_iterator(list.end()));
     logging::print(logging::flag::STAT, "chopped {} brushes into {}\n", original_count, brushes.size());
+    AddAllocationStats(allocs, stats.c_allocations, stats.c_frees, stats.c_allocated_kb);
 
     if (qbsp_options.debugchop.value()) {
         WriteBspBrushMap("chopped", brushes);
@@ -25,6 +25,7 @@
 #include <common/ostream.hh>
 #include <qbsp/brush.hh>
 #include <qbsp/map.hh>
+#include <qbsp/tree.hh>
 
 #include <unordered_set>
 #include <fstream>
@@ -141,37 +142,37 @@ void ExportObj_Brushes(const std::string &filesuffix, const bspbrush_t::containe
     }
 }
 
-static void ExportObj_Nodes_r(const node_t *node, std::vector<const face_t *> *dest)
+static void ExportObj_Nodes_r(const tree_t &tree, const node_t *node, std::vector<const face_t *> *dest)
 {
     if (node->is_leaf()) {
         return;
     }
-    auto *nodedata = node->get_nodedata();
+    auto *nodedata = tree.get_nodedata(node);
 
     for (auto &face : nodedata->facelist) {
         dest->push_back(face.get());
     }
 
-    ExportObj_Nodes_r(nodedata->children[0], dest);
-    ExportObj_Nodes_r(nodedata->children[1], dest);
+    ExportObj_Nodes_r(tree, node->children[0], dest);
+    ExportObj_Nodes_r(tree, node->children[1], dest);
 }
 
-void ExportObj_Nodes(const std::string &filesuffix, const node_t *nodes)
+void ExportObj_Nodes(const std::string &filesuffix, const tree_t &tree)
 {
     std::vector<const face_t *> faces;
-    ExportObj_Nodes_r(nodes, &faces);
+    ExportObj_Nodes_r(tree, tree.headnode, &faces);
     ExportObj_Faces(filesuffix, faces);
 }
 
-static void ExportObj_Marksurfaces_r(const node_t *node, std::unordered_set<const face_t *> *dest)
+static void ExportObj_Marksurfaces_r(const tree_t &tree, const node_t *node, std::unordered_set<const face_t *> *dest)
 {
-    if (auto *nodedata = node->get_nodedata()) {
-        ExportObj_Marksurfaces_r(nodedata->children[0], dest);
-        ExportObj_Marksurfaces_r(nodedata->children[1], dest);
+    if (!node->is_leaf()) {
+        ExportObj_Marksurfaces_r(tree, node->children[0], dest);
+        ExportObj_Marksurfaces_r(tree, node->children[1], dest);
         return;
     }
 
-    auto *leafdata = node->get_leafdata();
+    auto *leafdata = tree.get_leafdata(node);
 
     for (auto &face : leafdata->markfaces) {
         if (!face->get_texinfo().flags.is_nodraw) {
@@ -180,11 +181,11 @@ static void ExportObj_Marksurfaces_r(const node_t *node, std::unordered_set<cons
     }
 }
 
-void ExportObj_Marksurfaces(const std::string &filesuffix, const node_t *nodes)
+void ExportObj_Marksurfaces(const std::string &filesuffix, const tree_t &tree)
 {
     // many leafs will mark the same face, so collect them in an unordered_set to filter out duplicates
     std::unordered_set<const face_t *> faces;
-    ExportObj_Marksurfaces_r(nodes, &faces);
+    ExportObj_Marksurfaces_r(tree, tree.headnode, &faces);
 
     // copy to a vector
     std::vector<const face_t *> faces_vec;
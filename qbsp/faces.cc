@@ -22,11 +22,13 @@
 #include <qbsp/brush.hh>
 
 #include <common/log.hh>
+#include <common/profiler.hh>
 #include <qbsp/portals.hh>
 #include <qbsp/csg.hh>
 #include <qbsp/map.hh>
 #include <qbsp/merge.hh>
 #include <qbsp/qbsp.hh>
+#include <qbsp/tree.hh>
 #include <qbsp/writebsp.hh>
 
 #include <list>
@@ -38,7 +40,7 @@ struct makefaces_stats_t : logging::stat_tracker_t
     stat &c_subdivide = register_stat("subdivided");
 };
 
-static bool ShouldOmitFace(face_t *f)
+static bool ShouldOmitFace(const tree_t &tree, face_t *f)
 {
     if (!qbsp_options.includeskip.value() && f->get_texinfo().flags.is_nodraw) {
         // TODO: move to game specific
@@ -57,8 +59,8 @@ static bool ShouldOmitFace(face_t *f)
     }
 
     // omit faces fully covered by detail wall
-    if (!f->markleafs.empty() && std::all_of(f->markleafs.begin(), f->markleafs.end(), [](node_t *l) {
-            auto *leafdata = l->get_leafdata();
+    if (!f->markleafs.empty() && std::all_of(f->markleafs.begin(), f->markleafs.end(), [&tree](node_t *l) {
+            auto *leafdata = tree.get_leafdata(l);
             return leafdata->contents.is_detail_wall(qbsp_options.target_game);
         })) {
         return true;
@@ -67,9 +69,9 @@ static bool ShouldOmitFace(face_t *f)
     return false;
 }
 
-static void MergeNodeFaces(node_t *node, makefaces_stats_t &stats)
+static void MergeNodeFaces(tree_t &tree, node_t *node, makefaces_stats_t &stats)
 {
-    auto *nodedata = node->get_nodedata();
+    auto *nodedata = tree.get_nodedata(node);
     nodedata->facelist = MergeFaceList(std::move(nodedata->facelist), stats.c_merge);
 }
 
@@ -93,9 +95,9 @@ inline void EmitVertex(const qvec3d &vert, size_t &vert_id)
 }
 
 // output final vertices
-static void EmitFaceVertices(face_t *f)
+static void EmitFaceVertices(const tree_t &tree, face_t *f)
 {
-    if (ShouldOmitFace(f)) {
+    if (ShouldOmitFace(tree, f)) {
         return;
     }
 
@@ -106,24 +108,24 @@ static void EmitFaceVertices(face_t *f)
     }
 }
 
-static void EmitVertices_R(node_t *node)
+static void EmitVertices_R(tree_t &tree, node_t *node)
 {
     if (node->is_leaf()) {
         return;
     }
 
-    auto *nodedata = node->get_nodedata();
+    auto *nodedata = tree.get_nodedata(node);
     for (auto &f : nodedata->facelist) {
-        EmitFaceVertices(f.get());
+        EmitFaceVertices(tree, f.get());
     }
 
-    EmitVertices_R(nodedata->children[0]);
-    EmitVertices_R(nodedata->children[1]);
+    EmitVertices_R(tree, node->children[0]);
+    EmitVertices_R(tree, node->children[1]);
 }
 
-void EmitVertices(node_t *headnode)
+void EmitVertices(tree_t &tree)
 {
-    EmitVertices_R(headnode);
+    EmitVertices_R(tree, tree.headnode);
 }
 
 //===========================================================================
@@ -241,13 +243,13 @@ static void EmitFaceFragment(face_t *face, face_fragment_t *fragment, emit_faces
 MakeFaceEdges_r
 ================
 */
-static void EmitFaces_R(node_t *node, emit_faces_stats_t &stats)
+static void EmitFaces_R(tree_t &tree, node_t *node, emit_faces_stats_t &stats)
 {
     if (node->is_leaf()) {
         return;
     }
 
-    auto *nodedata = node->get_nodedata();
+    auto *nodedata = tree.get_nodedata(node);
     nodedata->firstface = static_cast<int>(map.bsp.dfaces.size());
 
     for (auto &face : nodedata->facelist) {
@@ -260,8 +262,8 @@ static void EmitFaces_R(node_t *node, emit_faces_stats_t &stats)
 
     nodedata->numfaces = static_cast<int>(map.bsp.dfaces.size()) - nodedata->firstface;
 
-    EmitFaces_R(nodedata->children[0], stats);
-    EmitFaces_R(nodedata->children[1], stats);
+    EmitFaces_R(tree, node->children[0], stats);
+    EmitFaces_R(tree, node->children[1], stats);
 }
 
 /*
@@ -269,7 +271,7 @@ static void EmitFaces_R(node_t *node, emit_faces_stats_t &stats)
 MakeFaceEdges
 ================
 */
-size_t EmitFaces(node_t *headnode)
+size_t EmitFaces(tree_t &tree)
 {
     logging::funcheader();
 
@@ -279,7 +281,7 @@ size_t EmitFaces(node_t *headnode)
 
     size_t firstface = map.bsp.dfaces.size();
 
-    EmitFaces_R(headnode, stats);
+    EmitFaces_R(tree, tree.headnode, stats);
 
     map.hashedges.clear();
 
@@ -295,23 +297,22 @@ AddMarksurfaces_r
 Adds the given face to the markfaces lists of all descendant leafs of `node`.
 ================
 */
-static void AddMarksurfaces_r(face_t *face, std::unique_ptr<face_t> face_copy, node_t *node)
+static void AddMarksurfaces_r(tree_t &tree, face_t *face, std::unique_ptr<face_t> face_copy, node_t *node)
 {
-    if (auto *leafdata = node->get_leafdata()) {
+    if (auto *leafdata = tree.get_leafdata(node)) {
         leafdata->markfaces.push_back(face);
         face->markleafs.push_back(node);
         return;
     }
 
-    auto *nodedata = node->get_nodedata();
-    const qplane3d &splitplane = nodedata->get_plane();
+    const qplane3d &splitplane = node->get_plane();
 
     auto [frontFragment, backFragment] = SplitFace(std::move(face_copy), splitplane);
     if (frontFragment) {
-        AddMarksurfaces_r(face, std::move(frontFragment), nodedata->children[0]);
+        AddMarksurfaces_r(tree, face, std::move(frontFragment), node->children[0]);
     }
     if (backFragment) {
-        AddMarksurfaces_r(face, std::move(backFragment), nodedata->children[1]);
+        AddMarksurfaces_r(tree, face, std::move(backFragment), node->children[1]);
     }
 }
 
@@ -322,25 +323,30 @@ MakeMarkFaces
 Populates the `markfaces` vectors of all leafs
 ================
 */
-void MakeMarkFaces(node_t *node)
+static void MakeMarkFaces_r(tree_t &tree, node_t *node)
 {
     if (node->is_leaf()) {
         return;
     }
 
-    auto *nodedata = node->get_nodedata();
+    auto *nodedata = tree.get_nodedata(node);
 
     // for the faces on this splitting node..
     for (auto &face : nodedata->facelist) {
         // add this face to all descendant leafs it touches
 
         // make a copy we can clip
-        AddMarksurfaces_r(face.get(), CopyFace(face.get()), nodedata->children[face->planenum & 1]);
+        AddMarksurfaces_r(tree, face.get(), CopyFace(face.get()), node->children[face->planenum & 1]);
     }
 
     // process child nodes recursively
-    MakeMarkFaces(nodedata->children[0]);
-    MakeMarkFaces(nodedata->children[1]);
+    MakeMarkFaces_r(tree, node->children[0]);
+    MakeMarkFaces_r(tree, node->children[1]);
+}
+
+void MakeMarkFaces(tree_t &tree)
+{
+    MakeMarkFaces_r(tree, tree.headnode);
 }
 
 /*
@@ -458,11 +464,11 @@ static std::list<std::unique_ptr<face_t>> SubdivideFace(std::unique_ptr<face_t>
     return surfaces;
 }
 
-static void SubdivideNodeFaces(node_t *node, makefaces_stats_t &stats)
+static void SubdivideNodeFaces(tree_t &tree, node_t *node, makefaces_stats_t &stats)
 {
     std::list<std::unique_ptr<face_t>> result;
 
-    auto *nodedata = node->get_nodedata();
+    auto *nodedata = tree.get_nodedata(node);
 
     // subdivide each face and push the results onto subdivided
     for (auto &face : nodedata->facelist) {
@@ -482,7 +488,7 @@ Typically, we're in an empty leaf and the other side of the portal is a solid wa
 see also FindPortalSide which populates p->side
 ============
 */
-static std::unique_ptr<face_t> FaceFromPortal(portal_t *p, bool pside)
+static std::unique_ptr<face_t> FaceFromPortal(const tree_t &tree, portal_t *p, bool pside)
 {
     side_t *side = p->sides[pside];
     if (!side)
@@ -504,7 +510,7 @@ static std::unique_ptr<face_t> FaceFromPortal(portal_t *p, bool pside)
     }
 
     f->contents = {
-        .front = p->nodes[pside]->get_leafdata()->contents, .back = p->nodes[!pside]->get_leafdata()->contents};
+        .front = tree.get_leafdata(p->nodes[pside])->contents, .back = tree.get_leafdata(p->nodes[!pside])->contents};
 
     UpdateFaceSphere(f.get());
 
@@ -524,23 +530,23 @@ mark the side that originally created it
   water / water : none
 ===============
 */
-static void MakeFaces_r(node_t *node, makefaces_stats_t &stats)
+static void MakeFaces_r(tree_t &tree, node_t *node, makefaces_stats_t &stats)
 {
     // recurse down to leafs
-    if (auto *nodedata = node->get_nodedata()) {
-        MakeFaces_r(nodedata->children[0], stats);
-        MakeFaces_r(nodedata->children[1], stats);
+    if (!node->is_leaf()) {
+        MakeFaces_r(tree, node->children[0], stats);
+        MakeFaces_r(tree, node->children[1], stats);
 
         // merge together all visible faces on the node
         if (!qbsp_options.nomerge.value())
-            MergeNodeFaces(node, stats);
+            MergeNodeFaces(tree, node, stats);
         if (qbsp_options.subdivide.boolValue())
-            SubdivideNodeFaces(node, stats);
+            SubdivideNodeFaces(tree, node, stats);
 
         return;
     }
 
-    auto *leafdata = node->get_leafdata();
+    auto *leafdata = tree.get_leafdata(node);
 
     // solid leafs never have visible faces
     if (leafdata->contents.is_any_solid(qbsp_options.target_game))
@@ -555,11 +561,11 @@ static void MakeFaces_r(node_t *node, makefaces_stats_t &stats)
     for (portal_t *p = node->portals; p; p = p->next[is_on_back]) {
         is_on_back = (p->nodes.back == node);
 
-        std::unique_ptr<face_t> f = FaceFromPortal(p, is_on_back);
+        std::unique_ptr<face_t> f = FaceFromPortal(tree, p, is_on_back);
 
         if (f) {
             stats.c_nodefaces++;
-            p->onnode->get_nodedata()->facelist.push_back(std::move(f));
+            tree.get_nodedata(p->onnode)->facelist.push_back(std::move(f));
         }
     }
 }
@@ -569,11 +575,12 @@ static void MakeFaces_r(node_t *node, makefaces_stats_t &stats)
 MakeFaces
 ============
 */
-void MakeFaces(node_t *node)
+void MakeFaces(tree_t &tree)
 {
     logging::funcheader();
+    profilefunc();
 
     makefaces_stats_t stats{};
 
-    MakeFaces_r(node, stats);
+    MakeFaces_r(tree, tree.headnode, stats);
 }
@@ -36,6 +36,7 @@
 #include <qbsp/qbsp.hh>
 
 #include <common/log.hh>
+#include <common/profiler.hh>
 #include <common/parser.hh>
 #include <common/fs.hh>
 #include <common/imglib.hh>
@@ -2069,6 +2070,7 @@ inline void WriteMapBrushMap(const fs::path &name, const std::vector<mapbrush_t>
 void ProcessMapBrushes()
 {
     logging::funcheader();
+    profilefunc();
 
     // load external maps (needs to be before world extents are calculated)
     for (auto &source : map.entities) {
@@ -2327,6 +2329,7 @@ void ProcessMapBrushes()
 void LoadMapFile()
 {
     logging::funcheader();
+    profilefunc();
 
     {
         texture_def_issues_t issue_stats;
@@ -28,6 +28,7 @@
 #include <qbsp/tree.hh>
 
 #include <common/log.hh>
+#include <common/profiler.hh>
 #include <common/ostream.hh>
 #include <climits>
 #include <vector>
@@ -36,17 +37,17 @@
 #include <unordered_set>
 #include <utility>
 
-static bool LeafSealsMap(const node_t *node)
+static bool LeafSealsMap(const tree_t &tree, const node_t *node)
 {
-    auto *leafdata = node->get_leafdata();
+    auto *leafdata = tree.get_leafdata(node);
     Q_assert(leafdata);
 
     return qbsp_options.target_game->contents_seals_map(leafdata->contents);
 }
 
-static bool LeafSealsForDetailFill(const node_t *node)
+static bool LeafSealsForDetailFill(const tree_t &tree, const node_t *node)
 {
-    auto *leafdata = node->get_leafdata();
+    auto *leafdata = tree.get_leafdata(node);
     Q_assert(leafdata);
 
     // NOTE: detail-solid is considered sealing for the detail fill,
@@ -72,67 +73,65 @@ leaf, so an info_player_start 24 units off a floor causes the
 room to not get filled in as solid.
 ===========
 */
-static node_t *PointInLeaf(node_t *node, const qvec3d &point, bool prefer_sealing)
+static node_t *PointInLeaf(const tree_t &tree, node_t *node, const qvec3d &point, bool prefer_sealing)
 {
-    auto *nodedata = node->get_nodedata();
-
-    if (!nodedata) { // leaf?
+    if (node->is_leaf()) {
         return node;
     }
 
-    double dist = nodedata->get_plane().distance_to(point);
+    double dist = node->get_plane().distance_to(point);
 
     if (dist > 0) {
         // point is on the front of the node plane
-        return PointInLeaf(nodedata->children[0], point, prefer_sealing);
+        return PointInLeaf(tree, node->children[0], point, prefer_sealing);
     } else if (dist < 0) {
         // point is on the back of the node plane
-        return PointInLeaf(nodedata->children[1], point, prefer_sealing);
+        return PointInLeaf(tree, node->children[1], point, prefer_sealing);
     } else {
         // point is exactly on the node plane
 
-        node_t *front = PointInLeaf(nodedata->children[0], point, prefer_sealing);
-        node_t *back = PointInLeaf(nodedata->children[1], point, prefer_sealing);
+        node_t *front = PointInLeaf(tree, node->children[0], point, prefer_sealing);
+        node_t *back = PointInLeaf(tree, node->children[1], point, prefer_sealing);
 
-        if (prefer_sealing == LeafSealsMap(front)) {
+        if (prefer_sealing == LeafSealsMap(tree, front)) {
             return front;
         }
         return back;
     }
 }
 
-static void ClearOccupied_r(node_t *node)
+static void ClearOccupied_r(tree_t &tree, node_t *node)
 {
-    if (auto *nodedata = node->get_nodedata()) {
-        ClearOccupied_r(nodedata->children[0]);
-        ClearOccupied_r(nodedata->children[1]);
+    if (!node->is_leaf()) {
+        ClearOccupied_r(tree, node->children[0]);
+        ClearOccupied_r(tree, node->children[1]);
         return;
     }
 
-    auto *leafdata = node->get_leafdata();
+    auto *leafdata = tree.get_leafdata(node);
     leafdata->outside_distance = -1;
     leafdata->occupied = 0;
     leafdata->occupant = nullptr;
 }
 
-static bool OutsideFill_Passable(const portal_t *p)
+static bool OutsideFill_Passable(const tree_t &tree, const portal_t *p)
 {
     if (!p->onnode) {
         // portal to outside_node
         return false;
     }
 
-    return !LeafSealsMap(p->nodes[0]) && !LeafSealsMap(p->nodes[1]);
+    return !LeafSealsMap(tree, p->nodes[0]) && !LeafSealsMap(tree, p->nodes[1]);
 }
 
-static bool DetailFill_Passable(const portal_t *p)
+static bool DetailFill_Passable(const tree_t &tree, const portal_t *p)
 {
     if (!p->onnode) {
         // portal to outside_node
         return false;
     }
 
-    return !LeafSealsForDetailFill(p->nodes[0]) && !LeafSealsForDetailFill(p->nodes[1]);
+    return !LeafSealsForDetailFill(tree, p->nodes[0]) && !LeafSealsForDetailFill(tree, p->nodes[1]);
 }
 
 /*
@@ -160,7 +159,7 @@ static void FloodFillLeafsFromVoid(tree_t &tree)
         Q_assert(fillnode != &tree.outside_node);
 
         // this must be true because the map is made from closed brushes, beyond which is void
-        Q_assert(!LeafSealsMap(fillnode));
+        Q_assert(!LeafSealsMap(tree, fillnode));
         queue.emplace_back(fillnode, 0);
     }
 
@@ -177,7 +176,7 @@ static void FloodFillLeafsFromVoid(tree_t &tree)
 
         // visit node
         visited_nodes.insert(node);
-        auto *leafdata = node->get_leafdata();
+        auto *leafdata = tree.get_leafdata(node);
         Q_assert(leafdata);
         leafdata->outside_distance = outside_distance;
 
@@ -186,7 +185,7 @@ static void FloodFillLeafsFromVoid(tree_t &tree)
         for (portal_t *portal = node->portals; portal; portal = portal->next[!side]) {
             side = (portal->nodes[0] == node);
 
-            if (!OutsideFill_Passable(portal))
+            if (!OutsideFill_Passable(tree, portal))
                 continue;
 
             node_t *neighbour = portal->nodes[side];
@@ -202,45 +201,45 @@ FindPortalsToVoid
 Given an occupied leaf, returns a list of porals leading to the void
 =============
 */
-static std::vector<portal_t *> FindPortalsToVoid(node_t *occupied_leaf)
+static std::vector<portal_t *> FindPortalsToVoid(tree_t &tree, node_t *occupied_leaf)
 {
-    Q_assert(occupied_leaf->get_leafdata()->occupant != nullptr);
-    Q_assert(occupied_leaf->get_leafdata()->outside_distance >= 0);
+    Q_assert(tree.get_leafdata(occupied_leaf)->occupant != nullptr);
+    Q_assert(tree.get_leafdata(occupied_leaf)->outside_distance >= 0);
 
     std::vector<portal_t *> result;
 
     node_t *node = occupied_leaf;
     while (1) {
         // exit?
-        if (node->get_leafdata()->outside_distance == 0)
+        if (tree.get_leafdata(node)->outside_distance == 0)
             break; // this is the void leaf where we started the flood fill in FloodFillFromVoid()
 
         // find the next node...
 
         node_t *bestneighbour = nullptr;
         portal_t *bestportal = nullptr;
-        int bestdist = node->get_leafdata()->outside_distance;
+        int bestdist = tree.get_leafdata(node)->outside_distance;
 
         int side;
         for (portal_t *portal = node->portals; portal; portal = portal->next[!side]) {
             side = (portal->nodes[0] == node);
 
-            if (!OutsideFill_Passable(portal))
+            if (!OutsideFill_Passable(tree, portal))
                 continue;
 
             node_t *neighbour = portal->nodes[side];
             Q_assert(neighbour != node);
-            Q_assert(neighbour->get_leafdata()->outside_distance >= 0);
+            Q_assert(tree.get_leafdata(neighbour)->outside_distance >= 0);
 
-            if (neighbour->get_leafdata()->outside_distance < bestdist) {
+            if (tree.get_leafdata(neighbour)->outside_distance < bestdist) {
                 bestneighbour = neighbour;
                 bestportal = portal;
-                bestdist = neighbour->get_leafdata()->outside_distance;
+                bestdist = tree.get_leafdata(neighbour)->outside_distance;
             }
         }
 
         Q_assert(bestneighbour != nullptr);
-        Q_assert(bestdist < node->get_leafdata()->outside_distance);
+        Q_assert(bestdist < tree.get_leafdata(node)->outside_distance);
 
         // go through bestportal
         result.push_back(bestportal);
@@ -343,7 +342,7 @@ MarkOccupiedLeafs
 sets node->occupant
 ==================
 */
-static void MarkOccupiedLeafs(node_t *headnode, hull_index_t hullnum)
+static void MarkOccupiedLeafs(tree_t &tree, node_t *headnode, hull_index_t hullnum)
 {
     for (int i = 1; i < map.entities.size(); i++) {
         mapentity_t &entity = map.entities.at(i);
@@ -359,10 +358,10 @@ static void MarkOccupiedLeafs(node_t *headnode, hull_index_t hullnum)
 
         /* find the leaf it's in. Skip opqaue leafs */
         bool prefer_sealing = !hullnum.has_value() || hullnum.value() == 0;
-        node_t *leaf = PointInLeaf(headnode, entity.origin, prefer_sealing);
-        auto *leafdata = leaf->get_leafdata();
+        node_t *leaf = PointInLeaf(tree, headnode, entity.origin, prefer_sealing);
+        auto *leafdata = tree.get_leafdata(leaf);
 
-        if (LeafSealsMap(leaf)) {
+        if (LeafSealsMap(tree, leaf)) {
             continue;
         }
 
@@ -375,15 +374,15 @@ static void MarkOccupiedLeafs(node_t *headnode, hull_index_t hullnum)
     }
 }
 
-static void FindOccupiedLeafs_R(node_t *node, std::vector<node_t *> &result)
+static void FindOccupiedLeafs_R(tree_t &tree, node_t *node, std::vector<node_t *> &result)
 {
-    if (auto *nodedata = node->get_nodedata()) {
-        FindOccupiedLeafs_R(nodedata->children[0], result);
-        FindOccupiedLeafs_R(nodedata->children[1], result);
+    if (!node->is_leaf()) {
+        FindOccupiedLeafs_R(tree, node->children[0], result);
+        FindOccupiedLeafs_R(tree, node->children[1], result);
         return;
     }
 
-    auto *leafdata = node->get_leafdata();
+    auto *leafdata = tree.get_leafdata(node);
     if (leafdata->occupant) {
         result.push_back(node);
     }
@@ -396,10 +395,10 @@ FindOccupiedLeafs
 Requires that FillOutside has run
 ==================
 */
-static std::vector<node_t *> FindOccupiedLeafs(node_t *headnode)
+static std::vector<node_t *> FindOccupiedLeafs(tree_t &tree, node_t *headnode)
 {
     std::vector<node_t *> result;
-    FindOccupiedLeafs_R(headnode, result);
+    FindOccupiedLeafs_R(tree, headnode, result);
     return result;
 }
 
@@ -427,16 +426,16 @@ MarkVisibleBrushSides
 Set f->touchesOccupiedLeaf=true on faces that are touching occupied leafs
 ==================
 */
-static void MarkVisibleBrushSides_R(node_t *node)
+static void MarkVisibleBrushSides_R(tree_t &tree, node_t *node)
 {
     // descent to leafs
-    if (auto *nodedata = node->get_nodedata()) {
-        MarkVisibleBrushSides_R(nodedata->children[0]);
-        MarkVisibleBrushSides_R(nodedata->children[1]);
+    if (!node->is_leaf()) {
+        MarkVisibleBrushSides_R(tree, node->children[0]);
+        MarkVisibleBrushSides_R(tree, node->children[1]);
         return;
     }
 
-    if (LeafSealsForDetailFill(node)) {
+    if (LeafSealsForDetailFill(tree, node)) {
         // this leaf is opaque
         return;
     }
@@ -453,7 +452,7 @@ static void MarkVisibleBrushSides_R(node_t *node)
         if (neighbour_leaf->is_leaf()) {
             // optimized case: just mark the brush sides in the neighbouring
             // leaf that are coplanar
-            for (auto *brush : neighbour_leaf->get_leafdata()->original_brushes) {
+            for (auto *brush : tree.get_leafdata(neighbour_leaf)->original_brushes) {
                 for (auto &side : brush->sides) {
                     // fixme-brushbsp: should this be get_plane() ?
                     // fixme-brushbsp: planenum
@@ -477,15 +476,15 @@ struct outleafs_stats_t : logging::stat_tracker_t
     stat &outleafs = register_stat("outside leaves");
 };
 
-static void OutLeafsToSolid_R(node_t *node, settings::filltype_t filltype, outleafs_stats_t &stats)
+static void OutLeafsToSolid_R(tree_t &tree, node_t *node, settings::filltype_t filltype, outleafs_stats_t &stats)
 {
-    if (auto *nodedata = node->get_nodedata()) {
-        OutLeafsToSolid_R(nodedata->children[0], filltype, stats);
-        OutLeafsToSolid_R(nodedata->children[1], filltype, stats);
+    if (!node->is_leaf()) {
+        OutLeafsToSolid_R(tree, node->children[0], filltype, stats);
+        OutLeafsToSolid_R(tree, node->children[1], filltype, stats);
         return;
     }
 
-    auto *leafdata = node->get_leafdata();
+    auto *leafdata = tree.get_leafdata(node);
 
     // skip leafs reachable from entities
     if (filltype == settings::filltype_t::INSIDE) {
@@ -513,15 +512,15 @@ struct detail_filled_leafs_stats_t : logging::stat_tracker_t
     stat &filledleafs = register_stat("detail filled leafs", true);
 };
 
-static void FillDetailEnclosedLeafsToDetailSolid_R(node_t *node, detail_filled_leafs_stats_t &stats)
+static void FillDetailEnclosedLeafsToDetailSolid_R(tree_t &tree, node_t *node, detail_filled_leafs_stats_t &stats)
 {
-    if (auto *nodedata = node->get_nodedata()) {
-        FillDetailEnclosedLeafsToDetailSolid_R(nodedata->children[0], stats);
-        FillDetailEnclosedLeafsToDetailSolid_R(nodedata->children[1], stats);
+    if (!node->is_leaf()) {
+        FillDetailEnclosedLeafsToDetailSolid_R(tree, node->children[0], stats);
+        FillDetailEnclosedLeafsToDetailSolid_R(tree, node->children[1], stats);
         return;
     }
 
-    auto *leafdata = node->get_leafdata();
+    auto *leafdata = tree.get_leafdata(node);
 
     // skip leafs reachable from entities
     if (leafdata->occupied > 0) {
@@ -529,7 +528,7 @@ static void FillDetailEnclosedLeafsToDetailSolid_R(node_t *node, detail_filled_l
     }
 
     // Don't fill sky, or count solids as outleafs
-    if (LeafSealsForDetailFill(node)) {
+    if (LeafSealsForDetailFill(tree, node)) {
         return;
     }
 
@@ -553,7 +552,7 @@ static void SetOccupied_R(node_t *node, int dist)
 }
 #endif
 
-using portal_passable_t = bool (*)(const portal_t *);
+using portal_passable_t = bool (*)(const tree_t &, const portal_t *);
 
 /*
 ==================
@@ -563,7 +562,7 @@ sets node->occupied to 1 or more to indicate the number of steps to a directly o
 ==================
 */
 static void BFSFloodFillFromOccupiedLeafs(
-    const std::vector<node_t *> &occupied_leafs, const portal_passable_t &predicate)
+    tree_t &tree, const std::vector<node_t *> &occupied_leafs, const portal_passable_t &predicate)
 {
     std::list<std::pair<node_t *, int>> queue;
     for (node_t *leaf : occupied_leafs) {
@@ -577,16 +576,16 @@ static void BFSFloodFillFromOccupiedLeafs(
         node_t *node = pair.first;
         const int dist = pair.second;
 
-        if (node->get_leafdata()->occupied == 0) {
+        if (tree.get_leafdata(node)->occupied == 0) {
             // we haven't visited this node yet
-            node->get_leafdata()->occupied = dist;
+            tree.get_leafdata(node)->occupied = dist;
 
             // push neighbouring nodes onto the back of the queue
             int side;
             for (portal_t *portal = node->portals; portal; portal = portal->next[!side]) {
                 side = (portal->nodes[0] == node);
 
-                if (!predicate(portal))
+                if (!predicate(tree, portal))
                     continue;
 
                 node_t *neighbour = portal->nodes[side];
@@ -596,54 +595,54 @@ static void BFSFloodFillFromOccupiedLeafs(
     }
 }
 
-static std::vector<portal_t *> MakeLeakLine(node_t *outleaf, mapentity_t *&leakentity)
+static std::vector<portal_t *> MakeLeakLine(tree_t &tree, node_t *outleaf, mapentity_t *&leakentity)
 {
     std::vector<portal_t *> result;
 
-    Q_assert(outleaf->get_leafdata()->occupied > 0);
+    Q_assert(tree.get_leafdata(outleaf)->occupied > 0);
 
     node_t *node = outleaf;
     while (1) {
         // exit?
-        if (node->get_leafdata()->occupied == 1)
+        if (tree.get_leafdata(node)->occupied == 1)
             break; // this node contains an entity
 
         // find the next node...
 
         node_t *bestneighbour = nullptr;
         portal_t *bestportal = nullptr;
-        int bestoccupied = node->get_leafdata()->occupied;
+        int bestoccupied = tree.get_leafdata(node)->occupied;
 
         int side;
         for (portal_t *portal = node->portals; portal; portal = portal->next[!side]) {
             side = (portal->nodes[0] == node);
 
-            if (!OutsideFill_Passable(portal))
+            if (!OutsideFill_Passable(tree, portal))
                 continue;
 
             node_t *neighbour = portal->nodes[side];
             Q_assert(neighbour != node);
-            Q_assert(neighbour->get_leafdata()->occupied > 0);
+            Q_assert(tree.get_leafdata(neighbour)->occupied > 0);
 
-            if (neighbour->get_leafdata()->occupied < bestoccupied) {
+            if (tree.get_leafdata(neighbour)->occupied < bestoccupied) {
                 bestneighbour = neighbour;
                 bestportal = portal;
-                bestoccupied = neighbour->get_leafdata()->occupied;
+                bestoccupied = tree.get_leafdata(neighbour)->occupied;
             }
         }
 
         Q_assert(bestneighbour != nullptr);
-        Q_assert(bestoccupied < node->get_leafdata()->occupied);
+        Q_assert(bestoccupied < tree.get_leafdata(node)->occupied);
 
         // go through bestportal
         result.push_back(bestportal);
         node = bestneighbour;
     }
 
-    Q_assert(node->get_leafdata()->occupant != nullptr);
-    Q_assert(node->get_leafdata()->occupied == 1);
+    Q_assert(tree.get_leafdata(node)->occupant != nullptr);
+    Q_assert(tree.get_leafdata(node)->occupied == 1);
 
-    leakentity = node->get_leafdata()->occupant;
+    leakentity = tree.get_leafdata(node)->occupant;
     return result;
 }
 
@@ -684,18 +683,19 @@ bool FillOutside(tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brus
     node_t *node = tree.headnode;
 
     logging::funcheader();
+    profilefunc();
     logging::percent_clock clock;
 
     /* Clear the outside filling state on all nodes */
-    ClearOccupied_r(node);
+    ClearOccupied_r(tree, node);
 
     // Sets leaf->occupant
-    MarkOccupiedLeafs(node, hullnum);
-    const std::vector<node_t *> occupied_leafs = FindOccupiedLeafs(node);
+    MarkOccupiedLeafs(tree, node, hullnum);
+    const std::vector<node_t *> occupied_leafs = FindOccupiedLeafs(tree, node);
 
     for (auto *occupied_leaf : occupied_leafs) {
-        Q_assert(occupied_leaf->get_leafdata()->outside_distance == -1);
-        Q_assert(occupied_leaf->get_leafdata()->occupied == 0);
+        Q_assert(tree.get_leafdata(occupied_leaf)->outside_distance == -1);
+        Q_assert(tree.get_leafdata(occupied_leaf)->occupied == 0);
     }
 
     if (occupied_leafs.empty()) {
@@ -713,14 +713,14 @@ bool FillOutside(tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brus
     }
 
     if (filltype == settings::filltype_t::INSIDE) {
-        BFSFloodFillFromOccupiedLeafs(occupied_leafs, OutsideFill_Passable);
+        BFSFloodFillFromOccupiedLeafs(tree, occupied_leafs, OutsideFill_Passable);
 
         /* first check to see if an occupied leaf is hit */
         const int side = (tree.outside_node.portals->nodes[0] == &tree.outside_node);
         node_t *fillnode = tree.outside_node.portals->nodes[side];
 
-        if (fillnode->get_leafdata()->occupied > 0) {
-            leakline = MakeLeakLine(fillnode, leakentity);
+        if (tree.get_leafdata(fillnode)->occupied > 0) {
+            leakline = MakeLeakLine(tree, fillnode, leakentity);
             std::reverse(leakline.begin(), leakline.end());
         }
     } else {
@@ -735,7 +735,7 @@ bool FillOutside(tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brus
         node_t *best_leak = nullptr;
 
         for (node_t *leaf : occupied_leafs) {
-            auto *leafdata = leaf->get_leafdata();
+            auto *leafdata = tree.get_leafdata(leaf);
             if (leafdata->outside_distance == -1)
                 continue;
 
@@ -746,9 +746,9 @@ bool FillOutside(tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brus
         }
 
         if (best_leak) {
-            leakentity = best_leak->get_leafdata()->occupant;
+            leakentity = tree.get_leafdata(best_leak)->occupant;
             Q_assert(leakentity != nullptr);
-            leakline = FindPortalsToVoid(best_leak);
+            leakline = FindPortalsToVoid(tree, best_leak);
         }
     }
 
@@ -782,20 +782,20 @@ bool FillOutside(tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brus
         }
 
         // clear occupied state, so areas can be flooded in Q2
-        // ClearOccupied_r(node);
+        // ClearOccupied_r(tree, node);
 
         return false;
     }
 
     // change the leaf contents
     outleafs_stats_t stats;
-    OutLeafsToSolid_R(node, filltype, stats);
+    OutLeafsToSolid_R(tree, node, filltype, stats);
 
     // See missing_face_simple.map for a test case with a brush that straddles between void and non-void
 
     MarkBrushSidesInvisible(brushes);
 
-    MarkVisibleBrushSides_R(node);
+    MarkVisibleBrushSides_R(tree, node);
 
 #if 0
     // FIXME: move somewhere else
@@ -815,11 +815,11 @@ void FillBrushEntity(tree_t &tree, hull_index_t hullnum, bspbrush_t::container &
     logging::funcheader();
 
     // Clear the outside filling state on all nodes
-    ClearOccupied_r(tree.headnode);
+    ClearOccupied_r(tree, tree.headnode);
 
     MarkBrushSidesInvisible(brushes);
 
-    MarkVisibleBrushSides_R(tree.headnode);
+    MarkVisibleBrushSides_R(tree, tree.headnode);
 }
 
 /**
@@ -833,26 +833,26 @@ void FillDetail(tree_t &tree, hull_index_t hullnum, bspbrush_t::container &brush
     logging::funcheader();
 
     // Clear the outside filling state on all leafs
-    ClearOccupied_r(tree.headnode);
+    ClearOccupied_r(tree, tree.headnode);
 
     // Sets leaf->occupant
-    MarkOccupiedLeafs(tree.headnode, hullnum);
-    const std::vector<node_t *> occupied_leafs = FindOccupiedLeafs(tree.headnode);
+    MarkOccupiedLeafs(tree, tree.headnode, hullnum);
+    const std::vector<node_t *> occupied_leafs = FindOccupiedLeafs(tree, tree.headnode);
 
     if (occupied_leafs.empty()) {
         logging::print("WARNING: No entities in empty space -- no filling performed (hull {})\n", hullnum.value_or(0));
         return;
     }
 
-    BFSFloodFillFromOccupiedLeafs(occupied_leafs, DetailFill_Passable);
+    BFSFloodFillFromOccupiedLeafs(tree, occupied_leafs, DetailFill_Passable);
 
     // change the leaf contents
     detail_filled_leafs_stats_t stats;
-    FillDetailEnclosedLeafsToDetailSolid_R(tree.headnode, stats);
+    FillDetailEnclosedLeafsToDetailSolid_R(tree, tree.headnode, stats);
 
     // See missing_face_simple.map for a test case with a brush that straddles between void and non-void
 
     MarkBrushSidesInvisible(brushes);
 
-    MarkVisibleBrushSides_R(tree.headnode);
+    MarkVisibleBrushSides_R(tree, tree.headnode);
 }
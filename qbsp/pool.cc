@@ -0,0 +1,231 @@
+/*  Copyright (C) 1996-1997  Id Software, Inc.
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+    See file, 'COPYING', for details.
+*/
+
+#include <qbsp/pool.hh>
+
+#include <array>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include <tbb/scalable_allocator.h>
+
+namespace pool
+{
+// block sizes are multiples of this, which is also the alignment
+constexpr size_t granularity = 16;
+// blocks of up to num_classes * granularity bytes, header included, are pooled
+constexpr size_t num_classes = 128;
+constexpr size_t slab_size = 64 * 1024;
+constexpr uint32_t large_class = std::numeric_limits<uint32_t>::max();
+
+// in front of every block
+struct alignas(granularity) header_t
+{
+    uint32_t size_class; // large_class for blocks from scalable_allocator
+    uint32_t epoch; // the scope_t the block was allocated in, or 0
+};
+
+static_assert(sizeof(header_t) == granularity);
+
+// a freed block, linked into its class's free list over the header
+struct free_block_t
+{
+    free_block_t *next;
+};
+
+// one per thread; only that thread touches it, except for scope_t::counts()
+struct alignas(64) thread_pool_t
+{
+    std::array<free_block_t *, num_classes> free_lists{};
+    uint8_t *slab_next = nullptr;
+    uint8_t *slab_end = nullptr;
+
+    // counts for the scope `counts_epoch`; reset when a newer scope is seen
+    uint32_t counts_epoch = 0;
+    counts_t counts;
+
+    inline counts_t &counts_for(uint32_t epoch)
+    {
+        if (counts_epoch != epoch) {
+            counts_epoch = epoch;
+            counts = {};
+        }
+
+        return counts;
+    }
+};
+
+struct registry_t
+{
+    std::mutex lock;
+    // never shrinks, as threads keep a pointer to theirs, and blocks may
+    // still be freed on other threads after the owner has exited
+    std::vector<std::unique_ptr<thread_pool_t>> pools;
+    std::vector<void *> slabs;
+};
+
+// never destroyed, as blocks can still be freed during static destruction
+static registry_t &registry()
+{
+    static registry_t *instance = new registry_t;
+    return *instance;
+}
+
+static std::atomic<uint32_t> current_epoch = 0;
+static std::atomic<uint32_t> next_epoch = 1;
+
+static thread_pool_t &local()
+{
+    static thread_local thread_pool_t *pool = nullptr;
+
+    if (!pool) {
+        registry_t &r = registry();
+        std::unique_lock lock(r.lock);
+        pool = r.pools.emplace_back(std::make_unique<thread_pool_t>()).get();
+    }
+
+    return *pool;
+}
+
+static void *carve(thread_pool_t &pool, size_t size)
+{
+    if (static_cast<size_t>(pool.slab_end - pool.slab_next) < size) {
+        // the rest of the current slab is left unused
+        auto *slab = static_cast<uint8_t *>(scalable_aligned_malloc(slab_size, 64));
+
+        if (!slab) {
+            throw std::bad_alloc();
+        }
+
+        {
+            registry_t &r = registry();
+            std::unique_lock lock(r.lock);
+            r.slabs.push_back(slab);
+        }
+
+        pool.slab_next = slab;
+        pool.slab_end = slab + slab_size;
+    }
+
+    void *block = pool.slab_next;
+    pool.slab_next += size;
+    return block;
+}
+
+void *allocate(size_t bytes)
+{
+    thread_pool_t &pool = local();
+    const size_t size_class = (bytes + sizeof(header_t) + granularity - 1) / granularity;
+    header_t *header;
+
+    if (size_class >= num_classes) {
+        header = static_cast<header_t *>(scalable_aligned_malloc(size_class * granularity, granularity));
+
+        if (!header) {
+            throw std::bad_alloc();
+        }
+
+        header->size_class = large_class;
+    } else {
+        if (free_block_t *block = pool.free_lists[size_class]) {
+            pool.free_lists[size_class] = block->next;
+            header = reinterpret_cast<header_t *>(block);
+        } else {
+            header = static_cast<header_t *>(carve(pool, size_class * granularity));
+        }
+
+        header->size_class = static_cast<uint32_t>(size_class);
+    }
+
+    header->epoch = current_epoch.load(std::memory_order_relaxed);
+
+    if (header->epoch) {
+        counts_t &counts = pool.counts_for(header->epoch);
+        counts.allocations++;
+        counts.bytes += bytes;
+    }
+
+    return header + 1;
+}
+
+void deallocate(void *p) noexcept
+{
+    if (!p) {
+        return;
+    }
+
+    thread_pool_t &pool = local();
+    header_t *header = static_cast<header_t *>(p) - 1;
+    const uint32_t epoch = current_epoch.load(std::memory_order_relaxed);
+
+    if (epoch && header->epoch == epoch) {
+        pool.counts_for(epoch).frees++;
+    }
+
+    const uint32_t size_class = header->size_class;
+
+    if (size_class == large_class) {
+        scalable_aligned_free(header);
+        return;
+    }
+
+    auto *block = reinterpret_cast<free_block_t *>(header);
+    block->next = pool.free_lists[size_class];
+    pool.free_lists[size_class] = block;
+}
+
+scope_t::scope_t()
+    : epoch(next_epoch++),
+      previous(current_epoch.exchange(epoch))
+{
+}
+
+scope_t::~scope_t()
+{
+    current_epoch = previous;
+}
+
+counts_t scope_t::counts() const
+{
+    registry_t &r = registry();
+    std::unique_lock lock(r.lock);
+    counts_t result;
+
+    for (auto &pool : r.pools) {
+        if (pool->counts_epoch == epoch) {
+            result.allocations += pool->counts.allocations;
+            result.frees += pool->counts.frees;
+            result.bytes += pool->counts.bytes;
+        }
+    }
+
+    return result;
+}
+
+size_t slab_bytes()
+{
+    registry_t &r = registry();
+    std::unique_lock lock(r.lock);
+    return r.slabs.size() * slab_size;
+}
+} // namespace pool
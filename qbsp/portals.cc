@@ -29,21 +29,21 @@
 #include <qbsp/outside.hh>
 #include <qbsp/tree.hh>
 #include <common/log.hh>
+#include <common/profiler.hh>
 #include <atomic>
 #include <common/prtfile.hh>
 
 #include "tbb/task_group.h"
 #include "common/vectorutils.hh"
 
-contentflags_t ClusterContents(const node_t *node)
+contentflags_t ClusterContents(const tree_t &tree, const node_t *node)
 {
     /* Pass the leaf contents up the stack */
-    if (auto *leafdata = node->get_leafdata())
+    if (auto *leafdata = tree.get_leafdata(node))
         return leafdata->contents;
 
-    auto *nodedata = node->get_nodedata();
     return qbsp_options.target_game->cluster_contents(
-        ClusterContents(nodedata->children[0]), ClusterContents(nodedata->children[1]));
+        ClusterContents(tree, node->children[0]), ClusterContents(tree, node->children[1]));
 }
 
 /*
@@ -56,14 +56,14 @@ The nodes on either side of the portal may actually be clusters,
 not leafs, so all contents should be ored together
 =============
 */
-bool Portal_VisFlood(const portal_t *p)
+bool Portal_VisFlood(const tree_t &tree, const portal_t *p)
 {
     if (!p->onnode) {
         return false; // to global outsideleaf
     }
 
-    contentflags_t contents0 = ClusterContents(p->nodes[0]);
-    contentflags_t contents1 = ClusterContents(p->nodes[1]);
+    contentflags_t contents0 = ClusterContents(tree, p->nodes[0]);
+    contentflags_t contents1 = ClusterContents(tree, p->nodes[1]);
 
     // Check per-game visibility
     return qbsp_options.target_game->portal_can_see_through(contents0, contents1, qbsp_options.transwater.value());
@@ -78,15 +78,15 @@ The entity flood determines which areas are
 Flowing from side s to side !s
 ===============
 */
-bool Portal_EntityFlood(const portal_t *p, int32_t s)
+bool Portal_EntityFlood(const tree_t &tree, const portal_t *p, int32_t s)
 {
     if (!p->nodes[0]->is_leaf() || !p->nodes[1]->is_leaf()) {
         FError("Portal_EntityFlood: not a leaf");
     }
 
     // can never cross to a solid
-    if (p->nodes[0]->get_leafdata()->contents.is_solid(qbsp_options.target_game) ||
-        p->nodes[1]->get_leafdata()->contents.is_solid(qbsp_options.target_game)) {
+    if (tree.get_leafdata(p->nodes[0])->contents.is_solid(qbsp_options.target_game) ||
+        tree.get_leafdata(p->nodes[1])->contents.is_solid(qbsp_options.target_game)) {
         return false;
     }
 
@@ -129,8 +129,7 @@ std::list<buildportal_t> MakeHeadnodePortals(tree_t &tree)
     // pad with some space so there will never be null volume leafs
     aabb3d bounds = tree.bounds.grow(SIDESPACE);
 
-    tree.outside_node.make_leaf();
-    tree.outside_node.get_leafdata()->contents = qbsp_options.target_game->create_solid_contents();
+    tree.make_leaf(&tree.outside_node)->contents = qbsp_options.target_game->create_solid_contents();
     tree.outside_node.portals = nullptr;
 
     // create 6 portals forming a cube around the bounds of the map.
@@ -194,15 +193,15 @@ constexpr double SPLIT_WINDING_EPSILON = 0.001;
 
 static std::optional<winding_t> BaseWindingForNode(const node_t *node)
 {
-    std::optional<winding_t> w = BaseWindingForPlane<winding_t>(node->get_nodedata()->get_plane());
+    std::optional<winding_t> w = BaseWindingForPlane<winding_t>(node->get_plane());
 
     // clip by all the parents
     for (auto *np = node->parent; np && w;) {
 
-        if (np->get_nodedata()->children[0] == node) {
-            w = w->clip_front(np->get_nodedata()->get_plane().get_plane(), BASE_WINDING_EPSILON, false);
+        if (np->children[0] == node) {
+            w = w->clip_front(np->get_plane().get_plane(), BASE_WINDING_EPSILON, false);
         } else {
-            w = w->clip_back(np->get_nodedata()->get_plane().get_plane(), BASE_WINDING_EPSILON, false);
+            w = w->clip_back(np->get_plane().get_plane(), BASE_WINDING_EPSILON, false);
         }
 
         node = np;
@@ -254,13 +253,11 @@ static std::optional<buildportal_t> MakeNodePortal(
         return std::nullopt;
     }
 
-    auto *nodedata = node->get_nodedata();
-
     buildportal_t new_portal{};
-    new_portal.plane = nodedata->get_plane();
+    new_portal.plane = node->get_plane();
     new_portal.onnode = node;
     new_portal.winding = std::move(*w);
-    new_portal.nodes = nodedata->children;
+    new_portal.nodes = node->children;
     return std::move(new_portal);
 }
 
@@ -275,11 +272,9 @@ children have portals instead of node.
 static twosided<std::list<buildportal_t>> SplitNodePortals(
     const node_t *node, std::list<buildportal_t> boundary_portals, portalstats_t &stats)
 {
-    auto *nodedata = node->get_nodedata();
-
-    const auto &plane = nodedata->get_plane();
-    node_t *f = nodedata->children[0];
-    node_t *b = nodedata->children[1];
+    const auto &plane = node->get_plane();
+    node_t *f = node->children[0];
+    node_t *b = node->children[1];
 
     twosided<std::list<buildportal_t>> result;
 
@@ -401,14 +396,12 @@ static void CalcTreeBounds_r(node_t *node, logging::percent_clock &clock)
         clock();
         CalcNodeBounds(node);
     } else {
-        auto *nodedata = node->get_nodedata();
-
         tbb::task_group g;
-        g.run([&]() { CalcTreeBounds_r(nodedata->children[0], clock); });
-        g.run([&]() { CalcTreeBounds_r(nodedata->children[1], clock); });
+        g.run([&]() { CalcTreeBounds_r(node->children[0], clock); });
+        g.run([&]() { CalcTreeBounds_r(node->children[1], clock); });
         g.wait();
 
-        node->bounds = nodedata->children[0]->bounds + nodedata->children[1]->bounds;
+        node->bounds = node->children[0]->bounds + node->children[1]->bounds;
     }
 
     if (node->bounds.mins()[0] >= node->bounds.maxs()[0]) {
@@ -443,17 +436,16 @@ static std::list<buildportal_t> ClipNodePortalsToTree_r(
     if (portals.empty()) {
         return portals;
     }
-    if (node->is_leaf() || (type == portaltype_t::VIS && node->get_nodedata()->detail_separator)) {
+    if (node->is_leaf() || (type == portaltype_t::VIS && node->detail_separator)) {
         return portals;
     }
-    auto *nodedata = node->get_nodedata();
 
     auto boundary_portals_split = SplitNodePortals(node, std::move(portals), stats);
 
     auto front_fragments =
-        ClipNodePortalsToTree_r(nodedata->children[0], type, std::move(boundary_portals_split.front), stats);
+        ClipNodePortalsToTree_r(node->children[0], type, std::move(boundary_portals_split.front), stats);
     auto back_fragments =
-        ClipNodePortalsToTree_r(nodedata->children[1], type, std::move(boundary_portals_split.back), stats);
+        ClipNodePortalsToTree_r(node->children[1], type, std::move(boundary_portals_split.back), stats);
 
     std::list<buildportal_t> merged_result = std::move(front_fragments);
     merged_result.splice(merged_result.end(), back_fragments);
@@ -472,7 +464,7 @@ std::list<buildportal_t> MakeTreePortals_r(node_t *node, portaltype_t type, std:
 {
     clock();
 
-    if (node->is_leaf() || (type == portaltype_t::VIS && node->get_nodedata()->detail_separator)) {
+    if (node->is_leaf() || (type == portaltype_t::VIS && node->detail_separator)) {
         return boundary_portals;
     }
 
@@ -486,16 +478,14 @@ std::list<buildportal_t> MakeTreePortals_r(node_t *node, portaltype_t type, std:
 
     std::list<buildportal_t> result_portals_front, result_portals_back;
 
-    auto *nodedata = node->get_nodedata();
-
     tbb::task_group g;
     g.run([&]() {
         result_portals_front =
-            MakeTreePortals_r(nodedata->children[0], type, std::move(boundary_portals_split.front), stats, clock);
+            MakeTreePortals_r(node->children[0], type, std::move(boundary_portals_split.front), stats, clock);
     });
     g.run([&]() {
         result_portals_back =
-            MakeTreePortals_r(nodedata->children[1], type, std::move(boundary_portals_split.back), stats, clock);
+            MakeTreePortals_r(node->children[1], type, std::move(boundary_portals_split.back), stats, clock);
     });
     g.wait();
 
@@ -509,9 +499,9 @@ std::list<buildportal_t> MakeTreePortals_r(node_t *node, portaltype_t type, std:
         // these portal fragments have node->children[1] on one side, and the leaf nodes from
         // node->children[0] on the other side
         std::list<buildportal_t> half_clipped =
-            ClipNodePortalsToTree_r(nodedata->children[0], type, make_list(std::move(*nodeportal)), stats);
+            ClipNodePortalsToTree_r(node->children[0], type, make_list(std::move(*nodeportal)), stats);
 
-        result_portals_onnode = ClipNodePortalsToTree_r(nodedata->children[1], type, std::move(half_clipped), stats);
+        result_portals_onnode = ClipNodePortalsToTree_r(node->children[1], type, std::move(half_clipped), stats);
     }
 
     // all done, merge together the lists and return
@@ -529,6 +519,7 @@ MakeTreePortals
 void MakeTreePortals(tree_t &tree)
 {
     logging::funcheader();
+    profilefunc();
 
     FreeTreePortals(tree);
 
@@ -568,28 +559,28 @@ FLOOD AREAS
 =========================================================
 */
 
-static void ApplyArea_r(node_t *node)
+static void ApplyArea_r(tree_t &tree, node_t *node)
 {
-    if (auto *nodedata = node->get_nodedata()) {
-        ApplyArea_r(nodedata->children[0]);
-        ApplyArea_r(nodedata->children[1]);
+    if (!node->is_leaf()) {
+        ApplyArea_r(tree, node->children[0]);
+        ApplyArea_r(tree, node->children[1]);
         return;
     }
 
-    node->get_leafdata()->area = map.c_areas;
+    tree.get_leafdata(node)->area = map.c_areas;
 }
 
-static mapentity_t *AreanodeEntityForLeaf(node_t *node)
+static mapentity_t *AreanodeEntityForLeaf(tree_t &tree, node_t *node)
 {
     // if detail cluster, search the children recursively
-    if (auto *nodedata = node->get_nodedata()) {
-        if (auto *child0result = AreanodeEntityForLeaf(nodedata->children[0]); child0result) {
+    if (!node->is_leaf()) {
+        if (auto *child0result = AreanodeEntityForLeaf(tree, node->children[0]); child0result) {
             return child0result;
         }
-        return AreanodeEntityForLeaf(nodedata->children[1]);
+        return AreanodeEntityForLeaf(tree, node->children[1]);
     }
 
-    auto *leafdata = node->get_leafdata();
+    auto *leafdata = tree.get_leafdata(node);
     for (auto &brush : leafdata->original_brushes) {
         if (brush->mapbrush->func_areaportal) {
             return brush->mapbrush->func_areaportal;
@@ -603,14 +594,14 @@ static mapentity_t *AreanodeEntityForLeaf(node_t *node)
 FloodAreas_r
 =============
 */
-static void FloodAreas_r(node_t *node)
+static void FloodAreas_r(tree_t &tree, node_t *node)
 {
-    auto *leafdata = node->get_leafdata();
+    auto *leafdata = tree.get_leafdata(node);
     Q_assert(leafdata);
 
     if (leafdata->contents.flags & EWT_INVISCONTENTS_AREAPORTAL) {
         // grab the func_areanode entity
-        mapentity_t *entity = AreanodeEntityForLeaf(node);
+        mapentity_t *entity = AreanodeEntityForLeaf(tree, node);
 
         if (entity == nullptr) {
             logging::print("WARNING: areaportal contents in node, but no entity found {} -> {}\n", node->bounds.mins(),
@@ -648,7 +639,7 @@ static void FloodAreas_r(node_t *node)
     // (unnecessary because we did a full tree portalization)
 #if 0
     if (!node->is_leaf()) {
-        ApplyArea_r(node);
+        ApplyArea_r(tree, node);
     }
 #endif
 
@@ -660,10 +651,10 @@ static void FloodAreas_r(node_t *node)
 		if (p->nodes[!s]->occupied)
 			continue;
 #endif
-        if (!Portal_EntityFlood(p, s))
+        if (!Portal_EntityFlood(tree, p, s))
             continue;
 
-        FloodAreas_r(p->nodes[!s]);
+        FloodAreas_r(tree, p->nodes[!s]);
     }
 }
 
@@ -675,15 +666,15 @@ Just decend the tree, and for each node that hasn't had an
 area set, flood fill out from there
 =============
 */
-static void FindAreas_r(node_t *node)
+static void FindAreas_r(tree_t &tree, node_t *node)
 {
-    if (auto *nodedata = node->get_nodedata()) {
-        FindAreas_r(nodedata->children[0]);
-        FindAreas_r(nodedata->children[1]);
+    if (!node->is_leaf()) {
+        FindAreas_r(tree, node->children[0]);
+        FindAreas_r(tree, node->children[1]);
         return;
     }
 
-    auto *leafdata = node->get_leafdata();
+    auto *leafdata = tree.get_leafdata(node);
 
     if (leafdata->area)
         return; // already got it
@@ -700,7 +691,7 @@ static void FindAreas_r(node_t *node)
         return;
 
     map.c_areas++;
-    FloodAreas_r(node);
+    FloodAreas_r(tree, node);
 }
 
 /**
@@ -759,7 +750,8 @@ static std::list<node_t *> FindShortestPath(node_t *a, node_t *b, const std::fun
 
 using exit_t = std::tuple<portal_t *, node_t *>;
 
-static void FindAreaPortalExits_R(node_t *n, std::unordered_set<node_t *> &visited, std::vector<exit_t> &exits)
+static void FindAreaPortalExits_R(
+    tree_t &tree, node_t *n, std::unordered_set<node_t *> &visited, std::vector<exit_t> &exits)
 {
     Q_assert(n->is_leaf());
 
@@ -776,19 +768,19 @@ static void FindAreaPortalExits_R(node_t *n, std::unordered_set<node_t *> &visit
             continue;
 
         // is this an exit?
-        if (!(neighbour->get_leafdata()->contents.flags & EWT_INVISCONTENTS_AREAPORTAL) &&
-            !neighbour->get_leafdata()->contents.is_solid(qbsp_options.target_game)) {
+        if (!(tree.get_leafdata(neighbour)->contents.flags & EWT_INVISCONTENTS_AREAPORTAL) &&
+            !tree.get_leafdata(neighbour)->contents.is_solid(qbsp_options.target_game)) {
             exits.emplace_back(p, neighbour);
             continue;
         }
 
         // valid edge to explore?
         // if this isn't an exit, don't leave AREAPORTAL
-        if (!(neighbour->get_leafdata()->contents.flags & EWT_INVISCONTENTS_AREAPORTAL))
+        if (!(tree.get_leafdata(neighbour)->contents.flags & EWT_INVISCONTENTS_AREAPORTAL))
             continue;
 
         // continue exploding
-        FindAreaPortalExits_R(neighbour, visited, exits);
+        FindAreaPortalExits_R(tree, neighbour, visited, exits);
     }
 }
 
@@ -796,12 +788,12 @@ static void FindAreaPortalExits_R(node_t *n, std::unordered_set<node_t *> &visit
  * DFS to find all portals leading out of the Q2_CONTENTS_AREAPORTAL leaf `n`, into non-solid leafs.
  * Returns all of the portals and corresponding "outside" leafs.
  */
-static std::vector<exit_t> FindAreaPortalExits(node_t *n)
+static std::vector<exit_t> FindAreaPortalExits(tree_t &tree, node_t *n)
 {
     std::unordered_set<node_t *> visited;
     std::vector<exit_t> exits;
 
-    FindAreaPortalExits_R(n, visited, exits);
+    FindAreaPortalExits_R(tree, n, visited, exits);
 
     return exits;
 }
@@ -809,9 +801,9 @@ static std::vector<exit_t> FindAreaPortalExits(node_t *n)
 /**
  * Attempts to write a leak line showing how the two sides of the areaportal are reachable.
  */
-static void DebugAreaPortalBothSidesLeak(node_t *node)
+static void DebugAreaPortalBothSidesLeak(tree_t &tree, node_t *node)
 {
-    std::vector<exit_t> exits = FindAreaPortalExits(node);
+    std::vector<exit_t> exits = FindAreaPortalExits(tree, node);
 
     if (exits.size() < 2) {
         logging::funcprint("WARNING: only found {} exits\n", exits.size());
@@ -829,13 +821,13 @@ static void DebugAreaPortalBothSidesLeak(node_t *node)
     for (size_t i = 1; i < exits.size(); ++i) {
         auto [exit_portal_i, exit_leaf_i] = exits[i];
 
-        auto path = FindShortestPath(exit_leaf0, exit_leaf_i, [](portal_t *p) -> bool {
-            if (!Portal_EntityFlood(p, 0))
+        auto path = FindShortestPath(exit_leaf0, exit_leaf_i, [&tree](portal_t *p) -> bool {
+            if (!Portal_EntityFlood(tree, p, 0))
                 return false;
 
             // don't go back into an areaportal
-            if ((p->nodes[0]->get_leafdata()->contents.flags & EWT_INVISCONTENTS_AREAPORTAL) ||
-                (p->nodes[1]->get_leafdata()->contents.flags & EWT_INVISCONTENTS_AREAPORTAL))
+            if ((tree.get_leafdata(p->nodes[0])->contents.flags & EWT_INVISCONTENTS_AREAPORTAL) ||
+                (tree.get_leafdata(p->nodes[1])->contents.flags & EWT_INVISCONTENTS_AREAPORTAL))
                 return false;
 
             return true;
@@ -883,15 +875,15 @@ Just decend the tree, and for each node that hasn't had an
 area set, flood fill out from there
 =============
 */
-static void SetAreaPortalAreas_r(node_t *node)
+static void SetAreaPortalAreas_r(tree_t &tree, node_t *node)
 {
-    if (auto *nodedata = node->get_nodedata()) {
-        SetAreaPortalAreas_r(nodedata->children[0]);
-        SetAreaPortalAreas_r(nodedata->children[1]);
+    if (!node->is_leaf()) {
+        SetAreaPortalAreas_r(tree, node->children[0]);
+        SetAreaPortalAreas_r(tree, node->children[1]);
         return;
     }
 
-    auto *leafdata = node->get_leafdata();
+    auto *leafdata = tree.get_leafdata(node);
 
     if (leafdata->contents.flags != EWT_INVISCONTENTS_AREAPORTAL)
         return;
@@ -900,7 +892,7 @@ static void SetAreaPortalAreas_r(node_t *node)
         return; // already set
 
     // grab the func_areanode entity
-    mapentity_t *entity = AreanodeEntityForLeaf(node);
+    mapentity_t *entity = AreanodeEntityForLeaf(tree, node);
 
     if (!entity) {
         logging::print("WARNING: areaportal missing for node: {} -> {}\n", node->bounds.mins(), node->bounds.maxs());
@@ -915,7 +907,7 @@ static void SetAreaPortalAreas_r(node_t *node)
                 "WARNING: {}: areaportal entity {} with targetname {} doesn't touch two areas\n  Node bounds: {} -> {}\n",
                 entity->location, entity - map.entities.data(), entity->epairs.get("targetname"), node->bounds.mins(),
                 node->bounds.maxs());
-            DebugAreaPortalBothSidesLeak(node);
+            DebugAreaPortalBothSidesLeak(tree, node);
         }
         return;
     }
@@ -954,8 +946,8 @@ void EmitAreaPortals(tree_t &tree)
         return;
     }
 
-    FindAreas_r(tree.headnode);
-    SetAreaPortalAreas_r(tree.headnode);
+    FindAreas_r(tree, tree.headnode);
+    SetAreaPortalAreas_r(tree, tree.headnode);
 
     for (size_t i = 1; i <= map.c_areas; i++) {
         darea_t &area = map.bsp.dareas.emplace_back();
@@ -1011,14 +1003,14 @@ FindPortalSide
 Finds a brush side to use for texturing the given portal
 ============
 */
-static void FindPortalSide(portal_t *p, visible_faces_stats_t &stats)
+static void FindPortalSide(tree_t &tree, portal_t *p, visible_faces_stats_t &stats)
 {
     // decide which content change is strongest
     // solid > lava > water, etc
 
     // if either is "_noclipfaces" then we don't require a content change
     contentflags_t viscontents = qbsp_options.target_game->portal_visible_contents(
-        p->nodes[0]->get_leafdata()->contents, p->nodes[1]->get_leafdata()->contents);
+        tree.get_leafdata(p->nodes[0])->contents, tree.get_leafdata(p->nodes[1])->contents);
     if (viscontents.is_empty(qbsp_options.target_game))
         return;
 
@@ -1026,16 +1018,15 @@ static void FindPortalSide(portal_t *p, visible_faces_stats_t &stats)
     side_t *bestside[2] = {nullptr, nullptr};
     side_t *exactside[2] = {nullptr, nullptr};
     float bestdot = 0;
-    const qbsp_plane_t &p1 = p->onnode->get_nodedata()->get_plane();
+    const qbsp_plane_t &p1 = p->onnode->get_plane();
 
     // check brushes on both sides of the portal
     for (int j = 0; j < 2; j++) {
-        node_t *n = p->nodes[j];
+        auto &original_brushes = tree.get_leafdata(p->nodes[j])->original_brushes;
 
-        // iterate the n->original_brushes vector in reverse order, so later brushes
+        // iterate the original_brushes vector in reverse order, so later brushes
         // in the map file order are prioritized
-        for (auto it = n->get_leafdata()->original_brushes.rbegin(); it != n->get_leafdata()->original_brushes.rend();
-            ++it) {
+        for (auto it = original_brushes.rbegin(); it != original_brushes.rend(); ++it) {
             auto *brush = *it;
             const bool generate_outside_face =
                 qbsp_options.target_game->portal_generates_face(viscontents, brush->contents, SIDE_FRONT);
@@ -1054,7 +1045,7 @@ static void FindPortalSide(portal_t *p, visible_faces_stats_t &stats)
                     continue;
                 }
 
-                if ((side.planenum & ~1) == p->onnode->get_nodedata()->planenum) {
+                if ((side.planenum & ~1) == p->onnode->planenum) {
                     // exact match (undirectional)
 
                     // because the brush is on j of the positive plane, the brushside must be facing away from j
@@ -1109,7 +1100,7 @@ static void FindPortalSide(portal_t *p, visible_faces_stats_t &stats)
     if (!bestside[0] && !bestside[1]) {
         stats.sides_not_found++;
         logging::print(logging::flag::VERBOSE, "couldn't find portal side at {}\n", p->winding.center());
-        stats.missing_portal_sides.push_back(p->winding.clone());
+        stats.missing_portal_sides.emplace_back(p->winding.begin(), p->winding.end());
     }
 
     p->sidefound = true;
@@ -1125,15 +1116,15 @@ MarkVisibleSides_r
 
 ===============
 */
-static void MarkVisibleSides_r(node_t *node, visible_faces_stats_t &stats)
+static void MarkVisibleSides_r(tree_t &tree, node_t *node, visible_faces_stats_t &stats)
 {
-    if (auto *nodedata = node->get_nodedata()) {
-        MarkVisibleSides_r(nodedata->children[0], stats);
-        MarkVisibleSides_r(nodedata->children[1], stats);
+    if (!node->is_leaf()) {
+        MarkVisibleSides_r(tree, node->children[0], stats);
+        MarkVisibleSides_r(tree, node->children[1], stats);
         return;
     }
 
-    auto *leafdata = node->get_leafdata();
+    auto *leafdata = tree.get_leafdata(node);
 
     // empty leafs are never boundary leafs
     if (leafdata->contents.is_empty(qbsp_options.target_game))
@@ -1146,7 +1137,7 @@ static void MarkVisibleSides_r(node_t *node, visible_faces_stats_t &stats)
         if (!p->onnode)
             continue; // edge of world
         if (!p->sidefound) {
-            FindPortalSide(p, stats);
+            FindPortalSide(tree, p, stats);
         }
         for (int i = 0; i < 2; ++i) {
             if (p->sides[i] && p->sides[i]->source) {
@@ -1166,13 +1157,14 @@ MarkVisibleSides
 void MarkVisibleSides(tree_t &tree, bspbrush_t::container &brushes)
 {
     logging::funcheader();
+    profilefunc();
 
     // clear all the visible flags
     MarkBrushSidesInvisible(brushes);
 
     visible_faces_stats_t stats;
     // set visible flags on the sides that are used by portals
-    MarkVisibleSides_r(tree.headnode, stats);
+    MarkVisibleSides_r(tree, tree.headnode, stats);
 
     if (!stats.missing_portal_sides.empty() && qbsp_options.debug_missing_portal_sides.value()) {
         fs::path name = qbsp_options.bsp_path;
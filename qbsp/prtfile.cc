@@ -22,6 +22,7 @@
 #include <qbsp/prtfile.hh>
 
 #include <common/log.hh>
+#include <common/profiler.hh>
 #include <common/ostream.hh>
 #include <common/prtfile.hh>
 #include <qbsp/map.hh>
@@ -39,27 +40,27 @@ PORTAL FILE GENERATION
 ==============================================================================
 */
 
-static void WritePortals_r(node_t *node, prtfile_t &portalFile, bool clusters)
+static void WritePortals_r(tree_t &tree, node_t *node, prtfile_t &portalFile, bool clusters)
 {
     const portal_t *p, *next;
     const winding_t *w;
     int i, front, back;
     qplane3d plane2;
 
-    if (auto *nodedata = node->get_nodedata(); nodedata && !nodedata->detail_separator) {
-        WritePortals_r(nodedata->children[0], portalFile, clusters);
-        WritePortals_r(nodedata->children[1], portalFile, clusters);
+    if (!node->is_leaf() && !node->detail_separator) {
+        WritePortals_r(tree, node->children[0], portalFile, clusters);
+        WritePortals_r(tree, node->children[1], portalFile, clusters);
         return;
     }
     // at this point, `node` may be a leaf or a cluster
-    if (auto *leafdata = node->get_leafdata(); leafdata && leafdata->contents.is_any_solid(qbsp_options.target_game))
+    if (auto *leafdata = tree.get_leafdata(node); leafdata && leafdata->contents.is_any_solid(qbsp_options.target_game))
         return;
 
     for (p = node->portals; p; p = next) {
         next = (p->nodes[0] == node) ? p->next[0] : p->next[1];
         if (!p->winding || p->nodes[0] != node)
             continue;
-        if (!Portal_VisFlood(p))
+        if (!Portal_VisFlood(tree, p))
             continue;
 
         w = &p->winding;
@@ -67,8 +68,8 @@ static void WritePortals_r(node_t *node, prtfile_t &portalFile, bool clusters)
         back = clusters ? p->nodes[1]->viscluster : p->nodes[1]->visleafnum;
 
         if (front == -1 || back == -1) {
-            auto front_contents = ClusterContents(p->nodes.front);
-            auto back_contents = ClusterContents(p->nodes.back);
+            auto front_contents = ClusterContents(tree, p->nodes.front);
+            auto back_contents = ClusterContents(tree, p->nodes.back);
 
             FError("front {}, cluster contents: {}. back {}, cluster contents: {}. portal: {}", front,
                 front_contents.to_string(), back, back_contents.to_string(), w->center());
@@ -97,15 +98,25 @@ static void WritePortals_r(node_t *node, prtfile_t &portalFile, bool clusters)
     }
 }
 
-static void WritePTR2ClusterMapping_r(node_t *node, prtfile_t &portalFile)
+// one cluster per leaf, the same as LoadPrtFile assigns for a PRT1
+static void SetIdentityClusters(prtfile_t &portalFile)
 {
-    if (auto *nodedata = node->get_nodedata()) {
-        WritePTR2ClusterMapping_r(nodedata->children[0], portalFile);
-        WritePTR2ClusterMapping_r(nodedata->children[1], portalFile);
+    portalFile.portalleafs_real = portalFile.portalleafs;
+    portalFile.dleafinfos.assign(portalFile.portalleafs + 1, {});
+    for (int i = 0; i < portalFile.portalleafs; i++) {
+        portalFile.dleafinfos[i + 1].cluster = i;
+    }
+}
+
+static void WritePTR2ClusterMapping_r(tree_t &tree, node_t *node, prtfile_t &portalFile)
+{
+    if (!node->is_leaf()) {
+        WritePTR2ClusterMapping_r(tree, node->children[0], portalFile);
+        WritePTR2ClusterMapping_r(tree, node->children[1], portalFile);
         return;
     }
 
-    auto *leafdata = node->get_leafdata();
+    auto *leafdata = tree.get_leafdata(node);
     if (leafdata->contents.is_any_solid(qbsp_options.target_game))
         return;
 
@@ -120,14 +131,14 @@ struct portal_state_t : logging::stat_tracker_t
     bool uses_detail;
 };
 
-static void CountPortals(const node_t *node, portal_state_t &state)
+static void CountPortals(const tree_t &tree, const node_t *node, portal_state_t &state)
 {
     const portal_t *portal;
 
     for (portal = node->portals; portal;) {
         /* only write out from first leaf */
         if (portal->nodes[0] == node) {
-            if (Portal_VisFlood(portal)) {
+            if (Portal_VisFlood(tree, portal)) {
                 state.num_visportals++;
             }
             portal = portal->next[0];
@@ -145,22 +156,23 @@ NumberLeafs_r
 - Otherwise, assign the given cluster number because parent splitter is detail
 ================
 */
-static void NumberLeafs_r(node_t *node, portal_state_t &state, int cluster)
+static void NumberLeafs_r(tree_t &tree, node_t *node, portal_state_t &state, int cluster)
 {
     /* decision node */
-    if (auto *nodedata = node->get_nodedata()) {
-        if (cluster < 0 && nodedata->detail_separator) {
+    if (!node->is_leaf()) {
+        if (cluster < 0 && node->detail_separator) {
             state.uses_detail = true;
             cluster = state.num_visclusters++;
             node->viscluster = cluster;
-            CountPortals(node, state);
+            CountPortals(tree, node, state);
         }
-        NumberLeafs_r(nodedata->children[0], state, cluster);
-        NumberLeafs_r(nodedata->children[1], state, cluster);
+        NumberLeafs_r(tree, node->children[0], state, cluster);
+        NumberLeafs_r(tree, node->children[1], state, cluster);
         return;
     }
 
-    if (auto *leafdata = node->get_leafdata(); leafdata && leafdata->contents.is_any_solid(qbsp_options.target_game)) {
+    if (auto *leafdata = tree.get_leafdata(node);
+        leafdata && leafdata->contents.is_any_solid(qbsp_options.target_game)) {
         /* solid block, viewpoint never inside */
         node->visleafnum = -1;
         node->viscluster = -1;
@@ -169,7 +181,7 @@ static void NumberLeafs_r(node_t *node, portal_state_t &state, int cluster)
 
     node->visleafnum = state.num_visleafs++;
     node->viscluster = (cluster < 0) ? state.num_visclusters++ : cluster;
-    CountPortals(node, state);
+    CountPortals(tree, node, state);
 }
 
 /*
@@ -177,13 +189,13 @@ static void NumberLeafs_r(node_t *node, portal_state_t &state, int cluster)
 WritePortalfile
 ================
 */
-static void WritePortalfile(node_t *headnode, portal_state_t &state)
+static void WritePortalfile(tree_t &tree, portal_state_t &state)
 {
     /*
      * Set the visleafnum and viscluster field in every leaf and count the
      * total number of portals.
      */
-    NumberLeafs_r(headnode, state, -1);
+    NumberLeafs_r(tree, tree.headnode, state, -1);
 
     // write the file
     fs::path name = qbsp_options.bsp_path;
@@ -195,25 +207,32 @@ static void WritePortalfile(node_t *headnode, portal_state_t &state)
     // (Since q2bsp natively supports clusters, we don't need PRT2.)
     if (qbsp_options.target_game->id == GAME_QUAKE_II) {
         portalFile.portalleafs = state.num_visclusters.count.load();
-        WritePortals_r(headnode, portalFile, true);
+        WritePortals_r(tree, tree.headnode, portalFile, true);
     } else if (!state.uses_detail) {
         /* If no detail clusters, just use a normal PRT1 format */
         portalFile.portalleafs = state.num_visleafs.count.load();
-        WritePortals_r(headnode, portalFile, false);
-    } else if (qbsp_options.forceprt1.value()) {
-        /* Write a PRT1 file for loading in the map editor. Vis will reject it. */
-        portalFile.portalleafs = state.num_visclusters.count.load();
-        WritePortals_r(headnode, portalFile, true);
+        WritePortals_r(tree, tree.headnode, portalFile, false);
+        SetIdentityClusters(portalFile);
     } else {
-        /* Write a PRT2 */
+        /* Write a PRT2; with forceprt1 only the PRT1 part is written (vis will reject it) */
         portalFile.portalleafs_real = state.num_visleafs.count.load();
         portalFile.portalleafs = state.num_visclusters.count.load();
-        WritePortals_r(headnode, portalFile, true);
+        WritePortals_r(tree, tree.headnode, portalFile, true);
         portalFile.dleafinfos.resize(state.num_visleafs.count.load() + 1);
-        WritePTR2ClusterMapping_r(headnode, portalFile);
+        WritePTR2ClusterMapping_r(tree, tree.headnode, portalFile);
     }
 
     WritePortalfile(name, portalFile, qbsp_options.target_version, state.uses_detail, qbsp_options.forceprt1.value());
+
+    if (map.output) {
+        // hand vis what it would read back from the file: with forceprt1, that's only the PRT1 part
+        if (state.uses_detail && qbsp_options.forceprt1.value() &&
+            qbsp_options.target_game->id != GAME_QUAKE_II) {
+            SetIdentityClusters(portalFile);
+        }
+
+        map.output->prtfile = std::move(portalFile);
+    }
 }
 
 /*
@@ -224,6 +243,7 @@ WritePortalFile
 void WritePortalFile(tree_t &tree)
 {
     logging::funcheader();
+    profilefunc();
 
     FreeTreePortals(tree);
 
@@ -244,7 +264,7 @@ void WritePortalFile(tree_t &tree)
     portal_state_t state{};
 
     /* save portal file for vis tracing */
-    WritePortalfile(tree.headnode, state);
+    WritePortalfile(tree, state);
 }
 
 /*
@@ -269,9 +289,9 @@ static void WriteDebugPortal(const portal_t *p, std::ofstream &portalFile)
 
 static void WriteTreePortals_r(node_t *node, std::ofstream &portalFile)
 {
-    if (auto *nodedata = node->get_nodedata()) {
-        WriteTreePortals_r(nodedata->children[0], portalFile);
-        WriteTreePortals_r(nodedata->children[1], portalFile);
+    if (!node->is_leaf()) {
+        WriteTreePortals_r(node->children[0], portalFile);
+        WriteTreePortals_r(node->children[1], portalFile);
         return;
     }
 
@@ -287,9 +307,9 @@ static void WriteTreePortals_r(node_t *node, std::ofstream &portalFile)
 
 static void CountTreePortals_r(node_t *node, size_t &count)
 {
-    if (auto *nodedata = node->get_nodedata()) {
-        CountTreePortals_r(nodedata->children[0], count);
-        CountTreePortals_r(nodedata->children[1], count);
+    if (!node->is_leaf()) {
+        CountTreePortals_r(node->children[0], count);
+        CountTreePortals_r(node->children[1], count);
         return;
     }
 
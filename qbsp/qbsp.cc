@@ -23,6 +23,7 @@
 #include <algorithm>
 
 #include <common/log.hh>
+#include <common/profiler.hh>
 #include <common/aabb.hh>
 #include <common/fs.hh>
 #include <common/settings.hh>
@@ -282,7 +283,7 @@ const qbsp_plane_t &face_t::get_positive_plane() const
     return map.get_plane(planenum & ~1);
 }
 
-const qbsp_plane_t &nodedata_t::get_plane() const
+const qbsp_plane_t &node_t::get_plane() const
 {
     return map.get_plane(planenum);
 }
@@ -495,6 +496,9 @@ qbsp_settings::qbsp_settings()
           "if 0 (default), use `maxnodesize` for deciding when to switch to midsplit bsp heuristic.\nif 0 < midsplitSurfFraction <= 1, switch to midsplit if the node contains more than this fraction of the model's\ntotal surfaces. Try 0.15 to 0.5. Works better than maxNodeSize for maps with a 3D skybox (e.g. +-128K unit maps)"},
       maxnodesize{this, "maxnodesize", 1024, &debugging_group,
           "triggers simpler BSP Splitting when node exceeds size (default 1024, 0 to disable)"},
+      midsplitmethod{this, "midsplitmethod", midsplitmethod_t::VOLUME,
+          {{"volume", midsplitmethod_t::VOLUME}, {"sah", midsplitmethod_t::SAH}}, &debugging_group,
+          "heuristic used by the simpler BSP splitting: \"volume\" (default) to halve the node volume, \"sah\" to use a surface area heuristic over the brush bounds"},
       oldrottex{this, "oldrottex", false, &debugging_group, "use old rotate_ brush texturing aligned at (0 0 0)"},
       epsilon{this, "epsilon", 0.0001, 0.0, 1.0, &debugging_group, "customize epsilon value for point-on-plane checks"},
       microvolume{this, "microvolume", 0.0, 0.0, 1000.0, &debugging_group, "microbrush volume"},
@@ -805,10 +809,9 @@ struct brush_list_stats_t : logging::stat_tracker_t
     stat &total_optimized_faces = register_stat("optimized brush side texinfos");
 };
 
-static void ExportBrushList_r(const mapentity_t &entity, node_t *node, brush_list_stats_t &stats)
+static void ExportBrushList_r(const mapentity_t &entity, tree_t &tree, node_t *node, brush_list_stats_t &stats)
 {
-    if (node->is_leaf()) {
-        auto *leafdata = node->get_leafdata();
+    if (auto *leafdata = tree.get_leafdata(node)) {
         int native = qbsp_options.target_game->contents_to_native(
             qbsp_options.target_game->contents_remap_for_export(leafdata->contents, gamedef_t::remap_type_t::leaf));
         if (native) {
@@ -870,18 +873,17 @@ static void ExportBrushList_r(const mapentity_t &entity, node_t *node, brush_lis
         return;
     }
 
-    auto *nodedata = node->get_nodedata();
-    ExportBrushList_r(entity, nodedata->children[0], stats);
-    ExportBrushList_r(entity, nodedata->children[1], stats);
+    ExportBrushList_r(entity, tree, node->children[0], stats);
+    ExportBrushList_r(entity, tree, node->children[1], stats);
 }
 
-static void ExportBrushList(mapentity_t &entity, node_t *node)
+static void ExportBrushList(mapentity_t &entity, tree_t &tree)
 {
     logging::funcheader();
 
     brush_list_stats_t stats;
 
-    ExportBrushList_r(entity, node, stats);
+    ExportBrushList_r(entity, tree, tree.headnode, stats);
 }
 
 static bool IsTrigger(const mapentity_t &entity)
@@ -901,51 +903,39 @@ static bool IsTrigger(const mapentity_t &entity)
     return trigger_pos == (tex.size() - strlen("trigger"));
 }
 
-static void CountLeafs_r(node_t *node, content_stats_base_t &stats)
+static void CountLeafs_r(const tree_t &tree, const node_t *node, int height, content_stats_base_t &stats,
+    std::vector<int> &heights, size_t &num_nodes)
 {
-    if (auto *leafdata = node->get_leafdata()) {
+    num_nodes++;
+
+    if (auto *leafdata = tree.get_leafdata(node)) {
         qbsp_options.target_game->count_contents_in_stats(leafdata->contents, stats);
+        heights.push_back(height);
         return;
     }
 
-    auto *nodedata = node->get_nodedata();
-    CountLeafs_r(nodedata->children[0], stats);
-    CountLeafs_r(nodedata->children[1], stats);
-}
-
-static int NodeHeight(node_t *node)
-{
-    if (node->parent) {
-        return 1 + NodeHeight(node->parent);
-    }
-    return 1;
-}
-
-static void CountLeafHeights_r(node_t *node, std::vector<int> &heights)
-{
-    if (node->is_leaf()) {
-        heights.push_back(NodeHeight(node));
-        return;
-    }
-    auto *nodedata = node->get_nodedata();
-    CountLeafHeights_r(nodedata->children[0], heights);
-    CountLeafHeights_r(nodedata->children[1], heights);
+    CountLeafs_r(tree, node->children[0], height + 1, stats, heights, num_nodes);
+    CountLeafs_r(tree, node->children[1], height + 1, stats, heights, num_nodes);
 }
 
-void CountLeafs(node_t *headnode)
+void CountLeafs(const tree_t &tree)
 {
     logging::funcheader();
 
     auto stats = qbsp_options.target_game->create_content_stats();
-    CountLeafs_r(headnode, *stats);
+
+    // count the heights of the tree at each leaf in the same walk
+    std::vector<int> leaf_heights;
+    size_t num_nodes = 0;
+
+    auto start = I_FloatTime();
+    CountLeafs_r(tree, tree.headnode, 1, *stats, leaf_heights, num_nodes);
+    auto walk_time = std::chrono::duration_cast<std::chrono::microseconds>(I_FloatTime() - start);
+
     qbsp_options.target_game->print_content_stats(*stats, "leafs");
 
-    // count the heights of the tree at each leaf
     logging::stat_tracker_t stat_print;
 
-    std::vector<int> leaf_heights;
-    CountLeafHeights_r(headnode, leaf_heights);
-
     const int max_height = *std::max_element(leaf_heights.begin(), leaf_heights.end());
     stat_print.register_stat("max tree height").count += max_height;
 
@@ -954,34 +944,45 @@ void CountLeafs(node_t *headnode)
         avg_height += (height / static_cast<double>(leaf_heights.size()));
     }
     stat_print.register_stat("avg tree height").count += static_cast<int>(avg_height);
+
+    const size_t num_leafs = leaf_heights.size();
+    const size_t tree_bytes = num_nodes * sizeof(node_t) + (num_nodes - num_leafs) * sizeof(nodedata_t) +
+                              num_leafs * sizeof(leafdata_t);
+
+    stat_print.register_stat("bytes per node_t").count += sizeof(node_t);
+    stat_print.register_stat("bytes per nodedata_t").count += sizeof(nodedata_t);
+    stat_print.register_stat("bytes per leafdata_t").count += sizeof(leafdata_t);
+    stat_print.register_stat("KiB in node_t").count += (num_nodes * sizeof(node_t)) / 1024;
+    stat_print.register_stat("KiB in tree").count += tree_bytes / 1024;
+    stat_print.register_stat("microseconds to walk tree").count += walk_time.count();
 }
 
-static void GatherBspbrushes_r(node_t *node, bspbrush_t::container &container)
+static void GatherBspbrushes_r(const tree_t &tree, node_t *node, bspbrush_t::container &container)
 {
-    if (auto *leafdata = node->get_leafdata()) {
-        for (auto &brush : leafdata->bsp_brushes) {
-            container.push_back(brush);
+    if (auto *leafdata = tree.get_leafdata(node)) {
+        if (leafdata->bsp_brushes) {
+            for (auto &brush : *leafdata->bsp_brushes) {
+                container.push_back(brush);
+            }
         }
         return;
     }
 
-    auto *nodedata = node->get_nodedata();
-    GatherBspbrushes_r(nodedata->children[0], container);
-    GatherBspbrushes_r(nodedata->children[1], container);
+    GatherBspbrushes_r(tree, node->children[0], container);
+    GatherBspbrushes_r(tree, node->children[1], container);
 }
 
-static void GatherLeafVolumes_r(node_t *node, bspbrush_t::container &container)
+static void GatherLeafVolumes_r(const tree_t &tree, node_t *node, bspbrush_t::container &container)
 {
-    if (auto *leafdata = node->get_leafdata()) {
+    if (auto *leafdata = tree.get_leafdata(node)) {
         if (!leafdata->contents.is_empty(qbsp_options.target_game)) {
             container.push_back(node->volume);
         }
         return;
     }
 
-    auto *nodedata = node->get_nodedata();
-    GatherLeafVolumes_r(nodedata->children[0], container);
-    GatherLeafVolumes_r(nodedata->children[1], container);
+    GatherLeafVolumes_r(tree, node->children[0], container);
+    GatherLeafVolumes_r(tree, node->children[1], container);
 }
 
 /* Returns true if the user requested to generate an entity bmodel clipnodes
@@ -1022,6 +1023,8 @@ static void ProcessEntity(mapentity_t &entity, hull_index_t hullnum)
     if (IsWorldBrushEntity(entity) || IsNonRemoveWorldBrushEntity(entity))
         return;
 
+    profilefunc();
+
     // for notriggermodels: if we have at least one trigger-like texture, do special trigger stuff
     bool discarded_trigger = !map.is_world_entity(entity) && qbsp_options.notriggermodels.value() && IsTrigger(entity);
 
@@ -1112,10 +1115,10 @@ static void ProcessEntity(mapentity_t &entity, hull_index_t hullnum)
         tree_t tree;
         BrushBSP(tree, entity, empty, tree_split_t::FAST);
         if (hullnum.value_or(0)) {
-            ExportClipNodes(entity, tree.headnode, hullnum.value());
+            ExportClipNodes(entity, tree, hullnum.value());
         } else {
             MakeTreePortals(tree); // needed to assign leaf bounds
-            ExportDrawNodes(entity, tree.headnode, map.bsp.dfaces.size());
+            ExportDrawNodes(entity, tree, map.bsp.dfaces.size());
         }
         return;
     }
@@ -1142,11 +1145,11 @@ static void ProcessEntity(mapentity_t &entity, hull_index_t hullnum)
                     FillDetail(tree, hullnum, brushes);
 
                 FreeTreePortals(tree);
-                PruneNodes(tree.headnode);
+                PruneNodes(tree);
             }
-            CountLeafs(tree.headnode);
+            CountLeafs(tree);
         }
-        ExportClipNodes(entity, tree.headnode, hullnum.value());
+        ExportClipNodes(entity, tree, hullnum.value());
         return;
     }
 
@@ -1168,12 +1171,12 @@ static void ProcessEntity(mapentity_t &entity, hull_index_t hullnum)
         if (!hullnum.value_or(0)) {
             if (qbsp_options.debugbspbrushes.value()) {
                 bspbrush_t::container all_bspbrushes;
-                GatherBspbrushes_r(tree.headnode, all_bspbrushes);
+                GatherBspbrushes_r(tree, tree.headnode, all_bspbrushes);
                 WriteBspBrushMap("first-brushbsp", all_bspbrushes);
             }
             if (qbsp_options.debugleafvolumes.value()) {
                 bspbrush_t::container all_bspbrushes;
-                GatherLeafVolumes_r(tree.headnode, all_bspbrushes);
+                GatherLeafVolumes_r(tree, tree.headnode, all_bspbrushes);
                 WriteBspBrushMap("first-brushbsp-volumes", all_bspbrushes);
             }
         }
@@ -1194,12 +1197,12 @@ static void ProcessEntity(mapentity_t &entity, hull_index_t hullnum)
             if (!hullnum.value_or(0)) {
                 if (qbsp_options.debugbspbrushes.value()) {
                     bspbrush_t::container all_bspbrushes;
-                    GatherBspbrushes_r(tree.headnode, all_bspbrushes);
+                    GatherBspbrushes_r(tree, tree.headnode, all_bspbrushes);
                     WriteBspBrushMap("second-brushbsp", all_bspbrushes);
                 }
                 if (qbsp_options.debugleafvolumes.value()) {
                     bspbrush_t::container all_bspbrushes;
-                    GatherLeafVolumes_r(tree.headnode, all_bspbrushes);
+                    GatherLeafVolumes_r(tree, tree.headnode, all_bspbrushes);
                     WriteBspBrushMap("second-brushbsp-volumes", all_bspbrushes);
                 }
             }
@@ -1229,10 +1232,10 @@ static void ProcessEntity(mapentity_t &entity, hull_index_t hullnum)
     MakeTreePortals(tree);
 
     MarkVisibleSides(tree, brushes);
-    MakeFaces(tree.headnode);
+    MakeFaces(tree);
 
     FreeTreePortals(tree);
-    PruneNodes(tree.headnode);
+    PruneNodes(tree);
 
     // write out .prt for main hull
     if (!hullnum.value_or(0) && map.is_world_entity(entity) && (!map.leakfile || qbsp_options.keepprt.value())) {
@@ -1275,7 +1278,7 @@ static void ProcessEntity(mapentity_t &entity, hull_index_t hullnum)
                             auto face = MakeFaceFromSide(tree.headnode, side);
 
                             if (face) {
-                                tree.headnode->get_nodedata()->facelist.push_back(std::move(face));
+                                tree.get_nodedata(tree.headnode)->facelist.push_back(std::move(face));
                             }
                         }
                     }
@@ -1285,29 +1288,29 @@ static void ProcessEntity(mapentity_t &entity, hull_index_t hullnum)
     }
 
     // needs to come after any face creation
-    MakeMarkFaces(tree.headnode);
+    MakeMarkFaces(tree);
 
-    CountLeafs(tree.headnode);
+    CountLeafs(tree);
 
     // output vertices first, since TJunc needs it
-    EmitVertices(tree.headnode);
+    EmitVertices(tree);
 
-    TJunc(tree.headnode);
+    TJunc(tree);
 
     if (qbsp_options.objexport.value() && map.is_world_entity(entity)) {
-        ExportObj_Nodes("pre_makefaceedges_plane_faces", tree.headnode);
-        ExportObj_Marksurfaces("pre_makefaceedges_marksurfaces", tree.headnode);
+        ExportObj_Nodes("pre_makefaceedges_plane_faces", tree);
+        ExportObj_Marksurfaces("pre_makefaceedges_marksurfaces", tree);
     }
 
     Q_assert(!entity.firstoutputfacenumber.has_value());
 
-    entity.firstoutputfacenumber = EmitFaces(tree.headnode);
+    entity.firstoutputfacenumber = EmitFaces(tree);
 
     if (qbsp_options.target_game->id == GAME_QUAKE_II) {
-        ExportBrushList(entity, tree.headnode);
+        ExportBrushList(entity, tree);
     }
 
-    ExportDrawNodes(entity, tree.headnode, entity.firstoutputfacenumber.value());
+    ExportDrawNodes(entity, tree, entity.firstoutputfacenumber.value());
     FreeTreePortals(tree);
 }
 
@@ -1676,8 +1679,12 @@ static void LoadSecondaryTextures()
 ProcessFile
 =================
 */
-void ProcessFile()
+void ProcessFile(qbsp_output_t *output)
 {
+    profiler::scope profile("qbsp");
+
+    map.output = output;
+
     if (qbsp_options.convertmapformat.value() != conversion_t::none) {
         ConvertMapFile();
         return;
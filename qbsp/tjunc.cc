@@ -23,7 +23,12 @@
 
 #include <qbsp/qbsp.hh>
 #include <qbsp/map.hh>
+#include <qbsp/tree.hh>
+#include <common/profiler.hh>
+#include <algorithm>
 #include <atomic>
+#include <numeric>
+#include <tuple>
 
 struct tjunc_stats_t : logging::stat_tracker_t
 {
@@ -36,6 +41,12 @@ struct tjunc_stats_t : logging::stat_tracker_t
     stat &tjunctions = register_stat("edges added by tjunctions");
     // # of faces that were successfully topologized by MWT
     stat &mwt = register_stat("faces optimized through MWT");
+    // # of faces that went through the full O(n^3) MWT
+    stat &mwtdp = register_stat("faces triangulated by MWT dynamic programming");
+    // # of faces above MWT_MAX_VERTICES that were triangulated by ear clipping instead
+    stat &mwtearclip = register_stat("faces triangulated by greedy ear clipping");
+    // # of faces where ear clipping failed, and we had to use the full MWT anyway
+    stat &mwtearclipfail = register_stat("faces where ear clipping fell back to MWT");
     // # of triangles computed by MWT
     stat &trimwt = register_stat("triangles computed from MWT");
     // # of faces added by MWT
@@ -185,35 +196,108 @@ static bool HasTJuncInteraction(const face_t *f1, const face_t *f2)
 
 /*
 ==========
-FindEdgeVerts_FaceBounds_R
+tjunc_vertex_index_t
 
-Recursive function for matching nodes that intersect the aabb
-for vertex checking.
+Flat k-d tree over every emitted vertex of every face in the tree,
+built once before fixing the faces. Each vertex is stored once per face
+that uses it, since whether it can cause a T-junction depends on the
+contents of that face (see HasTJuncInteraction).
 ==========
 */
-static void FindEdgeVerts_FaceBounds_R(
-    const node_t *node, const face_t *f, const aabb3d &aabb, std::vector<size_t> &verts)
+struct tjunc_vertex_index_t
 {
-    if (node->is_leaf()) {
-        return;
-    } else if (node->bounds.disjoint(aabb, 0.0)) {
-        return;
+    struct entry_t
+    {
+        qvec3d pos;
+        size_t vertex;
+        const face_t *face;
+    };
+
+    // entries are arranged so that the median of each range is its splitting
+    // point, with the split axis picked from the range bounds
+    std::vector<entry_t> entries;
+    std::vector<uint8_t> split_axis;
+
+    // ranges at least this small are just scanned linearly
+    static constexpr size_t LEAF_SIZE = 8;
+
+    void build(const std::vector<face_t *> &faces)
+    {
+        entries.clear();
+
+        for (auto *face : faces) {
+            for (auto &v : face->original_vertices) {
+                entries.push_back({map.bsp.dvertexes[v], v, face});
+            }
+        }
+
+        split_axis.resize(entries.size());
+        build_r(0, entries.size());
     }
 
-    auto *nodedata = node->get_nodedata();
-    for (auto &face : nodedata->facelist) {
-        if (!HasTJuncInteraction(f, face.get()))
-            continue;
-        for (auto &v : face->original_vertices) {
-            if (aabb.containsPoint(map.bsp.dvertexes[v])) {
-                verts.push_back(v);
-            }
+    // gather every vertex inside `aabb` from faces that can
+    // form T-junctions with `f`
+    void query(const face_t *f, const aabb3d &aabb, std::vector<size_t> &verts) const
+    {
+        query_r(0, entries.size(), f, aabb, verts);
+    }
+
+private:
+    void build_r(size_t begin, size_t end)
+    {
+        if (end - begin <= LEAF_SIZE) {
+            return;
         }
+
+        aabb3d bounds;
+
+        for (size_t i = begin; i < end; i++) {
+            bounds += entries[i].pos;
+        }
+
+        const qvec3d size = bounds.size();
+        const uint8_t axis = (size[0] >= size[1] && size[0] >= size[2]) ? 0 : (size[1] >= size[2]) ? 1 : 2;
+        const size_t mid = begin + (end - begin) / 2;
+
+        std::nth_element(entries.begin() + begin, entries.begin() + mid, entries.begin() + end,
+            [axis](const entry_t &a, const entry_t &b) { return a.pos[axis] < b.pos[axis]; });
+
+        split_axis[mid] = axis;
+
+        build_r(begin, mid);
+        build_r(mid + 1, end);
     }
 
-    FindEdgeVerts_FaceBounds_R(nodedata->children[0], f, aabb, verts);
-    FindEdgeVerts_FaceBounds_R(nodedata->children[1], f, aabb, verts);
-}
+    inline void test_entry(const entry_t &e, const face_t *f, const aabb3d &aabb, std::vector<size_t> &verts) const
+    {
+        if (aabb.containsPoint(e.pos) && HasTJuncInteraction(f, e.face)) {
+            verts.push_back(e.vertex);
+        }
+    }
+
+    void query_r(size_t begin, size_t end, const face_t *f, const aabb3d &aabb, std::vector<size_t> &verts) const
+    {
+        if (end - begin <= LEAF_SIZE) {
+            for (size_t i = begin; i < end; i++) {
+                test_entry(entries[i], f, aabb, verts);
+            }
+            return;
+        }
+
+        const size_t mid = begin + (end - begin) / 2;
+        const entry_t &split = entries[mid];
+        const uint8_t axis = split_axis[mid];
+
+        test_entry(split, f, aabb, verts);
+
+        if (aabb.mins()[axis] <= split.pos[axis]) {
+            query_r(begin, mid, f, aabb, verts);
+        }
+        if (aabb.maxs()[axis] >= split.pos[axis]) {
+            query_r(mid + 1, end, f, aabb, verts);
+        }
+    }
+};
 
 /*
 ==========
@@ -225,13 +309,13 @@ f is the face we're fixing; this will affect the candidate other faces
 because not everything has tjunc interactions (e.g. func_detail_wall and worldspawn.)
 ==========
 */
-static void FindEdgeVerts_FaceBounds(
-    const node_t *headnode, const face_t *f, const qvec3d &p1, const qvec3d &p2, std::vector<size_t> &verts)
+static void FindEdgeVerts_FaceBounds(const tjunc_vertex_index_t &index, const face_t *f, const qvec3d &p1,
+    const qvec3d &p2, std::vector<size_t> &verts)
 {
     // magic number, average of "usual" points per edge
     verts.reserve(8);
 
-    FindEdgeVerts_FaceBounds_R(headnode, f, (aabb3d{} + p1 + p2).grow(qvec3d(1.0, 1.0, 1.0)), verts);
+    index.query(f, (aabb3d{} + p1 + p2).grow(qvec3d(1.0, 1.0, 1.0)), verts);
 }
 
 /*
@@ -301,7 +385,7 @@ Generate a superface (the input face `f` but with all of the
 verts in the world added that lay on the line) and return it
 ==================
 */
-static std::vector<size_t> CreateSuperFace(node_t *headnode, face_t *f, tjunc_stats_t &stats)
+static std::vector<size_t> CreateSuperFace(const tjunc_vertex_index_t &index, face_t *f, tjunc_stats_t &stats)
 {
     std::vector<size_t> superface;
 
@@ -321,7 +405,7 @@ static std::vector<size_t> CreateSuperFace(node_t *headnode, face_t *f, tjunc_st
         qvec3d v2_pos = map.bsp.dvertexes[v2];
 
         edge_verts.clear();
-        FindEdgeVerts_FaceBounds(headnode, f, v1_pos, v2_pos, edge_verts);
+        FindEdgeVerts_FaceBounds(index, f, v1_pos, v2_pos, edge_verts);
 
         double len;
         qvec3d edge_dir = qv::normalize(v2_pos - v1_pos, len);
@@ -337,19 +421,43 @@ static std::vector<size_t> CreateSuperFace(node_t *headnode, face_t *f, tjunc_st
 
 using qvectri = qvec<size_t, 3>;
 
-// check if the given triangle exists in the set of triangles
-// in any permutation
-static std::optional<size_t> triangle_exists(const std::vector<qvectri> &triangles, size_t a, size_t b, size_t c)
+// hash lookup of triangles by their (sorted) vertices; the triangulation
+// functions below always output triangles with sorted vertices.
+struct triangle_lookup_t
 {
-    for (size_t i = 0; i < triangles.size(); i++) {
-        auto &tri = triangles[i];
+    size_t num_vertices;
+    std::unordered_map<size_t, size_t> triangles;
 
-        for (size_t s = 0; s < 3; s++) {
-            if (tri[s] == a && tri[(s + 1) % 3] == b && tri[(s + 2) % 3] == c) {
-                return i;
-            }
+    inline size_t key(size_t a, size_t b, size_t c) const { return (a * num_vertices + b) * num_vertices + c; }
+
+    triangle_lookup_t(const std::vector<qvectri> &tris, size_t num_vertices_in)
+        : num_vertices(num_vertices_in)
+    {
+        triangles.reserve(tris.size());
+
+        for (size_t i = 0; i < tris.size(); i++) {
+            triangles.emplace(key(tris[i][0], tris[i][1], tris[i][2]), i);
         }
     }
+};
+
+// check if the given triangle exists in the set of triangles
+// in any rotation of a, b, c
+static std::optional<size_t> triangle_exists(const triangle_lookup_t &lookup, size_t a, size_t b, size_t c)
+{
+    // rotate the smallest index to the front; the triangle can only
+    // exist if the other two are then in ascending order too
+    while (a > b || a > c) {
+        std::tie(a, b, c) = std::make_tuple(b, c, a);
+    }
+
+    if (b > c) {
+        return std::nullopt;
+    }
+
+    if (auto it = lookup.triangles.find(lookup.key(a, b, c)); it != lookup.triangles.end()) {
+        return it->second;
+    }
 
     return std::nullopt;
 }
@@ -358,6 +466,8 @@ static std::optional<size_t> triangle_exists(const std::vector<qvectri> &triangl
 // fan out of in the given set of triangles.
 static std::vector<size_t> find_best_fan(const std::vector<qvectri> &triangles, size_t num_vertices)
 {
+    const triangle_lookup_t lookup(triangles, num_vertices);
+
     // find the triangle with the most fannable vertices.
     std::vector<size_t> best_triangles;
 
@@ -374,7 +484,7 @@ static std::vector<size_t> find_best_fan(const std::vector<qvectri> &triangles,
             // TODO: can optimize by only looping around the verts
             // included in the triangle
             for (; last != first; last = (last + 1) % num_vertices) {
-                auto ftri = triangle_exists(triangles, first, mid, last);
+                auto ftri = triangle_exists(lookup, first, mid, last);
 
                 // no triangle found for A B C, so try again
                 // with A B D, etc.
@@ -573,6 +683,67 @@ static std::vector<qvectri> minimum_weight_triangulation(
     return triangles;
 }
 
+// above this many vertices, faces are triangulated with greedy ear
+// clipping rather than the O(n^3) minimum weight triangulation
+constexpr size_t MWT_MAX_VERTICES = 64;
+
+// Greedy O(n^2) approximation of minimum_weight_triangulation for
+// large faces: repeatedly clip off the valid ear with the shortest
+// new edge. Since the input is convex, any ear that passes the angle
+// check is a valid triangle. Returns an empty vector if it gets stuck.
+static std::vector<qvectri> ear_clip_triangulation(
+    const std::vector<size_t> &indices, const std::vector<qvec2d> &vertices)
+{
+    std::vector<size_t> remaining(vertices.size());
+    std::iota(remaining.begin(), remaining.end(), 0);
+
+    std::vector<qvectri> triangles;
+    triangles.reserve(vertices.size() - 2);
+
+    while (remaining.size() >= 3) {
+        std::optional<size_t> best_ear;
+        double best_length = std::numeric_limits<double>::max();
+
+        for (size_t i = 0; i < remaining.size(); i++) {
+            size_t a = remaining[(i + remaining.size() - 1) % remaining.size()];
+            size_t b = remaining[i];
+            size_t c = remaining[(i + 1) % remaining.size()];
+
+            if (!TriangleIsValid(indices[a], indices[b], indices[c], 0.01)) {
+                continue;
+            }
+
+            double length = qv::distance(vertices[a], vertices[c]);
+
+            if (length < best_length) {
+                best_length = length;
+                best_ear = i;
+            }
+
+            // the last triangle has only one choice
+            if (remaining.size() == 3) {
+                break;
+            }
+        }
+
+        if (!best_ear) {
+            return {};
+        }
+
+        const size_t i = best_ear.value();
+        qvectri tri{remaining[(i + remaining.size() - 1) % remaining.size()], remaining[i],
+            remaining[(i + 1) % remaining.size()]};
+        std::sort(tri.begin(), tri.end());
+        triangles.push_back(tri);
+
+        remaining.erase(remaining.begin() + i);
+    }
+
+    Q_assert(triangles.size() == vertices.size() - 2);
+
+    return triangles;
+}
+
 static std::list<std::vector<size_t>> mwt_face(
     const face_t *f, const std::vector<size_t> &vertices, tjunc_stats_t &stats)
 {
@@ -587,7 +758,22 @@ static std::list<std::vector<size_t>> mwt_face(
         points_2d[i] = {qv::dot(map.bsp.dvertexes[vertices[i]], u), qv::dot(map.bsp.dvertexes[vertices[i]], v)};
     }
 
-    auto tris = minimum_weight_triangulation(vertices, points_2d);
+    std::vector<qvectri> tris;
+
+    if (vertices.size() > MWT_MAX_VERTICES) {
+        tris = ear_clip_triangulation(vertices, points_2d);
+
+        if (tris.empty()) {
+            stats.mwtearclipfail++;
+        } else {
+            stats.mwtearclip++;
+        }
+    }
+
+    if (tris.empty()) {
+        tris = minimum_weight_triangulation(vertices, points_2d);
+        stats.mwtdp++;
+    }
 
     stats.trimwt += tris.size();
 
@@ -760,7 +946,7 @@ FixFaceEdges
 If the face has any T-junctions, fix them here.
 ==================
 */
-static void FixFaceEdges(node_t *headnode, face_t *f, tjunc_stats_t &stats)
+static void FixFaceEdges(const tjunc_vertex_index_t &index, face_t *f, tjunc_stats_t &stats)
 {
     // we were asked not to bother fixing any of the faces.
     if (qbsp_options.tjunc.value() == settings::tjunclevel_t::NONE) {
@@ -768,7 +954,7 @@ static void FixFaceEdges(node_t *headnode, face_t *f, tjunc_stats_t &stats)
         return;
     }
 
-    std::vector<size_t> superface = CreateSuperFace(headnode, f, stats);
+    std::vector<size_t> superface = CreateSuperFace(index, f, stats);
 
     if (superface.size() < 3) {
         // entire face collapsed
@@ -885,23 +1071,23 @@ static void FixFaceEdges(node_t *headnode, face_t *f, tjunc_stats_t &stats)
 FixEdges_r
 ==================
 */
-static void FindFaces_r(node_t *node, std::unordered_set<face_t *> &faces)
+static void FindFaces_r(tree_t &tree, node_t *node, std::vector<face_t *> &faces)
 {
     if (node->is_leaf()) {
         return;
     }
 
-    auto *nodedata = node->get_nodedata();
+    auto *nodedata = tree.get_nodedata(node);
 
     for (auto &f : nodedata->facelist) {
         // might have been omitted, so `original_vertices` will be empty
         if (f->original_vertices.size()) {
-            faces.insert(f.get());
+            faces.push_back(f.get());
         }
     }
 
-    FindFaces_r(nodedata->children[0], faces);
-    FindFaces_r(nodedata->children[1], faces);
+    FindFaces_r(tree, node->children[0], faces);
+    FindFaces_r(tree, node->children[1], faces);
 }
 
 /*
@@ -909,14 +1095,19 @@ static void FindFaces_r(node_t *node, std::unordered_set<face_t *> &faces)
 TJunc fixing entry point
 ===========
 */
-void TJunc(node_t *headnode)
+void TJunc(tree_t &tree)
 {
     logging::funcheader();
+    profilefunc();
 
     tjunc_stats_t stats{};
-    std::unordered_set<face_t *> faces;
+    std::vector<face_t *> faces;
+
+    FindFaces_r(tree, tree.headnode, faces);
 
-    FindFaces_r(headnode, faces);
+    tjunc_vertex_index_t index;
+    index.build(faces);
 
-    logging::parallel_for_each(faces, [&](auto &face) { FixFaceEdges(headnode, face, stats); });
+    logging::parallel_for(
+        static_cast<size_t>(0), faces.size(), [&](size_t i) { FixFaceEdges(index, faces[i], stats); });
 }
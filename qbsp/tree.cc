@@ -42,6 +42,64 @@ node_t *tree_t::create_node()
     return &(*it);
 }
 
+nodedata_t *tree_t::make_node(node_t *node)
+{
+    if (!node->is_leaf() && node->dataindex != node_t::NO_DATA) {
+        return &(nodedata[node->dataindex] = {});
+    }
+
+    release_data(node);
+
+    uint32_t index;
+
+    if (!free_nodedata.try_pop(index)) {
+        index = static_cast<uint32_t>(nodedata.grow_by(1) - nodedata.begin());
+    }
+
+    node->leaf = false;
+    node->dataindex = index;
+
+    return &nodedata[index];
+}
+
+leafdata_t *tree_t::make_leaf(node_t *node)
+{
+    if (node->is_leaf() && node->dataindex != node_t::NO_DATA) {
+        return &(leafdata[node->dataindex] = {});
+    }
+
+    release_data(node);
+
+    uint32_t index;
+
+    if (!free_leafdata.try_pop(index)) {
+        index = static_cast<uint32_t>(leafdata.grow_by(1) - leafdata.begin());
+    }
+
+    node->leaf = true;
+    node->dataindex = index;
+    node->children = {};
+
+    return &leafdata[index];
+}
+
+void tree_t::release_data(node_t *node)
+{
+    if (node->dataindex == node_t::NO_DATA) {
+        return;
+    }
+
+    if (node->is_leaf()) {
+        leafdata[node->dataindex] = {};
+        free_leafdata.push(node->dataindex);
+    } else {
+        nodedata[node->dataindex] = {};
+        free_nodedata.push(node->dataindex);
+    }
+
+    node->dataindex = node_t::NO_DATA;
+}
+
 void tree_t::clear()
 {
     headnode = nullptr;
@@ -50,6 +108,10 @@ void tree_t::clear()
 
     FreeTreePortals(*this);
     nodes.clear();
+    nodedata.clear();
+    leafdata.clear();
+    free_nodedata.clear();
+    free_leafdata.clear();
 }
 
 /*
@@ -60,9 +122,9 @@ FreeTreePortals_r
 */
 static void ClearNodePortals_r(node_t *node)
 {
-    if (auto *nodedata = node->get_nodedata()) {
-        ClearNodePortals_r(nodedata->children[0]);
-        ClearNodePortals_r(nodedata->children[1]);
+    if (!node->is_leaf()) {
+        ClearNodePortals_r(node->children[0]);
+        ClearNodePortals_r(node->children[1]);
     }
 
     node->portals = nullptr;
@@ -85,26 +147,28 @@ void FreeTreePortals(tree_t &tree)
 
 //============================================================================
 
-static void ConvertNodeToLeaf(node_t *node, contentflags_t contents)
+static void ConvertNodeToLeaf(tree_t &tree, node_t *node, contentflags_t contents)
 {
-    auto *nodedata = node->get_nodedata();
+    auto *front = tree.get_leafdata(node->children[0]);
+    auto *back = tree.get_leafdata(node->children[1]);
 
     // merge the children's brush lists
-    size_t base = nodedata->children[0]->get_leafdata()->original_brushes.size() >
-                          nodedata->children[1]->get_leafdata()->original_brushes.size()
-                      ? 0
-                      : 1;
-    std::vector<bspbrush_t *> original_brushes = std::move(nodedata->children[base]->get_leafdata()->original_brushes);
-    original_brushes.insert(original_brushes.end(),
-        nodedata->children[base ^ 1]->get_leafdata()->original_brushes.begin(),
-        nodedata->children[base ^ 1]->get_leafdata()->original_brushes.end());
+    if (front->original_brushes.size() <= back->original_brushes.size()) {
+        std::swap(front, back);
+    }
+    std::vector<bspbrush_t *> original_brushes = std::move(front->original_brushes);
+    original_brushes.insert(original_brushes.end(), back->original_brushes.begin(), back->original_brushes.end());
 
     std::sort(original_brushes.begin(), original_brushes.end(),
         [](const bspbrush_t *a, const bspbrush_t *b) { return a->mapbrush < b->mapbrush; });
     auto unique = std::unique(original_brushes.begin(), original_brushes.end());
     original_brushes.erase(unique, original_brushes.end());
 
-    auto *leafdata = node->make_leaf();
+    // the children are unreachable from here on
+    tree.release_data(node->children[0]);
+    tree.release_data(node->children[1]);
+
+    auto *leafdata = tree.make_leaf(node);
     leafdata->contents = contents;
     leafdata->original_brushes = original_brushes;
 }
@@ -112,17 +176,18 @@ static void ConvertNodeToLeaf(node_t *node, contentflags_t contents)
 struct prune_stats_t : logging::stat_tracker_t
 {
     stat &nodes_pruned = register_stat("nodes pruned");
+    stat &prune_time = register_stat("microseconds in PruneNodes");
 };
 
-static bool IsAnySolidLeaf(const node_t *node)
+static bool IsAnySolidLeaf(const tree_t &tree, const node_t *node)
 {
-    auto *leafdata = node->get_leafdata();
+    auto *leafdata = tree.get_leafdata(node);
     return leafdata && leafdata->contents.is_any_solid(qbsp_options.target_game);
 }
 
-static void PruneNodes_R(node_t *node, prune_stats_t &stats)
+static void PruneNodes_R(tree_t &tree, node_t *node, prune_stats_t &stats)
 {
-    if (auto *leafdata = node->get_leafdata()) {
+    if (auto *leafdata = tree.get_leafdata(node)) {
         // remap any contents
         if (qbsp_options.target_game->id != GAME_QUAKE_II &&
             leafdata->contents.is_detail_wall(qbsp_options.target_game)) {
@@ -131,20 +196,18 @@ static void PruneNodes_R(node_t *node, prune_stats_t &stats)
         return;
     }
 
-    auto *nodedata = node->get_nodedata();
-
     tbb::task_group g;
-    g.run([&]() { PruneNodes_R(nodedata->children[0], stats); });
-    g.run([&]() { PruneNodes_R(nodedata->children[1], stats); });
+    g.run([&]() { PruneNodes_R(tree, node->children[0], stats); });
+    g.run([&]() { PruneNodes_R(tree, node->children[1], stats); });
     g.wait();
 
     // fixme-brushbsp: is it correct to strip off detail flags here?
-    if (IsAnySolidLeaf(nodedata->children[0]) && IsAnySolidLeaf(nodedata->children[1])) {
+    if (IsAnySolidLeaf(tree, node->children[0]) && IsAnySolidLeaf(tree, node->children[1])) {
         contentflags_t merged_contents = qbsp_options.target_game->combine_contents(
-            nodedata->children[0]->get_leafdata()->contents, nodedata->children[1]->get_leafdata()->contents);
+            tree.get_leafdata(node->children[0])->contents, tree.get_leafdata(node->children[1])->contents);
 
         // This discards any faces on-node. Should be safe (?)
-        ConvertNodeToLeaf(node, merged_contents);
+        ConvertNodeToLeaf(tree, node, merged_contents);
         stats.nodes_pruned++;
     }
 
@@ -160,11 +223,13 @@ static void PruneNodes_R(node_t *node, prune_stats_t &stats)
     // fixme-brushbsp: maybe merge if same content type, and all faces on node are invisible?
 }
 
-void PruneNodes(node_t *node)
+void PruneNodes(tree_t &tree)
 {
     logging::funcheader();
 
     prune_stats_t stats;
 
-    PruneNodes_R(node, stats);
+    auto start = I_FloatTime();
+    PruneNodes_R(tree, tree.headnode, stats);
+    stats.prune_time += std::chrono::duration_cast<std::chrono::microseconds>(I_FloatTime() - start).count();
 }
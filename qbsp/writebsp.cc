@@ -24,6 +24,7 @@
 
 #include <common/log.hh>
 #include <qbsp/qbsp.hh>
+#include <qbsp/tree.hh>
 
 #include <vector>
 #include <algorithm>
@@ -111,24 +112,22 @@ size_t ExportMapTexinfo(size_t texinfonum)
 ExportClipNodes
 ==================
 */
-static size_t ExportClipNodes(node_t *node)
+static size_t ExportClipNodes(const tree_t &tree, node_t *node)
 {
-    if (auto *leafdata = node->get_leafdata()) {
+    if (auto *leafdata = tree.get_leafdata(node)) {
         return qbsp_options.target_game->contents_to_native(leafdata->contents);
     }
 
-    auto *nodedata = node->get_nodedata();
-
     /* emit a clipnode */
     const size_t nodenum = map.bsp.dclipnodes.size();
     map.bsp.dclipnodes.emplace_back();
 
-    const int child0 = ExportClipNodes(nodedata->children[0]);
-    const int child1 = ExportClipNodes(nodedata->children[1]);
+    const int child0 = ExportClipNodes(tree, node->children[0]);
+    const int child1 = ExportClipNodes(tree, node->children[1]);
 
     // Careful not to modify the vector while using this clipnode pointer
     bsp2_dclipnode_t &clipnode = map.bsp.dclipnodes[nodenum];
-    clipnode.planenum = ExportMapPlane(nodedata->planenum);
+    clipnode.planenum = ExportMapPlane(node->planenum);
     clipnode.children[0] = child0;
     clipnode.children[1] = child1;
 
@@ -147,10 +146,10 @@ First time just store away data, second time fix up reference points to
 accomodate new data interleaved with old.
 ==================
 */
-void ExportClipNodes(mapentity_t &entity, node_t *nodes, hull_index_t::value_type hullnum)
+void ExportClipNodes(mapentity_t &entity, tree_t &tree, hull_index_t::value_type hullnum)
 {
     auto &model = map.bsp.dmodels.at(entity.outputmodelnumber.value());
-    model.headnode[hullnum] = ExportClipNodes(nodes);
+    model.headnode[hullnum] = ExportClipNodes(tree, tree.headnode);
 }
 
 //===========================================================================
@@ -160,9 +159,9 @@ void ExportClipNodes(mapentity_t &entity, node_t *nodes, hull_index_t::value_typ
 ExportLeaf
 ==================
 */
-static void ExportLeaf(node_t *node)
+static void ExportLeaf(const tree_t &tree, node_t *node)
 {
-    leafdata_t *leafdata = node->get_leafdata();
+    const leafdata_t *leafdata = tree.get_leafdata(node);
     mleaf_t &dleaf = map.bsp.dleafs.emplace_back();
 
     const contentflags_t remapped =
@@ -231,7 +230,7 @@ constexpr int32_t PLANENUM_LEAF = -1;
 ExportDrawNodes
 ==================
 */
-static void ExportDrawNodes(node_t *node)
+static void ExportDrawNodes(const tree_t &tree, node_t *node)
 {
     const size_t ourNodeIndex = map.bsp.dnodes.size();
     bsp2_dnode_t *dnode = &map.bsp.dnodes.emplace_back();
@@ -239,14 +238,14 @@ static void ExportDrawNodes(node_t *node)
     dnode->mins = qv::floor(node->bounds.mins());
     dnode->maxs = qv::ceil(node->bounds.maxs());
 
-    auto *nodedata = node->get_nodedata();
-    dnode->planenum = ExportMapPlane(nodedata->planenum);
+    auto *nodedata = tree.get_nodedata(node);
+    dnode->planenum = ExportMapPlane(node->planenum);
     dnode->firstface = nodedata->firstface;
     dnode->numfaces = nodedata->numfaces;
 
     // recursively output the other nodes
     for (size_t i = 0; i < 2; i++) {
-        if (auto *children_i_leafdata = nodedata->children[i]->get_leafdata()) {
+        if (auto *children_i_leafdata = tree.get_leafdata(node->children[i])) {
             // children[i] is a leaf
             // In Q2, all leaves must have their own ID even if they share solidity.
             if (qbsp_options.target_game->id != GAME_QUAKE_II &&
@@ -256,13 +255,13 @@ static void ExportDrawNodes(node_t *node)
                 int32_t nextLeafIndex = static_cast<int32_t>(map.bsp.dleafs.size());
                 const int32_t childnum = -(nextLeafIndex + 1);
                 dnode->children[i] = childnum;
-                ExportLeaf(nodedata->children[i]);
+                ExportLeaf(tree, node->children[i]);
             }
         } else {
             // children[i] is a node
             const int32_t childnum = static_cast<int32_t>(map.bsp.dnodes.size());
             dnode->children[i] = childnum;
-            ExportDrawNodes(nodedata->children[i]);
+            ExportDrawNodes(tree, node->children[i]);
 
             // Important: our dnode pointer may be invalid after the recursive call, if the vector got resized.
             // So re-set the pointer.
@@ -283,8 +282,10 @@ static void ExportDrawNodes(node_t *node)
 ExportDrawNodes
 ==================
 */
-void ExportDrawNodes(mapentity_t &entity, node_t *headnode, int firstface)
+void ExportDrawNodes(mapentity_t &entity, tree_t &tree, int firstface)
 {
+    node_t *headnode = tree.headnode;
+
     // populate model struct (which was emitted previously)
     dmodelh2_t &dmodel = map.bsp.dmodels.at(entity.outputmodelnumber.value());
     dmodel.headnode[0] = static_cast<int32_t>(map.bsp.dnodes.size());
@@ -294,9 +295,9 @@ void ExportDrawNodes(mapentity_t &entity, node_t *headnode, int firstface)
     const size_t mapleafsAtStart = map.bsp.dleafs.size();
 
     if (headnode->is_leaf()) {
-        ExportLeaf(headnode);
+        ExportLeaf(tree, headnode);
     } else {
-        ExportDrawNodes(headnode);
+        ExportDrawNodes(tree, headnode);
     }
 
     // count how many leafs were exported by the above calls
@@ -527,6 +528,15 @@ static void WriteBSPFile()
 
     qbsp_options.bsp_path.replace_extension("bsp");
 
+    if (map.output) {
+        PrintBSPFileSizes(&bspdata);
+
+        // the next stage picks it up from here; it's written once the last stage is done
+        bspdata.file = qbsp_options.bsp_path;
+        map.output->bspdata = std::move(bspdata);
+        return;
+    }
+
     WriteBSPFile(qbsp_options.bsp_path, &bspdata);
     logging::print("Wrote {}\n", qbsp_options.bsp_path);
 
@@ -1,10 +1,23 @@
 #include <nanobench.h>
 #include <gtest/gtest.h>
 #include <vis/vis.hh>
+#include <light/light.hh>
+#include <light/phong.hh>
+#include <light/write.hh>
+#include <light/trace_embree.hh>
 #include <common/qvec.hh>
 #include <common/polylib.hh>
+#include <common/bspfile.hh>
+#include <common/cmdlib.hh>
+#include <common/log.hh>
+#include <common/parallel.hh>
+#include <testmaps.hh>
 
+#include "test_qbsp.hh"
+
+#include <algorithm>
 #include <array>
+#include <random>
 #include <vector>
 
 TEST(benchmark, winding)
@@ -158,3 +171,341 @@ TEST(benchmark, vectorMath)
     b.doNotOptimizeAway(vec0);
     b.doNotOptimizeAway(vec1);
 }
+
+/**
+ * Compares the BrushBSP split heuristics over every map in testmaps/,
+ * printing the qbsp time and output node/leaf/portal counts for each.
+ *
+ * Disabled by default since it compiles every test map several times;
+ * run with --gtest_also_run_disabled_tests --gtest_filter=benchmark.DISABLED_brushbspSplitMethods
+ */
+TEST(benchmark, DISABLED_brushbspSplitMethods)
+{
+    struct method_t
+    {
+        const char *name;
+        std::vector<std::string> args;
+    };
+
+    const std::array<method_t, 3> methods{
+        method_t{"volume", {"-midsplitmethod", "volume"}},
+        method_t{"sah", {"-midsplitmethod", "sah"}},
+        method_t{"forcegoodtree", {"-forcegoodtree"}},
+    };
+
+    std::vector<fs::path> maps;
+    for (auto &entry : fs::directory_iterator(testmaps_dir)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".map") {
+            maps.push_back(entry.path().filename());
+        }
+    }
+    std::sort(maps.begin(), maps.end());
+
+    struct totals_t
+    {
+        double seconds = 0;
+        size_t nodes = 0, leafs = 0, portals = 0;
+    };
+    std::array<totals_t, methods.size()> totals{};
+
+    logging::print("{:<48} {:<14} {:>9} {:>8} {:>8} {:>8}\n", "map", "method", "time (s)", "nodes", "leafs",
+        "portals");
+
+    for (auto &map : maps) {
+        const std::string mapname = map.string();
+        std::vector<std::string> game_args;
+
+        if (mapname.starts_with("q2_")) {
+            game_args = {"-q2bsp"};
+        } else if (mapname.starts_with("hl_")) {
+            game_args = {"-hlbsp"};
+        } else if (mapname.starts_with("h2_")) {
+            game_args = {"-hexen2"};
+        }
+
+        // only maps that compile with every method count towards the totals,
+        // so each method's totals cover the same maps
+        std::array<totals_t, methods.size()> results{};
+        bool skipped = false;
+
+        for (size_t i = 0; i < methods.size(); i++) {
+            std::vector<std::string> args = game_args;
+            args.insert(args.end(), methods[i].args.begin(), methods[i].args.end());
+
+            try {
+                auto start = I_FloatTime();
+                const auto [bsp, bspx, prt] = LoadTestmap(map, args);
+                const double seconds = (I_FloatTime() - start).count();
+                const size_t portals = prt ? prt->portals.size() : 0;
+
+                logging::print("{:<48} {:<14} {:>9.3f} {:>8} {:>8} {:>8}\n", mapname, methods[i].name, seconds,
+                    bsp.dnodes.size(), bsp.dleafs.size(), portals);
+
+                results[i] = {seconds, bsp.dnodes.size(), bsp.dleafs.size(), portals};
+            } catch (const std::exception &e) {
+                // leak tests, intentionally broken maps, etc.
+                logging::print("{:<48} {:<14} skipped: {}\n", mapname, methods[i].name, e.what());
+                skipped = true;
+                break;
+            }
+        }
+
+        if (skipped) {
+            continue;
+        }
+
+        for (size_t i = 0; i < methods.size(); i++) {
+            totals[i].seconds += results[i].seconds;
+            totals[i].nodes += results[i].nodes;
+            totals[i].leafs += results[i].leafs;
+            totals[i].portals += results[i].portals;
+        }
+    }
+
+    logging::print("\ntotals:\n");
+    for (size_t i = 0; i < methods.size(); i++) {
+        logging::print("{:<14} {:>9.3f} {:>8} {:>8} {:>8}\n", methods[i].name, totals[i].seconds, totals[i].nodes,
+            totals[i].leafs, totals[i].portals);
+    }
+}
+
+TEST(benchmark, bspReadWrite)
+{
+    fs::path source = fs::path(testmaps_dir) / "compiled" / "q1_cube.bsp";
+    fs::path output = fs::temp_directory_path() / "benchmark_bspReadWrite.bsp";
+
+    bspdata_t bspdata;
+    LoadBSPFile(source, &bspdata);
+
+    // pad out the byte lumps so this measures throughput rather than overhead
+    auto &bsp = std::get<bsp29_t>(bspdata.bsp);
+    bsp.dlightdata.resize(32 * 1024 * 1024, 0x7f);
+    bspdata.bspx.transfer("BENCHMARK", std::vector<uint8_t>(8 * 1024 * 1024, 0x55));
+
+    WriteBSPFile(output, &bspdata);
+    const size_t file_size = fs::file_size(output);
+
+    ankerl::nanobench::Bench bench;
+    bench.unit("byte").batch(file_size).minEpochIterations(4);
+
+    bench.run("WriteBSPFile", [&] { WriteBSPFile(output, &bspdata); });
+    bench.run("LoadBSPFile", [&] {
+        bspdata_t loaded;
+        LoadBSPFile(output, &loaded);
+        ankerl::nanobench::doNotOptimizeAway(loaded);
+    });
+
+    fs::remove(output);
+}
+
+TEST(benchmark, parallelForProgress)
+{
+    // a loop with very little work per iteration, where the progress reporting dominates
+    constexpr size_t count = 1 << 22;
+    std::vector<uint32_t> values(count);
+
+    // don't spam the [100%] lines
+    auto old_mask = logging::mask;
+    logging::mask &= ~bitflags<logging::flag>(logging::flag::PERCENT);
+
+    ankerl::nanobench::Bench bench;
+    bench.unit("iteration").batch(count).minEpochIterations(4);
+
+    bench.run("tbb::parallel_for", [&] {
+        tbb::parallel_for(static_cast<size_t>(0), count, [&](size_t i) { values[i] = static_cast<uint32_t>(i * i); });
+    });
+    bench.run("logging::parallel_for", [&] {
+        logging::parallel_for(static_cast<size_t>(0), count, [&](size_t i) { values[i] = static_cast<uint32_t>(i * i); });
+    });
+    bench.run("logging::percent_clock per iteration", [&] {
+        logging::percent_clock clock(count);
+        tbb::parallel_for(static_cast<size_t>(0), count, [&](size_t i) {
+            values[i] = static_cast<uint32_t>(i * i);
+            clock();
+        });
+    });
+
+    logging::mask = old_mask;
+
+    ankerl::nanobench::doNotOptimizeAway(values);
+}
+
+TEST(benchmark, phongNormals)
+{
+    // 64 columns of 24-sided segments, each segment in its own _phong_group
+    LoadTestmapQ1("q1_phong_benchmark.map");
+    fs::path bsp_path = fs::path(testmaps_dir) / "q1_phong_benchmark.bsp";
+
+    // -phongdebug_obj stops light right after CalculateVertexNormals, leaving bspdata
+    // in the generic format and the per-texinfo phong settings loaded
+    bspdata_t bspdata;
+    LoadBSPFile(bsp_path, &bspdata);
+    light_main({"", "-nodefaultpaths", "-phongdebug_obj", bsp_path.string()}, bspdata, nullptr);
+
+    const mbsp_t &bsp = std::get<mbsp_t>(bspdata.bsp);
+    const size_t smoothed = std::count_if(
+        bsp.dfaces.begin(), bsp.dfaces.end(), [](const mface_t &f) { return !GetSmoothFaces(&f).empty(); });
+    EXPECT_GT(smoothed, bsp.dfaces.size() / 2);
+
+    auto old_mask = logging::mask;
+    logging::mask &= ~bitflags<logging::flag>(logging::flag::PERCENT);
+
+    ankerl::nanobench::Bench bench;
+    bench.unit("face").batch(bsp.dfaces.size()).minEpochIterations(4);
+
+    bench.run("CalculateVertexNormals", [&] {
+        ResetPhong();
+        CalculateVertexNormals(&bsp);
+    });
+
+    logging::mask = old_mask;
+
+    light_reset();
+}
+
+TEST(benchmark, rayStreamPush)
+{
+    // a large face's worth of sample points
+    constexpr size_t count = 4096;
+    std::vector<qvec3f> origins(count);
+    for (size_t i = 0; i < count; i++) {
+        origins[i] = {static_cast<float>(i % 64), static_cast<float>(i / 64), 0.0f};
+    }
+
+    const qvec3f dir{0, 0, 1};
+    const qvec3f color{1, 1, 1};
+
+    ankerl::nanobench::Bench bench;
+    bench.unit("ray").batch(count).relative(true);
+
+    bench.run("pushRay, stream grown from empty", [&] {
+        raystream_occlusion_t rs;
+        for (size_t i = 0; i < count; i++) {
+            rs.pushRay(i, origins[i], dir, 1024.0f, &color);
+        }
+        ankerl::nanobench::doNotOptimizeAway(rs.getRay(count - 1));
+    });
+
+    raystream_occlusion_t reserved(count);
+
+    bench.run("pushRay, reserved stream", [&] {
+        reserved.clearPushedRays();
+        for (size_t i = 0; i < count; i++) {
+            reserved.pushRay(i, origins[i], dir, 1024.0f, &color);
+        }
+        ankerl::nanobench::doNotOptimizeAway(reserved.getRay(count - 1));
+    });
+
+    bench.run("pushRays, reserved stream", [&] {
+        reserved.clearPushedRays();
+        reserved.pushRays(origins, dir, 1024.0f, &color);
+        ankerl::nanobench::doNotOptimizeAway(reserved.getRay(count - 1));
+    });
+
+    EXPECT_EQ(reserved.numPushedRays(), count);
+    EXPECT_EQ(reserved.getRay(count - 1).index, count - 1);
+}
+
+// the lightmap filters as they were before PostProcessLightmap fused them: each
+// step makes a full pass over the image, and the blur writes a full size copy
+static void StagedPostProcessLightmap(
+    std::vector<qvec4f> &image, std::vector<qvec4f> &scratch, int w, int h, int extra, int soft)
+{
+    auto average = [](int kernel_w, int kernel_h, auto &&sample) {
+        float weight = 0, weight_all = 0;
+        qvec3f color{}, color_all{};
+        for (int y0 = 0; y0 < kernel_h; y0++) {
+            for (int x0 = 0; x0 < kernel_w; x0++) {
+                const qvec4f &in = sample(x0, y0);
+                color_all += in.xyz();
+                weight_all += 1.0f;
+                if (in[3] == 0.0f)
+                    continue;
+                color += in.xyz();
+                weight += 1.0f;
+            }
+        }
+        const qvec3f avg = weight > 0.0f ? color / weight : color_all / weight_all;
+        return qvec4f(avg[0], avg[1], avg[2], weight > 0.0f ? 1.0f : 0.0f);
+    };
+
+    for (int unhandled = -1; unhandled != 0 && unhandled != image.size();) {
+        unhandled = 0;
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                if (image[y * w + x][3] != 0)
+                    continue;
+                int n = 0;
+                qvec3f sum{};
+                for (int y1 = std::max(y - 1, 0); y1 <= std::min(y + 1, h - 1); y1++) {
+                    for (int x1 = std::max(x - 1, 0); x1 <= std::min(x + 1, w - 1); x1++) {
+                        if (image[y1 * w + x1][3] == 1) {
+                            n++;
+                            sum += image[y1 * w + x1].xyz();
+                        }
+                    }
+                }
+                if (n) {
+                    sum *= (1.0f / (float)n);
+                    image[y * w + x] = qvec4f(sum[0], sum[1], sum[2], 1.0f);
+                } else {
+                    unhandled++;
+                }
+            }
+        }
+    }
+
+    if (soft > 0) {
+        scratch.resize(image.size());
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                scratch[y * w + x] = average(2 * soft + 1, 2 * soft + 1, [&](int x0, int y0) -> const qvec4f & {
+                    return image[std::clamp(y + y0 - soft, 0, h - 1) * w + std::clamp(x + x0 - soft, 0, w - 1)];
+                });
+            }
+        }
+        std::swap(image, scratch);
+    }
+
+    const int outw = w / extra, outh = h / extra;
+    for (int y = 0; y < outh; y++) {
+        for (int x = 0; x < outw; x++) {
+            image[y * outw + x] = average(extra, extra, [&](int x0, int y0) -> const qvec4f & {
+                return image[(y * extra + y0) * w + x * extra + x0];
+            });
+        }
+    }
+    image.resize(outw * outh);
+}
+
+TEST(benchmark, postProcessLightmap)
+{
+    // a 32x32 luxel face at -extra 2 -soft 1, with a tenth of the samples occluded
+    constexpr int extra = 2, soft = 1, w = 32 * extra, h = 32 * extra;
+
+    std::mt19937 engine(1234);
+    std::uniform_real_distribution<float> color(0.0f, 300.0f);
+    std::bernoulli_distribution occluded(0.1);
+
+    std::vector<qvec4f> input(w * h);
+    for (auto &p : input) {
+        p = qvec4f(color(engine), color(engine), color(engine), occluded(engine) ? 0.0f : 1.0f);
+    }
+
+    std::vector<qvec4f> image, scratch;
+
+    ankerl::nanobench::Bench bench;
+    bench.unit("luxel").batch(input.size()).relative(true);
+
+    bench.run("separate passes, full size blur copy", [&] {
+        image = input;
+        StagedPostProcessLightmap(image, scratch, w, h, extra, soft);
+        ankerl::nanobench::doNotOptimizeAway(image);
+    });
+
+    bench.run("PostProcessLightmap, fused row by row", [&] {
+        image = input;
+        PostProcessLightmap(image, w, h, extra, soft, false);
+        ankerl::nanobench::doNotOptimizeAway(image);
+    });
+}
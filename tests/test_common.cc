@@ -4,10 +4,19 @@
 #include <common/bspfile.hh>
 #include <common/bspfile_q1.hh>
 #include <common/bspfile_q2.hh>
+#include <common/fs.hh>
 #include <common/imglib.hh>
+#include <common/json.hh>
+#include <common/parallel.hh>
+#include <common/profiler.hh>
 #include <common/settings.hh>
 #include <testmaps.hh>
 
+#include <algorithm>
+#include <fstream>
+#include <tbb/parallel_for.h>
+#include <tbb/task_arena.h>
+
 TEST(common, StripFilename)
 {
     ASSERT_EQ("/home/foo", fs::path("/home/foo/bar.txt").parent_path());
@@ -368,6 +377,293 @@ TEST(imglib, png)
     EXPECT_EQ(texture->height_scale, 1);
 }
 
+TEST(imglib, textureCache)
+{
+    auto *game = bspver_q2.game;
+    auto wal_metadata_path = std::filesystem::path(testmaps_dir) / "q2_wal_metadata";
+    auto cache_path = fs::temp_directory_path() / "test_imglib_texturecache";
+
+    fs::remove_all(cache_path);
+
+    settings::common_settings settings;
+    settings.paths.add_value(wal_metadata_path.string(), settings::source::COMMANDLINE);
+    settings.texturecache.set_value(cache_path, settings::source::COMMANDLINE);
+
+    game->init_filesystem("placeholder.map", settings);
+
+    auto [uncached, _0, _1] = img::load_texture("e1u1/yellow32x32", false, game, settings);
+    ASSERT_TRUE(uncached);
+
+    // one entry should have been written
+    ASSERT_EQ(std::distance(fs::directory_iterator(cache_path), fs::directory_iterator()), 1);
+
+    auto [cached, _2, _3] = img::load_texture("e1u1/yellow32x32", false, game, settings);
+    ASSERT_TRUE(cached);
+
+    EXPECT_EQ(cached->meta.name, uncached->meta.name);
+    EXPECT_EQ(cached->meta.width, uncached->meta.width);
+    EXPECT_EQ(cached->meta.height, uncached->meta.height);
+    EXPECT_EQ(cached->meta.extension, uncached->meta.extension);
+    EXPECT_EQ(cached->width, uncached->width);
+    EXPECT_EQ(cached->height, uncached->height);
+    EXPECT_EQ(cached->pixels, uncached->pixels);
+
+    // meta-only loads are cached separately
+    auto [meta_only, _4, _5] = img::load_texture("e1u1/yellow32x32", true, game, settings);
+    ASSERT_TRUE(meta_only);
+    EXPECT_TRUE(meta_only->pixels.empty());
+    EXPECT_EQ(std::distance(fs::directory_iterator(cache_path), fs::directory_iterator()), 2);
+
+    fs::remove_all(cache_path);
+}
+
+TEST(imglib, textureCacheCompanionWal)
+{
+    auto *game = bspver_q2.game;
+    auto wal_metadata_path = std::filesystem::path(testmaps_dir) / "q2_wal_metadata";
+    auto textures_path = fs::temp_directory_path() / "test_imglib_texturecache_wal";
+    auto cache_path = fs::temp_directory_path() / "test_imglib_texturecache_wal_cache";
+
+    fs::remove_all(textures_path);
+    fs::remove_all(cache_path);
+    fs::create_directories(textures_path / "textures" / "e1u1");
+    std::ofstream(textures_path / "textures" / "e1u1" / "companion.wal_json") << R"({ "value": 5 })";
+
+    settings::common_settings settings;
+    settings.paths.add_value(textures_path.string(), settings::source::COMMANDLINE);
+    settings.texturecache.set_value(cache_path, settings::source::COMMANDLINE);
+
+    game->init_filesystem("placeholder.map", settings);
+
+    // no .wal next to the .wal_json yet
+    auto [without_wal, _0, _1] = img::load_texture_meta("e1u1/companion", game, settings);
+    ASSERT_TRUE(without_wal);
+    EXPECT_EQ(without_wal->value, 5);
+    EXPECT_EQ(without_wal->width, 0);
+
+    // once the .wal shows up, the cached entry must not be used anymore
+    fs::create_directories(textures_path / "e1u1");
+    fs::copy_file(wal_metadata_path / "textures" / "e1u1" / "test.wal", textures_path / "e1u1" / "companion.wal");
+
+    auto [with_wal, _2, _3] = img::load_texture_meta("e1u1/companion", game, settings);
+    ASSERT_TRUE(with_wal);
+    EXPECT_EQ(with_wal->value, 5);
+    EXPECT_NE(with_wal->width, 0);
+    EXPECT_EQ(std::distance(fs::directory_iterator(cache_path), fs::directory_iterator()), 2);
+
+    // and the new entry is hit without reading the .wal_json
+    auto [cached, _4, cached_data] = img::load_texture_meta("e1u1/companion", game, settings);
+    ASSERT_TRUE(cached);
+    EXPECT_EQ(cached->width, with_wal->width);
+    EXPECT_FALSE(cached_data);
+    EXPECT_EQ(std::distance(fs::directory_iterator(cache_path), fs::directory_iterator()), 2);
+
+    fs::remove_all(textures_path);
+    fs::remove_all(cache_path);
+}
+
+// writes a .pak containing the given files
+static void WriteTestPak(const fs::path &path, const std::vector<std::pair<std::string, std::string>> &files)
+{
+    std::ofstream stream(path, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+    stream << endianness<std::endian::little>;
+
+    const uint32_t header_size = 12, entry_size = 64;
+    uint32_t offset = header_size;
+
+    for (auto &file : files) {
+        offset += file.second.size();
+    }
+
+    stream <= std::array<char, 4>{'P', 'A', 'C', 'K'};
+    stream <= offset;
+    stream <= static_cast<uint32_t>(files.size() * entry_size);
+
+    for (auto &file : files) {
+        stream.write(file.second.data(), file.second.size());
+    }
+
+    offset = header_size;
+
+    for (auto &file : files) {
+        std::array<char, 56> name{};
+        std::copy(file.first.begin(), file.first.end(), name.begin());
+        stream <= name;
+        stream <= offset;
+        stream <= static_cast<uint32_t>(file.second.size());
+        offset += file.second.size();
+    }
+}
+
+TEST(fs, pakArchive)
+{
+    const fs::path pak0 = fs::temp_directory_path() / "test_fs_pak0.pak";
+    const fs::path pak1 = fs::temp_directory_path() / "test_fs_pak1.pak";
+
+    WriteTestPak(pak0, {{"maps/a.txt", "first a"}, {"maps/b.txt", "only in pak0"}});
+    WriteTestPak(pak1, {{"maps/a.txt", "second a"}});
+
+    fs::clear();
+    ASSERT_TRUE(fs::addArchive(pak0));
+    ASSERT_TRUE(fs::addArchive(pak1));
+
+    // newer archives take priority
+    auto a = fs::load_view("maps/a.txt");
+    ASSERT_TRUE(a);
+    EXPECT_TRUE(a->is_mapped());
+    EXPECT_EQ(std::string(a->begin(), a->end()), "second a");
+
+    // pak names are case insensitive
+    auto b = fs::where("MAPS/B.TXT");
+    ASSERT_TRUE(b);
+    EXPECT_EQ(b.archive->pathname, pak0);
+    auto b_data = fs::load(b);
+    ASSERT_TRUE(b_data);
+    EXPECT_EQ(std::string(b_data->begin(), b_data->end()), "only in pak0");
+
+    EXPECT_FALSE(fs::where("maps/c.txt"));
+
+    // views keep the archive alive
+    fs::clear();
+    EXPECT_EQ(std::string(a->begin(), a->end()), "second a");
+
+    // concurrent loads from one archive
+    ASSERT_TRUE(fs::addArchive(pak0));
+
+    std::vector<std::string> results(256);
+    tbb::parallel_for(static_cast<size_t>(0), results.size(), [&](size_t i) {
+        auto data = fs::load((i & 1) ? "maps/a.txt" : "maps/b.txt");
+        results[i] = std::string(data->begin(), data->end());
+    });
+
+    for (size_t i = 0; i < results.size(); i++) {
+        EXPECT_EQ(results[i], (i & 1) ? "first a" : "only in pak0");
+    }
+
+    a.reset();
+    fs::clear();
+    fs::remove(pak0);
+    fs::remove(pak1);
+}
+
+TEST(profiler, chromeTrace)
+{
+    const fs::path trace_path = fs::temp_directory_path() / "test_profiler.json";
+
+    // not recording; nothing is kept
+    {
+        profiler::scope ignored("ignored");
+    }
+
+    profiler::start(trace_path);
+
+    {
+        profiler::scope outer("outer");
+
+        tbb::parallel_for(0, 64, [](int i) {
+            profiler::scope inner(fmt::format("inner {}", i % 2));
+        });
+    }
+
+    profiler::write();
+    profiler::stop();
+
+    std::ifstream f(trace_path);
+    ASSERT_TRUE(f);
+    json trace = json::parse(f);
+    f.close();
+    fs::remove(trace_path);
+
+    std::vector<json> outers, inners;
+
+    for (auto &event : trace.at("traceEvents")) {
+        if (event.at("ph") != "X") {
+            continue;
+        }
+
+        auto name = event.at("name").get<std::string>();
+        EXPECT_NE(name, "ignored");
+
+        if (name == "outer") {
+            outers.push_back(event);
+        } else {
+            EXPECT_TRUE(name == "inner 0" || name == "inner 1");
+            inners.push_back(event);
+        }
+    }
+
+    ASSERT_EQ(outers.size(), 1);
+    EXPECT_EQ(inners.size(), 64);
+
+    // every inner scope happened during the outer one
+    const double outer_start = outers[0].at("ts"), outer_end = outer_start + outers[0].at("dur").get<double>();
+
+    for (auto &event : inners) {
+        EXPECT_GE(event.at("ts").get<double>(), outer_start);
+        EXPECT_LE(event.at("ts").get<double>() + event.at("dur").get<double>(), outer_end + 0.001);
+    }
+}
+
+TEST(profiler, phaseTimes)
+{
+    profiler::start(fs::temp_directory_path() / "test_profiler_phases.json");
+
+    {
+        profiler::scope phase("phase");
+
+        // nested scope with the same name only counts once
+        {
+            profiler::scope nested("phase");
+        }
+
+        logging::parallel_for(0, 256, [](int i) {
+            profiler::scope work("work");
+            profiler::scope other("other");
+        });
+    }
+
+    {
+        profiler::scope phase("phase");
+    }
+
+    // with a single thread, all of the per-item scopes end up on the main thread,
+    // and still aren't phases
+    tbb::task_arena(1).execute([] {
+        profiler::scope phase("single threaded");
+
+        logging::parallel_for(0, 16, [](int i) { profiler::scope work("single threaded work"); });
+    });
+
+    auto phases = profiler::phase_times();
+    profiler::stop();
+
+    std::vector<std::string> names;
+    for (auto &[name, seconds] : phases) {
+        EXPECT_GE(seconds, 0.0) << name;
+        names.push_back(name);
+    }
+
+    EXPECT_EQ(names, (std::vector<std::string>{"phase", "single threaded"}));
+}
+
+TEST(log, nestedPercentClocks)
+{
+    // every clock that prints ends with a tick that carries the elapsed time
+    std::atomic<int> finished = 0;
+    logging::set_percent_callback([&](std::optional<uint32_t> percent, std::optional<duration> elapsed) {
+        if (elapsed) {
+            finished++;
+        }
+    });
+
+    // the inner loops are counted, but only the outer one is displayed
+    logging::parallel_for(0, 8, [](int i) { logging::parallel_for(0, 64, [](int j) {}); });
+
+    logging::set_percent_callback(nullptr);
+
+    EXPECT_EQ(finished, 1);
+}
+
 TEST(qmat, transpose)
 {
     // clang-format off
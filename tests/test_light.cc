@@ -3,9 +3,11 @@
 #include <light/light.hh>
 #include <light/trace.hh> // for clamp_texcoord
 #include <light/entities.hh>
+#include <light/write.hh>
 
 #include <random>
 #include <algorithm> // for std::sort
+#include <functional>
 
 #include <common/qvec.hh>
 
@@ -1068,3 +1070,131 @@ TEST(LightFormats, e5bgr9pack3)
     EXPECT_LT(error[1], 0.00001);
     EXPECT_LT(error[2], 0.000025);
 }
+
+// straightforward copy-per-step version of the lightmap filters, to check PostProcessLightmap against
+static std::vector<qvec4f> ReferenceAverage(const std::vector<qvec4f> &input, int w, int h, int outw, int outh,
+    const std::function<std::pair<int, int>(int x, int y, int i)> &kernel_sample, int kernel_size)
+{
+    std::vector<qvec4f> res(outw * outh);
+
+    for (int y = 0; y < outh; y++) {
+        for (int x = 0; x < outw; x++) {
+            float weight = 0, weight_all = 0;
+            qvec3f color{}, color_all{};
+
+            for (int i = 0; i < kernel_size; i++) {
+                auto [x1, y1] = kernel_sample(x, y, i);
+                const qvec4f &in = input.at(y1 * w + x1);
+
+                color_all += qvec3f(in);
+                weight_all += 1.0f;
+                if (in[3] == 0.0f)
+                    continue;
+                color += qvec3f(in);
+                weight += 1.0f;
+            }
+
+            const qvec3f avg = weight > 0.0f ? color / weight : color_all / weight_all;
+            res[y * outw + x] = qvec4f(avg[0], avg[1], avg[2], weight > 0.0f ? 1.0f : 0.0f);
+        }
+    }
+
+    return res;
+}
+
+static std::vector<qvec4f> ReferencePostProcess(
+    std::vector<qvec4f> img, int w, int h, int extra, int soft, bool highlightseams)
+{
+    if (highlightseams) {
+        for (auto &p : img)
+            if (p[3] == 0)
+                p = qvec4f(255, 0, 0, 1);
+    }
+
+    // flood fill, reading samples filled earlier in the same sweep
+    for (int unhandled = -1; unhandled != 0 && unhandled != img.size();) {
+        unhandled = 0;
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                if (img[y * w + x][3] != 0)
+                    continue;
+                int n = 0;
+                qvec3f sum{};
+                for (int y1 = y - 1; y1 <= y + 1; y1++) {
+                    for (int x1 = x - 1; x1 <= x + 1; x1++) {
+                        if (x1 < 0 || x1 >= w || y1 < 0 || y1 >= h || img[y1 * w + x1][3] != 1)
+                            continue;
+                        n++;
+                        sum += qvec3f(img[y1 * w + x1]);
+                    }
+                }
+                if (n) {
+                    sum *= (1.0f / (float)n);
+                    img[y * w + x] = qvec4f(sum[0], sum[1], sum[2], 1.0f);
+                } else {
+                    unhandled++;
+                }
+            }
+        }
+    }
+
+    if (soft > 0) {
+        const int size = 2 * soft + 1;
+        img = ReferenceAverage(
+            img, w, h, w, h,
+            [&](int x, int y, int i) {
+                return std::pair{std::clamp(x + (i % size) - soft, 0, w - 1),
+                    std::clamp(y + (i / size) - soft, 0, h - 1)};
+            },
+            size * size);
+    }
+
+    if (extra > 1) {
+        img = ReferenceAverage(
+            img, w, h, w / extra, h / extra,
+            [&](int x, int y, int i) { return std::pair{x * extra + (i % extra), y * extra + (i / extra)}; },
+            extra * extra);
+    }
+
+    return img;
+}
+
+TEST(LightFormats, postProcessLightmapBitExact)
+{
+    std::mt19937 engine(1234);
+    std::uniform_real_distribution<float> color(0.0f, 300.0f);
+
+    std::vector<qvec4f> image;
+
+    for (int extra : {1, 2, 4}) {
+        for (int soft : {0, 1, 3}) {
+            for (float occluded_fraction : {0.0f, 0.3f, 0.9f, 1.0f}) {
+                for (bool highlightseams : {false, true}) {
+                    SCOPED_TRACE(fmt::format("extra {} soft {} occluded {} highlightseams {}", extra, soft,
+                        occluded_fraction, highlightseams));
+
+                    const int w = extra * std::uniform_int_distribution<int>(1, 17)(engine);
+                    const int h = extra * std::uniform_int_distribution<int>(1, 17)(engine);
+
+                    std::bernoulli_distribution occluded(occluded_fraction);
+                    std::vector<qvec4f> input(w * h);
+                    for (auto &p : input) {
+                        p = qvec4f(color(engine), color(engine), color(engine), occluded(engine) ? 0.0f : 1.0f);
+                    }
+
+                    const std::vector<qvec4f> expected = ReferencePostProcess(input, w, h, extra, soft, highlightseams);
+
+                    image = input;
+                    PostProcessLightmap(image, w, h, extra, soft, highlightseams);
+
+                    ASSERT_EQ(image.size(), expected.size());
+                    for (size_t i = 0; i < image.size(); i++) {
+                        for (int c = 0; c < 4; c++) {
+                            ASSERT_EQ(image[i][c], expected[i][c]) << "sample " << i << " channel " << c;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
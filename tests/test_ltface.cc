@@ -4,13 +4,18 @@
 #include <light/ltface.hh>
 #include <light/surflight.hh>
 #include <common/bspinfo.hh>
+#include <common/json.hh>
 #include <common/litfile.hh>
 #include <qbsp/qbsp.hh>
+#include <pipeline/pipeline.hh>
 #include <testmaps.hh>
 #include <vis/vis.hh>
 #include "test_qbsp.hh"
 #include "test_main.hh"
 
+#include <fstream>
+#include <set>
+
 static testresults_t QbspVisLight_Common(const std::filesystem::path &name, std::vector<std::string> extra_qbsp_args,
     std::vector<std::string> extra_light_args, runvis_t run_vis)
 {
@@ -41,58 +46,41 @@ static testresults_t QbspVisLight_Common(const std::filesystem::path &name, std:
 
     auto wal_metadata_path = std::filesystem::path(testmaps_dir) / "q2_wal_metadata";
 
-    std::vector<std::string> args{
-        "", // the exe path, which we're ignoring in this case
-    };
+    pipeline_args_t args;
+    args.map_path = map_path;
+    args.bsp_path = bsp_path;
 
     if (!tests_verbose) {
-        args.push_back("-noverbose");
+        args.qbsp_args.push_back("-noverbose");
     } else {
-        args.push_back("-nopercent");
-        args.push_back("-loghulls");
+        args.qbsp_args.push_back("-nopercent");
+        args.qbsp_args.push_back("-loghulls");
     }
     for (auto &extra : extra_qbsp_args) {
-        args.push_back(extra);
+        args.qbsp_args.push_back(extra);
     }
-    args.push_back("-path");
-    args.push_back(wal_metadata_path.string());
-    args.push_back(map_path.string());
-    args.push_back(bsp_path.string());
-
-    // run qbsp
-
-    InitQBSP(args);
-    ProcessFile();
+    args.qbsp_args.push_back("-path");
+    args.qbsp_args.push_back(wal_metadata_path.string());
 
-    // run vis
-    if (run_vis == runvis_t::yes) {
-        std::vector<std::string> vis_args{
-            "", // the exe path, which we're ignoring in this case
-        };
-        vis_args.push_back(bsp_path.string());
-        vis_main(vis_args);
+    args.light_args = {
+        "-nodefaultpaths", // in case test_quake2_maps_dir is pointing at a real Q2 install, don't
+                           // read texture data etc. from there - we want the tests to behave the same
+                           // during development as they do on CI (which doesn't have a Q2 install).
+        "-path", wal_metadata_path.string()};
+    for (auto &arg : extra_light_args) {
+        args.light_args.push_back(arg);
     }
 
-    // run light
-    {
-        std::vector<std::string> light_args{"", // the exe path, which we're ignoring in this case
-            "-nodefaultpaths", // in case test_quake2_maps_dir is pointing at a real Q2 install, don't
-                               // read texture data etc. from there - we want the tests to behave the same
-                               // during development as they do on CI (which doesn't have a Q2 install).
-            "-path", wal_metadata_path.string()};
-        for (auto &arg : extra_light_args) {
-            light_args.push_back(arg);
-        }
-        light_args.push_back(bsp_path.string());
+    args.run_vis = (run_vis == runvis_t::yes);
 
-        light_main(light_args);
+    // run qbsp, vis and light, handing the bsp over in memory
+    RunPipeline(args);
 
-        // ensure a .lit is never created in q2
-        if (is_q2) {
-            auto lit_check_path = bsp_path;
-            lit_check_path.replace_extension(".lit");
-            EXPECT_FALSE(fs::exists(lit_check_path));
-        }
+    // ensure a .lit is never created in q2
+    if (is_q2) {
+        auto lit_check_path = bsp_path;
+        lit_check_path.replace_extension(".lit");
+        EXPECT_FALSE(fs::exists(lit_check_path));
     }
 
     // serialize obj
@@ -218,6 +206,212 @@ TEST(worldunitsperluxel, lightgrid)
     }
 }
 
+struct decoded_lightgrid_t
+{
+    struct point_t
+    {
+        bool occluded = true;
+        std::vector<std::pair<uint8_t, qvec3b>> styles; // style, color
+    };
+
+    qvec3i size;
+    std::vector<point_t> points; // x fastest, then y, then z
+};
+
+/**
+ * Expands a LIGHTGRID_OCTREE lump back out into a full grid. Points outside of
+ * every leaf are occluded.
+ */
+static decoded_lightgrid_t DecodeLightgridOctree(const std::vector<uint8_t> &lump)
+{
+    imemstream stream(lump.data(), lump.size());
+    stream >> endianness<std::endian::little>;
+
+    decoded_lightgrid_t result;
+    qvec3f grid_dist, grid_mins;
+    uint8_t num_styles;
+    uint32_t root_node, num_nodes;
+    stream >= grid_dist >= result.size >= grid_mins >= num_styles >= root_node >= num_nodes;
+
+    // 3 ints division point + 8 children each
+    stream.seekg(num_nodes * (3 * sizeof(int32_t) + 8 * sizeof(uint32_t)), std::ios_base::cur);
+
+    result.points.resize(result.size[0] * result.size[1] * result.size[2]);
+
+    uint32_t num_leafs;
+    stream >= num_leafs;
+    for (uint32_t i = 0; i < num_leafs; i++) {
+        qvec3i mins, size;
+        stream >= mins >= size;
+
+        for (int z = mins[2]; z < mins[2] + size[2]; z++) {
+            for (int y = mins[1]; y < mins[1] + size[1]; y++) {
+                for (int x = mins[0]; x < mins[0] + size[0]; x++) {
+                    auto &point = result.points[(z * result.size[1] + y) * result.size[0] + x];
+
+                    uint8_t used_styles;
+                    stream >= used_styles;
+                    if (used_styles == 0xff) {
+                        continue;
+                    }
+
+                    point.occluded = false;
+                    for (uint8_t j = 0; j < used_styles; j++) {
+                        uint8_t style;
+                        qvec3b color;
+                        stream >= style >= color;
+                        point.styles.emplace_back(style, color);
+                    }
+                }
+            }
+        }
+    }
+
+    EXPECT_TRUE(stream);
+    EXPECT_EQ(stream.tellg(), lump.size());
+    return result;
+}
+
+TEST(ltfaceQ2, lightgridAdaptive)
+{
+    SCOPED_TRACE("-lightgrid_adaptive writes the same grid layout while tracing fewer points");
+
+    auto lightgrid_rays = [](const fs::path &stats_path) -> uint64_t {
+        std::ifstream f(stats_path);
+        EXPECT_TRUE(f);
+        json stats = json::parse(f);
+        f.close();
+        fs::remove(stats_path);
+
+        for (auto &pass : stats.at("passes")) {
+            if (pass.at("name") == "lightgrid") {
+                return pass.at("rays").get<uint64_t>();
+            }
+        }
+        ADD_FAILURE() << "no lightgrid pass";
+        return 0;
+    };
+
+    const fs::path dense_stats = fs::temp_directory_path() / "test_lightgrid_dense.json";
+    auto [dense_bsp, dense_bspx] = QbspVisLight_Q2("q2_lightmap_custom_scale.map",
+        {"-lightgrid", "-lightgrid_dist", "16", "16", "16", "-raystats", dense_stats.string()});
+    const uint64_t dense_rays = lightgrid_rays(dense_stats);
+
+    const fs::path adaptive_stats = fs::temp_directory_path() / "test_lightgrid_adaptive.json";
+    auto [adaptive_bsp, adaptive_bspx] = QbspVisLight_Q2("q2_lightmap_custom_scale.map",
+        {"-lightgrid", "-lightgrid_dist", "16", "16", "16", "-lightgrid_adaptive", "4", "-raystats",
+            adaptive_stats.string()});
+    const uint64_t adaptive_rays = lightgrid_rays(adaptive_stats);
+
+    EXPECT_GT(dense_rays, 0);
+    EXPECT_LT(adaptive_rays, dense_rays);
+
+    // grid_dist, grid_size and grid_mins come first
+    constexpr size_t header_size = 3 * sizeof(float) + 3 * sizeof(int32_t) + 3 * sizeof(float);
+    const auto &dense_lump = dense_bspx.at("LIGHTGRID_OCTREE");
+    const auto &adaptive_lump = adaptive_bspx.at("LIGHTGRID_OCTREE");
+    ASSERT_GE(dense_lump.size(), header_size);
+    ASSERT_GE(adaptive_lump.size(), header_size);
+    EXPECT_TRUE(std::equal(dense_lump.begin(), dense_lump.begin() + header_size, adaptive_lump.begin()));
+
+    // only cells with no point in solid are interpolated, so every occluded
+    // point is traced and the occlusion matches exactly. an interpolated point
+    // is a blend of its cell's corners, which agree with each other to within
+    // n (4 here), so it is taken to match the dense grid when every channel is
+    // within 2n + 1 (the extra 1 for rounding to bytes). lighting isn't linear,
+    // so a few points may miss that; all of them have to be close on average.
+    const auto dense = DecodeLightgridOctree(dense_lump);
+    const auto adaptive = DecodeLightgridOctree(adaptive_lump);
+    ASSERT_EQ(dense.points.size(), adaptive.points.size());
+
+    constexpr int tolerance = 2 * 4 + 1;
+    size_t compared = 0, within_tolerance = 0;
+    double total_error = 0.0;
+
+    for (size_t i = 0; i < dense.points.size(); i++) {
+        const auto &d = dense.points[i];
+        const auto &a = adaptive.points[i];
+
+        ASSERT_EQ(d.occluded, a.occluded) << "grid index " << i;
+        if (d.occluded) {
+            continue;
+        }
+
+        compared++;
+
+        if (d.styles.size() != a.styles.size()) {
+            continue;
+        }
+
+        int max_error = 0;
+        for (size_t j = 0; j < d.styles.size(); j++) {
+            if (d.styles[j].first != a.styles[j].first) {
+                max_error = 255;
+                break;
+            }
+            for (int c = 0; c < 3; c++) {
+                max_error = std::max(max_error, std::abs(d.styles[j].second[c] - a.styles[j].second[c]));
+            }
+        }
+
+        total_error += max_error;
+        within_tolerance += (max_error <= tolerance);
+    }
+
+    ASSERT_GT(compared, 0);
+    EXPECT_GE(within_tolerance, compared * 95 / 100);
+    EXPECT_LE(total_error / compared, 4.0);
+}
+
+TEST(ltfaceQ2, lightgridBatchedMatchesPerPoint)
+{
+    SCOPED_TRACE("CalcLightgridAtPoints gives the same samples as CalcLightgridAtPoint on each point");
+
+    // the map has a point light, a sun, an emissive face and bounce, so every
+    // kind of light the lightgrid handles contributes
+    auto lightgrid_categories = [](const fs::path &stats_path) -> json {
+        std::ifstream f(stats_path);
+        EXPECT_TRUE(f);
+        json stats = json::parse(f);
+        f.close();
+        fs::remove(stats_path);
+
+        for (auto &pass : stats.at("passes")) {
+            if (pass.at("name") == "lightgrid") {
+                return pass.at("categories");
+            }
+        }
+        ADD_FAILURE() << "no lightgrid pass";
+        return json::object();
+    };
+
+    const fs::path batched_stats = fs::temp_directory_path() / "test_lightgrid_batched.json";
+    auto [batched_bsp, batched_bspx] = QbspVisLight_Q2("q2_lightgrid_batch.map",
+        {"-lightgrid", "-lightgrid_dist", "32", "32", "32", "-raystats", batched_stats.string()});
+    const json batched = lightgrid_categories(batched_stats);
+
+    const fs::path per_point_stats = fs::temp_directory_path() / "test_lightgrid_per_point.json";
+    auto [per_point_bsp, per_point_bspx] = QbspVisLight_Q2("q2_lightgrid_batch.map",
+        {"-lightgrid", "-lightgrid_dist", "32", "32", "32", "-lightgrid_nobatch", "-raystats",
+            per_point_stats.string()});
+    const json per_point = lightgrid_categories(per_point_stats);
+
+    for (const char *category : {"light", "sun", "surflight", "bounce"}) {
+        SCOPED_TRACE(category);
+
+        EXPECT_GT(batched.at(category).at("rays").get<uint64_t>(), 0);
+        // same rays, just in fewer, bigger streams
+        EXPECT_EQ(batched.at(category).at("rays"), per_point.at(category).at("rays"));
+        EXPECT_EQ(batched.at(category).at("occluded"), per_point.at(category).at("occluded"));
+        EXPECT_LT(batched.at(category).at("traces").get<uint64_t>(),
+            per_point.at(category).at("traces").get<uint64_t>());
+    }
+
+    // each point's contributions are added in the same order either way, so
+    // the samples match exactly, not just within rounding
+    EXPECT_EQ(batched_bspx.at("LIGHTGRID_OCTREE"), per_point_bspx.at("LIGHTGRID_OCTREE"));
+}
+
 TEST(ltfaceQ2, emissiveCubeArtifacts)
 {
     // A cube with surface flags "light", value "100", placed in a hallway.
@@ -453,6 +647,40 @@ TEST(ltfaceQ2, dirtDebug)
     CheckFaceLuxelAtPoint(&bsp, &bsp.dmodels[0], {0, 0, 0}, {-124, 300, 32});
 }
 
+TEST(ltfaceQ2, dirtAdaptive)
+{
+    SCOPED_TRACE("adaptive dirt traces fewer rays, but open areas and corners come out the same");
+
+    const fs::path stats_path = fs::temp_directory_path() / "test_dirtadaptive.json";
+
+    auto dirt_rays = [&]() {
+        std::ifstream f(stats_path);
+        json stats = json::parse(f);
+        f.close();
+        fs::remove(stats_path);
+
+        return stats.at("passes").at(0).at("categories").at("dirt").at("rays").get<uint64_t>();
+    };
+
+    QbspVisLight_Q2("q2_dirt.map", {"-dirtdebug", "-raystats", stats_path.string()});
+    const uint64_t full_rays = dirt_rays();
+
+    auto [bsp, bspx] =
+        QbspVisLight_Q2("q2_dirt.map", {"-dirtdebug", "-dirtadaptive", "0.001", "-raystats", stats_path.string()});
+    const uint64_t adaptive_rays = dirt_rays();
+
+    EXPECT_GT(adaptive_rays, 0);
+    EXPECT_LT(adaptive_rays, full_rays);
+
+    auto *face_under_lava = BSP_FindFaceAtPoint(&bsp, &bsp.dmodels[0], {104, 112, 48});
+    ASSERT_TRUE(face_under_lava);
+
+    CheckFaceLuxels(bsp, *face_under_lava, [](qvec3b sample) { EXPECT_EQ(sample, qvec3b(255)); });
+
+    // check floor in the corner
+    CheckFaceLuxelAtPoint(&bsp, &bsp.dmodels[0], {0, 0, 0}, {-124, 300, 32});
+}
+
 TEST(ltfaceQ2, lightTranslucency)
 {
     SCOPED_TRACE("liquids cast translucent colored shadows (sampling texture) by default");
@@ -963,6 +1191,74 @@ TEST(ltfaceQ1, minlightDoesntBounce)
     CheckFaceLuxelAtPoint(&bsp, &bsp.dmodels[0], {50, 50, 50}, {0, 0, 0}, {0, 0, 1}, &lit);
 }
 
+TEST(ltfaceQ1, lightmapDedup)
+{
+    SCOPED_TRACE("faces with identical lightmaps share them, without changing what any face samples");
+
+    auto [bsp, bspx, lit] = QbspVisLight_Q1("q1_minlight_nobounce.map", {"-lit"});
+    auto [unshared_bsp, unshared_bspx, unshared_lit] =
+        QbspVisLight_Q1("q1_minlight_nobounce.map", {"-lit", "-nolightmapdedup"});
+
+    // flat minlight, so plenty of faces come out the same
+    EXPECT_LT(bsp.dlightdata.size(), unshared_bsp.dlightdata.size());
+    EXPECT_EQ(std::get<lit1_t>(lit).rgbdata.size(), bsp.dlightdata.size() * 3);
+
+    std::set<int32_t> lightofs;
+
+    ASSERT_EQ(bsp.dfaces.size(), unshared_bsp.dfaces.size());
+
+    for (size_t i = 0; i < bsp.dfaces.size(); i++) {
+        const mface_t &face = bsp.dfaces[i];
+        const mface_t &unshared_face = unshared_bsp.dfaces[i];
+
+        ASSERT_EQ(face.lightofs == -1, unshared_face.lightofs == -1);
+
+        if (face.lightofs == -1) {
+            continue;
+        }
+
+        lightofs.insert(face.lightofs);
+
+        const faceextents_t extents(face, bsp, LMSCALE_DEFAULT);
+
+        for (int mapnum = 0; mapnum < MAXLIGHTMAPS && face.styles[mapnum] != 255; mapnum++) {
+            const int style = face.styles[mapnum];
+
+            for (int x = 0; x < extents.width(); ++x) {
+                for (int y = 0; y < extents.height(); ++y) {
+                    EXPECT_EQ(LM_Sample(&bsp, &face, &lit, extents, face.lightofs, {x, y}, style),
+                        LM_Sample(&unshared_bsp, &unshared_face, &unshared_lit, extents, unshared_face.lightofs,
+                            {x, y}, style));
+                }
+            }
+        }
+    }
+
+    EXPECT_LT(lightofs.size(), bsp.dfaces.size());
+}
+
+TEST(ltfaceQ1, lightmapDedupBeforeAllocation)
+{
+    SCOPED_TRACE("only unique lightmaps count against the lightmap space, so a map that only overflows because "
+                 "of its duplicates fits with dedup");
+
+    auto [bsp, bspx, lit] = QbspVisLight_Q1("q1_minlight_nobounce.map", {});
+    auto [unshared_bsp, unshared_bspx, unshared_lit] =
+        QbspVisLight_Q1("q1_minlight_nobounce.map", {"-nolightmapdedup"});
+
+    ASSERT_LT(bsp.dlightdata.size(), unshared_bsp.dlightdata.size());
+
+    // exactly what the shared lightmaps need
+    const std::string limit = std::to_string(bsp.dlightdata.size());
+
+    auto [limited_bsp, limited_bspx, limited_lit] =
+        QbspVisLight_Q1("q1_minlight_nobounce.map", {"-maxlightdata", limit});
+    EXPECT_EQ(limited_bsp.dlightdata, bsp.dlightdata);
+
+    EXPECT_THROW(QbspVisLight_Q1("q1_minlight_nobounce.map", {"-nolightmapdedup", "-maxlightdata", limit}),
+        ericwtools_error);
+}
+
 TEST(ltfaceQ1, sunlight)
 {
     auto [bsp, bspx, lit] = QbspVisLight_Q1("q1_sunlight.map", {"-lit"});
@@ -1025,6 +1321,78 @@ TEST(ltfaceQ1, bounceNoshadow)
     CheckFaceLuxelAtPoint(&bsp, &bsp.dmodels[0], {118, 118, 118}, {128, 12, 156}, {-1, 0, 0});
 }
 
+TEST(ltfaceQ1, rayStats)
+{
+    SCOPED_TRACE("-raystats writes the rays traced per pass and light category");
+
+    const fs::path stats_path = fs::temp_directory_path() / "test_raystats.json";
+
+    auto [bsp, bspx, lit] =
+        QbspVisLight_Q1("q1_light_bounce_litwater.map", {"-lit", "-bounce", "2", "-raystats", stats_path.string()});
+
+    std::ifstream f(stats_path);
+    ASSERT_TRUE(f);
+    json stats = json::parse(f);
+    f.close();
+    fs::remove(stats_path);
+
+    auto &passes = stats.at("passes");
+    ASSERT_GE(passes.size(), 2);
+    EXPECT_EQ(passes[0].at("name"), "direct");
+    EXPECT_EQ(passes[1].at("name"), "bounce 0");
+
+    // the map has a single point light, which bounces
+    auto &direct = passes[0].at("categories");
+    EXPECT_GT(direct.at("light").at("rays").get<uint64_t>(), 0);
+    EXPECT_LE(direct.at("light").at("occluded").get<uint64_t>(), direct.at("light").at("rays").get<uint64_t>());
+    EXPECT_EQ(direct.at("bounce").at("rays").get<uint64_t>(), 0);
+
+    auto &bounce = passes[1].at("categories");
+    EXPECT_GT(bounce.at("bounce").at("rays").get<uint64_t>(), 0);
+    EXPECT_GT(bounce.at("bounce").at("vpls").get<uint64_t>(), 0);
+    EXPECT_EQ(bounce.at("light").at("rays").get<uint64_t>(), 0);
+}
+
+TEST(ltfaceQ1, sunsamplesSubset)
+{
+    SCOPED_TRACE("-sunsamples_subset traces fewer sun rays for about the same total light");
+
+    const fs::path stats_path = fs::temp_directory_path() / "test_sunsamples_subset.json";
+
+    auto sun_rays = [&]() -> uint64_t {
+        std::ifstream f(stats_path);
+        EXPECT_TRUE(f);
+        json stats = json::parse(f);
+        f.close();
+        fs::remove(stats_path);
+
+        return stats.at("passes").at(0).at("categories").at("sun").at("rays").get<uint64_t>();
+    };
+
+    auto total_light = [](const mbsp_t &bsp) -> double {
+        double total = 0;
+        for (uint8_t value : bsp.dlightdata) {
+            total += value;
+        }
+        return total;
+    };
+
+    // without dedup, so that every face's luxels are in dlightdata exactly once in both
+    // runs, however many of them happen to come out identical
+    auto [full_bsp, full_bspx, full_lit] =
+        QbspVisLight_Q1("phongtest2.map", {"-nolightmapdedup", "-raystats", stats_path.string()});
+    const uint64_t full_rays = sun_rays();
+
+    auto [subset_bsp, subset_bspx, subset_lit] = QbspVisLight_Q1(
+        "phongtest2.map", {"-nolightmapdedup", "-sunsamples_subset", "8", "-raystats", stats_path.string()});
+    const uint64_t subset_rays = sun_rays();
+
+    EXPECT_GT(subset_rays, 0);
+    EXPECT_LT(subset_rays, full_rays / 2);
+
+    EXPECT_NEAR(total_light(subset_bsp), total_light(full_bsp), total_light(full_bsp) * 0.1);
+}
+
 TEST(ltfaceQ2, lightBlack)
 {
     auto [bsp, bspx] = QbspVisLight_Q2("q2_light_black.map", {});
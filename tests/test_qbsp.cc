@@ -5,6 +5,7 @@
 #include <qbsp/qbsp.hh>
 #include <qbsp/map.hh>
 #include <qbsp/csg.hh>
+#include <qbsp/tree.hh>
 #include <common/fs.hh>
 #include <common/bsputils.hh>
 #include <common/decompile.hh>
@@ -614,6 +615,33 @@ TEST(testmapsQ1, simpleSealed2)
         std::vector<const mface_t *>{other_floor, other_ceil, other_minus_x, other_plus_x, other_plus_y});
 }
 
+TEST(testmapsQ1, faceLeafs)
+{
+    const auto [bsp, bspx, prt] = LoadTestmapQ1("qbsp_simple_sealed2.map");
+
+    const face_leafs_t face_leafs = BSP_BuildFaceLeafs(&bsp);
+
+    ASSERT_EQ(face_leafs.offsets.size(), bsp.dfaces.size() + 1);
+
+    // must agree with scanning every leaf's marksurfaces
+    for (size_t i = 0; i < bsp.dfaces.size(); i++) {
+        std::vector<uint32_t> expected;
+
+        for (size_t j = 0; j < bsp.dleafs.size(); j++) {
+            auto markfaces = Leaf_Markfaces(&bsp, &bsp.dleafs[j]);
+
+            if (std::find(markfaces.begin(), markfaces.end(), &bsp.dfaces[i]) != markfaces.end()) {
+                expected.push_back(j);
+            }
+        }
+
+        auto leafs = face_leafs.leafs(i);
+        EXPECT_EQ(std::vector<uint32_t>(leafs.begin(), leafs.end()), expected);
+    }
+
+    EXPECT_TRUE(face_leafs.leafs(bsp.dfaces.size()).empty());
+}
+
 TEST(testmapsQ1, q1FuncIllusionaryVisblocker)
 {
     const auto [bsp, bspx, prt] = LoadTestmapQ1("q1_func_illusionary_visblocker.map", {});
@@ -723,6 +751,34 @@ TEST(testmapsQ1, simpleWorldspawnDetail)
     EXPECT_LE(bsp.dclipnodes.size(), 22);
 }
 
+TEST(testmapsQ1, forceprt1InMemoryPortalsMatchFile)
+{
+    SCOPED_TRACE("with -forceprt1, the portals handed to vis in memory are the PRT1 that vis would read from the file");
+
+    auto map_path = std::filesystem::path(testmaps_dir) / "qbsp_simple_worldspawn_detail.map";
+    auto bsp_path = fs::temp_directory_path() / "qbsp_simple_worldspawn_detail.bsp";
+
+    InitQBSP({"", "-noverbose", "-forceprt1", map_path.string(), bsp_path.string()});
+
+    qbsp_output_t output;
+    ProcessFile(&output);
+
+    ASSERT_TRUE(output.prtfile.has_value());
+
+    const prtfile_t from_file = LoadPrtFile(fs::path(bsp_path).replace_extension("prt"), &bspver_q1);
+    const prtfile_t &in_memory = *output.prtfile;
+
+    // the map has detail, so without -forceprt1 these would differ
+    EXPECT_EQ(in_memory.portalleafs, from_file.portalleafs);
+    EXPECT_EQ(in_memory.portalleafs_real, from_file.portalleafs_real);
+    EXPECT_EQ(in_memory.portals.size(), from_file.portals.size());
+
+    ASSERT_EQ(in_memory.dleafinfos.size(), from_file.dleafinfos.size());
+    for (size_t i = 0; i < in_memory.dleafinfos.size(); i++) {
+        EXPECT_EQ(in_memory.dleafinfos[i].cluster, from_file.dleafinfos[i].cluster) << "leaf " << i;
+    }
+}
+
 TEST(testmapsQ1, simpleWorldspawnDetailIllusionary)
 {
     const auto [bsp, bspx, prt] = LoadTestmapQ1("qbsp_simple_worldspawn_detail_illusionary.map");
@@ -1148,6 +1204,39 @@ TEST(testmapsQ1, tjuncManySidedFaceMaxedges0)
     EXPECT_GT(ceiling_faces[0]->numedges, 64);
 }
 
+TEST(testmapsQ1, tjuncManySidedFaceEarClip)
+{
+    // with no edge limit, the ceiling's superface has more than MWT_MAX_VERTICES
+    // vertices (see above), so the default -tjunc mwt triangulates it by ear clipping
+    const auto [bsp, bspx, prt] = LoadTestmapQ1("qbsp_tjunc_many_sided_face.map", {"-maxedges", "0"});
+
+    std::map<qvec3d, std::vector<const mface_t *>> faces_by_normal;
+    for (auto &face : bsp.dfaces) {
+        faces_by_normal[Face_Normal(&bsp, &face)].push_back(&face);
+    }
+
+    const std::vector<const mface_t *> &ceiling_faces = faces_by_normal.at({0, 0, -1});
+    ASSERT_GT(ceiling_faces.size(), 1);
+
+    // every face is a fan of non-degenerate triangles...
+    double total_area = 0;
+
+    for (auto *face : ceiling_faces) {
+        auto w = Face_Winding(&bsp, face);
+        ASSERT_GE(w.size(), 3);
+
+        for (size_t i = 1; i + 1 < w.size(); i++) {
+            const double tri_area = qv::length(qv::cross(w[i] - w[0], w[i + 1] - w[0])) * 0.5;
+            EXPECT_GT(tri_area, 0.01);
+        }
+
+        total_area += w.area();
+    }
+
+    // ...and together, they cover the ceiling exactly once
+    EXPECT_NEAR(320 * 320, total_area, 0.1);
+}
+
 TEST(testmapsQ1, tjuncManySidedFaceSky)
 {
     const auto [bsp, bspx, prt] = LoadTestmapQ1("qbsp_tjunc_many_sided_sky.map", {"-tjunc", "rotate"});
@@ -1985,6 +2074,36 @@ TEST(testmapsQ1, hull1ContentTypes)
     }
 }
 
+TEST(qbsp, treeDataReuse)
+{
+    tree_t tree;
+
+    // making a leaf a leaf again reuses its slot
+    node_t *leaf = tree.create_node();
+    tree.make_leaf(leaf)->original_brushes.push_back(nullptr);
+    EXPECT_EQ(tree.make_leaf(leaf)->original_brushes.size(), 0);
+    EXPECT_EQ(tree.leafdata.size(), 1);
+
+    // pruning: the children's slots are released, and reused for the parent
+    node_t *node = tree.create_node();
+    tree.make_node(node);
+    node->children[0] = tree.create_node();
+    node->children[1] = tree.create_node();
+    tree.make_leaf(node->children[0]);
+    tree.make_leaf(node->children[1]);
+    EXPECT_EQ(tree.leafdata.size(), 3);
+
+    tree.release_data(node->children[0]);
+    tree.release_data(node->children[1]);
+    tree.make_leaf(node);
+    EXPECT_TRUE(node->is_leaf());
+    EXPECT_EQ(tree.leafdata.size(), 3);
+
+    // the parent's node data is up for reuse too
+    tree.make_node(tree.create_node());
+    EXPECT_EQ(tree.nodedata.size(), 1);
+}
+
 TEST(qbsp, BrushFromBounds)
 {
     map.reset();
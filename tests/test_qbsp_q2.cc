@@ -854,7 +854,7 @@ TEST(testmapsQ2, mistTranswater)
     EXPECT_EQ(Face_TextureNameView(&bsp, up_faces[0]), "e1u1/water6");
     EXPECT_EQ(Face_TextureNameView(&bsp, down_faces[0]), "e1u1/water6");
 
-    const auto top_of_water_up = winding_t{{-232, -32, 352}, {-232, 0, 352}, {-200, 0, 352}, {-200, -32, 352}};
+    const auto top_of_water_up = polylib::winding_t{{-232, -32, 352}, {-232, 0, 352}, {-200, 0, 352}, {-200, -32, 352}};
     const auto top_of_water_dn = top_of_water_up.flip();
 
     EXPECT_TRUE(Face_Winding(&bsp, up_faces[0]).directional_equal(top_of_water_up));
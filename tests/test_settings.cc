@@ -112,6 +112,28 @@ TEST(settings, scalarStray)
     ASSERT_THROW(settings.parse(p), settings::parse_exception);
 }
 
+TEST(settings, parseSettingOneAtATime)
+{
+    settings::setting_container settings;
+    settings::setting_scalar scalarSetting(&settings, "scale", 1.0);
+    settings::setting_bool boolSetting(&settings, "locked", false);
+    const char *arguments[] = {"qbsp.exe", "-scale", "2", "-locked", "0", "--scale", "3", "remainder"};
+    token_parser_t p{std::size(arguments) - 1, arguments + 1, {}};
+
+    // each call eats exactly one option and its value, if it has one
+    ASSERT_EQ(settings.parse_setting(p), &scalarSetting);
+    ASSERT_EQ(p.cur, 2);
+    ASSERT_EQ(settings.parse_setting(p), &boolSetting);
+    ASSERT_EQ(p.cur, 4);
+    ASSERT_EQ(settings.parse_setting(p), &scalarSetting);
+    ASSERT_EQ(p.cur, 6);
+    ASSERT_EQ(settings.parse_setting(p), nullptr);
+    ASSERT_EQ(p.cur, 6);
+
+    ASSERT_EQ(scalarSetting.value(), 3);
+    ASSERT_EQ(boolSetting.value(), false);
+}
+
 // test int32 with implicit default
 TEST(settings, int32CanOmitArgumentDefault)
 {
@@ -3,6 +3,7 @@
 
 #include <stdexcept>
 #include <vis/vis.hh>
+#include <light/pvs.hh>
 
 #include "test_qbsp.hh"
 #include "testutils.hh"
@@ -159,6 +160,51 @@ TEST(vis, q1FuncIllusionaryVisblockerInteractions)
     EXPECT_FALSE(q1_leaf_sees(bsp, vis, in_visblocker_covered_by_illusionary_leaf, player_start_leaf));
 }
 
+// light's deduplicated PVS table must agree with DecompressAllVis for every pair of leafs,
+// whether it decompresses the visdata itself or is handed the rows
+static void CheckPvsTable(const mbsp_t &bsp)
+{
+    const bool is_q2 = bsp.loadversion->game->id == GAME_QUAKE_II;
+    const auto vis = DecompressAllVis(&bsp);
+
+    for (const auto *uncompressed_vis : {static_cast<const decltype(vis) *>(nullptr), &vis}) {
+        pvs_table_t table;
+        table.build(&bsp, uncompressed_vis);
+
+        // plus the see-nothing and see-everything rows
+        EXPECT_LE(table.num_rows(), vis.size() + 2);
+
+        for (auto &a : bsp.dleafs) {
+            const int key = is_q2 ? a.cluster : a.visofs;
+            const uint64_t *row = table.leaf_row(&a);
+
+            if (auto it = vis.find(key); it != vis.end()) {
+                ASSERT_NE(row, nullptr);
+
+                for (auto &b : bsp.dleafs) {
+                    EXPECT_EQ(table.leaf_visible(row, &b), Pvs_LeafVisible(&bsp, it->second, &b));
+                }
+            } else {
+                EXPECT_EQ(row, nullptr);
+            }
+        }
+    }
+}
+
+TEST(vis, pvsTableQ1)
+{
+    auto [bsp, bspx, lit] = QbspVisLight_Q1("q1_func_illusionary_visblocker.map", {}, runvis_t::yes);
+
+    CheckPvsTable(bsp);
+}
+
+TEST(vis, pvsTableQ2)
+{
+    auto [bsp, bspx] = QbspVisLight_Q2("q2_detail_leak_test.map", {}, runvis_t::yes);
+
+    CheckPvsTable(bsp);
+}
+
 TEST(vis, ClipStackWinding)
 {
     pstack_t stack{};
@@ -1,6 +1,7 @@
 #include <vis/vis.hh>
 #include <vis/leafbits.hh>
 #include <common/log.hh>
+#include <common/profiler.hh>
 #include <common/parallel.hh>
 #include <bit> // for std::popcount
 
@@ -516,6 +517,8 @@ static void RecursiveLeafFlow(int leafnum, threaddata_t *thread, pstack_t &prevs
 */
 visstats_t PortalFlow(visportal_t *p)
 {
+    profilefunc();
+
     threaddata_t data{p->visbits};
 
     if (p->status != pstat_working)
@@ -646,5 +649,7 @@ static void BasePortalThread(size_t portalnum)
 */
 void BasePortalVis()
 {
+    profilefunc();
+
     logging::parallel_for(0, numportals * 2, BasePortalThread);
 }
@@ -18,6 +18,7 @@
 */
 
 #include <common/log.hh>
+#include <common/profiler.hh>
 #include <vis/vis.hh>
 #include <common/bsputils.hh>
 #include <common/parallel.hh>
@@ -59,6 +60,7 @@ static aabb3d SurfaceBBox(const mbsp_t *bsp, const mface_t *surf)
 void CalcAmbientSounds(mbsp_t *bsp)
 {
     logging::funcheader();
+    profilefunc();
 
     // fast path for -noambient
     if (vis_options.noambientsky.value() && vis_options.noambientwater.value() && vis_options.noambientslime.value() &&
@@ -164,6 +166,7 @@ by ORing together all the PVS visible from a leaf
 void CalcPHS(mbsp_t *bsp)
 {
     logging::funcheader();
+    profilefunc();
 
     const int32_t leafbytes = (portalleafs + 7) >> 3;
     const int32_t leaflongs = leafbytes / sizeof(long);
@@ -2,6 +2,7 @@
 
 #include <vis/leafbits.hh>
 #include <common/log.hh>
+#include <common/profiler.hh>
 #include <common/bsputils.hh>
 #include <common/fs.hh>
 #include <common/parallel.hh>
@@ -488,6 +489,8 @@ static void ClusterFlow(int clusternum, leafbits_t &buffer, mbsp_t *bsp)
 */
 visstats_t CalcPortalVis(const mbsp_t *bsp)
 {
+    profilefunc();
+
     // fastvis just uses mightsee for a very loose bound
     if (vis_options.fast.value()) {
         for (auto &p : portals) {
@@ -579,10 +582,8 @@ visstats_t CalcVis(mbsp_t *bsp)
   LoadPortals
   ============
 */
-static void LoadPortals(const fs::path &name, mbsp_t *bsp)
+static void LoadPortals(const prtfile_t &prtfile, mbsp_t *bsp)
 {
-    const prtfile_t prtfile = LoadPrtFile(name, bsp->loadversion);
-
     portalleafs = prtfile.portalleafs;
     portalleafs_real = prtfile.portalleafs_real;
 
@@ -673,6 +674,44 @@ static void LoadPortals(const fs::path &name, mbsp_t *bsp)
     }
 }
 
+static void LoadPortals(const fs::path &name, mbsp_t *bsp)
+{
+    LoadPortals(LoadPrtFile(name, bsp->loadversion), bsp);
+}
+
+/*
+  ==================
+  ExportUncompressedVis
+
+  Hands the uncompressed PVS rows computed by CalcVis to light, keyed the same way
+  as DecompressAllVis (cluster for Q2, visofs otherwise). Must be called before the
+  next vis_reset. Empty if no PVS was calculated (-phsonly).
+  ==================
+*/
+std::unordered_map<int, std::vector<uint8_t>> ExportUncompressedVis(const mbsp_t *bsp)
+{
+    std::unordered_map<int, std::vector<uint8_t>> result;
+
+    if (uncompressed.empty()) {
+        return result;
+    }
+
+    const bool is_q2 = bsp->loadversion->game->id == GAME_QUAKE_II;
+    const size_t rowbytes = is_q2 ? leafbytes : leafbytes_real;
+    const size_t decompressed_size = DecompressedVisSize(bsp);
+
+    for (int clusternum = 0; clusternum < portalleafs; clusternum++) {
+        const uint8_t *row = uncompressed.data() + clusternum * rowbytes;
+        std::vector<uint8_t> decompressed(decompressed_size);
+        std::copy_n(row, std::min(rowbytes, decompressed_size), decompressed.data());
+
+        const int map_key = is_q2 ? clusternum : bsp->dvis.get_bit_offset(VIS_PVS, clusternum);
+        result[map_key] = std::move(decompressed);
+    }
+
+    return result;
+}
+
 void vis_reset()
 {
     numportals = 0;
@@ -710,13 +749,10 @@ void vis_reset()
     compressed.clear();
 }
 
-int vis_main(int argc, const char **argv)
+static void InitVis(int argc, const char **argv)
 {
     vis_reset();
 
-    bspdata_t bspdata;
-    const bspversion_t *loadversion;
-
     vis_options.preinitialize(argc, argv);
     vis_options.initialize(argc, argv);
     vis_options.postinitialize(argc, argv);
@@ -732,14 +768,20 @@ int vis_main(int argc, const char **argv)
 
     stateinterval = std::chrono::minutes(5); /* 5 minutes */
     starttime = statetime = I_FloatTime();
+}
 
-    LoadBSPFile(vis_options.sourceMap, &bspdata);
-
-    bspdata.version->game->init_filesystem(vis_options.sourceMap, vis_options);
+/*
+ * Runs vis on bspdata, which is left in bspver_generic. Portals are taken
+ * from prtfile if given, otherwise they're loaded from the .prt file.
+ */
+static void VisBSPData(bspdata_t &bspdata, const prtfile_t *prtfile)
+{
+    profiler::scope profile("vis");
 
-    loadversion = bspdata.version;
     ConvertBSPFormat(&bspdata, &bspver_generic);
 
+    bspdata.loadversion->game->init_filesystem(vis_options.sourceMap, vis_options);
+
     mbsp_t &bsp = std::get<mbsp_t>(bspdata.bsp);
 
     if (vis_options.phsonly.value()) {
@@ -756,7 +798,11 @@ int vis_main(int argc, const char **argv)
         }
     } else {
         portalfile = fs::path(vis_options.sourceMap).replace_extension("prt");
-        LoadPortals(portalfile, &bsp);
+        if (prtfile) {
+            LoadPortals(*prtfile, &bsp);
+        } else {
+            LoadPortals(portalfile, &bsp);
+        }
 
         statefile = fs::path(vis_options.sourceMap).replace_extension("vis");
         statetmpfile = fs::path(vis_options.sourceMap).replace_extension("vi0");
@@ -783,12 +829,10 @@ int vis_main(int argc, const char **argv)
     } else {
         CalcPHS(&bsp);
     }
+}
 
-    /* Convert data format back if necessary */
-    ConvertBSPFormat(&bspdata, loadversion);
-
-    WriteBSPFile(vis_options.sourceMap, &bspdata);
-
+static void FinishVis()
+{
     endtime = I_FloatTime();
     logging::print("{:.2} elapsed\n", (endtime - starttime));
 
@@ -797,6 +841,34 @@ int vis_main(int argc, const char **argv)
     }
 
     logging::close();
+}
+
+int vis_main(int argc, const char **argv)
+{
+    InitVis(argc, argv);
+
+    bspdata_t bspdata;
+    LoadBSPFile(vis_options.sourceMap, &bspdata);
+
+    VisBSPData(bspdata, nullptr);
+
+    /* Convert data format back if necessary */
+    ConvertBSPFormat(&bspdata, bspdata.loadversion);
+
+    WriteBSPFile(vis_options.sourceMap, &bspdata);
+
+    FinishVis();
+
+    return 0;
+}
+
+int vis_main(int argc, const char **argv, bspdata_t &bspdata, const prtfile_t &prtfile)
+{
+    InitVis(argc, argv);
+
+    VisBSPData(bspdata, &prtfile);
+
+    FinishVis();
 
     return 0;
 }
@@ -810,3 +882,13 @@ int vis_main(const std::vector<std::string> &args)
 
     return vis_main(argPtrs.size(), argPtrs.data());
 }
+
+int vis_main(const std::vector<std::string> &args, bspdata_t &bspdata, const prtfile_t &prtfile)
+{
+    std::vector<const char *> argPtrs;
+    for (const std::string &arg : args) {
+        argPtrs.push_back(arg.data());
+    }
+
+    return vis_main(argPtrs.size(), argPtrs.data(), bspdata, prtfile);
+}